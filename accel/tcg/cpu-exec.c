@@ -407,6 +407,24 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     return tb->tc.ptr;
 }
 
+/**
+ * helper_tb_hot: the execution counter of a TB expired
+ * @env: current cpu state
+ * @ptr: the TB, before its first insn
+ *
+ * Return to the main loop, which retranslates the TB as a superblock.
+ */
+void HELPER(tb_hot)(CPUArchState *env, void *ptr)
+{
+    CPUState *cpu = env_cpu(env);
+    TranslationBlock *tb = ptr;
+
+    /* Stop counting, in case no superblock can be formed. */
+    qatomic_set(&tb->hot_count, UINT32_MAX);
+    cpu->tb_hot = tb;
+    cpu_loop_exit_restore(cpu, GETPC());
+}
+
 /* Return the current PC from CPU, which may be cached in TB. */
 static vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 {
@@ -943,7 +961,7 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
         int tb_exit = 0;
 
         while (!cpu_handle_interrupt(cpu, &last_tb)) {
-            TranslationBlock *tb;
+            TranslationBlock *tb, *hot = NULL;
             TCGTBCPUState s = cpu->cc->tcg_ops->get_tb_cpu_state(cpu);
             s.cflags = cpu->cflags_next_tb;
 
@@ -965,14 +983,29 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             }
 
             tb = tb_lookup(cpu, s);
-            if (tb == NULL) {
+            if (unlikely(cpu->tb_hot)) {
+                /* Only retranslate if we are about to enter the hot TB */
+                hot = tb == cpu->tb_hot ? tb : NULL;
+                cpu->tb_hot = NULL;
+            }
+            if (tb == NULL || unlikely(hot)) {
+                unsigned reclaim_gen = tb_reclaim_gen();
                 CPUJumpCache *jc;
                 uint32_t h;
 
                 mmap_lock();
-                tb = tb_gen_code(cpu, s);
+                if (hot) {
+                    tb = tb_gen_superblock(cpu, s, hot);
+                } else {
+                    tb = tb_gen_code(cpu, s);
+                }
                 mmap_unlock();
 
+                /* Making room for the new TB may have discarded last_tb */
+                if (tb_reclaim_gen() != reclaim_gen) {
+                    last_tb = NULL;
+                }
+
                 /*
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
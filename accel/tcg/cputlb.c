@@ -280,6 +280,7 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
 static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
 {
     desc->n_used_entries = 0;
+    desc->n_large_pages = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
@@ -500,18 +501,90 @@ static inline void tlb_flush_vtlb_page_locked(CPUState *cpu, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(cpu, mmu_idx, page, -1);
 }
 
-static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
+static inline bool tlb_large_page_overlaps(vaddr lp_addr, vaddr lp_mask,
+                                           vaddr addr, vaddr last)
 {
-    vaddr lp_addr = cpu->neg.tlb.d[midx].large_page_addr;
-    vaddr lp_mask = cpu->neg.tlb.d[midx].large_page_mask;
+    return lp_addr <= last && (lp_addr | ~lp_mask) >= addr;
+}
 
-    /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
+/*
+ * Flush the entries covering one large page.  Only TARGET_PAGE_SIZE
+ * entries are installed for it, so walk either its pages or the whole
+ * tlb, whichever is shorter.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_flush_one_large_page_locked(CPUState *cpu, int midx,
+                                            vaddr lp_addr, vaddr lp_mask)
+{
+    CPUTLBDescFast *f = cpu_tlb_fast(cpu, midx);
+    size_t n_entries = tlb_n_entries(f);
+    vaddr n_pages = (~lp_mask >> TARGET_PAGE_BITS) + 1;
+    /* Keep TLB_INVALID_MASK so that empty entries do not match. */
+    vaddr mask = lp_mask | TLB_INVALID_MASK;
+
+    tlb_debug("large page flush midx %d (%016"
+              VADDR_PRIx "/%016" VADDR_PRIx ")\n",
+              midx, lp_addr, lp_mask);
+
+    if (n_pages <= n_entries) {
+        for (vaddr i = 0; i < n_pages; i++) {
+            vaddr page = lp_addr + (i << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
+                tlb_n_used_entries_dec(cpu, midx);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n_entries; i++) {
+            if (tlb_flush_entry_mask_locked(&f->table[i], lp_addr, mask)) {
+                tlb_n_used_entries_dec(cpu, midx);
+            }
+        }
+    }
+    tlb_flush_vtlb_page_mask_locked(cpu, midx, lp_addr, mask);
+}
+
+/*
+ * Flush the entries covering the large pages that overlap
+ * [addr, addr + len), and forget about those large pages.
+ * Return true if the entire tlb had to be flushed instead.
+ * Called with tlb_c.lock held.
+ */
+static bool tlb_flush_large_pages_locked(CPUState *cpu, int midx,
+                                         vaddr addr, vaddr len)
+{
+    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
+    vaddr last = addr + len - 1;
+    size_t i = 0;
+
+    if (tlb_large_page_overlaps(d->large_page_addr, d->large_page_mask,
+                                addr, last)) {
         tlb_debug("forcing full flush midx %d (%016"
                   VADDR_PRIx "/%016" VADDR_PRIx ")\n",
-                  midx, lp_addr, lp_mask);
+                  midx, d->large_page_addr, d->large_page_mask);
         tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
-    } else {
+        qatomic_set(&cpu->neg.tlb.c.large_page_flush_count,
+                    cpu->neg.tlb.c.large_page_flush_count + 1);
+        return true;
+    }
+
+    while (i < d->n_large_pages) {
+        CPUTLBLargePage lp = d->large_pages[i];
+
+        if (tlb_large_page_overlaps(lp.addr, lp.mask, addr, last)) {
+            d->large_pages[i] = d->large_pages[--d->n_large_pages];
+            tlb_flush_one_large_page_locked(cpu, midx, lp.addr, lp.mask);
+        } else {
+            i++;
+        }
+    }
+    return false;
+}
+
+static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
+{
+    /* Check if we need to flush due to large pages.  */
+    if (!tlb_flush_large_pages_locked(cpu, midx, page, TARGET_PAGE_SIZE)) {
         if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
             tlb_n_used_entries_dec(cpu, midx);
         }
@@ -665,7 +738,6 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
                                    vaddr addr, vaddr len,
                                    unsigned bits)
 {
-    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
     CPUTLBDescFast *f = cpu_tlb_fast(cpu, midx);
     vaddr mask = MAKE_64BIT_MASK(0, bits);
 
@@ -687,16 +759,8 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
         return;
     }
 
-    /*
-     * Check if we need to flush due to large pages.
-     * Because large_page_mask contains all 1's from the msb,
-     * we only need to test the end of the range.
-     */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  "%016" VADDR_PRIx "/%016" VADDR_PRIx ")\n",
-                  midx, d->large_page_addr, d->large_page_mask);
-        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
+    /* Check if we need to flush due to large pages.  */
+    if (tlb_flush_large_pages_locked(cpu, midx, addr, len)) {
         return;
     }
 
@@ -972,14 +1036,35 @@ static void tlb_set_dirty(CPUState *cpu, vaddr addr)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+/*
+ * Our TLB does not support large pages, so remember the large pages
+ * and flush all of their entries if any page within them is invalidated.
+ * Once CPU_TLB_LARGE_PAGES are tracked, remember the area covered by
+ * the rest and trigger a full TLB flush if these are invalidated.
+ */
 static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
                                vaddr addr, uint64_t size)
 {
-    vaddr lp_addr = cpu->neg.tlb.d[mmu_idx].large_page_addr;
+    CPUTLBDesc *d = &cpu->neg.tlb.d[mmu_idx];
+    vaddr lp_addr = d->large_page_addr;
     vaddr lp_mask = ~(size - 1);
 
+    for (size_t i = 0; i < d->n_large_pages; i++) {
+        CPUTLBLargePage *lp = &d->large_pages[i];
+
+        /* Already tracked, or within a larger page that is. */
+        if (lp->mask <= lp_mask && (addr & lp->mask) == lp->addr) {
+            return;
+        }
+    }
+    if (d->n_large_pages < CPU_TLB_LARGE_PAGES) {
+        d->large_pages[d->n_large_pages++] = (CPUTLBLargePage) {
+            .addr = addr & lp_mask,
+            .mask = lp_mask,
+        };
+        return;
+    }
+
     if (lp_addr == (vaddr)-1) {
         /* No previous large page.  */
         lp_addr = addr;
@@ -987,13 +1072,13 @@ static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
         /* Extend the existing region to include the new page.
            This is a compromise between unnecessary flushes and
            the cost of maintaining a full variable size TLB.  */
-        lp_mask &= cpu->neg.tlb.d[mmu_idx].large_page_mask;
+        lp_mask &= d->large_page_mask;
         while (((lp_addr ^ addr) & lp_mask) != 0) {
             lp_mask <<= 1;
         }
     }
-    cpu->neg.tlb.d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    cpu->neg.tlb.d[mmu_idx].large_page_mask = lp_mask;
+    d->large_page_addr = lp_addr & lp_mask;
+    d->large_page_mask = lp_mask;
 }
 
 static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
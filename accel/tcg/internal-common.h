@@ -18,6 +18,8 @@ extern int64_t max_delay;
 extern int64_t max_advance;
 
 extern bool one_insn_per_tb;
+extern bool tb_eviction;
+extern uint32_t superblock_threshold;
 
 extern bool icount_align_option;
 
@@ -48,6 +50,8 @@ static inline bool cpu_plugin_mem_cbs_enabled(const CPUState *cpu)
 }
 
 TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s);
+TranslationBlock *tb_gen_superblock(CPUState *cpu, TCGTBCPUState s,
+                                    TranslationBlock *hot);
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
@@ -138,6 +142,9 @@ G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 #endif /* CONFIG_USER_ONLY */
 
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+unsigned tb_reclaim_gen(void);
+void tb_reclaim__exclusive_or_serial(void);
+void queue_tb_reclaim(CPUState *cs);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
 
 void tcg_get_stats(AccelState *accel, GString *buf);
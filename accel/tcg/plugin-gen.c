@@ -248,6 +248,132 @@ static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
     tcg_temp_free_i32(clear_flags);
 }
 
+/*
+ * Records are appended without any branch, as the instruction's own ops
+ * may keep EBB temps live across a memory access.  The buffer is instead
+ * flushed when an instruction starts, if it cannot hold all of the
+ * instruction's accesses.  The extra record slot of each entry catches
+ * any access beyond n_records.
+ */
+static void gen_mem_buffer_cb(struct qemu_plugin_mem_buffer_cb *cb,
+                              qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
+{
+    qemu_plugin_u64 entry = { .score = cb->buffer->score };
+    TCGv_ptr ptr = gen_plugin_u64_ptr(entry);
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+    TCGv_i32 count = tcg_temp_ebb_new_i32();
+    TCGv_i32 offset = tcg_temp_ebb_new_i32();
+    size_t records = offsetof(struct qemu_plugin_mem_buffer_entry, records);
+
+    tcg_gen_ld_i32(count, ptr,
+                   offsetof(struct qemu_plugin_mem_buffer_entry, count));
+    tcg_gen_muli_i32(offset, count, sizeof(qemu_plugin_mem_record));
+    tcg_gen_ext_i32_ptr(rec, offset);
+    tcg_gen_add_ptr(rec, rec, ptr);
+
+    tcg_gen_st_i64(addr, rec,
+                   records + offsetof(qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i64(tcg_constant_i64(cb->pc), rec,
+                   records + offsetof(qemu_plugin_mem_record, pc));
+    tcg_gen_st_i32(tcg_constant_i32(meminfo), rec,
+                   records + offsetof(qemu_plugin_mem_record, info));
+
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_umin_i32(count, count, tcg_constant_i32(cb->buffer->n_records));
+    tcg_gen_st_i32(count, ptr,
+                   offsetof(struct qemu_plugin_mem_buffer_entry, count));
+
+    tcg_temp_free_i32(offset);
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(ptr);
+}
+
+static void gen_mem_buffer_reserve(struct qemu_plugin_mem_buffer *buffer,
+                                   unsigned int n_accesses)
+{
+    static TCGHelperInfo info = {
+        .flags = TCG_CALL_NO_RWG,
+        /*
+         * Match qemu_plugin_vcpu_mem_buffer_flush:
+         *   void (*)(uint32_t, struct qemu_plugin_mem_buffer *)
+         */
+        .typemask = (dh_typemask(void, 0) |
+                     dh_typemask(i32, 1) |
+                     dh_typemask(ptr, 2))
+    };
+    qemu_plugin_u64 entry = { .score = buffer->score };
+    TCGv_ptr ptr = gen_plugin_u64_ptr(entry);
+    TCGv_i32 count = tcg_temp_ebb_new_i32();
+    TCGLabel *after_flush = gen_new_label();
+    uint32_t limit = buffer->n_records - MIN(n_accesses, buffer->n_records);
+
+    tcg_gen_ld_i32(count, ptr,
+                   offsetof(struct qemu_plugin_mem_buffer_entry, count));
+    tcg_gen_brcondi_i32(TCG_COND_LEU, count, limit, after_flush);
+    TCGv_i32 cpu_index = gen_cpu_index();
+    tcg_gen_call2(qemu_plugin_vcpu_mem_buffer_flush, &info, NULL,
+                  tcgv_i32_temp(cpu_index),
+                  tcgv_ptr_temp(tcg_constant_ptr(buffer)));
+    tcg_temp_free_i32(cpu_index);
+    gen_set_label(after_flush);
+
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+}
+
+/* Count the memory accesses of the instruction starting after @op */
+static unsigned int plugin_insn_mem_accesses(TCGOp *op)
+{
+    unsigned int n = 0;
+
+    for (op = QTAILQ_NEXT(op, link);
+         op && op->opc != INDEX_op_insn_start;
+         op = QTAILQ_NEXT(op, link)) {
+        if (op->opc == INDEX_op_plugin_mem_cb) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static void gen_mem_buffers_reserve(struct qemu_plugin_insn *insn, TCGOp *op)
+{
+    const GArray *cbs = insn->mem_cbs;
+    unsigned int n_accesses = 0;
+    int i, j, n;
+
+    for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (cb->type != PLUGIN_CB_MEM_BUFFER) {
+            continue;
+        }
+        /* only check each buffer once */
+        for (j = 0; j < i; j++) {
+            struct qemu_plugin_dyn_cb *prev =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, j);
+
+            if (prev->type == PLUGIN_CB_MEM_BUFFER &&
+                prev->mem_buffer.buffer == cb->mem_buffer.buffer) {
+                break;
+            }
+        }
+        if (j < i) {
+            continue;
+        }
+        if (!n_accesses) {
+            n_accesses = plugin_insn_mem_accesses(op);
+            if (!n_accesses) {
+                /* accesses from helpers are checked as they are recorded */
+                return;
+            }
+        }
+        gen_mem_buffer_reserve(cb->mem_buffer.buffer, n_accesses);
+    }
+}
+
 static void inject_cb(struct qemu_plugin_dyn_cb *cb)
 
 {
@@ -285,6 +411,11 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             inject_cb(cb);
         }
         break;
+    case PLUGIN_CB_MEM_BUFFER:
+        if (rw & cb->mem_buffer.rw) {
+            gen_mem_buffer_cb(&cb->mem_buffer, meminfo, addr);
+        }
+        break;
     default:
         g_assert_not_reached();
     }
@@ -360,6 +491,7 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 assert(insn != NULL);
 
                 gen_enable_mem_helper(plugin_tb, insn);
+                gen_mem_buffers_reserve(insn, op);
 
                 cbs = insn->insn_cbs;
                 for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
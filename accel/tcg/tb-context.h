@@ -35,6 +35,9 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_overflow_flush_count; /* full flushes of a full buffer */
+    unsigned tb_region_evict_count;
+    unsigned tb_superblock_count;
 };
 
 extern TBContext tb_ctx;
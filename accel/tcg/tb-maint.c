@@ -976,6 +976,90 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+/*
+ * Called by tcg_region_evict() for each TB in a region whose code is about
+ * to be overwritten.
+ */
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    uint32_t cflags;
+
+    if (tb_page_addr0(tb) != -1) {
+        tb_phys_invalidate(tb, -1);
+        return false;
+    }
+
+    /*
+     * One-shot TBs are not in the hash table, so tb_phys_invalidate() would
+     * leave them alone, but they can still be chained and cached.
+     */
+    qemu_spin_lock(&tb->jmp_lock);
+    cflags = tb->cflags;
+    qatomic_set(&tb->cflags, cflags | CF_INVALID);
+    qemu_spin_unlock(&tb->jmp_lock);
+
+    if (!(cflags & CF_INVALID)) {
+        qemu_thread_jit_write();
+        tb_jmp_cache_inval_tb(tb);
+        tb_remove_from_jmp_list(tb, 0);
+        tb_remove_from_jmp_list(tb, 1);
+        tb_jmp_unlink(tb);
+        qemu_thread_jit_execute();
+    }
+    return false;
+}
+
+/*
+ * Changes whenever tb_reclaim__exclusive_or_serial() has made room, so that
+ * queued requests can tell that another vCPU already did the work.
+ */
+unsigned tb_reclaim_gen(void)
+{
+    return qatomic_read(&tb_ctx.tb_flush_count) +
+           qatomic_read(&tb_ctx.tb_region_evict_count);
+}
+
+/*
+ * Make room in the code buffer after tcg_tb_alloc() failed.  With
+ * tb-eviction=on, recycle the oldest regions and invalidate only the TBs
+ * in them.  Otherwise, or if no region can be recycled, flush everything.
+ * Same context requirements as tb_flush__exclusive_or_serial().
+ */
+void tb_reclaim__exclusive_or_serial(void)
+{
+    if (tb_eviction) {
+        size_t n;
+
+        assert(!runstate_is_running() ||
+               (current_cpu && cpu_in_serial_context(current_cpu)));
+
+        n = tcg_region_evict(tb_evict_iter, NULL);
+        if (n) {
+            trace_tb_region_evict(n);
+            qatomic_set(&tb_ctx.tb_region_evict_count,
+                        tb_ctx.tb_region_evict_count + n);
+            return;
+        }
+    }
+
+    qatomic_inc(&tb_ctx.tb_overflow_flush_count);
+    tb_flush__exclusive_or_serial();
+}
+
+static void do_tb_reclaim(CPUState *cpu, run_on_cpu_data gen)
+{
+    if (tb_reclaim_gen() == gen.host_int) {
+        tb_reclaim__exclusive_or_serial();
+    }
+}
+
+void queue_tb_reclaim(CPUState *cs)
+{
+    async_safe_run_on_cpu(cs, do_tb_reclaim,
+                          RUN_ON_CPU_HOST_INT(tb_reclaim_gen()));
+}
+
 /*
  * Add a new TB and link it to the physical page tables.
  * Called with mmap_lock held for user-mode emulation.
@@ -28,6 +28,7 @@
 #include "exec/replay-core.h"
 #include "exec/icount.h"
 #include "tcg/startup.h"
+#include "tcg/tcg.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/accel.h"
@@ -52,6 +53,8 @@ struct TCGState {
 
     OnOffAuto mttcg_enabled;
     bool one_insn_per_tb;
+    bool tb_eviction;
+    uint32_t superblock_threshold;
     int splitwx_enabled;
     unsigned long tb_size;
 };
@@ -83,6 +86,8 @@ static void tcg_accel_instance_init(Object *obj)
 }
 
 bool one_insn_per_tb;
+bool tb_eviction;
+uint32_t superblock_threshold;
 
 #ifndef CONFIG_USER_ONLY
 static void tcg_vm_change_state(void *opaque, bool running, RunState state)
@@ -165,7 +170,28 @@ static int tcg_init_machine(AccelState *as, MachineState *ms)
 
     page_init();
     tb_htable_init();
-    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_threads);
+#ifdef CONFIG_USER_ONLY
+    /* User mode has a single region, so there is nothing to evict.  */
+    if (s->tb_eviction) {
+        warn_report("tb-eviction is not supported in user mode, ignoring");
+        s->tb_eviction = false;
+    }
+#endif
+    tb_eviction = s->tb_eviction;
+    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_threads,
+             s->tb_eviction);
+
+    superblock_threshold = s->superblock_threshold;
+#ifdef CONFIG_DARWIN
+    /*
+     * The execution counters live in the TBs, in the code buffer.  Without
+     * split-wx, that buffer is MAP_JIT and not writable by generated code.
+     */
+    if (superblock_threshold && !tcg_splitwx_diff) {
+        warn_report("superblock-threshold requires split-wx=on on this host");
+        superblock_threshold = 0;
+    }
+#endif
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -256,6 +282,42 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static bool tcg_get_tb_eviction(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_eviction;
+}
+
+static void tcg_set_tb_eviction(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_eviction = value;
+}
+
+static void tcg_get_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->superblock_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->superblock_threshold = value;
+}
+
 static void tcg_accel_class_init(ObjectClass *oc, const void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -286,6 +348,20 @@ static void tcg_accel_class_init(ObjectClass *oc, const void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add_bool(oc, "tb-eviction",
+                                   tcg_get_tb_eviction,
+                                   tcg_set_tb_eviction);
+    object_class_property_set_description(oc, "tb-eviction",
+        "Recycle the oldest code buffer regions instead of flushing "
+        "all translation blocks when the buffer is full");
+
+    object_class_property_add(oc, "superblock-threshold", "uint32",
+        tcg_get_superblock_threshold, tcg_set_superblock_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "superblock-threshold",
+        "Executions after which a translation block is retranslated "
+        "together with its successors (0 = never)");
 }
 
 static const TypeInfo tcg_accel_type = {
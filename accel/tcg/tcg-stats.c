@@ -42,10 +42,20 @@ static void dump_accel_info(AccelState *accel, GString *buf)
     bool one_insn_per_tb = object_property_get_bool(OBJECT(accel),
                                                     "one-insn-per-tb",
                                                     &error_fatal);
+    bool tb_eviction = object_property_get_bool(OBJECT(accel),
+                                                "tb-eviction",
+                                                &error_fatal);
+    uint64_t superblock_threshold =
+        object_property_get_uint(OBJECT(accel), "superblock-threshold",
+                                 &error_fatal);
 
     g_string_append_printf(buf, "Accelerator settings:\n");
-    g_string_append_printf(buf, "one-insn-per-tb: %s\n\n",
+    g_string_append_printf(buf, "one-insn-per-tb: %s\n",
                            one_insn_per_tb ? "on" : "off");
+    g_string_append_printf(buf, "tb-eviction: %s\n",
+                           tb_eviction ? "on" : "off");
+    g_string_append_printf(buf, "superblock-threshold: %" PRIu64 "\n\n",
+                           superblock_threshold);
 }
 
 static void print_qht_statistics(struct qht_stats hst, GString *buf)
@@ -132,34 +142,44 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
-static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                             size_t *plarge)
 {
     CPUState *cpu;
-    size_t full = 0, part = 0, elide = 0;
+    size_t full = 0, part = 0, elide = 0, large = 0;
 
     CPU_FOREACH(cpu) {
         full += qatomic_read(&cpu->neg.tlb.c.full_flush_count);
         part += qatomic_read(&cpu->neg.tlb.c.part_flush_count);
         elide += qatomic_read(&cpu->neg.tlb.c.elide_flush_count);
+        large += qatomic_read(&cpu->neg.tlb.c.large_page_flush_count);
     }
     *pfull = full;
     *ppart = part;
     *pelide = elide;
+    *plarge = large;
 }
 
 static void tcg_dump_flush_info(GString *buf)
 {
-    size_t flush_full, flush_part, flush_elide;
+    size_t flush_full, flush_part, flush_elide, flush_large;
 
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
-
-    tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
+    g_string_append_printf(buf, "TB overflow flushes %u\n",
+                           qatomic_read(&tb_ctx.tb_overflow_flush_count));
+    g_string_append_printf(buf, "TB region evictions %u\n",
+                           qatomic_read(&tb_ctx.tb_region_evict_count));
+    g_string_append_printf(buf, "TB superblocks      %u\n",
+                           qatomic_read(&tb_ctx.tb_superblock_count));
+
+    tlb_flush_counts(&flush_full, &flush_part, &flush_elide, &flush_large);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    g_string_append_printf(buf, "TLB lpage flushes   %zu\n", flush_large);
 }
 
 static void dump_exec_info(GString *buf)
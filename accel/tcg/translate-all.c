@@ -25,6 +25,7 @@
 #include "exec/mmap-lock.h"
 #include "tb-internal.h"
 #include "exec/tb-flush.h"
+#include "exec/target_page.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/target-info.h"
 #include "exec/log.h"
@@ -231,13 +232,225 @@ void page_init(void)
     page_table_config_init();
 }
 
+/*
+ * Superblocks
+ *
+ * When the execution counter of a TB expires, the TB is retranslated
+ * together with the TBs that its goto_tb exits are chained to.  The
+ * opcodes of each successor replace the goto_tb ... exit_tb sequence
+ * that led to it, which is exactly the code that chained execution
+ * skips.  The optimizer and the register allocator then see one
+ * extended basic block where there used to be a chain of TBs.
+ *
+ * The trace only moves forward within the first page of the head TB,
+ * so only the head needs to check for pending interrupts, and SMC
+ * detection and unwinding work as for any other TB.
+ */
+
+#define TB_TRACE_MAX_BLOCKS 8
+
+/*
+ * Find the goto_tb for exit @n of @tb and the exit_tb that ends it.
+ * The successor can only be inlined if nothing after the exit_tb can
+ * unwind, since that code would be attributed to the last guest insn
+ * of the successor.
+ */
+static bool tb_trace_find_exit(TranslationBlock *tb, unsigned n,
+                               TCGOp **goto_op, TCGOp **exit_op)
+{
+    uintptr_t val = (uintptr_t)tcg_splitwx_to_rx(tb) + n;
+    TCGOp *op;
+
+    *goto_op = NULL;
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+        if (op->opc == INDEX_op_goto_tb && op->args[0] == n) {
+            *goto_op = op;
+            break;
+        }
+    }
+    if (!*goto_op) {
+        return false;
+    }
+
+    for (op = QTAILQ_NEXT(op, link); op; op = QTAILQ_NEXT(op, link)) {
+        if (op->opc == INDEX_op_exit_tb) {
+            break;
+        }
+        if (op->opc == INDEX_op_insn_start ||
+            (tcg_op_defs[op->opc].flags & TCG_OPF_BB_END)) {
+            return false;
+        }
+    }
+    if (!op || op->args[0] != val) {
+        return false;
+    }
+    *exit_op = op;
+
+    for (op = QTAILQ_NEXT(op, link); op; op = QTAILQ_NEXT(op, link)) {
+        if (op->opc == INDEX_op_insn_start ||
+            (tcg_op_defs[op->opc].flags & TCG_OPF_CALL_CLOBBER)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Check that @succ, chained from the block at @from_pc, can join the
+ * trace that starts with @tb at @pc and has @icount insns so far.
+ * Return its virtual pc in @succ_pc.
+ */
+static bool tb_trace_can_add(TranslationBlock *tb, vaddr pc, vaddr from_pc,
+                             int icount, TranslationBlock *succ,
+                             vaddr *succ_pc)
+{
+    tb_page_addr_t phys_pc = tb_page_addr0(tb);
+    tb_page_addr_t succ_phys = tb_page_addr0(succ);
+    uint32_t cflags = tb_cflags(succ);
+
+    /*
+     * Only counted TBs, which excludes superblocks.  A stale TB has
+     * CF_INVALID set and fails the cflags comparison.  The whole
+     * superblock is unwound with the key of its head, so that key must
+     * be valid for the successor as well.
+     */
+    if (!qatomic_read(&succ->hot_count) || cflags != tb->cflags ||
+        succ->flags != tb->flags || succ->cs_base != tb->cs_base) {
+        return false;
+    }
+    if (succ_phys == -1 || tb_page_addr1(succ) != -1 ||
+        ((succ_phys ^ phys_pc) & TARGET_PAGE_MASK)) {
+        return false;
+    }
+
+    /* CF_PCREL TBs do not record pc, so derive it from the page offset */
+    *succ_pc = pc + (succ_phys - phys_pc);
+    if (*succ_pc <= from_pc ||
+        (!(cflags & CF_PCREL) && succ->pc != *succ_pc) ||
+        ((*succ_pc + succ->size - 1) ^ pc) & TARGET_PAGE_MASK) {
+        return false;
+    }
+    return succ->icount <= TCG_MAX_INSNS - icount;
+}
+
+/*
+ * Append the TBs chained from the exits of @tb, given by @succ, to its
+ * opcodes.  Called after translating @tb, with its first page locked.
+ */
+static void tb_gen_trace(CPUState *cs, TranslationBlock *tb, vaddr pc,
+                         void *host_pc, TranslationBlock **succ)
+{
+    uintptr_t rx_tb = (uintptr_t)tcg_splitwx_to_rx(tb);
+    uint32_t cflags = tb->cflags;
+    TranslationBlock *next[TB_EXIT_IDXMAX + 1];
+    vaddr from_pc = pc, end = pc + tb->size;
+    int icount = tb->icount;
+    int blocks;
+
+    memcpy(next, succ, sizeof(next));
+
+    for (blocks = 1; blocks < TB_TRACE_MAX_BLOCKS; blocks++) {
+        TranslationBlock *b = NULL;
+        TCGOp *goto_op, *exit_op, *last, *op, *op_next;
+        int map[TB_EXIT_IDXMAX + 1] = { -1, -1 };
+        unsigned used = 0, n, k = 0;
+        vaddr b_pc = 0;
+        int max_insns;
+
+        /* Follow the exit whose successor has run most often. */
+        for (n = 0; n <= TB_EXIT_IDXMAX; n++) {
+            vaddr dest_pc;
+
+            if (next[n] &&
+                tb_trace_can_add(tb, pc, from_pc, icount, next[n], &dest_pc) &&
+                (!b || qatomic_read(&next[n]->hot_count) <
+                       qatomic_read(&b->hot_count))) {
+                b = next[n];
+                b_pc = dest_pc;
+                k = n;
+            }
+        }
+        if (!b || !tb_trace_find_exit(tb, k, &goto_op, &exit_op)) {
+            break;
+        }
+
+        last = tcg_last_op();
+        QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+            if (op->opc == INDEX_op_goto_tb && op->args[0] != k) {
+                used |= 1 << op->args[0];
+            }
+        }
+
+        /* Only the head of the trace checks for interrupts. */
+        tb->cflags = cflags | CF_NOIRQ;
+#ifdef CONFIG_DEBUG_TCG
+        tcg_ctx->goto_tb_issue_mask = 0;
+#endif
+        max_insns = b->icount;
+        cs->cc->tcg_ops->translate_code(cs, tb, &max_insns, b_pc,
+                                        host_pc + (b_pc - pc));
+        tb->cflags = cflags;
+
+        /*
+         * Give the exits of the successor the exit numbers that are free
+         * in the superblock.  Exits left without one return to the main
+         * loop unchained.
+         */
+        memset(next, 0, sizeof(next));
+        for (op = QTAILQ_NEXT(last, link); op; op = op_next) {
+            op_next = QTAILQ_NEXT(op, link);
+            if (op->opc == INDEX_op_goto_tb) {
+                n = op->args[0];
+                if (used != (1 << (TB_EXIT_IDXMAX + 1)) - 1) {
+                    map[n] = ctz32(~used);
+                    used |= 1 << map[n];
+                    op->args[0] = map[n];
+                    next[map[n]] = (TranslationBlock *)
+                        qatomic_read(&b->jmp_dest[n]);
+                    if ((uintptr_t)next[map[n]] & 1) {
+                        next[map[n]] = NULL;
+                    }
+                } else {
+                    tcg_op_remove(tcg_ctx, op);
+                }
+            } else if (op->opc == INDEX_op_exit_tb &&
+                       op->args[0] - rx_tb <= TB_EXIT_IDXMAX) {
+                n = op->args[0] - rx_tb;
+                op->args[0] = map[n] < 0 ? 0 : rx_tb + map[n];
+            }
+        }
+
+        /* Move the successor in place of the exit that chained to it. */
+        while ((op = QTAILQ_NEXT(last, link)) != NULL) {
+            QTAILQ_REMOVE(&tcg_ctx->ops, op, link);
+            QTAILQ_INSERT_BEFORE(goto_op, op, link);
+        }
+        for (op = goto_op; op != exit_op; op = op_next) {
+            op_next = QTAILQ_NEXT(op, link);
+            tcg_op_remove(tcg_ctx, op);
+        }
+        tcg_op_remove(tcg_ctx, exit_op);
+
+        icount += tb->icount;
+        end = MAX(end, b_pc + tb->size);
+        from_pc = b_pc;
+    }
+
+    tb->size = end - pc;
+    tb->icount = icount;
+    if (blocks > 1) {
+        qatomic_inc(&tb_ctx.tb_superblock_count);
+    }
+}
+
 /*
  * Isolate the portion of code gen which can setjmp/longjmp.
  * Return the size of the generated code, or negative on error.
  */
 static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
                            vaddr pc, void *host_pc,
-                           int *max_insns, int64_t *ti)
+                           int *max_insns, int64_t *ti,
+                           TranslationBlock **succ)
 {
     int ret = sigsetjmp(tcg_ctx->jmp_trans, 0);
     if (unlikely(ret != 0)) {
@@ -251,14 +464,27 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     cs->cc->tcg_ops->translate_code(cs, tb, max_insns, pc, host_pc);
 
     assert(tb->size != 0);
+    if (succ) {
+        tb_gen_trace(cs, tb, pc, host_pc, succ);
+    }
     tcg_ctx->cpu = NULL;
     *max_insns = tb->icount;
 
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
+/* cflags of TBs that are never counted, nor extended into superblocks */
+#define CF_NO_SUPERBLOCK \
+    (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_SINGLE_STEP | CF_MEMI_ONLY | \
+     CF_USE_ICOUNT | CF_NOIRQ | CF_BP_PAGE)
+
+/*
+ * Translate the TB for @s.  If @succ is not NULL, it holds the TBs that
+ * the previous translation of @s was chained to, and the new TB becomes
+ * a superblock.  Called with mmap_lock held for user mode emulation.
+ */
+static TranslationBlock *do_tb_gen_code(CPUState *cpu, TCGTBCPUState s,
+                                        TranslationBlock **succ)
 {
     CPUArchState *env = cpu_env(cpu);
     TranslationBlock *tb, *existing_tb;
@@ -288,13 +514,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
+        /* The successors may not survive making room */
+        succ = NULL;
+        /* eviction or flush must be done */
         if (cpu_in_serial_context(cpu)) {
             trace_tb_gen_code_buffer_overflow("tcg_tb_alloc");
-            tb_flush__exclusive_or_serial();
+            tb_reclaim__exclusive_or_serial();
             goto buffer_overflow;
         }
-        queue_tb_flush(cpu);
+        queue_tb_reclaim(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -309,6 +537,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     tb->cs_base = s.cs_base;
     tb->flags = s.flags;
     tb->cflags = s.cflags;
+    if (superblock_threshold && !succ && phys_pc != -1 &&
+        !(s.cflags & CF_NO_SUPERBLOCK)) {
+        tb->hot_count = superblock_threshold;
+    } else {
+        tb->hot_count = 0;
+    }
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
@@ -321,7 +555,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
  restart_translate:
     trace_translate_block(tb, s.pc, tb->tc.ptr);
 
-    gen_code_size = setjmp_gen_code(env, tb, s.pc, host_pc, &max_insns, &ti);
+    gen_code_size = setjmp_gen_code(env, tb, s.pc, host_pc, &max_insns, &ti,
+                                    succ);
     if (unlikely(gen_code_size < 0)) {
         switch (gen_code_size) {
         case -1:
@@ -352,6 +587,18 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
              * Try again with half as many insns as we attempted this time.
              * If a single insn overflows, there's a bug somewhere...
              */
+            if (succ) {
+                /*
+                 * Give up on the superblock first.  tb_gen_trace() may
+                 * have been interrupted, so restore the cflags.
+                 */
+                qemu_log_mask(CPU_LOG_TB_OP | CPU_LOG_TB_OP_OPT,
+                              "Restarting code generation "
+                              "without superblock\n");
+                succ = NULL;
+                tb->cflags = s.cflags;
+                goto restart_translate;
+            }
             assert(max_insns > 1);
             max_insns /= 2;
             qemu_log_mask(CPU_LOG_TB_OP | CPU_LOG_TB_OP_OPT,
@@ -540,6 +787,41 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     return tb;
 }
 
+TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
+{
+    return do_tb_gen_code(cpu, s, NULL);
+}
+
+/*
+ * Retranslate @hot, whose execution counter expired, as a superblock
+ * that includes the TBs it is chained to.  Return the TB to execute for
+ * @s, which is @hot itself if no superblock can be built.
+ * Called with mmap_lock held for user mode emulation.
+ */
+TranslationBlock *tb_gen_superblock(CPUState *cpu, TCGTBCPUState s,
+                                    TranslationBlock *hot)
+{
+    TranslationBlock *succ[TB_EXIT_IDXMAX + 1];
+    bool chained = false;
+    int n;
+
+    assert_memory_lock();
+
+    /* jmp_dest[] is cleared when @hot is invalidated */
+    for (n = 0; n <= TB_EXIT_IDXMAX; n++) {
+        uintptr_t dest = qatomic_read(&hot->jmp_dest[n]);
+
+        succ[n] = dest & 1 ? NULL : (TranslationBlock *)dest;
+        chained |= succ[n] != NULL;
+    }
+    if (!chained) {
+        return hot;
+    }
+
+    tb_phys_invalidate(hot, -1);
+    return do_tb_gen_code(cpu, s, succ);
+}
+
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
 {
@@ -103,6 +103,26 @@ static void gen_tb_end(const TranslationBlock *tb, uint32_t cflags,
     }
 }
 
+/*
+ * Count down the executions of TB, and return to the main loop to
+ * build a superblock when the count reaches zero.  The counter lives
+ * in the TB itself; racing updates from other vCPUs only make it
+ * less precise.
+ */
+static void gen_tb_hot_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_constant_ptr(tb);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *cold = gen_new_label();
+
+    tcg_gen_ld_i32(count, ptr, offsetof(TranslationBlock, hot_count));
+    tcg_gen_subi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, offsetof(TranslationBlock, hot_count));
+    tcg_gen_brcondi_i32(TCG_COND_NE, count, 0, cold);
+    gen_helper_tb_hot(tcg_env, ptr);
+    gen_set_label(cold);
+}
+
 bool translator_is_same_page(const DisasContextBase *db, vaddr addr)
 {
     return ((addr ^ db->pc_first) & TARGET_PAGE_MASK) == 0;
@@ -156,6 +176,15 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     plugin_enabled = plugin_gen_tb_start(cpu, db);
     db->plugin_enabled = plugin_enabled;
 
+    /* Superblocks would hide block boundaries from plugins. */
+    if (tb->hot_count) {
+        if (plugin_enabled) {
+            tb->hot_count = 0;
+        } else {
+            gen_tb_hot_count(tb);
+        }
+    }
+
     while (true) {
         *max_insns = ++db->num_insns;
         ops->insn_start(db, cpu);
@@ -32,6 +32,7 @@
 #include "qemu/option.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/bswap.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
@@ -78,6 +79,10 @@
 #include <linux/fs.h>
 #include <linux/hdreg.h>
 #include <linux/magic.h>
+#ifdef HAVE_NVME_URING_CMD
+#include <linux/nvme_ioctl.h>
+#include "block/nvme.h"
+#endif
 #include <scsi/sg.h>
 #ifdef __s390x__
 #include <asm/dasd.h>
@@ -183,6 +188,15 @@ typedef struct BDRVRawState {
     bool force_alignment;
     bool drop_cache;
     bool check_cache_dropped;
+#ifdef CONFIG_LINUX_IO_URING
+    /* host -> size of areas passed to aio_register_fixed_buf(), or NULL */
+    GHashTable *fixed_bufs;
+#endif
+#ifdef HAVE_NVME_URING_CMD
+    /* NVMe namespace of an nvme-passthru=on device, or 0 */
+    uint32_t nvme_nsid;
+    unsigned nvme_lba_shift;
+#endif
     struct {
         uint64_t discard_nb_ok;
         uint64_t discard_nb_failed;
@@ -526,6 +540,81 @@ static int check_hdev_writable(int fd)
     return 0;
 }
 
+#ifdef HAVE_NVME_URING_CMD
+/*
+ * Fills in @id with the Identify Namespace data structure of namespace @nsid
+ * of the NVMe generic character device @fd. Returns 0 on success, -errno
+ * otherwise.
+ */
+static int raw_nvme_identify_ns(int fd, uint32_t nsid, NvmeIdNs *id)
+{
+    struct nvme_admin_cmd cmd = {
+        .opcode = NVME_ADM_CMD_IDENTIFY,
+        .nsid = nsid,
+        .addr = (uintptr_t)id,
+        .data_len = sizeof(*id),
+        .cdw10 = NVME_ID_CNS_NS,
+    };
+
+    int ret;
+
+    ret = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    if (ret < 0) {
+        return -errno;
+    }
+
+    /* Positive values are NVMe status codes */
+    return ret == 0 ? 0 : -EIO;
+}
+
+/*
+ * With nvme-passthru=on, reads, writes, flushes, write zeroes and discards
+ * are sent as NVMe commands through IORING_OP_URING_CMD and bypass the host
+ * block layer. The namespace must be formatted without metadata so that guest
+ * data maps 1:1 onto logical blocks.
+ */
+static int raw_nvme_passthru_open(BlockDriverState *bs, Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+    g_autofree NvmeIdNs *id = g_new0(NvmeIdNs, 1);
+    NvmeLBAF *lbaf;
+    int nsid;
+    int ret;
+
+    if (!aio_has_io_uring_cmd()) {
+        error_setg(errp, "nvme-passthru=on requires io_uring passthrough "
+                   "commands, which are not supported by the host kernel");
+        return -ENOTSUP;
+    }
+
+    nsid = ioctl(s->fd, NVME_IOCTL_ID);
+    if (nsid <= 0) {
+        error_setg(errp, "'%s' is not an NVMe namespace", bs->filename);
+        return -EINVAL;
+    }
+
+    ret = raw_nvme_identify_ns(s->fd, nsid, id);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to identify NVMe namespace");
+        return ret;
+    }
+
+    lbaf = &id->lbaf[NVME_ID_NS_FLBAS_INDEX(id->flbas)];
+    if (le16_to_cpu(lbaf->ms)) {
+        error_setg(errp, "NVMe namespaces with metadata are not supported");
+        return -ENOTSUP;
+    }
+    if (lbaf->ds < BDRV_SECTOR_BITS || lbaf->ds > 16) {
+        error_setg(errp, "Unsupported NVMe LBA data size 2^%u", lbaf->ds);
+        return -ENOTSUP;
+    }
+
+    s->nvme_nsid = nsid;
+    s->nvme_lba_shift = lbaf->ds;
+    return 0;
+}
+#endif /* HAVE_NVME_URING_CMD */
+
 static void raw_parse_flags(int bdrv_flags, int *open_flags, bool has_writers)
 {
     bool read_write = false;
@@ -578,6 +667,21 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register I/O buffers with io_uring (default: off)",
+        },
+#endif
+#ifdef HAVE_NVME_URING_CMD
+        {
+            .name = "nvme-passthru",
+            .type = QEMU_OPT_BOOL,
+            .help = "send NVMe commands to an NVMe generic character device "
+                    "(default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -766,6 +870,17 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 #endif /* !defined(CONFIG_LINUX_IO_URING) */
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (qemu_opt_get_bool(opts, "aio-fixed-buffers", false)) {
+        if (!s->use_linux_io_uring) {
+            error_setg(errp, "aio-fixed-buffers=on requires aio=io_uring");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->fixed_bufs = g_hash_table_new(NULL, NULL);
+    }
+#endif
+
     s->has_discard = true;
     s->has_write_zeroes = true;
 
@@ -775,6 +890,26 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
+#ifdef HAVE_NVME_URING_CMD
+    if (qemu_opt_get_bool(opts, "nvme-passthru", false)) {
+        if (!device || !S_ISCHR(st.st_mode)) {
+            error_setg(errp, "nvme-passthru=on requires an NVMe generic "
+                       "character device");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (!s->use_linux_io_uring) {
+            error_setg(errp, "nvme-passthru=on requires aio=io_uring");
+            ret = -EINVAL;
+            goto fail;
+        }
+        ret = raw_nvme_passthru_open(bs, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+#endif
+
     if (!device) {
         if (!S_ISREG(st.st_mode)) {
             error_setg(errp, "'%s' driver requires '%s' to be a regular file",
@@ -836,6 +971,12 @@ fail:
     if (ret < 0 && s->fd != -1) {
         qemu_close(s->fd);
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (ret < 0 && s->fixed_bufs) {
+        g_hash_table_destroy(s->fixed_bufs);
+        s->fixed_bufs = NULL;
+    }
+#endif
     if (filename && (bdrv_flags & BDRV_O_TEMPORARY)) {
         unlink(filename);
     }
@@ -1341,6 +1482,69 @@ static int hdev_get_max_segments(int fd, struct stat *st)
 #endif
 }
 
+#ifdef HAVE_NVME_URING_CMD
+/*
+ * NVMe generic character devices have no queue limits in sysfs. Use the ones
+ * of the block device of the same namespace, e.g. nvme0n1 for ng0n1.
+ */
+static long raw_nvme_get_queue_limit(struct stat *st, const char *attribute)
+{
+    g_autofree char *link = NULL;
+    g_autofree char *blkdev = NULL;
+    char *path;
+    unsigned ctrl, ns;
+    struct stat blk_st;
+    int n;
+
+    link = g_strdup_printf("/sys/dev/char/%u:%u",
+                           major(st->st_rdev), minor(st->st_rdev));
+    path = realpath(link, NULL);
+    if (!path) {
+        return -errno;
+    }
+    n = sscanf(strrchr(path, '/') + 1, "ng%un%u", &ctrl, &ns);
+    free(path);
+    if (n != 2) {
+        return -ENOTSUP;
+    }
+
+    blkdev = g_strdup_printf("/dev/nvme%un%u", ctrl, ns);
+    if (stat(blkdev, &blk_st) < 0) {
+        return -errno;
+    }
+    return get_sysfs_long_val(&blk_st, attribute);
+}
+
+static void raw_nvme_refresh_limits(BlockDriverState *bs, struct stat *st)
+{
+    BDRVRawState *s = bs->opaque;
+    uint32_t lba_size = 1U << s->nvme_lba_shift;
+    /* Read, Write and Write Zeroes have a 16-bit block count */
+    uint64_t max_cmd = MIN((uint64_t)lba_size << 16,
+                           QEMU_ALIGN_DOWN(BDRV_REQUEST_MAX_BYTES, lba_size));
+    long val;
+
+    bs->bl.request_alignment = lba_size;
+    bs->bl.pwrite_zeroes_alignment = lba_size;
+    bs->bl.pdiscard_alignment = lba_size;
+    bs->bl.max_pwrite_zeroes = max_cmd;
+
+    /* The kernel bounces buffers that are not dword aligned */
+    s->buf_align = 4;
+    bs->bl.min_mem_alignment = s->buf_align;
+    bs->bl.opt_mem_alignment = qemu_real_host_page_size();
+
+    /* Without the sysfs limit, be conservative and assume a small MDTS */
+    val = raw_nvme_get_queue_limit(st, "max_hw_sectors_kb");
+    bs->bl.max_transfer = MIN(max_cmd, val > 0 ? val * KiB : 128 * KiB);
+
+    val = raw_nvme_get_queue_limit(st, "max_segments");
+    if (val > 0) {
+        bs->bl.max_iov = MIN(val, IOV_MAX);
+    }
+}
+#endif /* HAVE_NVME_URING_CMD */
+
 /*
  * Fills in *dalign with the discard alignment and returns 0 on success,
  * -errno otherwise.
@@ -1530,6 +1734,15 @@ static void raw_refresh_limits(BlockDriverState *bs, Error **errp)
     BDRVRawState *s = bs->opaque;
     struct stat st;
 
+#ifdef HAVE_NVME_URING_CMD
+    if (s->nvme_nsid) {
+        if (fstat(s->fd, &st) == 0) {
+            raw_nvme_refresh_limits(bs, &st);
+        }
+        return;
+    }
+#endif
+
     s->needs_alignment = raw_needs_alignment(bs);
     raw_probe_alignment(bs, s->fd, errp);
 
@@ -1631,6 +1844,13 @@ static int hdev_probe_blocksizes(BlockDriverState *bs, BlockSizes *bsz)
     BDRVRawState *s = bs->opaque;
     int ret;
 
+#ifdef HAVE_NVME_URING_CMD
+    if (s->nvme_nsid) {
+        bsz->log = bsz->phys = 1U << s->nvme_lba_shift;
+        return 0;
+    }
+#endif
+
     /* If DASD or zoned devices, get blocksizes */
     if (check_for_dasd(s->fd) < 0) {
         /* zoned devices are not DASD */
@@ -2557,6 +2777,13 @@ raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr, uint64_t bytes,
 
     if (fd_open(bs) < 0)
         return -EIO;
+#ifdef HAVE_NVME_URING_CMD
+    if (s->nvme_nsid) {
+        return luring_co_nvme_submit(bs, s->fd, s->nvme_nsid,
+                                     s->nvme_lba_shift, offset, bytes, qiov,
+                                     type, flags);
+    }
+#endif
 #if defined(CONFIG_BLKZONED)
     if ((type & (QEMU_AIO_WRITE | QEMU_AIO_ZONE_APPEND)) &&
         bs->bl.zoned != BLK_Z_NONE) {
@@ -2579,7 +2806,8 @@ raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr, uint64_t bytes,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (s->use_linux_io_uring) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type, flags);
+        ret = luring_co_submit(bs, s->fd, offset, qiov, type, flags,
+                               s->fixed_bufs != NULL);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2673,9 +2901,14 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
         .aio_type       = QEMU_AIO_FLUSH,
     };
 
-#ifdef CONFIG_LINUX_IO_URING
+#ifdef HAVE_NVME_URING_CMD
+    if (s->nvme_nsid) {
+        return luring_co_nvme_submit(bs, s->fd, s->nvme_nsid,
+                                     s->nvme_lba_shift, 0, 0, NULL,
+                                     QEMU_AIO_FLUSH, 0);
+    }
     if (s->use_linux_io_uring) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, 0);
+        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, 0, false);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2690,6 +2923,20 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->fixed_bufs) {
+        GHashTableIter iter;
+        gpointer host, size;
+
+        g_hash_table_iter_init(&iter, s->fixed_bufs);
+        while (g_hash_table_iter_next(&iter, &host, &size)) {
+            aio_unregister_fixed_buf(host, GPOINTER_TO_SIZE(size));
+        }
+        g_hash_table_destroy(s->fixed_bufs);
+        s->fixed_bufs = NULL;
+    }
+#endif
+
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
@@ -2927,6 +3174,19 @@ static int64_t raw_getlength(BlockDriverState *bs)
         return ret;
     }
 
+#ifdef HAVE_NVME_URING_CMD
+    if (s->nvme_nsid) {
+        g_autofree NvmeIdNs *id = g_new0(NvmeIdNs, 1);
+
+        /* Character devices have no size, ask the controller */
+        ret = raw_nvme_identify_ns(s->fd, s->nvme_nsid, id);
+        if (ret < 0) {
+            return ret;
+        }
+        return le64_to_cpu(id->nsze) << s->nvme_lba_shift;
+    }
+#endif
+
     size = lseek(s->fd, 0, SEEK_END);
     if (size < 0) {
         return -errno;
@@ -3641,6 +3901,16 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
         acb.aio_type |= QEMU_AIO_BLKDEV;
     }
 
+#ifdef HAVE_NVME_URING_CMD
+    if (s->nvme_nsid) {
+        ret = luring_co_nvme_submit(bs, s->fd, s->nvme_nsid,
+                                    s->nvme_lba_shift, offset, bytes, NULL,
+                                    QEMU_AIO_DISCARD, 0);
+        raw_account_discard(s, bytes, ret);
+        return ret;
+    }
+#endif
+
     ret = raw_thread_pool_submit(handle_aiocb_discard, &acb);
     raw_account_discard(s, bytes, ret);
     return ret;
@@ -3660,6 +3930,14 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
     RawPosixAIOData acb;
     ThreadPoolFunc *handler;
 
+#ifdef HAVE_NVME_URING_CMD
+    if (s->nvme_nsid) {
+        return luring_co_nvme_submit(bs, s->fd, s->nvme_nsid,
+                                     s->nvme_lba_shift, offset, bytes, NULL,
+                                     QEMU_AIO_WRITE_ZEROES, flags);
+    }
+#endif
+
 #ifdef CONFIG_FALLOCATE
     if (offset + bytes > bs->total_sectors * BDRV_SECTOR_SIZE) {
         BdrvTrackedRequest *req;
@@ -3956,6 +4234,34 @@ raw_co_copy_range_to(BlockDriverState *bs,
     return raw_thread_pool_submit(handle_aiocb_copy_range, &acb);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Guest RAM is registered here through the BlockRAMRegistrar. io_uring fixed
+ * buffers are only an optimization, so this never fails and I/O to memory
+ * that the kernel refused to register takes the ordinary path.
+ */
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->fixed_bufs && !g_hash_table_contains(s->fixed_bufs, host)) {
+        g_hash_table_insert(s->fixed_bufs, host, GSIZE_TO_POINTER(size));
+        aio_register_fixed_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->fixed_bufs && g_hash_table_remove(s->fixed_bufs, host)) {
+        aio_unregister_fixed_buf(host, size);
+    }
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
 BlockDriver bdrv_file = {
     .format_name = "file",
     .protocol_name = "file",
@@ -3983,6 +4289,10 @@ BlockDriver bdrv_file = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -4453,6 +4763,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
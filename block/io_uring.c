@@ -10,9 +10,14 @@
  */
 #include "qemu/osdep.h"
 #include <liburing.h>
+#ifdef HAVE_NVME_URING_CMD
+#include <linux/nvme_ioctl.h>
+#endif
 #include "qemu/aio.h"
 #include "block/block.h"
+#include "block/nvme.h"
 #include "block/raw-aio.h"
+#include "qemu/bswap.h"
 #include "qemu/coroutine.h"
 #include "system/block-backend.h"
 #include "trace.h"
@@ -25,6 +30,7 @@ typedef struct {
     int type;
     int fd;
     BdrvRequestFlags flags;
+    bool fixed_bufs; /* the node registered guest RAM as fixed buffers */
 
     /*
      * Short reads/writes require resubmission, see
@@ -33,9 +39,30 @@ typedef struct {
     int total_done;
     QEMUIOVector resubmit_qiov;
 
+    /* NVMe passthrough requests, see luring_co_nvme_submit() */
+    uint32_t nsid;
+    unsigned lba_shift;
+    uint64_t bytes;
+    NvmeDsmRange dsm_range;
+
     CqeHandler cqe_handler;
 } LuringRequest;
 
+/*
+ * Returns the index of the fixed buffer that @qiov lies in, or -1 if the
+ * request has to go through the ordinary read/write path. Fixed buffers save
+ * the kernel from pinning the pages for each request.
+ */
+static int luring_fixed_buf(LuringRequest *req, QEMUIOVector *qiov)
+{
+    /* There are no vectored fixed buffer operations */
+    if (!req->fixed_bufs || qiov->niov != 1) {
+        return -1;
+    }
+
+    return aio_get_fixed_buf(qiov->iov->iov_base, qiov->iov->iov_len);
+}
+
 static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
 {
     LuringRequest *req = opaque;
@@ -43,6 +70,7 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
     uint64_t offset = req->offset + req->total_done;
     int fd = req->fd;
     BdrvRequestFlags flags = req->flags;
+    int buf_index;
 
     if (req->resubmit_qiov.iov) {
         qiov = &req->resubmit_qiov;
@@ -52,7 +80,14 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
     case QEMU_AIO_WRITE:
     {
         int luring_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
-        if (luring_flags != 0 || qiov->niov > 1) {
+
+        buf_index = luring_fixed_buf(req, qiov);
+        if (buf_index >= 0) {
+            struct iovec *iov = qiov->iov;
+            io_uring_prep_write_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                      offset, buf_index);
+            sqe->rw_flags = luring_flags;
+        } else if (luring_flags != 0 || qiov->niov > 1) {
 #ifdef HAVE_IO_URING_PREP_WRITEV2
             io_uring_prep_writev2(sqe, fd, qiov->iov,
                                   qiov->niov, offset, luring_flags);
@@ -77,7 +112,12 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
         break;
     case QEMU_AIO_READ:
     {
-        if (qiov->niov > 1) {
+        buf_index = luring_fixed_buf(req, qiov);
+        if (buf_index >= 0) {
+            struct iovec *iov = qiov->iov;
+            io_uring_prep_read_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                     offset, buf_index);
+        } else if (qiov->niov > 1) {
             io_uring_prep_readv(sqe, fd, qiov->iov, qiov->niov, offset);
         } else {
             /* The man page says non-vectored is faster than vectored */
@@ -199,7 +239,8 @@ static void luring_cqe_handler(CqeHandler *cqe_handler)
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd,
                                   uint64_t offset, QEMUIOVector *qiov,
-                                  int type, BdrvRequestFlags flags)
+                                  int type, BdrvRequestFlags flags,
+                                  bool fixed_bufs)
 {
     LuringRequest req = {
         .co         = qemu_coroutine_self(),
@@ -209,6 +250,7 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd,
         .fd         = fd,
         .offset     = offset,
         .flags      = flags,
+        .fixed_bufs = fixed_bufs,
     };
 
     req.cqe_handler.cb = luring_cqe_handler;
@@ -222,6 +264,132 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd,
     return req.ret;
 }
 
+#ifdef HAVE_NVME_URING_CMD
+static void luring_prep_nvme_sqe(struct io_uring_sqe *sqe, void *opaque)
+{
+    LuringRequest *req = opaque;
+    struct nvme_uring_cmd *cmd = (struct nvme_uring_cmd *)sqe->cmd;
+    QEMUIOVector *qiov = req->qiov;
+    uint64_t slba = req->offset >> req->lba_shift;
+    uint32_t nlb = (req->bytes >> req->lba_shift) - 1;
+
+    io_uring_prep_rw(IORING_OP_URING_CMD, sqe, req->fd, NULL, 0, 0);
+    sqe->cmd_op = NVME_URING_CMD_IO;
+
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->nsid = req->nsid;
+
+    /* The kernel converts the command dwords to little-endian */
+    switch (req->type) {
+    case QEMU_AIO_READ:
+    case QEMU_AIO_WRITE:
+        cmd->opcode = req->type == QEMU_AIO_READ ? NVME_CMD_READ :
+                                                   NVME_CMD_WRITE;
+        if (qiov->niov > 1) {
+            sqe->cmd_op = NVME_URING_CMD_IO_VEC;
+            cmd->addr = (uintptr_t)qiov->iov;
+            cmd->data_len = qiov->niov;
+        } else {
+            cmd->addr = (uintptr_t)qiov->iov->iov_base;
+            cmd->data_len = qiov->iov->iov_len;
+        }
+        cmd->cdw10 = slba;
+        cmd->cdw11 = slba >> 32;
+        cmd->cdw12 = nlb;
+        if (req->flags & BDRV_REQ_FUA) {
+            cmd->cdw12 |= 1 << 30;
+        }
+        break;
+    case QEMU_AIO_WRITE_ZEROES:
+        cmd->opcode = NVME_CMD_WRITE_ZEROES;
+        cmd->cdw10 = slba;
+        cmd->cdw11 = slba >> 32;
+        cmd->cdw12 = nlb;
+        if (req->flags & BDRV_REQ_MAY_UNMAP) {
+            /* Deallocate */
+            cmd->cdw12 |= 1 << 25;
+        }
+        break;
+    case QEMU_AIO_DISCARD:
+        req->dsm_range = (NvmeDsmRange) {
+            .nlb = cpu_to_le32(nlb + 1),
+            .slba = cpu_to_le64(slba),
+        };
+        cmd->opcode = NVME_CMD_DSM;
+        cmd->addr = (uintptr_t)&req->dsm_range;
+        cmd->data_len = sizeof(req->dsm_range);
+        cmd->cdw10 = 0; /* one range */
+        cmd->cdw11 = NVME_DSMGMT_AD;
+        break;
+    case QEMU_AIO_FLUSH:
+        cmd->opcode = NVME_CMD_FLUSH;
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
+                        __func__, req->type);
+        abort();
+    }
+}
+
+static void luring_nvme_cqe_handler(CqeHandler *cqe_handler)
+{
+    LuringRequest *req = container_of(cqe_handler, LuringRequest, cqe_handler);
+    int ret = cqe_handler->cqe.res;
+
+    trace_luring_nvme_cqe_handler(req, ret);
+
+    if ((ret == -EINTR || ret == -EAGAIN) &&
+        aio_add_cmd_sqe(luring_prep_nvme_sqe, req, &req->cqe_handler) == 0) {
+        return;
+    }
+
+    /* Positive values are NVMe status codes, commands never complete short */
+    req->ret = ret > 0 ? -EIO : ret;
+
+    /* See luring_cqe_handler() */
+    if (!qemu_coroutine_entered(req->co)) {
+        aio_co_wake(req->co);
+    }
+}
+
+int coroutine_fn luring_co_nvme_submit(BlockDriverState *bs, int fd,
+                                       uint32_t nsid, unsigned lba_shift,
+                                       uint64_t offset, uint64_t bytes,
+                                       QEMUIOVector *qiov, int type,
+                                       BdrvRequestFlags flags)
+{
+    LuringRequest req = {
+        .co         = qemu_coroutine_self(),
+        .qiov       = qiov,
+        .ret        = -EINPROGRESS,
+        .type       = type,
+        .fd         = fd,
+        .offset     = offset,
+        .flags      = flags,
+        .nsid       = nsid,
+        .lba_shift  = lba_shift,
+        .bytes      = bytes,
+    };
+    int ret;
+
+    assert(QEMU_IS_ALIGNED(offset | bytes, 1ULL << lba_shift));
+    assert(!qiov || qiov->size == bytes);
+
+    req.cqe_handler.cb = luring_nvme_cqe_handler;
+
+    trace_luring_co_nvme_submit(bs, &req, fd, nsid, offset, bytes, type);
+    ret = aio_add_cmd_sqe(luring_prep_nvme_sqe, &req, &req.cqe_handler);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (req.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return req.ret;
+}
+#endif /* HAVE_NVME_URING_CMD */
+
 bool luring_has_fua(void)
 {
 #ifdef HAVE_IO_URING_PREP_WRITEV2
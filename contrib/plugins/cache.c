@@ -25,6 +25,15 @@ static GRand *rng;
 static int limit;
 static bool sys;
 
+/*
+ * In user mode data accesses are buffered and simulated in batches, so
+ * the L2 sees them somewhat later than the instruction fetches. System
+ * mode needs the physical address of each access, which is only
+ * available while the access is in flight.
+ */
+#define MEM_BUFFER_RECORDS 1024
+static struct qemu_plugin_mem_buffer *mem_buffer;
+
 enum EvictionPolicy {
     LRU,
     FIFO,
@@ -427,6 +436,59 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
+static InsnData *insn_lookup(uint64_t addr)
+{
+    InsnData *insn;
+
+    g_mutex_lock(&hashtable_lock);
+    insn = g_hash_table_lookup(miss_ht, &addr);
+    g_mutex_unlock(&hashtable_lock);
+
+    return insn;
+}
+
+static void vcpu_mem_buffer(unsigned int vcpu_index,
+                            const qemu_plugin_mem_record *records,
+                            size_t n_records, void *userdata)
+{
+    int cache_idx = vcpu_index % cores;
+    Cache *dcache = l1_dcaches[cache_idx];
+    InsnData *insn;
+    size_t i;
+
+    g_mutex_lock(&l1_dcache_locks[cache_idx]);
+    for (i = 0; i < n_records; i++) {
+        uint64_t effective_addr = records[i].vaddr;
+
+        dcache->accesses++;
+        if (access_cache(dcache, effective_addr)) {
+            continue;
+        }
+        dcache->misses++;
+
+        /* miss_ht is keyed by vaddr in user mode */
+        insn = insn_lookup(records[i].pc);
+        if (insn) {
+            __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
+        }
+
+        if (!use_l2) {
+            continue;
+        }
+
+        g_mutex_lock(&l2_ucache_locks[cache_idx]);
+        if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
+            if (insn) {
+                __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
+            }
+            l2_ucaches[cache_idx]->misses++;
+        }
+        l2_ucaches[cache_idx]->accesses++;
+        g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    }
+    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
+}
+
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
 {
     uint64_t insn_addr;
@@ -490,9 +552,13 @@ static void vcpu_tb_trans(struct qemu_plugin_tb *tb, void *userdata)
         }
         g_mutex_unlock(&hashtable_lock);
 
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, data);
+        if (mem_buffer) {
+            qemu_plugin_register_vcpu_mem_buffer(insn, rw, mem_buffer);
+        } else {
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             rw, data);
+        }
 
         qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
                                                QEMU_PLUGIN_CB_NO_REGS, data);
@@ -696,6 +762,10 @@ finish:
 
 static void plugin_exit(void *p)
 {
+    if (mem_buffer) {
+        qemu_plugin_mem_buffer_free(mem_buffer);
+    }
+
     log_stats();
     log_top_insns();
 
@@ -844,6 +914,11 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
 
+    if (!sys) {
+        mem_buffer = qemu_plugin_mem_buffer_new(MEM_BUFFER_RECORDS,
+                                                vcpu_mem_buffer, NULL);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans, NULL);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
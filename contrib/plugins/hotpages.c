@@ -48,6 +48,13 @@ typedef struct {
 static GMutex lock;
 static GHashTable *pages;
 
+/*
+ * Without system emulation there is no hwaddr to query, so accesses
+ * can be buffered and counted in batches.
+ */
+#define MEM_BUFFER_RECORDS 1024
+static struct qemu_plugin_mem_buffer *mem_buffer;
+
 static gint cmp_access_count(gconstpointer a, gconstpointer b, gpointer d)
 {
     PageCounters *ea = (PageCounters *) a;
@@ -79,6 +86,10 @@ static void plugin_exit(void *p)
     int i;
     GList *counts;
 
+    if (mem_buffer) {
+        qemu_plugin_mem_buffer_free(mem_buffer);
+    }
+
     counts = g_hash_table_get_values(pages);
     if (counts && g_list_next(counts)) {
         GList *it;
@@ -106,12 +117,34 @@ static void plugin_init(void)
     pages = g_hash_table_new(g_int64_hash, g_int64_equal);
 }
 
+/* Account an access to @page, called with lock held */
+static void count_access(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
+                         uint64_t page)
+{
+    PageCounters *count;
+
+    page &= ~page_mask;
+    count = (PageCounters *) g_hash_table_lookup(pages, &page);
+
+    if (!count) {
+        count = g_new0(PageCounters, 1);
+        count->page_address = page;
+        g_hash_table_insert(pages, &count->page_address, count);
+    }
+    if (qemu_plugin_mem_is_store(meminfo)) {
+        count->writes++;
+        count->cpu_write |= (1 << cpu_index);
+    } else {
+        count->reads++;
+        count->cpu_read |= (1 << cpu_index);
+    }
+}
+
 static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
                        uint64_t vaddr, void *udata)
 {
     struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(meminfo, vaddr);
     uint64_t page;
-    PageCounters *count;
 
     /* We only get a hwaddr for system emulation */
     if (track_io) {
@@ -127,24 +160,22 @@ static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
             page = vaddr;
         }
     }
-    page &= ~page_mask;
 
     g_mutex_lock(&lock);
-    count = (PageCounters *) g_hash_table_lookup(pages, &page);
+    count_access(cpu_index, meminfo, page);
+    g_mutex_unlock(&lock);
+}
 
-    if (!count) {
-        count = g_new0(PageCounters, 1);
-        count->page_address = page;
-        g_hash_table_insert(pages, &count->page_address, count);
-    }
-    if (qemu_plugin_mem_is_store(meminfo)) {
-        count->writes++;
-        count->cpu_write |= (1 << cpu_index);
-    } else {
-        count->reads++;
-        count->cpu_read |= (1 << cpu_index);
-    }
+static void vcpu_mem_buffer(unsigned int cpu_index,
+                            const qemu_plugin_mem_record *records,
+                            size_t n_records, void *udata)
+{
+    size_t i;
 
+    g_mutex_lock(&lock);
+    for (i = 0; i < n_records; i++) {
+        count_access(cpu_index, records[i].info, records[i].vaddr);
+    }
     g_mutex_unlock(&lock);
 }
 
@@ -155,9 +186,14 @@ static void vcpu_tb_trans(struct qemu_plugin_tb *tb, void *userdata)
 
     for (i = 0; i < n; i++) {
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_haddr,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, NULL);
+
+        if (mem_buffer) {
+            qemu_plugin_register_vcpu_mem_buffer(insn, rw, mem_buffer);
+        } else {
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_haddr,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             rw, NULL);
+        }
     }
 }
 
@@ -197,6 +233,12 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
 
     plugin_init();
 
+    /* with io=on only system emulation records anything */
+    if (!info->system_emulation && !track_io) {
+        mem_buffer = qemu_plugin_mem_buffer_new(MEM_BUFFER_RECORDS,
+                                                vcpu_mem_buffer, NULL);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans, NULL);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
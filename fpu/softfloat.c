@@ -119,6 +119,11 @@ this code that are retained.
  * This is particularly useful for the inexact flag, which is very frequently
  * raised in floating-point workloads.
  *
+ * Some guests clear the flags very often though, e.g. on every save and
+ * restore of the FP status register.  For add, sub, mul, div and sqrt we
+ * therefore also use the host FPU when the inexact flag is not set, and
+ * raise it ourselves after a cheap check that the host result is exact.
+ *
  * We optimize the code further by deferring to soft-fp whenever FP exception
  * detection might get hairy. Two examples: (1) when at least one operand is
  * denormal/inf/NaN; (2) when operands are not guaranteed to lead to a 0 result
@@ -213,11 +218,6 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
 # define QEMU_HARDFLOAT_USE_ISINF   0
 #endif
 
-/*
- * Some targets clear the FP flags before most FP operations. This prevents
- * the use of hardfloat, since hardfloat relies on the inexact flag being
- * already set.
- */
 # if defined(__FAST_MATH__)
 #  warning disabling hardfloat due to -ffast-math: hardfloat requires an exact \
     IEEE implementation
@@ -228,13 +228,26 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
 # define QEMU_SOFTFLOAT_ATTR QEMU_FLATTEN __attribute__((noinline))
 #endif
 
-static inline bool can_use_fpu(const float_status *s)
+/*
+ * Whether the host FPU can be used by an operation that raises the
+ * inexact flag itself, after checking that the host result is exact.
+ */
+static inline bool can_use_fpu_any_flags(const float_status *s)
 {
     if (QEMU_NO_HARDFLOAT) {
         return false;
     }
-    return likely(s->float_exception_flags & float_flag_inexact &&
-                  get_float_rounding_mode(s) == float_round_nearest_even);
+    return likely(get_float_rounding_mode(s) == float_round_nearest_even);
+}
+
+/*
+ * Whether the host FPU can be used by any other operation, which relies
+ * on the inexact flag being already set.
+ */
+static inline bool can_use_fpu(const float_status *s)
+{
+    return likely(s->float_exception_flags & float_flag_inexact) &&
+           can_use_fpu_any_flags(s);
 }
 
 /*
@@ -261,6 +274,10 @@ typedef union {
 
 typedef bool (*f32_check_fn)(union_float32 a, union_float32 b);
 typedef bool (*f64_check_fn)(union_float64 a, union_float64 b);
+typedef bool (*f32_exact_fn)(union_float32 a, union_float32 b,
+                             union_float32 r);
+typedef bool (*f64_exact_fn)(union_float64 a, union_float64 b,
+                             union_float64 r);
 
 typedef float32 (*soft_f32_op2_fn)(float32 a, float32 b, float_status *s);
 typedef float64 (*soft_f64_op2_fn)(float64 a, float64 b, float_status *s);
@@ -335,17 +352,77 @@ static inline bool f64_is_inf(union_float64 a)
     return float64_is_infinity(a.s);
 }
 
+/*
+ * Exactness checks for the host result @r of an operation on zero or
+ * normal inputs, where @r is zero or normal as well.
+ *
+ * A sum is exact iff the rounding error found by Fast2Sum is zero: with
+ * |a| >= |b| and rounding to nearest, r - a is computed exactly, and the
+ * error is b - (r - a).
+ *
+ * A product, quotient or square root is exact iff the odd parts of the
+ * significands satisfy r = a * b, a = r * b or a = r * r respectively.
+ * The exponents cannot then disagree, as @r is within half an ulp of the
+ * exact result.
+ */
+static inline uint64_t f32_sig_odd(union_float32 a)
+{
+    uint32_t m = deposit32(float32_val(a.s), 23, 9, 1);
+
+    return m >> ctz32(m);
+}
+
+static inline uint64_t f64_sig_odd(union_float64 a)
+{
+    uint64_t m = deposit64(float64_val(a.s), 52, 12, 1);
+
+    return m >> ctz64(m);
+}
+
+static inline bool f32_sig_odd_mul_eq(union_float32 a, union_float32 b,
+                                      union_float32 c)
+{
+    return f32_sig_odd(a) * f32_sig_odd(b) == f32_sig_odd(c);
+}
+
+static inline bool f64_sig_odd_mul_eq(union_float64 a, union_float64 b,
+                                      union_float64 c)
+{
+    uint64_t lo, hi;
+
+    mulu64(&lo, &hi, f64_sig_odd(a), f64_sig_odd(b));
+    return hi == 0 && lo == f64_sig_odd(c);
+}
+
+static inline bool f32_add_exact(union_float32 a, union_float32 b,
+                                 union_float32 r)
+{
+    if (fabsf(a.h) < fabsf(b.h)) {
+        return r.h - b.h == a.h;
+    }
+    return r.h - a.h == b.h;
+}
+
+static inline bool f64_add_exact(union_float64 a, union_float64 b,
+                                 union_float64 r)
+{
+    if (fabs(a.h) < fabs(b.h)) {
+        return r.h - b.h == a.h;
+    }
+    return r.h - a.h == b.h;
+}
+
 static inline float32
 float32_gen2(float32 xa, float32 xb, float_status *s,
              hard_f32_op2_fn hard, soft_f32_op2_fn soft,
-             f32_check_fn pre, f32_check_fn post)
+             f32_check_fn pre, f32_check_fn post, f32_exact_fn exact)
 {
     union_float32 ua, ub, ur;
 
     ua.s = xa;
     ub.s = xb;
 
-    if (unlikely(!can_use_fpu(s))) {
+    if (unlikely(!can_use_fpu_any_flags(s))) {
         goto soft;
     }
 
@@ -356,9 +433,12 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
 
     ur.h = hard(ua.h, ub.h);
     if (unlikely(f32_is_inf(ur))) {
-        float_raise(float_flag_overflow, s);
+        float_raise(float_flag_overflow | float_flag_inexact, s);
     } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && post(ua, ub)) {
         goto soft;
+    } else if (!(s->float_exception_flags & float_flag_inexact) &&
+               !exact(ua, ub, ur)) {
+        float_raise(float_flag_inexact, s);
     }
     return ur.s;
 
@@ -369,14 +449,14 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
 static inline float64
 float64_gen2(float64 xa, float64 xb, float_status *s,
              hard_f64_op2_fn hard, soft_f64_op2_fn soft,
-             f64_check_fn pre, f64_check_fn post)
+             f64_check_fn pre, f64_check_fn post, f64_exact_fn exact)
 {
     union_float64 ua, ub, ur;
 
     ua.s = xa;
     ub.s = xb;
 
-    if (unlikely(!can_use_fpu(s))) {
+    if (unlikely(!can_use_fpu_any_flags(s))) {
         goto soft;
     }
 
@@ -387,9 +467,12 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
 
     ur.h = hard(ua.h, ub.h);
     if (unlikely(f64_is_inf(ur))) {
-        float_raise(float_flag_overflow, s);
+        float_raise(float_flag_overflow | float_flag_inexact, s);
     } else if (unlikely(fabs(ur.h) <= DBL_MIN) && post(ua, ub)) {
         goto soft;
+    } else if (!(s->float_exception_flags & float_flag_inexact) &&
+               !exact(ua, ub, ur)) {
+        float_raise(float_flag_inexact, s);
     }
     return ur.s;
 
@@ -1690,42 +1773,60 @@ static bool f64_addsubmul_post(union_float64 a, union_float64 b)
     }
 }
 
+static bool f32_sub_exact(union_float32 a, union_float32 b, union_float32 r)
+{
+    b.h = -b.h;
+    return f32_add_exact(a, b, r);
+}
+
+static bool f64_sub_exact(union_float64 a, union_float64 b, union_float64 r)
+{
+    b.h = -b.h;
+    return f64_add_exact(a, b, r);
+}
+
 static float32 float32_addsub(float32 a, float32 b, float_status *s,
-                              hard_f32_op2_fn hard, soft_f32_op2_fn soft)
+                              hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                              f32_exact_fn exact)
 {
     return float32_gen2(a, b, s, hard, soft,
-                        f32_is_zon2, f32_addsubmul_post);
+                        f32_is_zon2, f32_addsubmul_post, exact);
 }
 
 static float64 float64_addsub(float64 a, float64 b, float_status *s,
-                              hard_f64_op2_fn hard, soft_f64_op2_fn soft)
+                              hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                              f64_exact_fn exact)
 {
     return float64_gen2(a, b, s, hard, soft,
-                        f64_is_zon2, f64_addsubmul_post);
+                        f64_is_zon2, f64_addsubmul_post, exact);
 }
 
 float32 QEMU_FLATTEN
 float32_add(float32 a, float32 b, float_status *s)
 {
-    return float32_addsub(a, b, s, hard_f32_add, soft_f32_add);
+    return float32_addsub(a, b, s, hard_f32_add, soft_f32_add,
+                          f32_add_exact);
 }
 
 float32 QEMU_FLATTEN
 float32_sub(float32 a, float32 b, float_status *s)
 {
-    return float32_addsub(a, b, s, hard_f32_sub, soft_f32_sub);
+    return float32_addsub(a, b, s, hard_f32_sub, soft_f32_sub,
+                          f32_sub_exact);
 }
 
 float64 QEMU_FLATTEN
 float64_add(float64 a, float64 b, float_status *s)
 {
-    return float64_addsub(a, b, s, hard_f64_add, soft_f64_add);
+    return float64_addsub(a, b, s, hard_f64_add, soft_f64_add,
+                          f64_add_exact);
 }
 
 float64 QEMU_FLATTEN
 float64_sub(float64 a, float64 b, float_status *s)
 {
-    return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub);
+    return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub,
+                          f64_sub_exact);
 }
 
 static float64 float64r32_addsub(float64 a, float64 b, float_status *status,
@@ -1855,18 +1956,28 @@ static double hard_f64_mul(double a, double b)
     return a * b;
 }
 
+static bool f32_mul_exact(union_float32 a, union_float32 b, union_float32 r)
+{
+    return float32_is_zero(r.s) || f32_sig_odd_mul_eq(a, b, r);
+}
+
+static bool f64_mul_exact(union_float64 a, union_float64 b, union_float64 r)
+{
+    return float64_is_zero(r.s) || f64_sig_odd_mul_eq(a, b, r);
+}
+
 float32 QEMU_FLATTEN
 float32_mul(float32 a, float32 b, float_status *s)
 {
     return float32_gen2(a, b, s, hard_f32_mul, soft_f32_mul,
-                        f32_is_zon2, f32_addsubmul_post);
+                        f32_is_zon2, f32_addsubmul_post, f32_mul_exact);
 }
 
 float64 QEMU_FLATTEN
 float64_mul(float64 a, float64 b, float_status *s)
 {
     return float64_gen2(a, b, s, hard_f64_mul, soft_f64_mul,
-                        f64_is_zon2, f64_addsubmul_post);
+                        f64_is_zon2, f64_addsubmul_post, f64_mul_exact);
 }
 
 float64 float64r32_mul(float64 a, float64 b, float_status *status)
@@ -2250,18 +2361,28 @@ static bool f64_div_post(union_float64 a, union_float64 b)
     return !float64_is_zero(a.s);
 }
 
+static bool f32_div_exact(union_float32 a, union_float32 b, union_float32 r)
+{
+    return float32_is_zero(r.s) || f32_sig_odd_mul_eq(r, b, a);
+}
+
+static bool f64_div_exact(union_float64 a, union_float64 b, union_float64 r)
+{
+    return float64_is_zero(r.s) || f64_sig_odd_mul_eq(r, b, a);
+}
+
 float32 QEMU_FLATTEN
 float32_div(float32 a, float32 b, float_status *s)
 {
     return float32_gen2(a, b, s, hard_f32_div, soft_f32_div,
-                        f32_div_pre, f32_div_post);
+                        f32_div_pre, f32_div_post, f32_div_exact);
 }
 
 float64 QEMU_FLATTEN
 float64_div(float64 a, float64 b, float_status *s)
 {
     return float64_gen2(a, b, s, hard_f64_div, soft_f64_div,
-                        f64_div_pre, f64_div_post);
+                        f64_div_pre, f64_div_post, f64_div_exact);
 }
 
 float64 float64r32_div(float64 a, float64 b, float_status *status)
@@ -4385,7 +4506,7 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
     union_float32 ua, ur;
 
     ua.s = xa;
-    if (unlikely(!can_use_fpu(s))) {
+    if (unlikely(!can_use_fpu_any_flags(s))) {
         goto soft;
     }
 
@@ -4401,6 +4522,10 @@ float32 QEMU_FLATTEN float32_sqrt(float32 xa, float_status *s)
         goto soft;
     }
     ur.h = sqrtf(ua.h);
+    if (!(s->float_exception_flags & float_flag_inexact) &&
+        !float32_is_zero(ur.s) && !f32_sig_odd_mul_eq(ur, ur, ua)) {
+        float_raise(float_flag_inexact, s);
+    }
     return ur.s;
 
  soft:
@@ -4412,7 +4537,7 @@ float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
     union_float64 ua, ur;
 
     ua.s = xa;
-    if (unlikely(!can_use_fpu(s))) {
+    if (unlikely(!can_use_fpu_any_flags(s))) {
         goto soft;
     }
 
@@ -4428,6 +4553,10 @@ float64 QEMU_FLATTEN float64_sqrt(float64 xa, float_status *s)
         goto soft;
     }
     ur.h = sqrt(ua.h);
+    if (!(s->float_exception_flags & float_flag_inexact) &&
+        !float64_is_zero(ur.s) && !f64_sig_odd_mul_eq(ur, ur, ua)) {
+        float_raise(float_flag_inexact, s);
+    }
     return ur.s;
 
  soft:
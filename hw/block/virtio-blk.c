@@ -41,6 +41,12 @@
 /* Internal buffer size limit for zone report */
 #define VIRTIO_BLK_MAX_ZONES_PER_BATCH 4096
 
+/* Requests popped at once by virtio_blk_handle_vq() */
+#define VIRTIO_BLK_POP_BATCH 32
+
+/* Longest descriptor chain whose request is recycled by the element pool */
+#define VIRTIO_BLK_POOL_SG_MAX 16
+
 static void virtio_blk_ioeventfd_attach(VirtIOBlock *s);
 
 static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
@@ -54,6 +60,14 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
     req->mr_next = NULL;
 }
 
+void virtio_blk_free_request(VirtIOBlockReq *req)
+{
+    VirtIOBlock *s = req->dev;
+
+    virtqueue_element_pool_put(&s->vq_pools[virtio_get_queue_index(req->vq)],
+                               &req->elem);
+}
+
 void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
@@ -88,7 +102,7 @@ static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
         if (acct_failed) {
             block_acct_failed(blk_get_stats(s->blk), &req->acct);
         }
-        g_free(req);
+        virtio_blk_free_request(req);
     }
 
     blk_error_action(s->blk, action, is_read, error);
@@ -131,7 +145,7 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
 
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
         block_acct_done(blk_get_stats(s->blk), &req->acct);
-        g_free(req);
+        virtio_blk_free_request(req);
     }
 }
 
@@ -146,7 +160,7 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
 
     virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     block_acct_done(blk_get_stats(s->blk), &req->acct);
-    g_free(req);
+    virtio_blk_free_request(req);
 }
 
 static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
@@ -164,17 +178,7 @@ static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
     if (is_write_zeroes) {
         block_acct_done(blk_get_stats(s->blk), &req->acct);
     }
-    g_free(req);
-}
-
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
-{
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
-
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
-    }
-    return req;
+    virtio_blk_free_request(req);
 }
 
 static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
@@ -215,7 +219,7 @@ static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
 
 fail:
     virtio_blk_req_complete(req, status);
-    g_free(req);
+    virtio_blk_free_request(req);
 }
 
 static inline void submit_requests(VirtIOBlock *s, MultiReqBuffer *mrb,
@@ -638,7 +642,7 @@ static void virtio_blk_zone_report_complete(void *opaque, int ret)
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtio_blk_free_request(req);
     g_free(zrd->zones);
     g_free(data);
 }
@@ -693,7 +697,7 @@ static void virtio_blk_handle_zone_report(VirtIOBlockReq *req,
     return;
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtio_blk_free_request(req);
 }
 
 static void virtio_blk_zone_mgmt_complete(void *opaque, int ret)
@@ -709,7 +713,7 @@ static void virtio_blk_zone_mgmt_complete(void *opaque, int ret)
     }
 
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtio_blk_free_request(req);
 }
 
 static int virtio_blk_handle_zone_mgmt(VirtIOBlockReq *req, BlockZoneOp op)
@@ -751,7 +755,7 @@ static int virtio_blk_handle_zone_mgmt(VirtIOBlockReq *req, BlockZoneOp op)
     return 0;
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtio_blk_free_request(req);
     return err_status;
 }
 
@@ -782,7 +786,7 @@ static void virtio_blk_zone_append_complete(void *opaque, int ret)
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtio_blk_free_request(req);
     g_free(data);
 }
 
@@ -820,7 +824,7 @@ static int virtio_blk_handle_zone_append(VirtIOBlockReq *req,
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtio_blk_free_request(req);
     return err_status;
 }
 
@@ -887,7 +891,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
             virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
             block_acct_invalid(blk_get_stats(s->blk),
                                is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
-            g_free(req);
+            virtio_blk_free_request(req);
             return 0;
         }
 
@@ -943,7 +947,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                               VIRTIO_BLK_ID_BYTES));
         iov_from_buf(in_iov, in_num, 0, serial, size);
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-        g_free(req);
+        virtio_blk_free_request(req);
         break;
     }
     case VIRTIO_BLK_T_ZONE_APPEND & ~VIRTIO_BLK_T_OUT:
@@ -975,7 +979,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         if (unlikely(!(type & VIRTIO_BLK_T_OUT) ||
                      out_len > sizeof(dwz_hdr))) {
             virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-            g_free(req);
+            virtio_blk_free_request(req);
             return 0;
         }
 
@@ -992,7 +996,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                                                             is_write_zeroes);
         if (err_status != VIRTIO_BLK_S_OK) {
             virtio_blk_req_complete(req, err_status);
-            g_free(req);
+            virtio_blk_free_request(req);
         }
 
         break;
@@ -1007,7 +1011,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         if (!vbk->handle_unknown_request ||
             !vbk->handle_unknown_request(req, mrb, type)) {
             virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-            g_free(req);
+            virtio_blk_free_request(req);
         }
     }
     }
@@ -1016,9 +1020,12 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtQueueElementPool *pool = &s->vq_pools[virtio_get_queue_index(vq)];
+    VirtQueueElement *elems[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, num;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
+    bool broken = false;
 
     defer_call_begin();
 
@@ -1027,11 +1034,20 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                g_free(req);
-                break;
+        while (!broken &&
+               (num = virtqueue_pop_batch(vq, pool, elems,
+                                          ARRAY_SIZE(elems)))) {
+            for (i = 0; i < num; i++) {
+                VirtIOBlockReq *req = container_of(elems[i], VirtIOBlockReq,
+                                                   elem);
+
+                virtio_blk_init_request(s, vq, req);
+                if (broken || virtio_blk_handle_request(req, &mrb)) {
+                    /* The device is broken, drop the rest of the batch */
+                    virtqueue_detach_element(req->vq, &req->elem, 0);
+                    virtio_blk_free_request(req);
+                    broken = true;
+                }
             }
         }
 
@@ -1080,7 +1096,7 @@ static void virtio_blk_dma_restart_bh(void *opaque)
             while (req) {
                 next = req->next;
                 virtqueue_detach_element(req->vq, &req->elem, 0);
-                g_free(req);
+                virtio_blk_free_request(req);
                 req = next;
             }
             break;
@@ -1163,7 +1179,7 @@ static void virtio_blk_reset(VirtIODevice *vdev)
             /* No other threads can access req->vq here */
             virtqueue_detach_element(req->vq, &req->elem, 0);
 
-            g_free(req);
+            virtio_blk_free_request(req);
         }
     }
 
@@ -1814,8 +1830,11 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     s->rq = NULL;
     s->sector_mask = (s->conf.conf.logical_block_size / BDRV_SECTOR_SIZE) - 1;
 
+    s->vq_pools = g_new(VirtQueueElementPool, conf->num_queues);
     for (i = 0; i < conf->num_queues; i++) {
         virtio_add_queue(vdev, conf->queue_size, virtio_blk_handle_output);
+        virtqueue_element_pool_init(&s->vq_pools[i], sizeof(VirtIOBlockReq),
+                                    conf->queue_size, VIRTIO_BLK_POOL_SG_MAX);
     }
     qemu_coroutine_inc_pool_size(conf->num_queues * conf->queue_size / 2);
 
@@ -1829,7 +1848,10 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         error_propagate(errp, err);
         for (i = 0; i < conf->num_queues; i++) {
             virtio_del_queue(vdev, i);
+            virtqueue_element_pool_destroy(&s->vq_pools[i]);
         }
+        g_free(s->vq_pools);
+        s->vq_pools = NULL;
         virtio_cleanup(vdev);
         return;
     }
@@ -1864,7 +1886,10 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     virtio_blk_vq_aio_context_cleanup(s);
     for (i = 0; i < conf->num_queues; i++) {
         virtio_del_queue(vdev, i);
+        virtqueue_element_pool_destroy(&s->vq_pools[i]);
     }
+    g_free(s->vq_pools);
+    s->vq_pools = NULL;
     qemu_coroutine_dec_pool_size(conf->num_queues * conf->queue_size / 2);
     qemu_mutex_destroy(&s->rq_lock);
     blk_ram_registrar_destroy(&s->blk_ram_registrar);
@@ -118,6 +118,7 @@ static void cpu_common_reset_hold(Object *obj, ResetType type)
     cpu->exception_index = -1;
     cpu->crash_occurred = false;
     cpu->cflags_next_tb = -1;
+    cpu->tb_hot = NULL;
 
     cpu_exec_reset_hold(cpu);
 }
@@ -41,11 +41,13 @@
 #include "qemu/module.h"
 #include "qemu/range.h"
 #include "system/system.h"
+#include "system/iothread.h"
 #include "hw/core/hw-error.h"
 #include "hw/net/mii.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "hw/core/qdev-properties.h"
+#include "migration/blocker.h"
 #include "migration/vmstate.h"
 
 #include "e1000_common.h"
@@ -82,6 +84,15 @@ struct E1000EState {
     E1000ECore core;
     bool init_vet;
     bool timadj;
+
+    IOThread *iothread;
+    Error *migration_blocker;
+    /*
+     * The net layer marks the NIC as busy while delivering packets, which
+     * happens concurrently with MMIO when the receive path runs in the
+     * IOThread.
+     */
+    MemReentrancyGuard nic_reentrancy_guard;
 };
 
 #define E1000E_MMIO_IDX     0
@@ -266,6 +277,7 @@ static void e1000e_core_realize(E1000EState *s)
 {
     s->core.owner = &s->parent_obj;
     s->core.owner_nic = s->nic;
+    s->core.ctx = s->iothread ? iothread_get_aio_context(s->iothread) : NULL;
 }
 
 static void
@@ -320,7 +332,9 @@ e1000e_init_net_peer(E1000EState *s, PCIDevice *pci_dev, uint8_t *macaddr)
     int i;
 
     s->nic = qemu_new_nic(&net_e1000e_info, &s->conf,
-        object_get_typename(OBJECT(s)), dev->id, &dev->mem_reentrancy_guard, s);
+        object_get_typename(OBJECT(s)), dev->id,
+        s->iothread ? &s->nic_reentrancy_guard : &dev->mem_reentrancy_guard,
+        s);
 
     s->core.max_queue_num = s->conf.peers.queues ? s->conf.peers.queues - 1 : 0;
 
@@ -407,6 +421,36 @@ static void e1000e_write_config(PCIDevice *pci_dev, uint32_t address,
     }
 }
 
+static bool e1000e_iothread_init(E1000EState *s, Error **errp)
+{
+    int i;
+
+    if (!s->iothread) {
+        return true;
+    }
+
+    for (i = 0; i < s->conf.peers.queues; i++) {
+        NetClientState *peer = s->conf.peers.ncs[i];
+
+        if (!peer) {
+            continue;
+        }
+        if (!qemu_has_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' does not support iothread",
+                       peer->name);
+            return false;
+        }
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            error_setg(errp, "iothread is not supported with netdev filters");
+            return false;
+        }
+    }
+
+    error_setg(&s->migration_blocker,
+               "e1000e does not support migration with iothread");
+    return migrate_add_blocker(&s->migration_blocker, errp) >= 0;
+}
+
 static void e1000e_pci_realize(PCIDevice *pci_dev, Error **errp)
 {
     static const uint16_t e1000e_pmrb_offset = 0x0C8;
@@ -419,6 +463,12 @@ static void e1000e_pci_realize(PCIDevice *pci_dev, Error **errp)
 
     trace_e1000e_cb_pci_realize();
 
+    if (!e1000e_iothread_init(s, errp)) {
+        return;
+    }
+
+    qemu_rec_mutex_init(&s->core.lock);
+
     pci_dev->config_write = e1000e_write_config;
 
     pci_dev->config[PCI_CACHE_LINE_SIZE] = 0x10;
@@ -509,6 +559,9 @@ static void e1000e_pci_uninit(PCIDevice *pci_dev)
 
     e1000e_cleanup_msix(s);
     msi_uninit(pci_dev);
+
+    qemu_rec_mutex_destroy(&s->core.lock);
+    migrate_del_blocker(&s->migration_blocker);
 }
 
 static void e1000e_qdev_reset_hold(Object *obj, ResetType type)
@@ -671,6 +724,8 @@ static const Property e1000e_properties[] = {
                         e1000e_prop_subsys, uint16_t),
     DEFINE_PROP_BOOL("init-vet", E1000EState, init_vet, true),
     DEFINE_PROP_BOOL("migrate-timadj", E1000EState, timadj, true),
+    DEFINE_PROP_LINK("iothread", E1000EState, iothread, TYPE_IOTHREAD,
+                     IOThread *),
 };
 
 static void e1000e_class_init(ObjectClass *class, const void *data)
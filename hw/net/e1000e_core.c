@@ -35,6 +35,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/log.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
+#include "qemu/aio-wait.h"
 #include "net/net.h"
 #include "net/tap.h"
 #include "hw/net/mii.h"
@@ -87,19 +90,114 @@ e1000e_process_snap_option(E1000ECore *core, uint32_t cmd_and_length)
     }
 }
 
+/*
+ * Interrupts raised in the IOThread, i.e. without the BQL, are recorded
+ * in core->irq_pending and delivered by e1000e_irq_bh().  Bits below
+ * E1000E_MSIX_VEC_NUM are MSI-X vectors.
+ */
+#define E1000E_IRQ_PENDING_MSI      BIT(30)
+#define E1000E_IRQ_PENDING_LEVEL    BIT(31)
+
+static void
+e1000e_defer_irq(E1000ECore *core, uint32_t pending)
+{
+    core->irq_pending |= pending;
+    qemu_bh_schedule(core->irq_bh);
+}
+
+static void
+e1000e_set_irq_level(E1000ECore *core, int level)
+{
+    if (!bql_locked()) {
+        core->irq_level = level;
+        e1000e_defer_irq(core, E1000E_IRQ_PENDING_LEVEL);
+        return;
+    }
+
+    /* Do not let a stale level from the IOThread override this one */
+    core->irq_pending &= ~E1000E_IRQ_PENDING_LEVEL;
+    pci_set_irq(core->owner, level);
+}
+
 static inline void
 e1000e_raise_legacy_irq(E1000ECore *core)
 {
     trace_e1000e_irq_legacy_notify(true);
     e1000x_inc_reg_if_not_full(core->mac, IAC);
-    pci_set_irq(core->owner, 1);
+    e1000e_set_irq_level(core, 1);
 }
 
 static inline void
 e1000e_lower_legacy_irq(E1000ECore *core)
 {
     trace_e1000e_irq_legacy_notify(false);
-    pci_set_irq(core->owner, 0);
+    e1000e_set_irq_level(core, 0);
+}
+
+static void
+e1000e_msi_notify(E1000ECore *core)
+{
+    if (!bql_locked()) {
+        e1000e_defer_irq(core, E1000E_IRQ_PENDING_MSI);
+        return;
+    }
+
+    msi_notify(core->owner, 0);
+}
+
+static void
+e1000e_msix_send(E1000ECore *core, unsigned int vector)
+{
+    if (!bql_locked()) {
+        e1000e_defer_irq(core, BIT(vector));
+        return;
+    }
+
+    msix_notify(core->owner, vector);
+}
+
+/* Context: BH in the main loop */
+static void
+e1000e_irq_bh(void *opaque)
+{
+    E1000ECore *core = opaque;
+    uint32_t pending;
+    unsigned int vector;
+
+    QEMU_LOCK_GUARD(&core->lock);
+
+    pending = core->irq_pending;
+    core->irq_pending = 0;
+
+    for (vector = 0; vector < E1000E_MSIX_VEC_NUM; vector++) {
+        if (pending & BIT(vector)) {
+            msix_notify(core->owner, vector);
+        }
+    }
+
+    if (pending & E1000E_IRQ_PENDING_MSI) {
+        msi_notify(core->owner, 0);
+    }
+
+    if (pending & E1000E_IRQ_PENDING_LEVEL) {
+        pci_set_irq(core->owner, core->irq_level);
+    }
+}
+
+static inline void
+e1000e_dma_read(E1000ECore *core, dma_addr_t addr, void *buf,
+                dma_addr_t len)
+{
+    pci_dma_rw(core->owner, addr, buf, len, DMA_DIRECTION_TO_DEVICE,
+               core->dma_attrs);
+}
+
+static inline void
+e1000e_dma_write(E1000ECore *core, dma_addr_t addr, const void *buf,
+                 dma_addr_t len)
+{
+    pci_dma_rw(core->owner, addr, (void *)buf, len,
+               DMA_DIRECTION_FROM_DEVICE, core->dma_attrs);
 }
 
 static inline void
@@ -144,6 +242,8 @@ e1000e_intrmgr_on_timer(void *opaque)
 {
     E1000IntrDelayTimer *timer = opaque;
 
+    QEMU_LOCK_GUARD(&timer->core->lock);
+
     trace_e1000e_irq_throttling_timer(timer->delay_reg << 2);
 
     timer->running = false;
@@ -155,6 +255,8 @@ e1000e_intrmgr_on_throttling_timer(void *opaque)
 {
     E1000IntrDelayTimer *timer = opaque;
 
+    QEMU_LOCK_GUARD(&timer->core->lock);
+
     timer->running = false;
 
     if (timer->core->mac[IMS] & timer->core->mac[ICR]) {
@@ -174,6 +276,8 @@ e1000e_intrmgr_on_msix_throttling_timer(void *opaque)
     E1000IntrDelayTimer *timer = opaque;
     int idx = timer - &timer->core->eitr[0];
 
+    QEMU_LOCK_GUARD(&timer->core->lock);
+
     timer->running = false;
 
     trace_e1000e_irq_msix_notify_postponed_vec(idx);
@@ -710,8 +814,9 @@ e1000e_process_tx_desc(E1000ECore *core,
     addr = le64_to_cpu(dp->buffer_addr);
 
     if (!tx->skip_cp) {
-        if (!net_tx_pkt_add_raw_fragment_pci(tx->tx_pkt, core->owner,
-                                             addr, split_size)) {
+        if (!net_tx_pkt_add_raw_fragment_pci_attrs(tx->tx_pkt, core->owner,
+                                                   addr, split_size,
+                                                   core->dma_attrs)) {
             tx->skip_cp = true;
         }
     }
@@ -773,8 +878,8 @@ e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
     txd_upper = le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD;
 
     dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(core->owner, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
+    e1000e_dma_write(core, base + ((char *)&dp->upper - (char *)dp),
+                     &dp->upper, sizeof(dp->upper));
     return e1000e_tx_wb_interrupt_cause(core, queue_idx);
 }
 
@@ -908,7 +1013,7 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
     while (!e1000e_ring_empty(core, txi)) {
         base = e1000e_ring_head_descr(core, txi);
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
+        e1000e_dma_read(core, base, &desc, sizeof(desc));
 
         trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
                               desc.lower.data, desc.upper.data);
@@ -926,6 +1031,42 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
     net_tx_pkt_reset(txr->tx->tx_pkt, net_tx_pkt_unmap_frag_pci, core->owner);
 }
 
+/* Context: BH in core->ctx */
+static void
+e1000e_tx_bh(void *opaque)
+{
+    struct e1000e_tx *tx = opaque;
+    E1000ECore *core = tx->core;
+    int qidx = tx - core->tx;
+    E1000E_TxRing txr;
+
+    /* The rings are kicked again by e1000e_vm_state_change() */
+    if (!runstate_is_running()) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&core->lock);
+
+    if (core->mac[qidx == 0 ? TARC0 : TARC1] & E1000_TARC_ENABLE) {
+        e1000e_tx_ring_init(core, &txr, qidx);
+        e1000e_start_xmit(core, &txr);
+    }
+}
+
+static void
+e1000e_kick_tx(E1000ECore *core, int qidx)
+{
+    E1000E_TxRing txr;
+
+    if (core->ctx) {
+        qemu_bh_schedule(core->tx[qidx].bh);
+        return;
+    }
+
+    e1000e_tx_ring_init(core, &txr, qidx);
+    e1000e_start_xmit(core, &txr);
+}
+
 static bool
 e1000e_has_rxbufs(E1000ECore *core, const E1000ERingInfo *r,
                   size_t total_size)
@@ -946,16 +1087,31 @@ e1000e_start_recv(E1000ECore *core)
 
     trace_e1000e_rx_start_recv();
 
+    /* The queues belong to the IOThread */
+    if (core->ctx && qemu_get_current_aio_context() != core->ctx) {
+        qemu_bh_schedule(core->rx_bh);
+        return;
+    }
+
     for (i = 0; i <= core->max_queue_num; i++) {
         qemu_flush_queued_packets(qemu_get_subqueue(core->owner_nic, i));
     }
 }
 
+/* Context: BH in core->ctx */
+static void
+e1000e_rx_bh(void *opaque)
+{
+    e1000e_start_recv(opaque);
+}
+
 bool
 e1000e_can_receive(E1000ECore *core)
 {
     int i;
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     if (!e1000x_rx_ready(core->owner, core->mac)) {
         return false;
     }
@@ -1319,19 +1475,17 @@ static inline void
 e1000e_pci_dma_write_rx_desc(E1000ECore *core, dma_addr_t addr,
                              union e1000_rx_desc_union *desc, dma_addr_t len)
 {
-    PCIDevice *dev = core->owner;
-
     if (e1000e_rx_use_legacy_descriptor(core)) {
         struct e1000_rx_desc *d = &desc->legacy;
         size_t offset = offsetof(struct e1000_rx_desc, status);
         uint8_t status = d->status;
 
         d->status &= ~E1000_RXD_STAT_DD;
-        pci_dma_write(dev, addr, desc, len);
+        e1000e_dma_write(core, addr, desc, len);
 
         if (status & E1000_RXD_STAT_DD) {
             d->status = status;
-            pci_dma_write(dev, addr + offset, &status, sizeof(status));
+            e1000e_dma_write(core, addr + offset, &status, sizeof(status));
         }
     } else {
         if (core->mac[RCTL] & E1000_RCTL_DTYP_PS) {
@@ -1341,11 +1495,11 @@ e1000e_pci_dma_write_rx_desc(E1000ECore *core, dma_addr_t addr,
             uint32_t status = d->wb.middle.status_error;
 
             d->wb.middle.status_error &= ~E1000_RXD_STAT_DD;
-            pci_dma_write(dev, addr, desc, len);
+            e1000e_dma_write(core, addr, desc, len);
 
             if (status & E1000_RXD_STAT_DD) {
                 d->wb.middle.status_error = status;
-                pci_dma_write(dev, addr + offset, &status, sizeof(status));
+                e1000e_dma_write(core, addr + offset, &status, sizeof(status));
             }
         } else {
             union e1000_rx_desc_extended *d = &desc->extended;
@@ -1354,11 +1508,11 @@ e1000e_pci_dma_write_rx_desc(E1000ECore *core, dma_addr_t addr,
             uint32_t status = d->wb.upper.status_error;
 
             d->wb.upper.status_error &= ~E1000_RXD_STAT_DD;
-            pci_dma_write(dev, addr, desc, len);
+            e1000e_dma_write(core, addr, desc, len);
 
             if (status & E1000_RXD_STAT_DD) {
                 d->wb.upper.status_error = status;
-                pci_dma_write(dev, addr + offset, &status, sizeof(status));
+                e1000e_dma_write(core, addr + offset, &status, sizeof(status));
             }
         }
     }
@@ -1378,7 +1532,7 @@ e1000e_write_hdr_frag_to_rx_buffers(E1000ECore *core,
 {
     assert(data_len <= core->rxbuf_sizes[0] - bastate->written[0]);
 
-    pci_dma_write(core->owner, ba[0] + bastate->written[0], data, data_len);
+    e1000e_dma_write(core, ba[0] + bastate->written[0], data, data_len);
     bastate->written[0] += data_len;
 
     bastate->cur_idx = 1;
@@ -1406,7 +1560,7 @@ e1000e_write_payload_frag_to_rx_buffers(E1000ECore *core,
                                         data,
                                         bytes_to_write);
 
-        pci_dma_write(core->owner,
+        e1000e_dma_write(core,
             ba[bastate->cur_idx] + bastate->written[bastate->cur_idx],
             data, bytes_to_write);
 
@@ -1479,7 +1633,6 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
                              const E1000E_RxRing *rxr,
                              const E1000E_RSSInfo *rss_info)
 {
-    PCIDevice *d = core->owner;
     dma_addr_t base;
     union e1000_rx_desc_union desc;
     size_t desc_offset = 0;
@@ -1513,7 +1666,7 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
 
         base = e1000e_ring_head_descr(core, rxi);
 
-        pci_dma_read(d, base, &desc, core->rx_desc_len);
+        e1000e_dma_read(core, base, &desc, core->rx_desc_len);
 
         trace_e1000e_rx_descr(rxi->idx, base, core->rx_desc_len);
 
@@ -1648,6 +1801,8 @@ e1000e_rx_fix_l4_csum(E1000ECore *core, struct NetRxPkt *pkt)
 ssize_t
 e1000e_receive_iov(E1000ECore *core, const struct iovec *iov, int iovcnt)
 {
+    QEMU_LOCK_GUARD(&core->lock);
+
     return e1000e_receive_internal(core, iov, iovcnt, core->has_vnet);
 }
 
@@ -1818,8 +1973,11 @@ void
 e1000e_core_set_link_status(E1000ECore *core)
 {
     NetClientState *nc = qemu_get_queue(core->owner_nic);
-    uint32_t old_status = core->mac[STATUS];
+    uint32_t old_status;
+
+    QEMU_LOCK_GUARD(&core->lock);
 
+    old_status = core->mac[STATUS];
     trace_e1000e_link_status_changed(nc->link_down ? false : true);
 
     if (nc->link_down) {
@@ -2018,7 +2176,7 @@ e1000e_msix_notify_one(E1000ECore *core, uint32_t cause, uint32_t int_cfg)
         if (vec < E1000E_MSIX_VEC_NUM) {
             if (!e1000e_eitr_should_postpone(core, vec)) {
                 trace_e1000e_irq_msix_notify_vec(vec);
-                msix_notify(core->owner, vec);
+                e1000e_msix_send(core, vec);
             }
         } else {
             trace_e1000e_wrn_msix_vec_wrong(cause, int_cfg);
@@ -2173,7 +2331,7 @@ static void e1000e_raise_interrupts(E1000ECore *core,
     } else if (!e1000e_itr_should_postpone(core)) {
         if (msi_enabled(core->owner)) {
             trace_e1000e_irq_msi_notify(raised_causes);
-            msi_notify(core->owner, 0);
+            e1000e_msi_notify(core);
         } else {
             e1000e_raise_legacy_irq(core);
         }
@@ -2218,6 +2376,9 @@ static inline void
 e1000e_autoneg_timer(void *opaque)
 {
     E1000ECore *core = opaque;
+
+    QEMU_LOCK_GUARD(&core->lock);
+
     if (!qemu_get_queue(core->owner_nic)->link_down) {
         e1000x_update_regs_on_autoneg_done(core->mac, core->phy[0]);
         e1000e_start_recv(core);
@@ -2438,32 +2599,27 @@ e1000e_set_dbal(E1000ECore *core, int index, uint32_t val)
 static void
 e1000e_set_tctl(E1000ECore *core, int index, uint32_t val)
 {
-    E1000E_TxRing txr;
     core->mac[index] = val;
 
     if (core->mac[TARC0] & E1000_TARC_ENABLE) {
-        e1000e_tx_ring_init(core, &txr, 0);
-        e1000e_start_xmit(core, &txr);
+        e1000e_kick_tx(core, 0);
     }
 
     if (core->mac[TARC1] & E1000_TARC_ENABLE) {
-        e1000e_tx_ring_init(core, &txr, 1);
-        e1000e_start_xmit(core, &txr);
+        e1000e_kick_tx(core, 1);
     }
 }
 
 static void
 e1000e_set_tdt(E1000ECore *core, int index, uint32_t val)
 {
-    E1000E_TxRing txr;
     int qidx = e1000e_mq_queue_idx(TDT, index);
     uint32_t tarc_reg = (qidx == 0) ? TARC0 : TARC1;
 
     core->mac[index] = val & 0xffff;
 
     if (core->mac[tarc_reg] & E1000_TARC_ENABLE) {
-        e1000e_tx_ring_init(core, &txr, qidx);
-        e1000e_start_xmit(core, &txr);
+        e1000e_kick_tx(core, qidx);
     }
 }
 
@@ -3309,6 +3465,8 @@ e1000e_core_write(E1000ECore *core, hwaddr addr, uint64_t val, unsigned size)
 {
     uint16_t index = e1000e_get_reg_index_with_offset(mac_reg_access, addr);
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     if (index < E1000E_NWRITEOPS && e1000e_macreg_writeops[index]) {
         if (mac_reg_access[index] & MAC_ACCESS_PARTIAL) {
             trace_e1000e_wrn_regs_write_trivial(index << 2);
@@ -3328,6 +3486,8 @@ e1000e_core_read(E1000ECore *core, hwaddr addr, unsigned size)
     uint64_t val;
     uint16_t index = e1000e_get_reg_index_with_offset(mac_reg_access, addr);
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     if (index < E1000E_NREADOPS && e1000e_macreg_readops[index]) {
         if (mac_reg_access[index] & MAC_ACCESS_PARTIAL) {
             trace_e1000e_wrn_regs_read_trivial(index << 2);
@@ -3352,20 +3512,126 @@ e1000e_autoneg_resume(E1000ECore *core)
     }
 }
 
+/* Context: BH in core->ctx */
+static void
+e1000e_vm_state_change_bh(void *opaque)
+{
+    E1000ECore *core = opaque;
+    bool running = runstate_is_running();
+    int i;
+
+    for (i = 0; i <= core->max_queue_num; i++) {
+        NetClientState *nc = qemu_get_subqueue(core->owner_nic, i);
+
+        if (running) {
+            qemu_flush_queued_packets(nc);
+            if (nc->peer) {
+                qemu_flush_queued_packets(nc->peer);
+            }
+        } else {
+            /* see net_vm_change_state_handler() */
+            qemu_flush_or_purge_queued_packets(nc, true);
+            if (nc->peer) {
+                qemu_flush_or_purge_queued_packets(nc->peer, true);
+            }
+        }
+    }
+
+    if (running) {
+        for (i = 0; i < E1000E_NUM_QUEUES; i++) {
+            qemu_bh_schedule(core->tx[i].bh);
+        }
+    }
+}
+
+/*
+ * The net layer leaves the queues of clients in an IOThread to their
+ * owner, and e1000e_tx_bh() does not process the rings while the VM is
+ * stopped.
+ */
+static void
+e1000e_vm_state_change(void *opaque, bool running, RunState state)
+{
+    E1000ECore *core = opaque;
+
+    aio_wait_bh_oneshot(core->ctx, e1000e_vm_state_change_bh, core);
+}
+
+static void
+e1000e_core_attach_ctx(E1000ECore *core)
+{
+    int i;
+
+    for (i = 0; i < E1000E_NUM_QUEUES; i++) {
+        core->tx[i].bh = aio_bh_new(core->ctx, e1000e_tx_bh, &core->tx[i]);
+    }
+    core->rx_bh = aio_bh_new(core->ctx, e1000e_rx_bh, core);
+
+    for (i = 0; i <= core->max_queue_num; i++) {
+        qemu_set_net_aio_context(qemu_get_subqueue(core->owner_nic, i),
+                                 core->ctx);
+    }
+
+    core->vmstate = qemu_add_vm_change_state_handler(e1000e_vm_state_change,
+                                                     core);
+}
+
+/* Context: BH in core->ctx */
+static void
+e1000e_core_detach_ctx_bh(void *opaque)
+{
+    E1000ECore *core = opaque;
+    int i;
+
+    for (i = 0; i < E1000E_NUM_QUEUES; i++) {
+        qemu_bh_delete(core->tx[i].bh);
+        core->tx[i].bh = NULL;
+    }
+    qemu_bh_delete(core->rx_bh);
+    core->rx_bh = NULL;
+
+    for (i = 0; i <= core->max_queue_num; i++) {
+        NetClientState *nc = qemu_get_subqueue(core->owner_nic, i);
+
+        qemu_flush_or_purge_queued_packets(nc, true);
+        qemu_set_net_aio_context(nc, NULL);
+    }
+}
+
+static void
+e1000e_core_detach_ctx(E1000ECore *core)
+{
+    qemu_del_vm_change_state_handler(core->vmstate);
+    core->vmstate = NULL;
+
+    aio_wait_bh_oneshot(core->ctx, e1000e_core_detach_ctx_bh, core);
+}
+
 void
 e1000e_core_pci_realize(E1000ECore     *core,
                         const uint16_t *eeprom_templ,
                         uint32_t        eeprom_size,
                         const uint8_t  *macaddr)
 {
+    DeviceState *owner = DEVICE(core->owner);
     int i;
 
+    core->irq_bh = qemu_bh_new_guarded(e1000e_irq_bh, core,
+                                       &owner->mem_reentrancy_guard);
+
+    core->dma_attrs = MEMTXATTRS_UNSPECIFIED;
+    if (core->ctx) {
+        /* MMIO would need the BQL */
+        core->dma_attrs.memory = true;
+    }
+
     core->autoneg_timer = timer_new_ms(QEMU_CLOCK_VIRTUAL,
                                        e1000e_autoneg_timer, core);
     e1000e_intrmgr_pci_realize(core);
 
     for (i = 0; i < E1000E_NUM_QUEUES; i++) {
         net_tx_pkt_init(&core->tx[i].tx_pkt, E1000E_MAX_TX_FRAGS);
+        core->tx[i].core = core;
     }
 
     net_rx_pkt_init(&core->rx_pkt);
@@ -3376,6 +3642,10 @@ e1000e_core_pci_realize(E1000ECore     *core,
                                PCI_DEVICE_GET_CLASS(core->owner)->device_id,
                                macaddr);
     e1000e_update_rx_offloads(core);
+
+    if (core->ctx) {
+        e1000e_core_attach_ctx(core);
+    }
 }
 
 void
@@ -3383,6 +3653,13 @@ e1000e_core_pci_uninit(E1000ECore *core)
 {
     int i;
 
+    if (core->ctx) {
+        e1000e_core_detach_ctx(core);
+    }
+
+    qemu_bh_delete(core->irq_bh);
+    core->irq_bh = NULL;
+
     timer_free(core->autoneg_timer);
 
     e1000e_intrmgr_pci_unint(core);
@@ -3520,6 +3797,8 @@ static void e1000e_reset(E1000ECore *core, bool sw)
 void
 e1000e_core_reset(E1000ECore *core)
 {
+    QEMU_LOCK_GUARD(&core->lock);
+
     e1000e_reset(core, false);
 }
 
@@ -3528,6 +3807,8 @@ void e1000e_core_pre_save(E1000ECore *core)
     int i;
     NetClientState *nc = qemu_get_queue(core->owner_nic);
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     /*
      * If link is down and auto-negotiation is supported and ongoing,
      * complete auto-negotiation immediately. This allows us to look
@@ -3550,6 +3831,8 @@ e1000e_core_post_load(E1000ECore *core)
 {
     NetClientState *nc = qemu_get_queue(core->owner_nic);
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     /*
      * nc.link_down can't be migrated, so infer link_down according
      * to link status bit in core.mac[STATUS].
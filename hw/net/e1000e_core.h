@@ -36,6 +36,8 @@
 #ifndef HW_NET_E1000E_CORE_H
 #define HW_NET_E1000E_CORE_H
 
+#include "qemu/thread.h"
+
 #define E1000E_PHY_PAGE_SIZE    (0x20)
 #define E1000E_PHY_PAGES        (0x07)
 #define E1000E_MAC_SIZE         (0x8000)
@@ -77,6 +79,10 @@ struct E1000Core {
         unsigned char sum_needed;
         bool cptse;
         struct NetTxPkt *tx_pkt;
+
+        /* Processes the ring in the IOThread, see e1000e_kick_tx() */
+        QEMUBH *bh;
+        E1000ECore *core;
     } tx[E1000E_NUM_QUEUES];
 
     struct NetRxPkt *rx_pkt;
@@ -110,6 +116,25 @@ struct E1000Core {
     void (*owner_start_recv)(PCIDevice *d);
 
     int64_t timadj;
+
+    /*
+     * With an IOThread, the TX rings and the receive path run in @ctx
+     * instead of the vCPU thread and the main loop.  @ctx and @lock are
+     * set up by the device before e1000e_core_pci_realize().  @lock
+     * protects the core state against the MMIO handlers and nests inside
+     * the BQL, so code running in @ctx leaves interrupt delivery to the
+     * main loop and only accesses RAM with DMA (@dma_attrs).
+     */
+    AioContext *ctx;
+    QemuRecMutex lock;
+    MemTxAttrs dma_attrs;
+    QEMUBH *rx_bh;
+    VMChangeStateEntry *vmstate;
+
+    /* Interrupts raised without the BQL, delivered by e1000e_irq_bh() */
+    QEMUBH *irq_bh;
+    uint32_t irq_pending;
+    int irq_level;
 };
 
 void
@@ -39,12 +39,14 @@
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/lockable.h"
 #include "net/eth.h"
 #include "net/net.h"
 #include "net/tap.h"
 #include "qemu/module.h"
 #include "qemu/range.h"
 #include "system/system.h"
+#include "system/iothread.h"
 #include "hw/core/hw-error.h"
 #include "hw/net/mii.h"
 #include "hw/pci/pci.h"
@@ -53,6 +55,7 @@
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "hw/core/qdev-properties.h"
+#include "migration/blocker.h"
 #include "migration/vmstate.h"
 
 #include "igb_common.h"
@@ -79,6 +82,15 @@ struct IGBState {
 
     IGBCore core;
     bool has_flr;
+
+    IOThread *iothread;
+    Error *migration_blocker;
+    /*
+     * The net layer marks the NIC as busy while delivering packets, which
+     * happens concurrently with MMIO when the receive path runs in the
+     * IOThread.
+     */
+    MemReentrancyGuard nic_reentrancy_guard;
 };
 
 #define IGB_CAP_SRIOV_OFFSET    (0x160)
@@ -101,7 +113,11 @@ static void igb_write_config(PCIDevice *dev, uint32_t addr,
     IGBState *s = IGB(dev);
 
     trace_igb_write_config(addr, val, len);
-    pci_default_write_config(dev, addr, val, len);
+
+    /* VFs may be enabled or disabled, igb_start_xmit() looks them up */
+    WITH_QEMU_LOCK_GUARD(&s->core.lock) {
+        pci_default_write_config(dev, addr, val, len);
+    }
     if (s->has_flr) {
         pcie_cap_flr_write_config(dev, addr, val, len);
     }
@@ -287,6 +303,7 @@ static void igb_core_realize(IGBState *s)
 {
     s->core.owner = &s->parent_obj;
     s->core.owner_nic = s->nic;
+    s->core.ctx = s->iothread ? iothread_get_aio_context(s->iothread) : NULL;
 }
 
 static void
@@ -325,7 +342,9 @@ igb_init_net_peer(IGBState *s, PCIDevice *pci_dev, uint8_t *macaddr)
     int i;
 
     s->nic = qemu_new_nic(&net_igb_info, &s->conf,
-        object_get_typename(OBJECT(s)), dev->id, &dev->mem_reentrancy_guard, s);
+        object_get_typename(OBJECT(s)), dev->id,
+        s->iothread ? &s->nic_reentrancy_guard : &dev->mem_reentrancy_guard,
+        s);
 
     s->core.max_queue_num = s->conf.peers.queues ? s->conf.peers.queues - 1 : 0;
 
@@ -378,6 +397,36 @@ igb_add_pm_capability(PCIDevice *pdev, uint8_t offset, uint16_t pmc)
     return ret;
 }
 
+static bool igb_iothread_init(IGBState *s, Error **errp)
+{
+    int i;
+
+    if (!s->iothread) {
+        return true;
+    }
+
+    for (i = 0; i < s->conf.peers.queues; i++) {
+        NetClientState *peer = s->conf.peers.ncs[i];
+
+        if (!peer) {
+            continue;
+        }
+        if (!qemu_has_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' does not support iothread",
+                       peer->name);
+            return false;
+        }
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            error_setg(errp, "iothread is not supported with netdev filters");
+            return false;
+        }
+    }
+
+    error_setg(&s->migration_blocker,
+               "igb does not support migration with iothread");
+    return migrate_add_blocker(&s->migration_blocker, errp) >= 0;
+}
+
 static void igb_pci_realize(PCIDevice *pci_dev, Error **errp)
 {
     IGBState *s = IGB(pci_dev);
@@ -386,6 +435,13 @@ static void igb_pci_realize(PCIDevice *pci_dev, Error **errp)
 
     trace_e1000e_cb_pci_realize();
 
+    if (!igb_iothread_init(s, errp)) {
+        return;
+    }
+
+    /* VFs may use the core as soon as they are created */
+    qemu_rec_mutex_init(&s->core.lock);
+
     pci_dev->config_write = igb_write_config;
 
     pci_dev->config[PCI_CACHE_LINE_SIZE] = 0x10;
@@ -450,6 +506,8 @@ static void igb_pci_realize(PCIDevice *pci_dev, Error **errp)
                             IGB_MAX_VF_FUNCTIONS, IGB_VF_OFFSET, IGB_VF_STRIDE,
                             errp)) {
         igb_cleanup_msix(s);
+        qemu_rec_mutex_destroy(&s->core.lock);
+        migrate_del_blocker(&s->migration_blocker);
         return;
     }
 
@@ -486,6 +544,9 @@ static void igb_pci_uninit(PCIDevice *pci_dev)
 
     igb_cleanup_msix(s);
     msi_uninit(pci_dev);
+
+    qemu_rec_mutex_destroy(&s->core.lock);
+    migrate_del_blocker(&s->migration_blocker);
 }
 
 static void igb_qdev_reset_hold(Object *obj, ResetType type)
@@ -597,6 +658,8 @@ static const VMStateDescription igb_vmstate = {
 static const Property igb_properties[] = {
     DEFINE_NIC_PROPERTIES(IGBState, conf),
     DEFINE_PROP_BOOL("x-pcie-flr-init", IGBState, has_flr, true),
+    DEFINE_PROP_LINK("iothread", IGBState, iothread, TYPE_IOTHREAD,
+                     IOThread *),
 };
 
 static void igb_class_init(ObjectClass *class, const void *data)
@@ -39,6 +39,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/log.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
+#include "qemu/aio-wait.h"
 #include "net/net.h"
 #include "net/tap.h"
 #include "hw/net/mii.h"
@@ -97,48 +100,162 @@ igb_receive_internal(IGBCore *core, const struct iovec *iov, int iovcnt,
 static void igb_raise_interrupts(IGBCore *core, size_t index, uint32_t causes);
 static void igb_reset(IGBCore *core, bool sw);
 
+/*
+ * Interrupts raised in the IOThread, i.e. without the BQL, are recorded
+ * in core->irq_pending and delivered by igb_irq_bh().  Bits below
+ * IGB_INTR_NUM are MSI-X causes.
+ */
+#define IGB_IRQ_PENDING_MSI     BIT(30)
+#define IGB_IRQ_PENDING_LEVEL   BIT(31)
+
+QEMU_BUILD_BUG_ON(IGB_INTR_NUM > 30);
+
+static void
+igb_defer_irq(IGBCore *core, uint32_t pending)
+{
+    core->irq_pending |= pending;
+    qemu_bh_schedule(core->irq_bh);
+}
+
+static void
+igb_set_irq_level(IGBCore *core, int level)
+{
+    if (!bql_locked()) {
+        core->irq_level = level;
+        igb_defer_irq(core, IGB_IRQ_PENDING_LEVEL);
+        return;
+    }
+
+    /* Do not let a stale level from the IOThread override this one */
+    core->irq_pending &= ~IGB_IRQ_PENDING_LEVEL;
+    pci_set_irq(core->owner, level);
+}
+
 static inline void
 igb_raise_legacy_irq(IGBCore *core)
 {
     trace_e1000e_irq_legacy_notify(true);
     e1000x_inc_reg_if_not_full(core->mac, IAC);
-    pci_set_irq(core->owner, 1);
+    igb_set_irq_level(core, 1);
 }
 
 static inline void
 igb_lower_legacy_irq(IGBCore *core)
 {
     trace_e1000e_irq_legacy_notify(false);
-    pci_set_irq(core->owner, 0);
+    igb_set_irq_level(core, 0);
 }
 
-static void igb_msix_notify(IGBCore *core, unsigned int cause)
+static void
+igb_msi_notify(IGBCore *core)
+{
+    if (!bql_locked()) {
+        igb_defer_irq(core, IGB_IRQ_PENDING_MSI);
+        return;
+    }
+
+    msi_notify(core->owner, 0);
+}
+
+static bool
+igb_msix_vector(IGBCore *core, unsigned int cause, PCIDevice **dev,
+                unsigned int *vector)
 {
-    PCIDevice *dev = core->owner;
     uint16_t vfn;
-    uint32_t effective_eiac;
-    unsigned int vector;
 
     vfn = 8 - (cause + 2) / IGBVF_MSIX_VEC_NUM;
     if (vfn < pcie_sriov_num_vfs(core->owner)) {
-        dev = pcie_sriov_get_vf_at_index(core->owner, vfn);
-        assert(dev);
-        vector = (cause + 2) % IGBVF_MSIX_VEC_NUM;
+        *dev = pcie_sriov_get_vf_at_index(core->owner, vfn);
+        assert(*dev);
+        *vector = (cause + 2) % IGBVF_MSIX_VEC_NUM;
     } else if (cause >= IGB_MSIX_VEC_NUM) {
         qemu_log_mask(LOG_GUEST_ERROR,
                       "igb: Tried to use vector unavailable for PF");
-        return;
+        return false;
     } else {
-        vector = cause;
+        *dev = core->owner;
+        *vector = cause;
+    }
+
+    return true;
+}
+
+static void
+igb_msix_send(IGBCore *core, unsigned int cause)
+{
+    PCIDevice *dev;
+    unsigned int vector;
+
+    if (!bql_locked()) {
+        igb_defer_irq(core, BIT(cause));
+        return;
+    }
+
+    if (igb_msix_vector(core, cause, &dev, &vector)) {
+        msix_notify(dev, vector);
+    }
+}
+
+/* Context: BH in the main loop */
+static void
+igb_irq_bh(void *opaque)
+{
+    IGBCore *core = opaque;
+    uint32_t pending;
+    unsigned int cause;
+
+    QEMU_LOCK_GUARD(&core->lock);
+
+    pending = core->irq_pending;
+    core->irq_pending = 0;
+
+    for (cause = 0; cause < IGB_INTR_NUM; cause++) {
+        if (pending & BIT(cause)) {
+            igb_msix_send(core, cause);
+        }
+    }
+
+    if (pending & IGB_IRQ_PENDING_MSI) {
+        msi_notify(core->owner, 0);
+    }
+
+    if (pending & IGB_IRQ_PENDING_LEVEL) {
+        pci_set_irq(core->owner, core->irq_level);
+    }
+}
+
+static void igb_msix_notify(IGBCore *core, unsigned int cause)
+{
+    PCIDevice *dev;
+    uint32_t effective_eiac;
+    unsigned int vector;
+
+    if (!igb_msix_vector(core, cause, &dev, &vector)) {
+        return;
     }
 
-    msix_notify(dev, vector);
+    igb_msix_send(core, cause);
 
     trace_e1000e_irq_icr_clear_eiac(core->mac[EICR], core->mac[EIAC]);
     effective_eiac = core->mac[EIAC] & BIT(cause);
     core->mac[EICR] &= ~effective_eiac;
 }
 
+static inline void
+igb_dma_read(IGBCore *core, PCIDevice *dev, dma_addr_t addr, void *buf,
+             dma_addr_t len)
+{
+    pci_dma_rw(dev, addr, buf, len, DMA_DIRECTION_TO_DEVICE, core->dma_attrs);
+}
+
+static inline void
+igb_dma_write(IGBCore *core, PCIDevice *dev, dma_addr_t addr,
+              const void *buf, dma_addr_t len)
+{
+    pci_dma_rw(dev, addr, (void *)buf, len, DMA_DIRECTION_FROM_DEVICE,
+               core->dma_attrs);
+}
+
 static inline void
 igb_intrmgr_rearm_timer(IGBIntrDelayTimer *timer)
 {
@@ -166,6 +283,8 @@ igb_intrmgr_on_msix_throttling_timer(void *opaque)
     IGBIntrDelayTimer *timer = opaque;
     int idx = timer - &timer->core->eitr[0];
 
+    QEMU_LOCK_GUARD(&timer->core->lock);
+
     timer->running = false;
 
     trace_e1000e_irq_msix_notify_postponed_vec(idx);
@@ -647,8 +766,9 @@ igb_process_tx_desc(IGBCore *core,
     length = cmd_type_len & 0xFFFF;
 
     if (!tx->skip_cp) {
-        if (!net_tx_pkt_add_raw_fragment_pci(tx->tx_pkt, dev,
-                                             buffer_addr, length)) {
+        if (!net_tx_pkt_add_raw_fragment_pci_attrs(tx->tx_pkt, dev,
+                                                   buffer_addr, length,
+                                                   core->dma_attrs)) {
             tx->skip_cp = true;
         }
     }
@@ -847,13 +967,13 @@ igb_txdesc_writeback(IGBCore *core, dma_addr_t base,
 
     if (tdwba & 1) {
         uint32_t buffer = cpu_to_le32(core->mac[txi->dh]);
-        pci_dma_write(d, tdwba & ~3, &buffer, sizeof(buffer));
+        igb_dma_write(core, d, tdwba & ~3, &buffer, sizeof(buffer));
     } else {
         uint32_t status = le32_to_cpu(tx_desc->wb.status) | E1000_TXD_STAT_DD;
 
         tx_desc->wb.status = cpu_to_le32(status);
-        pci_dma_write(d, base + offsetof(union e1000_adv_tx_desc, wb),
-            &tx_desc->wb, sizeof(tx_desc->wb));
+        igb_dma_write(core, d, base + offsetof(union e1000_adv_tx_desc, wb),
+                      &tx_desc->wb, sizeof(tx_desc->wb));
     }
 
     return igb_tx_wb_eic(core, txi->idx);
@@ -893,7 +1013,7 @@ igb_start_xmit(IGBCore *core, const IGB_TxRing *txr)
     while (!igb_ring_empty(core, txi)) {
         base = igb_ring_head_descr(core, txi);
 
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        igb_dma_read(core, d, base, &desc, sizeof(desc));
 
         trace_e1000e_tx_descr((void *)(intptr_t)desc.read.buffer_addr,
                               desc.read.cmd_type_len, desc.wb.status);
@@ -911,6 +1031,25 @@ igb_start_xmit(IGBCore *core, const IGB_TxRing *txr)
     net_tx_pkt_reset(txr->tx->tx_pkt, net_tx_pkt_unmap_frag_pci, d);
 }
 
+/* Context: BH in core->ctx */
+static void
+igb_tx_bh(void *opaque)
+{
+    struct igb_tx *tx = opaque;
+    IGBCore *core = tx->core;
+    IGB_TxRing txr;
+
+    /* The rings are kicked again by igb_vm_state_change() */
+    if (!runstate_is_running()) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&core->lock);
+
+    igb_tx_ring_init(core, &txr, tx - core->tx);
+    igb_start_xmit(core, &txr);
+}
+
 static uint32_t
 igb_rxbufsize(IGBCore *core, const E1000ERingInfo *r)
 {
@@ -950,16 +1089,31 @@ igb_start_recv(IGBCore *core)
 
     trace_e1000e_rx_start_recv();
 
+    /* The queues belong to the IOThread */
+    if (core->ctx && qemu_get_current_aio_context() != core->ctx) {
+        qemu_bh_schedule(core->rx_bh);
+        return;
+    }
+
     for (i = 0; i <= core->max_queue_num; i++) {
         qemu_flush_queued_packets(qemu_get_subqueue(core->owner_nic, i));
     }
 }
 
+/* Context: BH in core->ctx */
+static void
+igb_rx_bh(void *opaque)
+{
+    igb_start_recv(opaque);
+}
+
 bool
 igb_can_receive(IGBCore *core)
 {
     int i;
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     if (!e1000x_rx_ready(core->owner, core->mac)) {
         return false;
     }
@@ -1598,11 +1752,11 @@ igb_pci_dma_write_rx_desc(IGBCore *core, PCIDevice *dev, dma_addr_t addr,
         uint8_t status = d->status;
 
         d->status &= ~E1000_RXD_STAT_DD;
-        pci_dma_write(dev, addr, desc, len);
+        igb_dma_write(core, dev, addr, desc, len);
 
         if (status & E1000_RXD_STAT_DD) {
             d->status = status;
-            pci_dma_write(dev, addr + offset, &status, sizeof(status));
+            igb_dma_write(core, dev, addr + offset, &status, sizeof(status));
         }
     } else {
         union e1000_adv_rx_desc *d = &desc->adv;
@@ -1611,11 +1765,11 @@ igb_pci_dma_write_rx_desc(IGBCore *core, PCIDevice *dev, dma_addr_t addr,
         uint32_t status = d->wb.upper.status_error;
 
         d->wb.upper.status_error &= ~E1000_RXD_STAT_DD;
-        pci_dma_write(dev, addr, desc, len);
+        igb_dma_write(core, dev, addr, desc, len);
 
         if (status & E1000_RXD_STAT_DD) {
             d->wb.upper.status_error = status;
-            pci_dma_write(dev, addr + offset, &status, sizeof(status));
+            igb_dma_write(core, dev, addr + offset, &status, sizeof(status));
         }
     }
 }
@@ -1737,7 +1891,7 @@ igb_write_hdr_frag_to_rx_buffers(IGBCore *core,
 {
     assert(data_len <= pdma_st->rx_desc_header_buf_size -
                        pdma_st->bastate.written[0]);
-    pci_dma_write(d,
+    igb_dma_write(core, d,
                   pdma_st->ba[0] + pdma_st->bastate.written[0],
                   data, data_len);
     pdma_st->bastate.written[0] += data_len;
@@ -1804,7 +1958,7 @@ igb_write_payload_frag_to_rx_buffers(IGBCore *core,
             data,
             bytes_to_write);
 
-        pci_dma_write(d,
+        igb_dma_write(core, d,
                       pdma_st->ba[pdma_st->bastate.cur_idx] +
                       pdma_st->bastate.written[pdma_st->bastate.cur_idx],
                       data, bytes_to_write);
@@ -1927,7 +2081,7 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
         }
 
         base = igb_ring_head_descr(core, rxi);
-        pci_dma_read(d, base, &desc, rx_desc_len);
+        igb_dma_read(core, d, base, &desc, rx_desc_len);
         trace_e1000e_rx_descr(rxi->idx, base, rx_desc_len);
 
         igb_read_rx_descr(core, &desc, &pdma_st, rxi);
@@ -1978,6 +2132,8 @@ igb_rx_fix_l4_csum(IGBCore *core, struct NetRxPkt *pkt)
 ssize_t
 igb_receive_iov(IGBCore *core, const struct iovec *iov, int iovcnt)
 {
+    QEMU_LOCK_GUARD(&core->lock);
+
     return igb_receive_internal(core, iov, iovcnt, core->has_vnet, NULL);
 }
 
@@ -2139,8 +2295,11 @@ igb_set_phy_ctrl(IGBCore *core, uint16_t val)
 void igb_core_set_link_status(IGBCore *core)
 {
     NetClientState *nc = qemu_get_queue(core->owner_nic);
-    uint32_t old_status = core->mac[STATUS];
+    uint32_t old_status;
+
+    QEMU_LOCK_GUARD(&core->lock);
 
+    old_status = core->mac[STATUS];
     trace_e1000e_link_status_changed(nc->link_down ? false : true);
 
     if (nc->link_down) {
@@ -2331,10 +2490,10 @@ static void igb_raise_interrupts(IGBCore *core, size_t index, uint32_t causes)
 
         if (msix_enabled(core->owner)) {
             trace_e1000e_irq_msix_notify_vec(0);
-            msix_notify(core->owner, 0);
+            igb_msix_send(core, 0);
         } else if (msi_enabled(core->owner)) {
             trace_e1000e_irq_msi_notify(raised_causes);
-            msi_notify(core->owner, 0);
+            igb_msi_notify(core);
         } else {
             igb_raise_legacy_irq(core);
         }
@@ -2462,6 +2621,8 @@ void igb_core_vf_reset(IGBCore *core, uint16_t vfn)
     uint16_t qn0 = vfn;
     uint16_t qn1 = vfn + IGB_NUM_VM_POOLS;
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     trace_igb_core_vf_reset(vfn);
 
     /* disable Rx and Tx for the VF*/
@@ -2627,6 +2788,9 @@ static inline void
 igb_autoneg_timer(void *opaque)
 {
     IGBCore *core = opaque;
+
+    QEMU_LOCK_GUARD(&core->lock);
+
     if (!qemu_get_queue(core->owner_nic)->link_down) {
         e1000x_update_regs_on_autoneg_done(core->mac, core->phy);
         igb_start_recv(core);
@@ -2806,6 +2970,11 @@ igb_set_tdt(IGBCore *core, int index, uint32_t val)
 
     core->mac[index] = val & 0xffff;
 
+    if (core->ctx) {
+        qemu_bh_schedule(core->tx[qn].bh);
+        return;
+    }
+
     igb_tx_ring_init(core, &txr, qn);
     igb_start_xmit(core, &txr);
 }
@@ -4239,6 +4408,8 @@ igb_core_write(IGBCore *core, hwaddr addr, uint64_t val, unsigned size)
 {
     uint16_t index = igb_get_reg_index_with_offset(mac_reg_access, addr);
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     if (index < IGB_NWRITEOPS && igb_macreg_writeops[index]) {
         if (mac_reg_access[index] & MAC_ACCESS_PARTIAL) {
             trace_e1000e_wrn_regs_write_trivial(index << 2);
@@ -4258,6 +4429,8 @@ igb_core_read(IGBCore *core, hwaddr addr, unsigned size)
     uint64_t val;
     uint16_t index = igb_get_reg_index_with_offset(mac_reg_access, addr);
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     if (index < IGB_NREADOPS && igb_macreg_readops[index]) {
         if (mac_reg_access[index] & MAC_ACCESS_PARTIAL) {
             trace_e1000e_wrn_regs_read_trivial(index << 2);
@@ -4282,20 +4455,126 @@ igb_autoneg_resume(IGBCore *core)
     }
 }
 
+/* Context: BH in core->ctx */
+static void
+igb_vm_state_change_bh(void *opaque)
+{
+    IGBCore *core = opaque;
+    bool running = runstate_is_running();
+    int i;
+
+    for (i = 0; i <= core->max_queue_num; i++) {
+        NetClientState *nc = qemu_get_subqueue(core->owner_nic, i);
+
+        if (running) {
+            qemu_flush_queued_packets(nc);
+            if (nc->peer) {
+                qemu_flush_queued_packets(nc->peer);
+            }
+        } else {
+            /* see net_vm_change_state_handler() */
+            qemu_flush_or_purge_queued_packets(nc, true);
+            if (nc->peer) {
+                qemu_flush_or_purge_queued_packets(nc->peer, true);
+            }
+        }
+    }
+
+    if (running) {
+        for (i = 0; i < IGB_NUM_QUEUES; i++) {
+            qemu_bh_schedule(core->tx[i].bh);
+        }
+    }
+}
+
+/*
+ * The net layer leaves the queues of clients in an IOThread to their
+ * owner, and igb_tx_bh() does not process the rings while the VM is
+ * stopped.
+ */
+static void
+igb_vm_state_change(void *opaque, bool running, RunState state)
+{
+    IGBCore *core = opaque;
+
+    aio_wait_bh_oneshot(core->ctx, igb_vm_state_change_bh, core);
+}
+
+static void
+igb_core_attach_ctx(IGBCore *core)
+{
+    int i;
+
+    for (i = 0; i < IGB_NUM_QUEUES; i++) {
+        core->tx[i].bh = aio_bh_new(core->ctx, igb_tx_bh, &core->tx[i]);
+    }
+    core->rx_bh = aio_bh_new(core->ctx, igb_rx_bh, core);
+
+    for (i = 0; i <= core->max_queue_num; i++) {
+        qemu_set_net_aio_context(qemu_get_subqueue(core->owner_nic, i),
+                                 core->ctx);
+    }
+
+    core->vmstate = qemu_add_vm_change_state_handler(igb_vm_state_change,
+                                                     core);
+}
+
+/* Context: BH in core->ctx */
+static void
+igb_core_detach_ctx_bh(void *opaque)
+{
+    IGBCore *core = opaque;
+    int i;
+
+    for (i = 0; i < IGB_NUM_QUEUES; i++) {
+        qemu_bh_delete(core->tx[i].bh);
+        core->tx[i].bh = NULL;
+    }
+    qemu_bh_delete(core->rx_bh);
+    core->rx_bh = NULL;
+
+    for (i = 0; i <= core->max_queue_num; i++) {
+        NetClientState *nc = qemu_get_subqueue(core->owner_nic, i);
+
+        qemu_flush_or_purge_queued_packets(nc, true);
+        qemu_set_net_aio_context(nc, NULL);
+    }
+}
+
+static void
+igb_core_detach_ctx(IGBCore *core)
+{
+    qemu_del_vm_change_state_handler(core->vmstate);
+    core->vmstate = NULL;
+
+    aio_wait_bh_oneshot(core->ctx, igb_core_detach_ctx_bh, core);
+}
+
 void
 igb_core_pci_realize(IGBCore        *core,
                      const uint16_t *eeprom_templ,
                      uint32_t        eeprom_size,
                      const uint8_t  *macaddr)
 {
+    DeviceState *owner = DEVICE(core->owner);
     int i;
 
+    core->irq_bh = qemu_bh_new_guarded(igb_irq_bh, core,
+                                       &DEVICE(owner)->mem_reentrancy_guard);
+
+    core->dma_attrs = MEMTXATTRS_UNSPECIFIED;
+    if (core->ctx) {
+        /* MMIO would need the BQL */
+        core->dma_attrs.memory = true;
+    }
+
     core->autoneg_timer = timer_new_ms(QEMU_CLOCK_VIRTUAL,
                                        igb_autoneg_timer, core);
     igb_intrmgr_pci_realize(core);
 
     for (i = 0; i < IGB_NUM_QUEUES; i++) {
         net_tx_pkt_init(&core->tx[i].tx_pkt, E1000E_MAX_TX_FRAGS);
+        core->tx[i].core = core;
     }
 
     net_rx_pkt_init(&core->rx_pkt);
@@ -4306,6 +4585,10 @@ igb_core_pci_realize(IGBCore        *core,
                                PCI_DEVICE_GET_CLASS(core->owner)->device_id,
                                macaddr);
     igb_update_rx_offloads(core);
+
+    if (core->ctx) {
+        igb_core_attach_ctx(core);
+    }
 }
 
 void
@@ -4313,6 +4596,13 @@ igb_core_pci_uninit(IGBCore *core)
 {
     int i;
 
+    if (core->ctx) {
+        igb_core_detach_ctx(core);
+    }
+
+    qemu_bh_delete(core->irq_bh);
+    core->irq_bh = NULL;
+
     timer_free(core->autoneg_timer);
 
     igb_intrmgr_pci_unint(core);
@@ -4505,6 +4795,8 @@ static void igb_reset(IGBCore *core, bool sw)
 void
 igb_core_reset(IGBCore *core)
 {
+    QEMU_LOCK_GUARD(&core->lock);
+
     igb_reset(core, false);
 }
 
@@ -4513,6 +4805,8 @@ void igb_core_pre_save(IGBCore *core)
     int i;
     NetClientState *nc = qemu_get_queue(core->owner_nic);
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     /*
      * If link is down and auto-negotiation is supported and ongoing,
      * complete auto-negotiation immediately. This allows us to look
@@ -4535,6 +4829,8 @@ igb_core_post_load(IGBCore *core)
 {
     NetClientState *nc = qemu_get_queue(core->owner_nic);
 
+    QEMU_LOCK_GUARD(&core->lock);
+
     /*
      * nc.link_down can't be migrated, so infer link_down according
      * to link status bit in core.mac[STATUS].
@@ -40,6 +40,8 @@
 #ifndef HW_NET_IGB_CORE_H
 #define HW_NET_IGB_CORE_H
 
+#include "qemu/thread.h"
+
 #define E1000E_MAC_SIZE         (0x8000)
 #define IGB_EEPROM_SIZE         (1024)
 
@@ -81,6 +83,10 @@ struct IGBCore {
         bool skip_cp;
 
         struct NetTxPkt *tx_pkt;
+
+        /* Processes the ring in the IOThread, see igb_set_tdt() */
+        QEMUBH *bh;
+        IGBCore *core;
     } tx[IGB_NUM_QUEUES];
 
     struct NetRxPkt *rx_pkt;
@@ -99,6 +105,25 @@ struct IGBCore {
     void (*owner_start_recv)(PCIDevice *d);
 
     int64_t timadj;
+
+    /*
+     * With an IOThread, the TX rings and the receive path run in @ctx
+     * instead of the vCPU thread and the main loop.  @ctx and @lock are
+     * set up by the device before igb_core_pci_realize().  @lock protects the
+     * core state against the MMIO handlers and nests inside the BQL, so
+     * code running in @ctx leaves interrupt delivery to the main loop and
+     * only accesses RAM with DMA (@dma_attrs).
+     */
+    AioContext *ctx;
+    QemuRecMutex lock;
+    MemTxAttrs dma_attrs;
+    QEMUBH *rx_bh;
+    VMChangeStateEntry *vmstate;
+
+    /* Interrupts raised without the BQL, delivered by igb_irq_bh() */
+    QEMUBH *irq_bh;
+    uint32_t irq_pending;
+    int irq_level;
 };
 
 void
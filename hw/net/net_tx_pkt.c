@@ -479,9 +479,19 @@ void net_tx_pkt_unmap_frag_pci(void *context, void *base, size_t len)
 
 bool net_tx_pkt_add_raw_fragment_pci(struct NetTxPkt *pkt, PCIDevice *pci_dev,
                                      dma_addr_t pa, size_t len)
+{
+    return net_tx_pkt_add_raw_fragment_pci_attrs(pkt, pci_dev, pa, len,
+                                                 MEMTXATTRS_UNSPECIFIED);
+}
+
+bool net_tx_pkt_add_raw_fragment_pci_attrs(struct NetTxPkt *pkt,
+                                           PCIDevice *pci_dev,
+                                           dma_addr_t pa, size_t len,
+                                           MemTxAttrs attrs)
 {
     dma_addr_t mapped_len = len;
-    void *base = pci_dma_map(pci_dev, pa, &mapped_len, DMA_DIRECTION_TO_DEVICE);
+    void *base = dma_memory_map(pci_get_address_space(pci_dev), pa,
+                                &mapped_len, DMA_DIRECTION_TO_DEVICE, attrs);
     if (!base) {
         return false;
     }
@@ -20,6 +20,7 @@
 
 #include "net/eth.h"
 #include "exec/hwaddr.h"
+#include "exec/memattrs.h"
 
 /* define to enable packet dump functions */
 /*#define NET_TX_PKT_DEBUG*/
@@ -179,6 +180,17 @@ void net_tx_pkt_unmap_frag_pci(void *context, void *base, size_t len);
 bool net_tx_pkt_add_raw_fragment_pci(struct NetTxPkt *pkt, PCIDevice *pci_dev,
                                      dma_addr_t pa, size_t len);
 
+/**
+ * Same as net_tx_pkt_add_raw_fragment_pci(), but maps the fragment with
+ * the given memory transaction attributes.
+ *
+ * @attrs:          memory transaction attributes
+ */
+bool net_tx_pkt_add_raw_fragment_pci_attrs(struct NetTxPkt *pkt,
+                                           PCIDevice *pci_dev,
+                                           dma_addr_t pa, size_t len,
+                                           MemTxAttrs attrs);
+
 /**
  * Send packet to qemu. handles sw offloads if vhdr is not supported.
  *
@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
+#include "qemu/defer-call.h"
 #include "qemu/iov.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
@@ -20,6 +21,7 @@
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/gro.h"
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
@@ -31,6 +33,7 @@
 #include "net/vhost_net.h"
 #include "net/announce.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-net.h"
 #include "hw/core/qdev-properties.h"
@@ -38,9 +41,12 @@
 #include "qapi/qapi-events-migration.h"
 #include "hw/virtio/virtio-access.h"
 #include "migration/misc.h"
+#include "migration/blocker.h"
 #include "standard-headers/linux/ethtool.h"
 #include "system/system.h"
 #include "system/replay.h"
+#include "system/runstate.h"
+#include "qemu/aio-wait.h"
 #include "trace.h"
 #include "monitor/qdev.h"
 #include "monitor/monitor.h"
@@ -59,6 +65,12 @@
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
 
+/* Packets popped at once by virtio_net_flush_tx() */
+#define VIRTIO_NET_TX_BATCH 32
+
+/* Longest descriptor chain whose element is recycled by the element pools */
+#define VIRTIO_NET_POOL_SG_MAX 32
+
 #define VIRTIO_NET_IP4_ADDR_SIZE   8        /* ipv4 saddr + daddr */
 
 #define VIRTIO_NET_TCP_FLAG         0x3F
@@ -401,10 +413,110 @@ static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+typedef void VirtIONetQueueFunc(VirtIONetQueue *q, void *opaque);
+
+typedef struct VirtIONetQueueRunData {
+    VirtIONetQueueFunc *fn;
+    VirtIONetQueue *q;
+    void *opaque;
+} VirtIONetQueueRunData;
+
+static void virtio_net_queue_run_bh(void *opaque)
+{
+    VirtIONetQueueRunData *data = opaque;
+
+    data->fn(data->q, data->opaque);
+}
+
+/*
+ * Run @fn in the AioContext that processes the queue pair @q and wait
+ * for it to complete, so that it does not race with the datapath.
+ *
+ * Context: BQL held
+ */
+static void virtio_net_queue_run(VirtIONetQueue *q, VirtIONetQueueFunc *fn,
+                                 void *opaque)
+{
+    VirtIONetQueueRunData data = {
+        .fn = fn,
+        .q = q,
+        .opaque = opaque,
+    };
+
+    if (q->ctx) {
+        aio_wait_bh_oneshot(q->ctx, virtio_net_queue_run_bh, &data);
+    } else {
+        fn(q, opaque);
+    }
+}
+
+static void virtio_net_rx_zc_post(VirtIONetQueue *q);
+static void virtio_net_rx_zc_reclaim(VirtIONetQueue *q);
+static void virtio_net_rss_backlog_run(VirtIONetQueue *q);
+static void virtio_net_gro_retry(VirtIONetQueue *q);
+
+static void virtio_net_queue_set_status(VirtIONetQueue *q, void *opaque)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    NetClientState *ncs = qemu_get_subqueue(n->nic, q - n->vqs);
+    uint8_t queue_status = *(uint8_t *)opaque;
+    bool queue_started;
+
+    queue_started =
+        virtio_net_started(n, queue_status) && !n->vhost_started;
+
+    if (queue_started) {
+        virtio_net_rss_backlog_run(q);
+        virtio_net_gro_retry(q);
+        qemu_flush_queued_packets(ncs);
+        virtio_net_rx_zc_post(q);
+    } else {
+        virtio_net_rx_zc_reclaim(q);
+    }
+
+    if (!q->tx_waiting) {
+        return;
+    }
+
+    if (queue_started) {
+        if (q->tx_timer) {
+            timer_mod(q->tx_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
+        } else {
+            replay_bh_schedule_event(q->tx_bh);
+        }
+    } else {
+        if (q->tx_timer) {
+            timer_del(q->tx_timer);
+        } else {
+            qemu_bh_cancel(q->tx_bh);
+        }
+        if ((n->status & VIRTIO_NET_S_LINK_UP) == 0 &&
+            (queue_status & VIRTIO_CONFIG_S_DRIVER_OK) &&
+            vdev->vm_running) {
+            /*
+             * if tx is waiting we are likely have some packets in tx queue
+             * and disabled notification
+             */
+            q->tx_waiting = 0;
+            virtio_queue_set_notification(q->tx_vq, 1);
+            virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
+        }
+    }
+}
+
+static uint8_t virtio_net_queue_status(VirtIONet *n, int index, uint8_t status)
+{
+    if ((!n->multiqueue && index != 0) || index >= n->curr_queue_pairs) {
+        return 0;
+    }
+    return status;
+}
+
 static int virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
-    VirtIONetQueue *q;
     int i;
     uint8_t queue_status;
 
@@ -412,49 +524,9 @@ static int virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     virtio_net_vhost_status(n, status);
 
     for (i = 0; i < n->max_queue_pairs; i++) {
-        NetClientState *ncs = qemu_get_subqueue(n->nic, i);
-        bool queue_started;
-        q = &n->vqs[i];
-
-        if ((!n->multiqueue && i != 0) || i >= n->curr_queue_pairs) {
-            queue_status = 0;
-        } else {
-            queue_status = status;
-        }
-        queue_started =
-            virtio_net_started(n, queue_status) && !n->vhost_started;
-
-        if (queue_started) {
-            qemu_flush_queued_packets(ncs);
-        }
-
-        if (!q->tx_waiting) {
-            continue;
-        }
-
-        if (queue_started) {
-            if (q->tx_timer) {
-                timer_mod(q->tx_timer,
-                               qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
-            } else {
-                replay_bh_schedule_event(q->tx_bh);
-            }
-        } else {
-            if (q->tx_timer) {
-                timer_del(q->tx_timer);
-            } else {
-                qemu_bh_cancel(q->tx_bh);
-            }
-            if ((n->status & VIRTIO_NET_S_LINK_UP) == 0 &&
-                (queue_status & VIRTIO_CONFIG_S_DRIVER_OK) &&
-                vdev->vm_running) {
-                /* if tx is waiting we are likely have some packets in tx queue
-                 * and disabled notification */
-                q->tx_waiting = 0;
-                virtio_queue_set_notification(q->tx_vq, 1);
-                virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
-            }
-        }
+        queue_status = virtio_net_queue_status(n, i, status);
+        virtio_net_queue_run(&n->vqs[i], virtio_net_queue_set_status,
+                             &queue_status);
     }
     return 0;
 }
@@ -765,6 +837,19 @@ static int peer_detach(VirtIONet *n, int index)
     return tap_disable(nc->peer);
 }
 
+static void virtio_net_queue_set_peer(VirtIONetQueue *q, void *opaque)
+{
+    VirtIONet *n = q->n;
+    int index = q - n->vqs;
+    int *r = opaque;
+
+    if (index < n->curr_queue_pairs) {
+        *r = peer_attach(n, index);
+    } else {
+        *r = peer_detach(n, index);
+    }
+}
+
 static void virtio_net_set_queue_pairs(VirtIONet *n)
 {
     int i;
@@ -775,13 +860,8 @@ static void virtio_net_set_queue_pairs(VirtIONet *n)
     }
 
     for (i = 0; i < n->max_queue_pairs; i++) {
-        if (i < n->curr_queue_pairs) {
-            r = peer_attach(n, i);
-            assert(!r);
-        } else {
-            r = peer_detach(n, i);
-            assert(!r);
-        }
+        virtio_net_queue_run(&n->vqs[i], virtio_net_queue_set_peer, &r);
+        assert(!r);
     }
 }
 
@@ -960,7 +1040,7 @@ static void virtio_net_set_features(VirtIODevice *vdev,
         virtio_has_feature_ex(features, VIRTIO_NET_F_GUEST_TSO6);
     n->rss_data.redirect = virtio_has_feature_ex(features, VIRTIO_NET_F_RSS);
 
-    if (n->has_vnet_hdr) {
+    if (n->has_vnet_hdr || n->rx_gro) {
         n->curr_guest_offloads =
             virtio_net_guest_offloads_by_features(features);
         virtio_net_apply_guest_offloads(n);
@@ -1270,6 +1350,46 @@ static void virtio_net_detach_ebpf_rss(VirtIONet *n)
     virtio_net_attach_ebpf_to_backend(n->nic, -1);
 }
 
+/*
+ * Software RSS runs in the AioContext of the queue pair that received
+ * the packet, concurrently with the control virtqueue.  It uses a copy
+ * of rss_data that is replaced as a whole when the configuration
+ * changes.
+ */
+typedef struct VirtioNetRssSteering {
+    struct rcu_head rcu;
+    uint32_t hash_types;
+    bool redirect;
+    bool populate_hash;
+    uint16_t default_queue;
+    uint16_t indirections_len;
+    uint16_t indirections_table[VIRTIO_NET_RSS_MAX_TABLE_LEN];
+    NetToeplitzTable toeplitz;
+} VirtioNetRssSteering;
+
+static void virtio_net_update_rss_steering(VirtIONet *n)
+{
+    VirtioNetRssSteering *rss = NULL;
+    VirtioNetRssSteering *old = n->rss_steering;
+
+    if (n->rss_data.enabled && n->rss_data.enabled_software_rss) {
+        rss = g_new(VirtioNetRssSteering, 1);
+        rss->hash_types = n->rss_data.runtime_hash_types;
+        rss->redirect = n->rss_data.redirect;
+        rss->populate_hash = n->rss_data.populate_hash;
+        rss->default_queue = n->rss_data.default_queue;
+        rss->indirections_len = n->rss_data.indirections_len;
+        memcpy(rss->indirections_table, n->rss_data.indirections_table,
+               sizeof(uint16_t) * n->rss_data.indirections_len);
+        net_toeplitz_table_init(&rss->toeplitz, n->rss_data.key);
+    }
+
+    qatomic_rcu_set(&n->rss_steering, rss);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+}
+
 static void virtio_net_commit_rss_config(VirtIONet *n)
 {
     if (n->rss_data.peer_hash_available) {
@@ -1297,6 +1417,8 @@ static void virtio_net_commit_rss_config(VirtIONet *n)
         virtio_net_detach_ebpf_rss(n);
         trace_virtio_net_rss_disable(n);
     }
+
+    virtio_net_update_rss_steering(n);
 }
 
 static void virtio_net_disable_rss(VirtIONet *n)
@@ -1617,12 +1739,26 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 
 /* RX */
 
+/*
+ * Deliver coalesced packets that the rx queue had no room for.  They go
+ * before the packets that the net layer queued meanwhile.
+ */
+static void virtio_net_gro_retry(VirtIONetQueue *q)
+{
+    if (q->gro) {
+        net_gro_flush(q->gro);
+    }
+}
+
 static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
 
+    virtio_net_rss_backlog_run(&n->vqs[queue_index]);
+    virtio_net_gro_retry(&n->vqs[queue_index]);
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
+    virtio_net_rx_zc_post(&n->vqs[queue_index]);
 }
 
 static bool virtio_net_can_receive(NetClientState *nc)
@@ -1734,6 +1870,13 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
     }
 }
 
+/*
+ * With IOThreads this runs outside the BQL while the control virtqueue
+ * updates the filter state in the main loop.  The race is benign: a
+ * packet that arrives during a VIRTIO_NET_CTRL_RX or _MAC command may be
+ * filtered with either the old or the new settings, which the guest
+ * cannot tell apart from the packet arriving slightly earlier or later.
+ */
 static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
 {
     static const uint8_t bcast[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
@@ -1856,13 +1999,14 @@ static uint8_t virtio_net_get_hash_type(bool hasip4,
     return 0xff;
 }
 
-static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
-                                  size_t size,
+static int virtio_net_process_rss(NetClientState *nc,
+                                  const VirtioNetRssSteering *rss,
+                                  const uint8_t *buf, size_t size,
                                   struct virtio_net_hdr_v1_hash *hdr)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     unsigned int index = nc->queue_index, new_index = index;
-    struct NetRxPkt *pkt = n->rx_pkt;
+    struct NetRxPkt *pkt = virtio_net_get_subqueue(nc)->rx_pkt;
     uint8_t net_hash_type;
     uint32_t hash;
     bool hasip4, hasip6;
@@ -1886,34 +2030,42 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     net_rx_pkt_set_protocols(pkt, &iov, 1, n->host_hdr_len);
     net_rx_pkt_get_protocols(pkt, &hasip4, &hasip6, &l4hdr_proto);
     net_hash_type = virtio_net_get_hash_type(hasip4, hasip6, l4hdr_proto,
-                                             n->rss_data.runtime_hash_types);
+                                             rss->hash_types);
     if (net_hash_type > NetPktRssIpV6UdpEx) {
-        if (n->rss_data.populate_hash) {
+        if (rss->populate_hash) {
             hdr->hash_value_lo = VIRTIO_NET_HASH_REPORT_NONE;
             hdr->hash_value_hi = VIRTIO_NET_HASH_REPORT_NONE;
             hdr->hash_report = 0;
         }
-        return n->rss_data.redirect ? n->rss_data.default_queue : -1;
+        return rss->redirect ? rss->default_queue : -1;
     }
 
-    hash = net_rx_pkt_calc_rss_hash(pkt, net_hash_type, n->rss_data.key);
+    hash = net_rx_pkt_calc_rss_hash_table(pkt, net_hash_type, &rss->toeplitz);
 
-    if (n->rss_data.populate_hash) {
+    if (rss->populate_hash) {
         hdr->hash_value_lo = cpu_to_le16(hash & 0xffff);
         hdr->hash_value_hi = cpu_to_le16((hash >> 16) & 0xffff);
         hdr->hash_report = reports[net_hash_type];
     }
 
-    if (n->rss_data.redirect) {
-        new_index = hash & (n->rss_data.indirections_len - 1);
-        new_index = n->rss_data.indirections_table[new_index];
+    if (rss->redirect) {
+        new_index = hash & (rss->indirections_len - 1);
+        new_index = rss->indirections_table[new_index];
     }
 
     return (index == new_index) ? -1 : new_index;
 }
 
-static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
-                                      size_t size)
+/*
+ * Place a packet in the rx virtqueue of @nc.  @gso_hdr describes the
+ * packet if the peer does not use vnet headers and the packet was
+ * coalesced, see virtio_net_gro_flush().  @hash_hdr carries the hash
+ * computed by software RSS.
+ */
+static ssize_t
+virtio_net_receive_queue(NetClientState *nc, const uint8_t *buf, size_t size,
+                         const struct virtio_net_hdr *gso_hdr,
+                         const struct virtio_net_hdr_v1_hash *hash_hdr)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q;
@@ -1921,20 +2073,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     QEMU_UNINITIALIZED VirtQueueElement *elems[VIRTQUEUE_MAX_SIZE];
     QEMU_UNINITIALIZED size_t lens[VIRTQUEUE_MAX_SIZE];
     QEMU_UNINITIALIZED struct iovec mhdr_sg[VIRTQUEUE_MAX_SIZE];
-    struct virtio_net_hdr_v1_hash extra_hdr;
+    struct virtio_net_hdr_v1_hash extra_hdr = *hash_hdr;
     unsigned mhdr_cnt = 0;
     size_t offset, i, guest_offset, j;
     ssize_t err;
 
-    memset(&extra_hdr, 0, sizeof(extra_hdr));
-
-    if (n->rss_data.enabled && n->rss_data.enabled_software_rss) {
-        int index = virtio_net_process_rss(nc, buf, size, &extra_hdr);
-        if (index >= 0) {
-            nc = qemu_get_subqueue(n->nic, index % n->curr_queue_pairs);
-        }
-    }
-
     if (!virtio_net_can_receive(nc)) {
         return -1;
     }
@@ -1964,8 +2107,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             goto err;
         }
 
-        elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
+        if (!virtqueue_pop_batch(q->rx_vq, &q->rx_pool, &elem, 1)) {
             if (i) {
                 virtio_error(vdev, "virtio-net unexpected empty queue: "
                              "i %zd mergeable %d offset %zd, size %zd, "
@@ -1978,12 +2120,14 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             err = -1;
             goto err;
         }
+        /* The posted buffers are not the last ones popped anymore */
+        q->rx_zc_unpop = false;
 
         if (elem->in_num < 1) {
             virtio_error(vdev,
                          "virtio-net receive queue contains no in buffers");
             virtqueue_detach_element(q->rx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_pool_put(&q->rx_pool, elem);
             err = -1;
             goto err;
         }
@@ -2000,7 +2144,14 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                 extra_hdr.hdr.num_buffers = cpu_to_le16(1);
             }
 
-            receive_header(n, sg, elem->in_num, buf, size);
+            if (gso_hdr) {
+                struct virtio_net_hdr hdr = *gso_hdr;
+
+                virtio_net_hdr_swap(vdev, &hdr);
+                iov_from_buf(sg, elem->in_num, 0, &hdr, sizeof(hdr));
+            } else {
+                receive_header(n, sg, elem->in_num, buf, size);
+            }
             if (n->rss_data.populate_hash) {
                 offset = offsetof(typeof(extra_hdr), hash_value_lo);
                 iov_from_buf(sg, elem->in_num, offset,
@@ -2026,7 +2177,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_unpop(q->rx_vq, elem, total);
-            g_free(elem);
+            virtqueue_element_pool_put(&q->rx_pool, elem);
             err = size;
             goto err;
         }
@@ -2047,7 +2198,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     for (j = 0; j < i; j++) {
         /* signal other side */
         virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
-        g_free(elems[j]);
+        virtqueue_element_pool_put(&q->rx_pool, elems[j]);
     }
 
     virtqueue_flush(q->rx_vq, i);
@@ -2058,18 +2209,309 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 err:
     for (j = 0; j < i; j++) {
         virtqueue_detach_element(q->rx_vq, elems[j], lens[j]);
-        g_free(elems[j]);
+        virtqueue_element_pool_put(&q->rx_pool, elems[j]);
     }
 
     return err;
 }
 
+/* A packet handed to another queue pair by software RSS */
+typedef struct VirtioNetRssPacket {
+    QSIMPLEQ_ENTRY(VirtioNetRssPacket) next;
+    struct virtio_net_hdr_v1_hash hash_hdr;
+    struct virtio_net_hdr gso_hdr;
+    bool has_gso_hdr;
+    size_t size;
+    uint8_t data[];
+} VirtioNetRssPacket;
+
+/*
+ * Deliver the packets steered to @q by other queue pairs.  Stops at the
+ * first packet that does not fit, virtio_net_handle_rx() retries when
+ * the guest adds buffers.
+ *
+ * Context: AioContext of @q
+ */
+static void virtio_net_rss_backlog_run(VirtIONetQueue *q)
+{
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+    VirtioNetRssPacket *pkt;
+
+    if (!qatomic_read(&q->rss_backlog_len)) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    for (;;) {
+        /* Other queue pairs only append, the head stays valid */
+        WITH_QEMU_LOCK_GUARD(&q->rss_lock) {
+            pkt = QSIMPLEQ_FIRST(&q->rss_backlog);
+        }
+        if (!pkt) {
+            break;
+        }
+
+        if (!virtio_net_receive_queue(nc, pkt->data, pkt->size,
+                                      pkt->has_gso_hdr ? &pkt->gso_hdr : NULL,
+                                      &pkt->hash_hdr)) {
+            break;
+        }
+
+        WITH_QEMU_LOCK_GUARD(&q->rss_lock) {
+            QSIMPLEQ_REMOVE_HEAD(&q->rss_backlog, next);
+            qatomic_set(&q->rss_backlog_len, q->rss_backlog_len - 1);
+        }
+        g_free(pkt);
+    }
+}
+
+static void virtio_net_rss_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    defer_call_begin();
+    virtio_net_rss_backlog_run(q);
+    defer_call_end();
+}
+
+/*
+ * Hand a packet to the queue pair of @nc.  With IOThreads, queue pairs
+ * may be processed in different AioContexts; the packet is then copied
+ * to the backlog of the target and delivered by its rss_bh, so that the
+ * copy to guest memory and the notification run on the thread of the
+ * target queue pair.  The backlog holds up to a virtqueue worth of
+ * packets and further packets are dropped.
+ */
+static ssize_t
+virtio_net_rss_steer(NetClientState *nc, const uint8_t *buf, size_t size,
+                     const struct virtio_net_hdr *gso_hdr,
+                     const struct virtio_net_hdr_v1_hash *hash_hdr)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtioNetRssPacket *pkt;
+
+    qemu_mutex_lock(&q->rss_lock);
+
+    if (q->rss_ctx == qemu_get_current_aio_context() &&
+        QSIMPLEQ_EMPTY(&q->rss_backlog)) {
+        qemu_mutex_unlock(&q->rss_lock);
+        return virtio_net_receive_queue(nc, buf, size, gso_hdr, hash_hdr);
+    }
+
+    if (q->rss_backlog_len < n->net_conf.rx_queue_size) {
+        pkt = g_malloc(sizeof(*pkt) + size);
+        pkt->hash_hdr = *hash_hdr;
+        pkt->has_gso_hdr = gso_hdr != NULL;
+        if (gso_hdr) {
+            pkt->gso_hdr = *gso_hdr;
+        }
+        pkt->size = size;
+        memcpy(pkt->data, buf, size);
+
+        QSIMPLEQ_INSERT_TAIL(&q->rss_backlog, pkt, next);
+        qatomic_set(&q->rss_backlog_len, q->rss_backlog_len + 1);
+
+        /* NULL while the queue pair moves, scheduled once it has moved */
+        if (q->rss_bh) {
+            qemu_bh_schedule(q->rss_bh);
+        }
+    }
+
+    qemu_mutex_unlock(&q->rss_lock);
+    return size;
+}
+
+static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
+                                      size_t size,
+                                      const struct virtio_net_hdr *gso_hdr)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtioNetRssSteering *rss = qatomic_rcu_read(&n->rss_steering);
+    struct virtio_net_hdr_v1_hash hash_hdr;
+
+    memset(&hash_hdr, 0, sizeof(hash_hdr));
+
+    if (rss) {
+        int index = virtio_net_process_rss(nc, rss, buf, size, &hash_hdr);
+        if (index >= 0) {
+            nc = qemu_get_subqueue(n->nic, index % n->curr_queue_pairs);
+            if (n->vq_aio_context) {
+                return virtio_net_rss_steer(nc, buf, size, gso_hdr,
+                                            &hash_hdr);
+            }
+        }
+    }
+
+    return virtio_net_receive_queue(nc, buf, size, gso_hdr, &hash_hdr);
+}
+
 static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     RCU_READ_LOCK_GUARD();
 
-    return virtio_net_receive_rcu(nc, buf, size);
+    return virtio_net_receive_rcu(nc, buf, size, NULL);
+}
+
+/*
+ * Zero-copy receive: receive buffers are posted to the peer, which
+ * stores frames in guest memory and completes them with
+ * virtio_net_rx_complete_buffer().  Features that need to look at or
+ * rewrite the packet before it is placed, or a vnet header from the
+ * peer, use the copy path.
+ */
+static bool virtio_net_rx_zc_possible(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+
+    if (q->ctx || n->rss_data.enabled || n->rss_data.populate_hash ||
+        n->rsc4_enabled || n->rsc6_enabled || n->host_hdr_len) {
+        return false;
+    }
+
+    return virtio_net_can_receive(nc) && qemu_can_post_rx_buffers(nc);
+}
+
+/* The peer gets the slot in rx_zc as the opaque of the buffer */
+static bool virtio_net_rx_zc_add(VirtIONetQueue *q, VirtQueueElement *elem)
+{
+    VirtIONet *n = q->n;
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+    unsigned int slot = virtio_net_rx_zc_ring_tail(&q->rx_zc);
+
+    /*
+     * The header and the frame must be contiguous in guest memory.  After
+     * an out of order completion the ring can be full with fewer buffers
+     * posted, and the tail slot is still in use.
+     */
+    if (virtio_net_rx_zc_ring_full(&q->rx_zc) || elem->in_num != 1 ||
+        !qemu_post_rx_buffer(nc, elem->in_sg[0].iov_base,
+                             elem->in_sg[0].iov_len, n->guest_hdr_len,
+                             GUINT_TO_POINTER(slot))) {
+        return false;
+    }
+
+    virtio_net_rx_zc_ring_push(&q->rx_zc, elem);
+    return true;
+}
+
+static void virtio_net_rx_zc_post(VirtIONetQueue *q)
+{
+    VirtQueueElement *elem;
+
+    if (!virtio_net_rx_zc_possible(q)) {
+        return;
+    }
+
+    while (!virtio_net_rx_zc_ring_full(&q->rx_zc)) {
+        if (!virtqueue_pop_batch(q->rx_vq, &q->rx_pool, &elem, 1)) {
+            /* Get a kick when the guest adds buffers */
+            virtio_queue_set_notification(q->rx_vq, 1);
+            if (!virtqueue_pop_batch(q->rx_vq, &q->rx_pool, &elem, 1)) {
+                break;
+            }
+        }
+
+        if (!q->rx_zc.num) {
+            q->rx_zc_unpop = true;
+        }
+
+        if (!virtio_net_rx_zc_add(q, elem)) {
+            /* Leave it to the copy path */
+            virtqueue_unpop_batch(q->rx_vq, &elem, 1);
+            virtqueue_element_pool_put(&q->rx_pool, elem);
+            break;
+        }
+    }
+}
+
+/* Take back the posted buffers, e.g. when the queue is stopped. */
+static void virtio_net_rx_zc_reclaim(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+    VirtIONetRxZcRing *r = &q->rx_zc;
+    g_autofree VirtQueueElement **elems = NULL;
+    unsigned int i, num = 0;
+
+    if (!r->num) {
+        return;
+    }
+
+    qemu_reclaim_rx_buffers(qemu_get_subqueue(n->nic, q - n->vqs));
+
+    elems = g_new(VirtQueueElement *, r->num);
+    for (i = 0; i < r->num; i++) {
+        unsigned int slot = (r->head + i) % r->size;
+
+        if (r->slots[slot]) {
+            elems[num++] = r->slots[slot];
+            r->slots[slot] = NULL;
+        }
+    }
+    r->head = 0;
+    r->num = 0;
+
+    RCU_READ_LOCK_GUARD();
+
+    if (q->rx_zc_unpop) {
+        virtqueue_unpop_batch(q->rx_vq, elems, num);
+    } else {
+        /* Buffers after them were used already, return them empty */
+        virtqueue_push_batch(q->rx_vq, elems, NULL, num);
+        virtio_notify(VIRTIO_DEVICE(n), q->rx_vq);
+    }
+
+    for (i = 0; i < num; i++) {
+        virtqueue_element_pool_put(&q->rx_pool, elems[i]);
+    }
+}
+
+static void virtio_net_rx_complete_buffer(NetClientState *nc, void *opaque,
+                                          size_t len)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    unsigned int slot = GPOINTER_TO_UINT(opaque);
+    VirtQueueElement *elem = q->rx_zc.slots[slot];
+    uint16_t num_buffers;
+    void *frame;
+
+    RCU_READ_LOCK_GUARD();
+
+    if (!virtio_net_rx_zc_ring_take(&q->rx_zc, slot)) {
+        /* Completed out of order, the remaining ones leave a hole */
+        q->rx_zc_unpop = false;
+    }
+
+    frame = elem->in_sg[0].iov_base + n->guest_hdr_len;
+    if (!receive_filter(n, frame, len)) {
+        /* Drop the frame and give the buffer back to the peer if possible */
+        q->rx_zc_unpop = false;
+        if (virtio_net_rx_zc_add(q, elem)) {
+            return;
+        }
+        len = 0;
+    } else {
+        receive_header(n, elem->in_sg, 1, frame, len);
+        if (n->guest_hdr_len >= sizeof(struct virtio_net_hdr_mrg_rxbuf)) {
+            virtio_stw_p(vdev, &num_buffers, 1);
+            iov_from_buf(elem->in_sg, 1,
+                         offsetof(struct virtio_net_hdr_mrg_rxbuf, num_buffers),
+                         &num_buffers, sizeof(num_buffers));
+        }
+        len += n->guest_hdr_len;
+    }
+
+    virtqueue_fill(q->rx_vq, elem, len, 0);
+    virtqueue_element_pool_put(&q->rx_pool, elem);
+    virtqueue_flush(q->rx_vq, 1);
+    virtio_notify(vdev, q->rx_vq);
+
+    virtio_net_rx_zc_post(q);
 }
 
 /*
@@ -2680,18 +3122,83 @@ static ssize_t virtio_net_rsc_receive(NetClientState *nc,
     return virtio_net_do_receive(nc, buf, size);
 }
 
-static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
-                                  size_t size)
+/*
+ * Without vnet headers from the peer, TCP segments are coalesced in
+ * software for guests that accept TSO packets.
+ */
+static unsigned int virtio_net_gro_types(VirtIONet *n)
 {
-    VirtIONet *n = qemu_get_nic_opaque(nc);
-    if ((n->rsc4_enabled || n->rsc6_enabled)) {
-        /* this never happens with existing backends, but just in case. */
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            warn_report_once("virtio-net: host_hdr_len %zu != guest_hdr_len %zu, "
-                             "skipping RSC",
-                             n->host_hdr_len, n->guest_hdr_len);
-            return virtio_net_do_receive(nc, buf, size);
-        }
+    unsigned int types = 0;
+
+    if (!n->rx_gro || n->has_vnet_hdr ||
+        !(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_CSUM))) {
+        return 0;
+    }
+
+    if (n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO4)) {
+        types |= NET_GRO_TCPV4;
+    }
+    if (n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO6)) {
+        types |= NET_GRO_TCPV6;
+    }
+    return types;
+}
+
+/*
+ * A packet that does not fit in the queue stays held by the GRO engine,
+ * see virtio_net_gro_retry().
+ */
+static bool virtio_net_gro_flush(void *opaque, const struct virtio_net_hdr *hdr,
+                                 const uint8_t *buf, size_t size)
+{
+    VirtIONetQueue *q = opaque;
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+
+    RCU_READ_LOCK_GUARD();
+
+    if (!virtio_net_can_receive(nc)) {
+        return false;
+    }
+    return virtio_net_receive_rcu(nc, buf, size, hdr) != 0;
+}
+
+static ssize_t virtio_net_gro_receive(NetClientState *nc, const uint8_t *buf,
+                                      size_t size, unsigned int types)
+{
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    if (!q->gro) {
+        q->gro = net_gro_new(virtio_net_gro_flush, q);
+    }
+
+    switch (net_gro_receive(q->gro, buf, size, types)) {
+    case NET_GRO_HELD:
+        return size;
+    case NET_GRO_BUSY:
+        /* Queued by the net layer until virtio_net_handle_rx() */
+        return 0;
+    default:
+        return virtio_net_do_receive(nc, buf, size);
+    }
+}
+
+static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
+                                  size_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    unsigned int gro_types = virtio_net_gro_types(n);
+
+    if (gro_types) {
+        return virtio_net_gro_receive(nc, buf, size, gro_types);
+    }
+    if ((n->rsc4_enabled || n->rsc6_enabled)) {
+        /* this never happens with existing backends, but just in case. */
+        if (n->host_hdr_len != n->guest_hdr_len) {
+            warn_report_once("virtio-net: host_hdr_len %zu != guest_hdr_len %zu, "
+                             "skipping RSC",
+                             n->host_hdr_len, n->guest_hdr_len);
+            return virtio_net_do_receive(nc, buf, size);
+        }
         return virtio_net_rsc_receive(nc, buf, size);
     } else {
         return virtio_net_do_receive(nc, buf, size);
@@ -2710,7 +3217,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_pool_put(&q->tx_pool, q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2732,14 +3239,97 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     }
 }
 
+/*
+ * Send the packet of a tx element.  Returns 1 if the element can be
+ * completed, 0 if the peer queued the packet and will call
+ * virtio_net_tx_complete(), and -EINVAL if the element is invalid.
+ */
+static int virtio_net_tx_send(VirtIONetQueue *q, VirtQueueElement *elem)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    ssize_t ret;
+    unsigned int out_num;
+    struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
+    struct virtio_net_hdr vhdr;
+
+    out_num = elem->out_num;
+    out_sg = elem->out_sg;
+    if (out_num < 1) {
+        virtio_error(vdev, "virtio-net header not in first element");
+        return -EINVAL;
+    }
+
+    if (n->needs_vnet_hdr_swap) {
+        if (iov_to_buf(out_sg, out_num, 0, &vhdr, sizeof(vhdr)) <
+            sizeof(vhdr)) {
+            virtio_error(vdev, "virtio-net header incorrect");
+            return -EINVAL;
+        }
+        virtio_net_hdr_swap(vdev, &vhdr);
+        sg2[0].iov_base = &vhdr;
+        sg2[0].iov_len = sizeof(vhdr);
+        out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1, out_sg, out_num,
+                           sizeof(vhdr), -1);
+        if (out_num == VIRTQUEUE_MAX_SIZE) {
+            /* drop */
+            return 1;
+        }
+        out_num += 1;
+        out_sg = sg2;
+    }
+    /*
+     * If host wants to see the guest header as is, we can
+     * pass it on unchanged. Otherwise, copy just the parts
+     * that host is interested in.
+     */
+    assert(n->host_hdr_len <= n->guest_hdr_len);
+    if (n->host_hdr_len != n->guest_hdr_len) {
+        if (iov_size(out_sg, out_num) < n->guest_hdr_len) {
+            virtio_error(vdev, "virtio-net header is invalid");
+            return -EINVAL;
+        }
+        unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                   out_sg, out_num,
+                                   0, n->host_hdr_len);
+        sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                         out_sg, out_num,
+                         n->guest_hdr_len, -1);
+        out_num = sg_num;
+        out_sg = sg;
+
+        if (out_num < 1) {
+            virtio_error(vdev, "virtio-net nothing to send");
+            return -EINVAL;
+        }
+    }
+
+    ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
+                                  out_sg, out_num, virtio_net_tx_complete);
+    return ret == 0 ? 0 : 1;
+}
+
+static void virtio_net_tx_release(VirtIONetQueue *q, VirtQueueElement **elems,
+                                  unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        virtqueue_element_pool_put(&q->tx_pool, elems[i]);
+    }
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement *elem;
+    VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
+    unsigned int i, num, rest;
     int32_t num_packets = 0;
-    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    int ret = 1;
+
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2749,90 +3339,49 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
-    for (;;) {
-        ssize_t ret;
-        unsigned int out_num;
-        struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr vhdr;
-
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
+    while (num_packets < n->tx_burst) {
+        num = virtqueue_pop_batch(q->tx_vq, &q->tx_pool, elems,
+                                  MIN(ARRAY_SIZE(elems),
+                                      n->tx_burst - num_packets));
+        if (!num) {
             break;
         }
 
-        out_num = elem->out_num;
-        out_sg = elem->out_sg;
-        if (out_num < 1) {
-            virtio_error(vdev, "virtio-net header not in first element");
-            goto detach;
+        for (i = 0; i < num; i++) {
+            ret = virtio_net_tx_send(q, elems[i]);
+            if (ret <= 0) {
+                break;
+            }
         }
 
-        if (n->needs_vnet_hdr_swap) {
-            if (iov_to_buf(out_sg, out_num, 0, &vhdr, sizeof(vhdr)) <
-                sizeof(vhdr)) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                goto detach;
-            }
-            virtio_net_hdr_swap(vdev, &vhdr);
-            sg2[0].iov_base = &vhdr;
-            sg2[0].iov_len = sizeof(vhdr);
-            out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1, out_sg, out_num,
-                               sizeof(vhdr), -1);
-            if (out_num == VIRTQUEUE_MAX_SIZE) {
-                goto drop;
-            }
-            out_num += 1;
-            out_sg = sg2;
+        /* Complete what was sent with a single flush and notification */
+        if (i) {
+            virtqueue_push_batch(q->tx_vq, elems, NULL, i);
+            virtio_notify(vdev, q->tx_vq);
+            virtio_net_tx_release(q, elems, i);
+            num_packets += i;
         }
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            if (iov_size(out_sg, out_num) < n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header is invalid");
-                goto detach;
-            }
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
-
-            if (out_num < 1) {
-                virtio_error(vdev, "virtio-net nothing to send");
-                goto detach;
-            }
+
+        if (i == num) {
+            continue;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        /* Give back the elements after the one that stopped the batch */
+        rest = num - i - 1;
+        virtqueue_unpop_batch(q->tx_vq, elems + i + 1, rest);
+        virtio_net_tx_release(q, elems + i + 1, rest);
+
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
+            q->async_tx.elem = elems[i];
             return -EBUSY;
         }
 
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
-        if (++num_packets >= n->tx_burst) {
-            break;
-        }
+        virtqueue_detach_element(q->tx_vq, elems[i], 0);
+        virtqueue_element_pool_put(&q->tx_pool, elems[i]);
+        return -EINVAL;
     }
     return num_packets;
-
-detach:
-    virtqueue_detach_element(q->tx_vq, elem, 0);
-    g_free(elem);
-    return -EINVAL;
 }
 
 static void virtio_net_tx_timer(void *opaque);
@@ -2991,6 +3540,69 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+static bool virtio_net_tx_uses_timer(VirtIONet *n)
+{
+    return n->net_conf.tx && !strcmp(n->net_conf.tx, "timer");
+}
+
+/* Create the tx timer or bottom half in the AioContext of the queue pair */
+static void virtio_net_tx_handler_new(VirtIONetQueue *q)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+    DeviceState *transport = qdev_get_parent_bus(DEVICE(vdev))->parent;
+
+    if (virtio_net_tx_uses_timer(q->n)) {
+        if (q->ctx) {
+            q->tx_timer = aio_timer_new(q->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                        virtio_net_tx_timer, q);
+        } else {
+            q->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                       virtio_net_tx_timer, q);
+        }
+    } else {
+        if (q->ctx) {
+            q->tx_bh = aio_bh_new_guarded(q->ctx, virtio_net_tx_bh, q,
+                                          &transport->mem_reentrancy_guard);
+        } else {
+            q->tx_bh = virtio_bh_new_guarded(DEVICE(vdev),
+                                             virtio_net_tx_bh, q);
+        }
+    }
+}
+
+static void virtio_net_tx_handler_delete(VirtIONetQueue *q)
+{
+    if (q->tx_timer) {
+        timer_free(q->tx_timer);
+        q->tx_timer = NULL;
+    } else {
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = NULL;
+    }
+}
+
+/*
+ * Deliver the software RSS backlog of @q in @ctx, or in the main loop if
+ * @ctx is NULL.  Nothing may run in the old AioContext of the queue pair.
+ */
+static void virtio_net_rss_set_aio_context(VirtIONetQueue *q, AioContext *ctx)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+    DeviceState *transport = qdev_get_parent_bus(DEVICE(vdev))->parent;
+
+    QEMU_LOCK_GUARD(&q->rss_lock);
+
+    if (q->rss_bh) {
+        qemu_bh_delete(q->rss_bh);
+    }
+    q->rss_ctx = ctx ?: qemu_get_aio_context();
+    q->rss_bh = aio_bh_new_guarded(q->rss_ctx, virtio_net_rss_bh, q,
+                                   &transport->mem_reentrancy_guard);
+    if (!QSIMPLEQ_EMPTY(&q->rss_backlog)) {
+        qemu_bh_schedule(q->rss_bh);
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2998,24 +3610,39 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
     n->vqs[index].rx_vq = virtio_add_queue(vdev, n->net_conf.rx_queue_size,
                                            virtio_net_handle_rx);
 
-    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+    if (virtio_net_tx_uses_timer(n)) {
         n->vqs[index].tx_vq =
             virtio_add_queue(vdev, n->net_conf.tx_queue_size,
                              virtio_net_handle_tx_timer);
-        n->vqs[index].tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
-                                              virtio_net_tx_timer,
-                                              &n->vqs[index]);
     } else {
         n->vqs[index].tx_vq =
             virtio_add_queue(vdev, n->net_conf.tx_queue_size,
                              virtio_net_handle_tx_bh);
-        n->vqs[index].tx_bh = virtio_bh_new_guarded(DEVICE(vdev),
-                                                    virtio_net_tx_bh,
-                                                    &n->vqs[index]);
     }
 
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
+    n->vqs[index].ctx = NULL;
+    virtqueue_element_pool_init(&n->vqs[index].rx_pool,
+                                sizeof(VirtQueueElement),
+                                n->net_conf.rx_queue_size,
+                                VIRTIO_NET_POOL_SG_MAX);
+    virtqueue_element_pool_init(&n->vqs[index].tx_pool,
+                                sizeof(VirtQueueElement),
+                                n->net_conf.tx_queue_size,
+                                VIRTIO_NET_POOL_SG_MAX);
+    n->vqs[index].rx_zc = (VirtIONetRxZcRing) {
+        .slots = g_new0(void *, n->net_conf.rx_queue_size),
+        .size = n->net_conf.rx_queue_size,
+    };
+    n->vqs[index].gro = NULL;
+    net_rx_pkt_init(&n->vqs[index].rx_pkt);
+    qemu_mutex_init(&n->vqs[index].rss_lock);
+    QSIMPLEQ_INIT(&n->vqs[index].rss_backlog);
+    n->vqs[index].rss_backlog_len = 0;
+    n->vqs[index].rss_bh = NULL;
+    virtio_net_rss_set_aio_context(&n->vqs[index], NULL);
+    virtio_net_tx_handler_new(&n->vqs[index]);
 }
 
 static void virtio_net_del_queue(VirtIONet *n, int index)
@@ -3024,18 +3651,33 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     VirtIONetQueue *q = &n->vqs[index];
     NetClientState *nc = qemu_get_subqueue(n->nic, index);
 
+    assert(!q->ctx);
+    virtio_net_rx_zc_reclaim(q);
     qemu_purge_queued_packets(nc);
 
     virtio_del_queue(vdev, index * 2);
-    if (q->tx_timer) {
-        timer_free(q->tx_timer);
-        q->tx_timer = NULL;
-    } else {
-        qemu_bh_delete(q->tx_bh);
-        q->tx_bh = NULL;
-    }
+    virtio_net_tx_handler_delete(q);
     q->tx_waiting = 0;
     virtio_del_queue(vdev, index * 2 + 1);
+    virtqueue_element_pool_destroy(&q->rx_pool);
+    virtqueue_element_pool_destroy(&q->tx_pool);
+    g_free(q->rx_zc.slots);
+    q->rx_zc.slots = NULL;
+    net_gro_free(q->gro);
+    q->gro = NULL;
+    net_rx_pkt_uninit(q->rx_pkt);
+    q->rx_pkt = NULL;
+
+    qemu_bh_delete(q->rss_bh);
+    q->rss_bh = NULL;
+    while (!QSIMPLEQ_EMPTY(&q->rss_backlog)) {
+        VirtioNetRssPacket *pkt = QSIMPLEQ_FIRST(&q->rss_backlog);
+
+        QSIMPLEQ_REMOVE_HEAD(&q->rss_backlog, next);
+        g_free(pkt);
+    }
+    q->rss_backlog_len = 0;
+    qemu_mutex_destroy(&q->rss_lock);
 }
 
 static void virtio_net_change_num_queues(VirtIONet *n, int new_num_queues)
@@ -3114,9 +3756,15 @@ static void virtio_net_get_features(VirtIODevice *vdev, uint64_t *features,
         virtio_clear_feature_ex(features, VIRTIO_NET_F_HOST_TSO6);
         virtio_clear_feature_ex(features, VIRTIO_NET_F_HOST_ECN);
 
-        virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_CSUM);
-        virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_TSO4);
-        virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_TSO6);
+        /* Coalesced TCP segments are checksum offloaded GSO packets */
+        if (!n->rx_gro) {
+            virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_CSUM);
+            virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_TSO4);
+            virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_TSO6);
+        } else {
+            /* RSC needs the vnet header of the peer */
+            virtio_clear_feature_ex(features, VIRTIO_NET_F_RSC_EXT);
+        }
         virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_ECN);
 
         virtio_clear_feature_ex(features, VIRTIO_NET_F_HOST_USO);
@@ -3153,6 +3801,11 @@ static void virtio_net_get_features(VirtIODevice *vdev, uint64_t *features,
     }
 
     if (!get_vhost_net(nc->peer)) {
+        if (n->vq_aio_context) {
+            /* queue reset would race with the IOThread processing the vq */
+            virtio_clear_feature_ex(features, VIRTIO_F_RING_RESET);
+        }
+
         if (!use_own_hash) {
             virtio_clear_feature_ex(features, VIRTIO_NET_F_HASH_REPORT);
             virtio_clear_feature_ex(features, VIRTIO_NET_F_RSS);
@@ -3657,6 +4310,7 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .rx_complete_buffer = virtio_net_rx_complete_buffer,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
@@ -3666,6 +4320,20 @@ static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc;
+
+    if (n->vq_aio_context && !n->vhost_started) {
+        /* guest notifiers are used by the IOThreads, not by vhost */
+        EventNotifier *notifier;
+
+        if (idx == VIRTIO_CONFIG_IRQ_IDX) {
+            notifier = virtio_config_get_guest_notifier(vdev);
+        } else {
+            notifier = virtio_queue_get_guest_notifier(
+                virtio_get_queue(vdev, idx));
+        }
+        return event_notifier_test_and_clear(notifier);
+    }
+
     assert(n->vhost_started);
     if (!n->multiqueue && idx == 2) {
         /* Must guard against invalid features and bogus queue index
@@ -3890,6 +4558,286 @@ static bool failover_hide_primary_device(DeviceListener *listener,
     return qatomic_read(&n->failover_primary_hidden);
 }
 
+/* Context: BQL held */
+static bool virtio_net_vq_aio_context_init(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (!n->iothread && !n->iothread_vq_mapping_list) {
+        return true;
+    }
+
+    if (n->iothread && n->iothread_vq_mapping_list) {
+        error_setg(errp,
+                   "iothread and iothread-vq-mapping properties cannot be set "
+                   "at the same time");
+        return false;
+    }
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp,
+                   "device is incompatible with iothread "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread");
+        return false;
+    }
+
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "iothread is not supported with vhost");
+            return false;
+        }
+        if (!qemu_has_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' does not support iothread",
+                       peer->name);
+            return false;
+        }
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            error_setg(errp, "iothread is not supported with netdev filters");
+            return false;
+        }
+    }
+
+    /* RSC keeps its coalescing timers in the main loop */
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "iothread is not supported with guest_rsc_ext");
+        return false;
+    }
+
+    n->vq_aio_context = g_new(AioContext *, n->max_queue_pairs);
+
+    if (n->iothread_vq_mapping_list) {
+        if (!iothread_vq_mapping_apply(n->iothread_vq_mapping_list,
+                                       n->vq_aio_context,
+                                       n->max_queue_pairs,
+                                       errp)) {
+            g_free(n->vq_aio_context);
+            n->vq_aio_context = NULL;
+            return false;
+        }
+    } else {
+        AioContext *ctx = iothread_get_aio_context(n->iothread);
+        for (i = 0; i < n->max_queue_pairs; i++) {
+            n->vq_aio_context[i] = ctx;
+        }
+
+        /* Released in virtio_net_vq_aio_context_cleanup() */
+        object_ref(OBJECT(n->iothread));
+    }
+
+    /* virtio_net_guest_notifier_mask() only knows about vhost */
+    vdev->use_guest_notifier_mask = false;
+    return true;
+}
+
+/* Context: BQL held */
+static void virtio_net_vq_aio_context_cleanup(VirtIONet *n)
+{
+    assert(!n->ioeventfd_started);
+
+    if (!n->vq_aio_context) {
+        return;
+    }
+
+    if (n->iothread_vq_mapping_list) {
+        iothread_vq_mapping_cleanup(n->iothread_vq_mapping_list);
+    }
+
+    if (n->iothread) {
+        object_unref(OBJECT(n->iothread));
+    }
+
+    g_free(n->vq_aio_context);
+    n->vq_aio_context = NULL;
+}
+
+/*
+ * Move the queue pair and its peer to @ctx.  Nothing may run in the old
+ * AioContext of the queue pair.
+ *
+ * Context: BQL held
+ */
+static void virtio_net_queue_set_aio_context(VirtIONetQueue *q,
+                                             AioContext *ctx)
+{
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+
+    virtio_net_tx_handler_delete(q);
+    q->ctx = ctx;
+    virtio_net_tx_handler_new(q);
+    virtio_net_rss_set_aio_context(q, ctx);
+    if (nc->ctx != ctx) {
+        qemu_set_net_aio_context(nc, ctx);
+    }
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_ioeventfd_start_queue(VirtIONetQueue *q, void *opaque)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+    uint8_t queue_status = virtio_net_queue_status(n, q - n->vqs,
+                                                   vdev->status);
+
+    /* Attaching the notifiers also kicks the virtqueues */
+    virtio_queue_aio_attach_host_notifier(q->rx_vq, q->ctx);
+    virtio_queue_aio_attach_host_notifier(q->tx_vq, q->ctx);
+
+    /* Packets queued while the main loop owned the queue pair */
+    if (nc->peer) {
+        qemu_flush_queued_packets(nc->peer);
+    }
+    virtio_net_queue_set_status(q, &queue_status);
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_ioeventfd_stop_queue(VirtIONetQueue *q, void *opaque)
+{
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+    VirtQueue *vqs[] = { q->rx_vq, q->tx_vq };
+
+    for (int i = 0; i < ARRAY_SIZE(vqs); i++) {
+        virtio_queue_aio_detach_host_notifier(vqs[i], q->ctx);
+
+        /*
+         * Test and clear notifier after disabling event, in case poll
+         * callback didn't have time to run.
+         */
+        virtio_queue_host_notifier_read(virtio_queue_get_host_notifier(vqs[i]));
+    }
+
+    if (q->tx_timer) {
+        timer_del(q->tx_timer);
+    } else {
+        qemu_bh_cancel(q->tx_bh);
+    }
+
+    /* Packets steered here until the move wait in the backlog */
+    WITH_QEMU_LOCK_GUARD(&q->rss_lock) {
+        qemu_bh_delete(q->rss_bh);
+        q->rss_bh = NULL;
+        q->rss_ctx = NULL;
+    }
+
+    if (!runstate_is_running()) {
+        /* see net_vm_change_state_handler() */
+        qemu_flush_or_purge_queued_packets(nc, true);
+        if (nc->peer) {
+            qemu_flush_or_purge_queued_packets(nc->peer, true);
+        }
+    }
+
+    qemu_set_net_aio_context(nc, NULL);
+}
+
+/*
+ * With IOThreads, the rx and tx virtqueues of each queue pair and the fd
+ * of its peer are processed in the AioContext of the queue pair while
+ * ioeventfd is started, and in the main loop otherwise.  The control
+ * virtqueue always stays in the main loop.
+ *
+ * Context: BQL held
+ */
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int queue_pairs = n->multiqueue ? n->max_queue_pairs : 1;
+    int i, r;
+
+    if (!n->vq_aio_context) {
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+
+    if (n->ioeventfd_started) {
+        return 0;
+    }
+
+    for (i = 0; i < queue_pairs; i++) {
+        NetClientState *nc = qemu_get_subqueue(n->nic, i);
+
+        /* filters may have been added since realize */
+        if (nc->peer && !QTAILQ_EMPTY(&nc->peer->filters)) {
+            error_report("virtio-net: netdev '%s' has filters, cannot use "
+                         "iothread", nc->peer->name);
+            return -ENOTSUP;
+        }
+    }
+
+    /* Set up guest notifier (irq) */
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set.", r);
+        return -ENOSYS;
+    }
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r < 0) {
+        k->set_guest_notifiers(qbus->parent, nvqs, false);
+        return r;
+    }
+
+    n->ioeventfd_started = true;
+
+    for (i = 0; i < queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        /* Stop processing the queue pair in the main loop */
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq),
+                                   NULL);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq),
+                                   NULL);
+
+        virtio_net_queue_set_aio_context(q, n->vq_aio_context[i]);
+        virtio_net_queue_run(q, virtio_net_ioeventfd_start_queue, NULL);
+    }
+    return 0;
+}
+
+/* Context: BQL held */
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queue_pairs = n->multiqueue ? n->max_queue_pairs : 1;
+    int i;
+
+    if (!n->vq_aio_context) {
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return;
+    }
+
+    if (!n->ioeventfd_started) {
+        return;
+    }
+
+    for (i = 0; i < queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        virtio_net_queue_run(q, virtio_net_ioeventfd_stop_queue, NULL);
+        virtio_net_queue_set_aio_context(q, NULL);
+    }
+
+    n->ioeventfd_started = false;
+    virtio_device_stop_ioeventfd_impl(vdev);
+
+    /* Clean up guest notifier (irq) */
+    k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev), false);
+}
+
 static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -3934,6 +4882,8 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     virtio_net_set_config_size(n, n->host_features);
     virtio_init(vdev, VIRTIO_ID_NET, n->config_size);
+    /* Net backends deliver packets in defer_call_begin() sections */
+    vdev->defer_notify = true;
 
     /*
      * We set a lower limit on RX queue size to what it always was.
@@ -3984,6 +4934,21 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+    if (!virtio_net_vq_aio_context_init(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
+
+    if (n->vq_aio_context) {
+        error_setg(&n->migration_blocker,
+                   "virtio-net does not support migration with iothread");
+        if (migrate_add_blocker(&n->migration_blocker, errp) < 0) {
+            virtio_net_vq_aio_context_cleanup(n);
+            virtio_cleanup(vdev);
+            return;
+        }
+    }
+
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -4058,8 +5023,6 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     QTAILQ_INIT(&n->rsc_chains);
     n->qdev = dev;
 
-    net_rx_pkt_init(&n->rx_pkt);
-
     if (qemu_get_vnet_hash_supported_types(qemu_get_queue(n->nic)->peer,
                                            &n->rss_data.peer_hash_types)) {
         n->rss_data.peer_hash_available = true;
@@ -4114,7 +5077,9 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
-    net_rx_pkt_uninit(n->rx_pkt);
+    g_free(n->rss_steering);
+    migrate_del_blocker(&n->migration_blocker);
+    virtio_net_vq_aio_context_cleanup(n);
     virtio_cleanup(vdev);
 }
 
@@ -4278,6 +5243,7 @@ static const Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_BOOL("rx-gro", VirtIONet, rx_gro, true),
     DEFINE_PROP_BIT64("guest_uso4", VirtIONet, host_features,
                       VIRTIO_NET_F_GUEST_USO4, true),
     DEFINE_PROP_BIT64("guest_uso6", VirtIONet, host_features,
@@ -4336,6 +5302,10 @@ static const Property virtio_net_properties[] = {
                                host_features_ex,
                                VIRTIO_NET_F_GUEST_UDP_TUNNEL_GSO_CSUM,
                                true),
+    DEFINE_PROP_LINK("iothread", VirtIONet, iothread, TYPE_IOTHREAD,
+                     IOThread *),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIONet,
+                                         iothread_vq_mapping_list),
 };
 
 static void virtio_net_class_init(ObjectClass *klass, const void *data)
@@ -4359,6 +5329,8 @@ static void virtio_net_class_init(ObjectClass *klass, const void *data)
     vdc->set_status = virtio_net_set_status;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
     vdc->pre_load_queues = virtio_net_pre_load_queues;
     vdc->post_load = virtio_net_post_load_virtio;
@@ -40,6 +40,7 @@
  *              sriov_vi_flexible=<N[optional]> \
  *              sriov_max_vi_per_vf=<N[optional]> \
  *              sriov_max_vq_per_vf=<N[optional]> \
+ *              iothread=<iothread_id[optional]> \
  *              atomic.dn=<on|off[optional]>, \
  *              atomic.awun<N[optional]>, \
  *              atomic.awupf<N[optional]>, \
@@ -152,6 +153,20 @@
  *   a secondary controller. The default 0 resolves to
  *   `(sriov_vq_flexible / sriov_max_vfs)`.
  *
+ * - `iothread`
+ *   Process the I/O queues in the given IOThread instead of the main loop.
+ *   The admin queue is always processed in the main loop.
+ *
+ * - `iothread-vq-mapping`
+ *   Spread the I/O queues over several IOThreads, using the same syntax as
+ *   the virtio-blk parameter of the same name. I/O Completion Queue `cqid`
+ *   is queue index `cqid - 1` in the mapping and the Submission Queues
+ *   follow the Completion Queue they post to. Cannot be combined with
+ *   `iothread`.
+ *
+ *   Zoned namespaces, atomic writes and Flexible Data Placement are not
+ *   available when IOThreads are used, and migration is blocked.
+ *
  * nvme namespace device parameters
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * - `shared`
@@ -200,6 +215,9 @@
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
+#include "qemu/aio-wait.h"
+#include "qemu/timer.h"
+#include "qemu/bitmap.h"
 #include "qemu/units.h"
 #include "qemu/range.h"
 #include "qapi/error.h"
@@ -210,6 +228,7 @@
 #include "hw/pci/msix.h"
 #include "hw/pci/pcie_sriov.h"
 #include "system/spdm-socket.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "migration/blocker.h"
 #include "migration/qemu-file-types.h"
 #include "migration/vmstate.h"
@@ -263,6 +282,8 @@ static const uint32_t nvme_feature_cap[NVME_FID_MAX] = {
     [NVME_ERROR_RECOVERY]           = NVME_FEAT_CAP_CHANGE | NVME_FEAT_CAP_NS,
     [NVME_VOLATILE_WRITE_CACHE]     = NVME_FEAT_CAP_CHANGE,
     [NVME_NUMBER_OF_QUEUES]         = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_COALESCING]     = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_VECTOR_CONF]    = NVME_FEAT_CAP_CHANGE,
     [NVME_WRITE_ATOMICITY]          = NVME_FEAT_CAP_CHANGE,
     [NVME_ASYNCHRONOUS_EVENT_CONF]  = NVME_FEAT_CAP_CHANGE,
     [NVME_TIMESTAMP]                = NVME_FEAT_CAP_CHANGE,
@@ -711,6 +732,115 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+static bool nvme_cq_in_iothread(NvmeCQueue *cq)
+{
+    return cq->ctx != qemu_get_aio_context();
+}
+
+/*
+ * Interrupt state is protected by the BQL, so completion queues serviced by
+ * an IOThread kick cq->irq_notifier and let the main loop update it here.
+ *
+ * Context: BQL held
+ */
+static void nvme_cq_update_irq(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    bool pending = qatomic_read(&cq->tail) != qatomic_read(&cq->head);
+
+    if (cq->irq_enabled && pending != cq->irq_pending) {
+        n->cq_pending += pending ? 1 : -1;
+    }
+    cq->irq_pending = pending;
+
+    if (!pending) {
+        nvme_irq_deassert(n, cq);
+    }
+}
+
+static bool nvme_cq_coalescing(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    uint32_t intc = n->features.int_coalescing;
+
+    /* coalescing never applies to the admin completion queue */
+    if (!cq->cqid || !cq->irq_enabled) {
+        return false;
+    }
+
+    /* an aggregation threshold of 0h or a time of 0h means no delay */
+    if (!NVME_INTC_THR(intc) || !NVME_INTC_TIME(intc)) {
+        return false;
+    }
+
+    return !test_bit(cq->vector, n->features.intvc_cd);
+}
+
+static void nvme_cq_coalesce_timer(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    trace_pci_nvme_irq_coalesced(cq->cqid, cq->vector, cq->coalesced);
+    cq->coalesced = 0;
+
+    /* the host may have reaped the entries by polling in the meantime */
+    if (qatomic_read(&cq->tail) != qatomic_read(&cq->head)) {
+        nvme_irq_assert(cq->ctrl, cq);
+    }
+}
+
+/*
+ * Raise the interrupt of @cq after @nr_cqes new entries were posted, unless
+ * Interrupt Coalescing (FID 08h) says to wait for more of them. The
+ * aggregation time bounds the delay.
+ */
+static void nvme_cq_notify(NvmeCtrl *n, NvmeCQueue *cq, uint32_t nr_cqes)
+{
+    uint32_t intc = n->features.int_coalescing;
+
+    cq->coalesced += nr_cqes;
+
+    /* the aggregation threshold is 0's based */
+    if (nvme_cq_coalescing(cq) && cq->coalesced <= NVME_INTC_THR(intc)) {
+        if (!timer_pending(cq->coalesce_timer)) {
+            timer_mod(cq->coalesce_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                      NVME_INTC_TIME(intc) * 100 * SCALE_US);
+        }
+
+        return;
+    }
+
+    timer_del(cq->coalesce_timer);
+
+    trace_pci_nvme_irq_coalesced(cq->cqid, cq->vector, cq->coalesced);
+    cq->coalesced = 0;
+
+    nvme_irq_assert(n, cq);
+}
+
+/*
+ * The entries posted by the IOThread count towards the aggregation
+ * threshold like those posted by the main loop.
+ *
+ * Context: BQL held
+ */
+static void nvme_cq_irq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, irq_notifier);
+    uint32_t posted;
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    posted = qatomic_xchg(&cq->iothread_posted, 0);
+    nvme_cq_update_irq(cq);
+    if (posted && cq->irq_pending) {
+        nvme_cq_notify(cq->ctrl, cq, posted);
+    }
+}
+
 static void nvme_req_clear(NvmeRequest *req)
 {
     req->ns = NULL;
@@ -1520,6 +1650,7 @@ static void nvme_post_cqes(void *opaque)
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
     bool pending = cq->head != cq->tail;
+    uint32_t posted = 0;
     int ret;
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
@@ -1563,6 +1694,7 @@ static void nvme_post_cqes(void *opaque)
         QTAILQ_REMOVE(&cq->req_list, req, entry);
 
         nvme_inc_cq_tail(cq);
+        posted++;
 
         if (QTAILQ_EMPTY(&sq->req_list) && !nvme_sq_empty(sq)) {
             qemu_bh_schedule(sq->bh);
@@ -1571,11 +1703,17 @@ static void nvme_post_cqes(void *opaque)
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
     }
     if (cq->tail != cq->head) {
+        if (nvme_cq_in_iothread(cq)) {
+            qatomic_add(&cq->iothread_posted, posted);
+            event_notifier_set(&cq->irq_notifier);
+            return;
+        }
+
         if (cq->irq_enabled && !pending) {
             n->cq_pending++;
         }
 
-        nvme_irq_assert(n, cq);
+        nvme_cq_notify(n, cq, posted);
     }
 }
 
@@ -4769,16 +4907,49 @@ static void nvme_cq_notifier(EventNotifier *e)
     nvme_update_cq_head(cq);
 
     if (cq->tail == cq->head) {
-        if (cq->irq_enabled) {
-            n->cq_pending--;
-        }
+        if (nvme_cq_in_iothread(cq)) {
+            event_notifier_set(&cq->irq_notifier);
+        } else {
+            if (cq->irq_enabled) {
+                n->cq_pending--;
+            }
 
-        nvme_irq_deassert(n, cq);
+            nvme_irq_deassert(n, cq);
+        }
     }
 
     qemu_bh_schedule(cq->bh);
 }
 
+/*
+ * Queues serviced by the main loop use the iohandler context, like any other
+ * device; the ones serviced by an IOThread are polled in its AioContext.
+ */
+static void nvme_set_notifier_handler(AioContext *ctx, EventNotifier *e,
+                                      EventNotifierHandler *handler)
+{
+    if (ctx == qemu_get_aio_context()) {
+        event_notifier_set_handler(e, handler);
+    } else {
+        aio_set_event_notifier(ctx, e, handler, NULL, NULL);
+    }
+}
+
+/*
+ * Run @cb in the AioContext that services a queue and wait for it to finish.
+ *
+ * Context: BQL held
+ */
+static void nvme_run_in_queue_ctx(AioContext *ctx, QEMUBHFunc *cb,
+                                  void *opaque)
+{
+    if (ctx == qemu_get_aio_context()) {
+        cb(opaque);
+    } else {
+        aio_wait_bh_oneshot(ctx, cb, opaque);
+    }
+}
+
 static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
 {
     NvmeCtrl *n = cq->ctrl;
@@ -4790,7 +4961,7 @@ static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
         return ret;
     }
 
-    event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    nvme_set_notifier_handler(cq->ctx, &cq->notifier, nvme_cq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &cq->notifier);
 
@@ -4819,23 +4990,62 @@ static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
         return ret;
     }
 
-    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    nvme_set_notifier_handler(sq->ctx, &sq->notifier, nvme_sq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &sq->notifier);
 
     return 0;
 }
 
+/*
+ * Stop processing a submission queue.
+ *
+ * Context: @sq's AioContext
+ */
+static void nvme_sq_detach(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    qemu_bh_delete(sq->bh);
+    sq->bh = NULL;
+
+    if (sq->ioeventfd_enabled) {
+        nvme_set_notifier_handler(sq->ctx, &sq->notifier, NULL);
+    }
+}
+
+/*
+ * Stop fetching new commands from @sq and wait until all outstanding ones
+ * have been cancelled or completed.
+ *
+ * Context: @sq's AioContext
+ */
+static void nvme_sq_cancel_reqs(NvmeSQueue *sq)
+{
+    NvmeRequest *r, *next;
+
+    sq->stopped = true;
+
+    QTAILQ_FOREACH_SAFE(r, &sq->out_req_list, entry, next) {
+        assert(r->aiocb);
+        r->status = NVME_CMD_ABORT_SQ_DEL;
+        blk_aio_cancel_async(r->aiocb);
+    }
+
+    AIO_WAIT_WHILE_UNLOCKED(sq->ctx, !QTAILQ_EMPTY(&sq->out_req_list));
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     uint16_t offset = sq->sqid << 3;
 
     n->sq[sq->sqid] = NULL;
-    qemu_bh_delete(sq->bh);
+    if (sq->bh) {
+        nvme_run_in_queue_ctx(sq->ctx, nvme_sq_detach, sq);
+    }
     if (sq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &sq->notifier);
-        event_notifier_set_handler(&sq->notifier, NULL);
         event_notifier_cleanup(&sq->notifier);
     }
     g_free(sq->io_req);
@@ -4844,30 +5054,15 @@ static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
     }
 }
 
-static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
+/* Context: @sq's AioContext */
+static void nvme_del_sq_bh(void *opaque)
 {
-    NvmeDeleteQ *c = (NvmeDeleteQ *)&req->cmd;
+    NvmeSQueue *sq = opaque;
+    NvmeCtrl *n = sq->ctrl;
     NvmeRequest *r, *next;
-    NvmeSQueue *sq;
     NvmeCQueue *cq;
-    uint16_t qid = le16_to_cpu(c->qid);
 
-    if (unlikely(!qid || nvme_check_sqid(n, qid))) {
-        trace_pci_nvme_err_invalid_del_sq(qid);
-        return NVME_INVALID_QID | NVME_DNR;
-    }
-
-    trace_pci_nvme_del_sq(qid);
-
-    sq = n->sq[qid];
-    while (!QTAILQ_EMPTY(&sq->out_req_list)) {
-        r = QTAILQ_FIRST(&sq->out_req_list);
-        assert(r->aiocb);
-        r->status = NVME_CMD_ABORT_SQ_DEL;
-        blk_aio_cancel(r->aiocb);
-    }
-
-    assert(QTAILQ_EMPTY(&sq->out_req_list));
+    nvme_sq_cancel_reqs(sq);
 
     if (!nvme_check_cqid(n, sq->cqid)) {
         cq = n->cq[sq->cqid];
@@ -4882,6 +5077,24 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
         }
     }
 
+    nvme_sq_detach(sq);
+}
+
+static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeDeleteQ *c = (NvmeDeleteQ *)&req->cmd;
+    NvmeSQueue *sq;
+    uint16_t qid = le16_to_cpu(c->qid);
+
+    if (unlikely(!qid || nvme_check_sqid(n, qid))) {
+        trace_pci_nvme_err_invalid_del_sq(qid);
+        return NVME_INVALID_QID | NVME_DNR;
+    }
+
+    trace_pci_nvme_del_sq(qid);
+
+    sq = n->sq[qid];
+    nvme_run_in_queue_ctx(sq->ctx, nvme_del_sq_bh, sq);
     nvme_free_sq(sq, n);
     return NVME_SUCCESS;
 }
@@ -4894,6 +5107,12 @@ static void __nvme_init_sq(NvmeSQueue *sq)
     int i;
     NvmeCQueue *cq;
 
+    assert(n->cq[cqid]);
+    cq = n->cq[cqid];
+
+    /* A submission queue is serviced wherever its completion queue is */
+    sq->ctx = cq->ctx;
+    sq->stopped = false;
     sq->io_req = g_new0(NvmeRequest, sq->size);
 
     QTAILQ_INIT(&sq->req_list);
@@ -4903,8 +5122,16 @@ static void __nvme_init_sq(NvmeSQueue *sq)
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
 
-    sq->bh = qemu_bh_new_guarded(nvme_process_sq, sq,
-                                 &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    /*
+     * The reentrancy guard is per device and cannot be shared with IOThreads
+     * without blocking concurrent MMIO from vCPUs.
+     */
+    if (nvme_cq_in_iothread(cq)) {
+        sq->bh = aio_bh_new(sq->ctx, nvme_process_sq, sq);
+    } else {
+        sq->bh = qemu_bh_new_guarded(nvme_process_sq, sq,
+                                     &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    }
 
     if (n->dbbuf_enabled) {
         sq->db_addr = n->dbbuf_dbs + (sqid << 3);
@@ -4917,8 +5144,6 @@ static void __nvme_init_sq(NvmeSQueue *sq)
         }
     }
 
-    assert(n->cq[cqid]);
-    cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
 }
@@ -5566,19 +5791,70 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+/*
+ * Stop processing a completion queue.
+ *
+ * Context: @cq's AioContext
+ */
+static void nvme_cq_detach(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    qemu_bh_delete(cq->bh);
+    cq->bh = NULL;
+
+    if (cq->ioeventfd_enabled) {
+        nvme_set_notifier_handler(cq->ctx, &cq->notifier, NULL);
+    }
+}
+
+/*
+ * Quiesce an I/O completion queue serviced by an IOThread together with the
+ * submission queues that post to it. This has to happen in one go, since
+ * posting completions touches the submission queues and vice versa.
+ *
+ * Context: @cq's AioContext
+ */
+static void nvme_cq_quiesce_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeSQueue *sq;
+
+    QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+        sq->stopped = true;
+    }
+
+    QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+        nvme_sq_cancel_reqs(sq);
+    }
+
+    QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+        nvme_sq_detach(sq);
+    }
+
+    nvme_cq_detach(cq);
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     PCIDevice *pci = PCI_DEVICE(n);
     uint16_t offset = (cq->cqid << 3) + (1 << 2);
 
     n->cq[cq->cqid] = NULL;
-    qemu_bh_delete(cq->bh);
+    if (cq->bh) {
+        nvme_run_in_queue_ctx(cq->ctx, nvme_cq_detach, cq);
+    }
     if (cq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &cq->notifier);
-        event_notifier_set_handler(&cq->notifier, NULL);
         event_notifier_cleanup(&cq->notifier);
     }
+    if (nvme_cq_in_iothread(cq)) {
+        event_notifier_set_handler(&cq->irq_notifier, NULL);
+        event_notifier_cleanup(&cq->irq_notifier);
+    }
+    timer_free(cq->coalesce_timer);
+    cq->coalesce_timer = NULL;
     if (msix_present(pci) && cq->irq_enabled) {
         msix_vector_unuse(pci, cq->vector);
     }
@@ -5592,6 +5868,7 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeRequest *req)
     NvmeDeleteQ *c = (NvmeDeleteQ *)&req->cmd;
     NvmeCQueue *cq;
     uint16_t qid = le16_to_cpu(c->qid);
+    bool pending;
 
     if (unlikely(!qid || nvme_check_cqid(n, qid))) {
         trace_pci_nvme_err_invalid_del_cq_cqid(qid);
@@ -5604,7 +5881,13 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeRequest *req)
         return NVME_INVALID_QUEUE_DEL;
     }
 
-    if (cq->irq_enabled && cq->tail != cq->head) {
+    if (nvme_cq_in_iothread(cq)) {
+        pending = cq->irq_pending;
+    } else {
+        pending = cq->tail != cq->head;
+    }
+
+    if (cq->irq_enabled && pending) {
         n->cq_pending--;
     }
 
@@ -5624,6 +5907,17 @@ static void __nvme_init_cq(NvmeCQueue *cq)
         msix_vector_use(pci, cq->vector);
     }
 
+    cq->ctx = qemu_get_aio_context();
+    if (cqid && n->ioq_aio_context) {
+        /* Fall back to the main loop if we cannot signal interrupts */
+        if (!event_notifier_init(&cq->irq_notifier, 0)) {
+            event_notifier_set_handler(&cq->irq_notifier,
+                                       nvme_cq_irq_notifier);
+            cq->ctx = n->ioq_aio_context[cqid - 1];
+        }
+    }
+    cq->irq_pending = false;
+
     QTAILQ_INIT(&cq->sq_list);
     if (n->dbbuf_enabled) {
         cq->db_addr = n->dbbuf_dbs + (cqid << 3) + (1 << 2);
@@ -5636,8 +5930,17 @@ static void __nvme_init_cq(NvmeCQueue *cq)
         }
     }
     n->cq[cqid] = cq;
-    cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
-                                 &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    cq->coalesced = 0;
+    cq->iothread_posted = 0;
+    if (nvme_cq_in_iothread(cq)) {
+        cq->bh = aio_bh_new(cq->ctx, nvme_post_cqes, cq);
+    } else {
+        cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
+                                     &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    }
+    /* runs in the main loop, like nvme_cq_irq_notifier() */
+    cq->coalesce_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                      nvme_cq_coalesce_timer, cq);
 }
 
 static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
@@ -6473,6 +6776,20 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         result = n->features.async_config;
         goto out;
+    case NVME_INTERRUPT_COALESCING:
+        result = n->features.int_coalescing;
+        goto out;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->conf_ioqpairs + 1 || iv >= n->features.nr_intvc) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        result = iv;
+        if (iv == n->admin_cq.vector || test_bit(iv, n->features.intvc_cd)) {
+            result |= NVME_INTVC_NOCOALESCING;
+        }
+        goto out;
     case NVME_TIMESTAMP:
         return nvme_get_feature_timestamp(n, req);
     case NVME_HOST_BEHAVIOR_SUPPORT:
@@ -6696,7 +7013,7 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     uint32_t nsid = le32_to_cpu(cmd->nsid);
     uint8_t fid = NVME_GETSETFEAT_FID(dw10);
     uint8_t save = NVME_SETFEAT_SAVE(dw10);
-    uint16_t status;
+    uint16_t status, iv;
     int i;
 
     trace_pci_nvme_setfeat(nvme_cid(req), nsid, fid, save, dw11);
@@ -6816,6 +7133,24 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         n->features.async_config = dw11;
         break;
+    case NVME_INTERRUPT_COALESCING:
+        n->features.int_coalescing = dw11 & 0xffff;
+        trace_pci_nvme_setfeat_intc(NVME_INTC_THR(dw11), NVME_INTC_TIME(dw11));
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->conf_ioqpairs + 1 || iv >= n->features.nr_intvc) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        if (dw11 & NVME_INTVC_NOCOALESCING) {
+            set_bit(iv, n->features.intvc_cd);
+        } else {
+            clear_bit(iv, n->features.intvc_cd);
+        }
+
+        trace_pci_nvme_setfeat_intvc(iv, !!(dw11 & NVME_INTVC_NOCOALESCING));
+        break;
     case NVME_TIMESTAMP:
         return nvme_set_feature_timestamp(n, req);
     case NVME_HOST_BEHAVIOR_SUPPORT:
@@ -6906,6 +7241,11 @@ static bool nvme_csi_supported(NvmeCtrl *n, uint8_t csi)
         return true;
 
     case NVME_CSI_ZONED:
+        /* zone state is shared between all queues */
+        if (n->ioq_aio_context) {
+            return false;
+        }
+
         cc = ldl_le_p(&n->bar.cc);
 
         return NVME_CC_CSS(cc) == NVME_CC_CSS_ALL;
@@ -7906,9 +8246,14 @@ static void nvme_process_sq(void *opaque)
 
     /*
      * We don't want to have a race with nvme_ctrl_pre_save().
-     * What implicitly protects us from this is BQL.
+     * What implicitly protects us from this is BQL. Migration is blocked
+     * when queues are serviced by IOThreads.
      */
-    assert(bql_locked());
+    assert(bql_locked() || sq->ctx != qemu_get_aio_context());
+
+    if (sq->stopped) {
+        return;
+    }
 
     if (n->dbbuf_enabled) {
         nvme_update_sq_tail(sq);
@@ -8027,6 +8372,14 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
         nvme_ns_drain(ns);
     }
 
+    for (i = 1; i < n->num_queues; i++) {
+        NvmeCQueue *cq = n->cq[i];
+
+        if (cq != NULL && nvme_cq_in_iothread(cq)) {
+            aio_wait_bh_oneshot(cq->ctx, nvme_cq_quiesce_bh, cq);
+        }
+    }
+
     for (i = 0; i < n->num_queues; i++) {
         if (n->sq[i] != NULL) {
             nvme_free_sq(n->sq[i], n);
@@ -8558,6 +8911,17 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         trace_pci_nvme_mmio_doorbell_cq(cq->cqid, new_head);
 
+        if (nvme_cq_in_iothread(cq)) {
+            /*
+             * The IOThread may be posting concurrently, so we cannot tell
+             * whether the queue was full. Always let it retry.
+             */
+            qatomic_set(&cq->head, new_head);
+            qemu_bh_schedule(cq->bh);
+            nvme_cq_update_irq(cq);
+            return;
+        }
+
         /* scheduled deferred cqe posting if queue was previously full */
         if (nvme_cq_full(cq)) {
             qemu_bh_schedule(cq->bh);
@@ -8881,6 +9245,8 @@ static void nvme_init_state(NvmeCtrl *n)
     n->cq = g_new0(NvmeCQueue *, n->num_queues);
     n->temperature = NVME_TEMPERATURE;
     n->features.temp_thresh_hi = NVME_TEMPERATURE_WARNING;
+    n->features.nr_intvc = PCI_MSIX_FLAGS_QSIZE + 1;
+    n->features.intvc_cd = bitmap_new(n->features.nr_intvc);
     n->starttime_ms = qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL);
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
     QTAILQ_INIT(&n->aer_queue);
@@ -9533,6 +9899,10 @@ static bool nvme_set_migration_blockers(NvmeCtrl *n, PCIDevice *pci_dev,
         g_ptr_array_add(blocker_features, (void *) "unknown capability");
     }
 
+    if (n->ioq_aio_context) {
+        g_ptr_array_add(blocker_features, (void *) "IOThreads");
+    }
+
     assert(n->migration_blocker == NULL);
     if (blocker_features->len > 0) {
         g_autofree char *blocker_list = NULL;
@@ -9598,6 +9968,74 @@ void nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns)
     ns->attached++;
 }
 
+static bool nvme_init_ioq_aio_context(NvmeCtrl *n, Error **errp)
+{
+    NvmeParams *params = &n->params;
+
+    if (!n->iothread && !n->iothread_vq_mapping_list) {
+        return true;
+    }
+
+    if (n->iothread && n->iothread_vq_mapping_list) {
+        error_setg(errp,
+                   "iothread and iothread-vq-mapping properties cannot be set "
+                   "at the same time");
+        return false;
+    }
+
+    if (params->atomic_awun || params->atomic_awupf) {
+        error_setg(errp, "atomic writes are not supported with iothread");
+        return false;
+    }
+
+    if (n->subsys->endgrp.fdp.enabled) {
+        error_setg(errp,
+                   "flexible data placement is not supported with iothread");
+        return false;
+    }
+
+    n->ioq_aio_context = g_new(AioContext *, params->max_ioqpairs);
+
+    if (n->iothread_vq_mapping_list) {
+        if (!iothread_vq_mapping_apply(n->iothread_vq_mapping_list,
+                                       n->ioq_aio_context,
+                                       params->max_ioqpairs, errp)) {
+            g_free(n->ioq_aio_context);
+            n->ioq_aio_context = NULL;
+            return false;
+        }
+    } else {
+        AioContext *ctx = iothread_get_aio_context(n->iothread);
+
+        for (unsigned i = 0; i < params->max_ioqpairs; i++) {
+            n->ioq_aio_context[i] = ctx;
+        }
+
+        /* Released in nvme_cleanup_ioq_aio_context() */
+        object_ref(OBJECT(n->iothread));
+    }
+
+    return true;
+}
+
+static void nvme_cleanup_ioq_aio_context(NvmeCtrl *n)
+{
+    if (!n->ioq_aio_context) {
+        return;
+    }
+
+    if (n->iothread_vq_mapping_list) {
+        iothread_vq_mapping_cleanup(n->iothread_vq_mapping_list);
+    }
+
+    if (n->iothread) {
+        object_unref(OBJECT(n->iothread));
+    }
+
+    g_free(n->ioq_aio_context);
+    n->ioq_aio_context = NULL;
+}
+
 static void nvme_realize(PCIDevice *pci_dev, Error **errp)
 {
     NvmeCtrl *n = NVME(pci_dev);
@@ -9637,6 +10075,9 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     if (nvme_init_subsys(n, errp)) {
         return;
     }
+    if (!nvme_init_ioq_aio_context(n, errp)) {
+        return;
+    }
     nvme_init_state(n);
     if (!nvme_init_pci(n, pci_dev, errp)) {
         return;
@@ -9668,6 +10109,7 @@ static void nvme_exit(PCIDevice *pci_dev)
     int i;
 
     nvme_ctrl_reset(n, NVME_RESET_FUNCTION);
+    nvme_cleanup_ioq_aio_context(n);
 
     for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
         ns = nvme_ns(n, i);
@@ -9681,6 +10123,7 @@ static void nvme_exit(PCIDevice *pci_dev)
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
+    g_free(n->features.intvc_cd);
 
     if (n->params.cmb_size_mb) {
         g_free(n->cmb.buf);
@@ -9734,6 +10177,10 @@ static const Property nvme_props[] = {
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
     DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", NvmeCtrl,
+                                         iothread_vq_mapping_list),
     DEFINE_PROP_BOOL("dbcs", NvmeCtrl, params.dbcs, true),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
@@ -10347,6 +10794,15 @@ static bool nvme_ctrl_post_load(void *opaque, int version_id, Error **errp)
         }
     }
 
+    /* aggregation timers are not migrated, restart them for pending CQEs */
+    for (i = 1; i < n->num_queues; i++) {
+        NvmeCQueue *cq = n->cq[i];
+
+        if (cq && cq->tail != cq->head && nvme_cq_coalescing(cq)) {
+            nvme_cq_notify(n, cq, 0);
+        }
+    }
+
     /* restore cq->req_list-s */
     for (i = 0; i < n->num_queues; i++) {
         NvmeRequest *req_from, *next;
@@ -10465,6 +10921,26 @@ static bool nvme_ctrl_post_load(void *opaque, int version_id, Error **errp)
     return true;
 }
 
+static bool nvme_int_coalescing_needed(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+
+    return n->features.int_coalescing ||
+           !bitmap_empty(n->features.intvc_cd, n->features.nr_intvc);
+}
+
+static const VMStateDescription nvme_vmstate_int_coalescing = {
+    .name = "nvme/int-coalescing",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = nvme_int_coalescing_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(features.int_coalescing, NvmeCtrl),
+        VMSTATE_BITMAP(features.intvc_cd, NvmeCtrl, 0, features.nr_intvc),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription nvme_vmstate = {
     .name = "nvme",
     .minimum_version_id = 1,
@@ -10523,6 +10999,10 @@ static const VMStateDescription nvme_vmstate = {
 
         VMSTATE_END_OF_LIST()
     },
+    .subsections = (const VMStateDescription * const []) {
+        &nvme_vmstate_int_coalescing,
+        NULL
+    },
 };
 
 static void nvme_class_init(ObjectClass *oc, const void *data)
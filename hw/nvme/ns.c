@@ -853,6 +853,17 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
     ns->subsys = subsys;
     ns->endgrp = &subsys->endgrp;
 
+    if (n->ioq_aio_context && ns->params.zoned) {
+        error_setg(errp, "zoned namespaces are not supported with iothread");
+        return;
+    }
+
+    if (n->ioq_aio_context &&
+        (ns->params.atomic.nawun || ns->params.atomic.nawupf)) {
+        error_setg(errp, "atomic writes are not supported with iothread");
+        return;
+    }
+
     if (!nvme_ns_set_nsabp(n, ns, errp)) {
         return;
     }
@@ -21,6 +21,8 @@
 #include "qemu/uuid.h"
 #include "hw/pci/pci_device.h"
 #include "hw/block/block.h"
+#include "system/iothread.h"
+#include "qapi/qapi-types-virtio.h"
 
 #include "block/nvme.h"
 
@@ -521,8 +523,10 @@ typedef struct NvmeSQueue {
     uint64_t    db_addr;
     uint64_t    ei_addr;
     QEMUBH      *bh;
+    AioContext  *ctx;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
+    bool        stopped;
     NvmeRequest *io_req;
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
@@ -542,8 +546,17 @@ typedef struct NvmeCQueue {
     uint64_t    db_addr;
     uint64_t    ei_addr;
     QEMUBH      *bh;
+    AioContext  *ctx;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
+    /* Interrupts of queues serviced by an IOThread are raised from here */
+    EventNotifier irq_notifier;
+    bool        irq_pending;
+    /* CQEs the IOThread posted since it last kicked irq_notifier */
+    uint32_t    iothread_posted;
+    /* Interrupt Coalescing: CQEs posted since the interrupt was last raised */
+    uint32_t    coalesced;
+    QEMUTimer   *coalesce_timer;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
@@ -659,6 +672,10 @@ typedef struct NvmeCtrl {
     NvmeCQueue      admin_cq;
     NvmeIdCtrl      id_ctrl;
 
+    IOThread                     *iothread;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    AioContext                   **ioq_aio_context; /* indexed by cqid - 1 */
+
     struct {
         struct {
             uint16_t temp_thresh_hi;
@@ -667,6 +684,11 @@ typedef struct NvmeCtrl {
 
         uint32_t                async_config;
         NvmeHostBehaviorSupport hbs;
+
+        uint32_t                int_coalescing;
+        /* Coalescing Disable bit of each interrupt vector */
+        unsigned long           *intvc_cd;
+        int32_t                 nr_intvc;
     } features;
 
     NvmePriCtrlCap  pri_ctrl_cap;
@@ -640,12 +640,44 @@ static void vring_packed_desc_read_flags(VirtIODevice *vdev,
     *flags = virtio_lduw_phys_cached(vdev, cache, off);
 }
 
+/*
+ * Return a host pointer to descriptor @i if @cache maps RAM, so that all
+ * fields can be loaded with a single bounds check.  Descriptor rings and
+ * indirect tables are in RAM unless the guest is misbehaving.
+ */
+static inline const uint8_t *vring_packed_desc_ptr(MemoryRegionCache *cache,
+                                                   unsigned int i)
+{
+    hwaddr off = (hwaddr)i * sizeof(VRingPackedDesc);
+
+    if (likely(cache->ptr) && off < cache->len &&
+        cache->len - off >= sizeof(VRingPackedDesc)) {
+        return cache->ptr + off;
+    }
+    return NULL;
+}
+
 static void vring_packed_desc_read(VirtIODevice *vdev,
                                    VRingPackedDesc *desc,
                                    MemoryRegionCache *cache,
                                    int i, bool strict_order)
 {
     hwaddr off = i * sizeof(VRingPackedDesc);
+    const uint8_t *ptr = vring_packed_desc_ptr(cache, i);
+
+    if (likely(ptr)) {
+        fuzz_dma_read_cb(cache->xlat + off, sizeof(*desc), cache->mrs.mr);
+        desc->flags = virtio_lduw_p(vdev, ptr +
+                                    offsetof(VRingPackedDesc, flags));
+        if (strict_order) {
+            /* Make sure flags is read before the rest fields. */
+            smp_rmb();
+        }
+        desc->addr = virtio_ldq_p(vdev, ptr + offsetof(VRingPackedDesc, addr));
+        desc->len = virtio_ldl_p(vdev, ptr + offsetof(VRingPackedDesc, len));
+        desc->id = virtio_lduw_p(vdev, ptr + offsetof(VRingPackedDesc, id));
+        return;
+    }
 
     vring_packed_desc_read_flags(vdev, &desc->flags, cache, i);
 
@@ -928,6 +960,23 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_detach_element(vq, elem, len);
 }
 
+void virtqueue_unpop_batch(VirtQueue *vq, VirtQueueElement **elems,
+                           unsigned int num)
+{
+    unsigned int i, ndescs = 0;
+
+    for (i = 0; i < num; i++) {
+        ndescs += elems[i]->ndescs;
+        virtqueue_detach_element(vq, elems[i], 0);
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtqueue_packed_rewind(vq, ndescs);
+    } else {
+        virtqueue_split_rewind(vq, num);
+    }
+}
+
 /* virtqueue_rewind:
  * @vq: The #VirtQueue
  * @num: Number of elements to push back
@@ -1231,6 +1280,22 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *len, unsigned int num)
+{
+    unsigned int i;
+
+    if (!num) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < num; i++) {
+        virtqueue_fill(vq, elems[i], len ? len[i] : 0, i);
+    }
+    virtqueue_flush(vq, num);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1712,9 +1777,15 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * Lay out the scatter-gather arrays after the first @sz bytes of @elem, and
+ * return the size of the element.  The size only depends on the sum of
+ * @out_num and @in_num, so that pooled elements fit any chain that is not
+ * longer than the one they were allocated for.
+ */
+static size_t virtqueue_element_layout(VirtQueueElement *elem, size_t sz,
+                                       unsigned out_num, unsigned in_num)
 {
-    VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
@@ -1722,19 +1793,86 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
+    if (elem) {
+        elem->out_num = out_num;
+        elem->in_num = in_num;
+        elem->in_addr = (void *)elem + in_addr_ofs;
+        elem->out_addr = (void *)elem + out_addr_ofs;
+        elem->in_sg = (void *)elem + in_sg_ofs;
+        elem->out_sg = (void *)elem + out_sg_ofs;
+    }
+    return out_sg_end;
+}
+
+static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    elem = g_malloc(virtqueue_element_layout(NULL, sz, out_num, in_num));
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
-    elem->out_num = out_num;
-    elem->in_num = in_num;
-    elem->in_addr = (void *)elem + in_addr_ofs;
-    elem->out_addr = (void *)elem + out_addr_ofs;
-    elem->in_sg = (void *)elem + in_sg_ofs;
-    elem->out_sg = (void *)elem + out_sg_ofs;
+    virtqueue_element_layout(elem, sz, out_num, in_num);
+    elem->pooled = false;
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_new_element(VirtQueueElementPool *pool, size_t sz,
+                                   unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
+    if (!pool || out_num + in_num > pool->sg_max) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    if (pool->num) {
+        elem = pool->free[--pool->num];
+    } else {
+        elem = g_malloc(virtqueue_element_layout(NULL, pool->sz,
+                                                 pool->sg_max, 0));
+    }
+    virtqueue_element_layout(elem, pool->sz, out_num, in_num);
+    elem->pooled = true;
+    return elem;
+}
+
+void virtqueue_element_pool_init(VirtQueueElementPool *pool, size_t sz,
+                                 unsigned int max, unsigned int sg_max)
+{
+    assert(sz >= sizeof(VirtQueueElement));
+    pool->sz = sz;
+    pool->sg_max = sg_max;
+    pool->num = 0;
+    pool->max = max;
+    pool->free = g_new(VirtQueueElement *, max);
+}
+
+void virtqueue_element_pool_destroy(VirtQueueElementPool *pool)
+{
+    while (pool->num) {
+        g_free(pool->free[--pool->num]);
+    }
+    g_free(pool->free);
+    pool->free = NULL;
+    pool->max = 0;
+}
+
+void virtqueue_element_pool_put(VirtQueueElementPool *pool,
+                                VirtQueueElement *elem)
+{
+    if (elem->pooled && pool->num < pool->max) {
+        pool->free[pool->num++] = elem;
+    } else {
+        g_free(elem);
+    }
+}
+
+/*
+ * Called within rcu_read_lock(), after checking that the ring is not empty
+ * and with a barrier between the avail index and the descriptor reads.
+ */
+static void *virtqueue_split_pop_avail(VirtQueue *vq, size_t sz,
+                                       VirtQueueElementPool *pool)
 {
     unsigned int i, head, max, idx;
     VRingMemoryRegionCaches *caches;
@@ -1751,14 +1889,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1849,7 +1979,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_new_element(pool, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1881,7 +2011,52 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /*
+     * Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads().
+     */
+    smp_rmb();
+
+    return virtqueue_split_pop_avail(vq, sz, NULL);
+}
+
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq,
+                                              VirtQueueElementPool *pool,
+                                              VirtQueueElement **elems,
+                                              unsigned int max)
+{
+    unsigned int i;
+    int num;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return 0;
+    }
+
+    /* Orders all descriptor reads of the batch after the avail index read */
+    num = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (num <= 0) {
+        return 0;
+    }
+
+    num = MIN(num, max);
+    for (i = 0; i < num; i++) {
+        elems[i] = virtqueue_split_pop_avail(vq, pool->sz, pool);
+        if (!elems[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz,
+                                  VirtQueueElementPool *pool)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1990,7 +2165,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_new_element(pool, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -2038,12 +2213,35 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop(vq, sz, NULL);
     } else {
         return virtqueue_split_pop(vq, sz);
     }
 }
 
+unsigned int virtqueue_pop_batch(VirtQueue *vq, VirtQueueElementPool *pool,
+                                 VirtQueueElement **elems, unsigned int max)
+{
+    unsigned int i;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_split_pop_batch(vq, pool, elems, max);
+    }
+
+    /* Each packed descriptor carries its own availability flag */
+    for (i = 0; i < max; i++) {
+        elems[i] = virtqueue_packed_pop(vq, pool->sz, pool);
+        if (!elems[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2715,6 +2913,17 @@ static void virtio_notify_irqfd_deferred_fn(void *opaque)
     event_notifier_set(notifier);
 }
 
+/*
+ * Likewise in the main loop for devices with defer_notify, so that a
+ * backend that delivers a batch of packets raises the interrupt only once
+ */
+static void virtio_notify_vector_deferred_fn(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    virtio_notify_vector(vq->vdev, vq->vector);
+}
+
 static void virtio_irq(VirtQueue *vq)
 {
     /*
@@ -2742,6 +2951,8 @@ static void virtio_irq(VirtQueue *vq)
      */
     if (qemu_in_iothread()) {
         defer_call(virtio_notify_irqfd_deferred_fn, &vq->guest_notifier);
+    } else if (vq->vdev->defer_notify) {
+        defer_call(virtio_notify_vector_deferred_fn, vq);
     } else {
         virtio_notify_vector(vq->vdev, vq->vector);
     }
@@ -4345,7 +4556,7 @@ static const Property virtio_properties[] = {
                      disable_legacy_check, false),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -4415,7 +4626,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
@@ -75,10 +75,26 @@ static inline bool laio_has_fua(void)
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext.
+ * @fixed_bufs says whether @bs registered guest RAM with
+ * aio_register_fixed_buf() and may use it for @qiov.
+ */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type,
-                                  BdrvRequestFlags flags);
+                                  BdrvRequestFlags flags, bool fixed_bufs);
+#ifdef HAVE_NVME_URING_CMD
+/*
+ * luring_co_nvme_submit: submit an NVMe command for the byte range @offset
+ * and @bytes of namespace @nsid to the NVMe generic character device @fd.
+ * Only usable when aio_has_io_uring_cmd() returns true.
+ */
+int coroutine_fn luring_co_nvme_submit(BlockDriverState *bs, int fd,
+                                       uint32_t nsid, unsigned lba_shift,
+                                       uint64_t offset, uint64_t bytes,
+                                       QEMUIOVector *qiov, int type,
+                                       BdrvRequestFlags flags);
+#endif
 bool luring_has_fua(void);
 #else
 static inline bool luring_has_fua(void)
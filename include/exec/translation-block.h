@@ -95,6 +95,13 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
+    /*
+     * Executions left before the TB is retranslated as a superblock,
+     * decremented by the TB itself.  Zero if the TB is not counted,
+     * which includes superblocks.
+     */
+    uint32_t hot_count;
+
     struct tb_tc tc;
 
     /*
@@ -206,6 +206,9 @@ typedef uint32_t MMUIdxMap;
 /* Use a fully associative victim tlb of 8 entries. */
 #define CPU_VTLB_SIZE 8
 
+/* Track up to 8 large pages exactly per mmu_idx. */
+#define CPU_TLB_LARGE_PAGES 8
+
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
  * so the layout is not as critical as that of CPUTLBEntry. This is
@@ -274,11 +277,23 @@ struct CPUTLBEntryFull {
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
+typedef struct CPUTLBLargePage {
+    vaddr addr;
+    vaddr mask;
+} CPUTLBLargePage;
+
 typedef struct CPUTLBDesc {
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
+     * The large pages allocated into the tlb.  Each is matched if
+     * (page & mask) == addr.  When any page within one of them is
+     * flushed, we flush the entries covering that large page.
+     */
+    CPUTLBLargePage large_pages[CPU_TLB_LARGE_PAGES];
+    size_t n_large_pages;
+    /*
+     * Describe a region covering all of the large pages that did not
+     * fit in large_pages[].  When any page within this region is
+     * flushed, we must flush the entire tlb.  The region is matched if
      * (addr & large_page_mask) == large_page_addr.
      */
     vaddr large_page_addr;
@@ -316,6 +331,8 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Full flushes of one mmu_idx forced by flushing a large page. */
+    size_t large_page_flush_count;
 } CPUTLBCommon;
 
 /*
@@ -504,6 +521,8 @@ struct CPUState {
     bool exit_request;
     int exclusive_context_count;
     uint32_t cflags_next_tb;
+    /* TB whose execution counter expired, to be retranslated next */
+    TranslationBlock *tb_hot;
     uint32_t interrupt_request;
     unsigned singlestep_flags;
     int64_t icount_budget;
@@ -71,6 +71,9 @@ struct VirtIOBlock {
      */
     AioContext **vq_aio_context;
 
+    /* Recycled requests of each virtqueue, see virtio_blk_free_request() */
+    VirtQueueElementPool *vq_pools;
+
     uint64_t host_features;
     size_t config_size;
     BlockRAMRegistrar blk_ram_registrar;
@@ -110,5 +113,6 @@ typedef struct VirtIOBlkClass {
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq);
 void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status);
+void virtio_blk_free_request(VirtIOBlockReq *req);
 
 #endif
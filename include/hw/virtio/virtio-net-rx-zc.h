@@ -0,0 +1,65 @@
+/*
+ * Receive buffers posted by virtio-net for zero-copy receive
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_VIRTIO_NET_RX_ZC_H
+#define QEMU_VIRTIO_NET_RX_ZC_H
+
+/*
+ * Buffers occupy consecutive slots from @head, in the order they were
+ * popped from the virtqueue.  The peer may complete them in any order.
+ * A completed buffer that is not the oldest one leaves a NULL hole
+ * that stays in the ring until all buffers before it have completed,
+ * so the ring can be full even though fewer than @size buffers are
+ * still posted.
+ */
+typedef struct VirtIONetRxZcRing {
+    void **slots;
+    unsigned int size;
+    unsigned int head;
+    unsigned int num;
+} VirtIONetRxZcRing;
+
+static inline bool virtio_net_rx_zc_ring_full(const VirtIONetRxZcRing *r)
+{
+    return r->num == r->size;
+}
+
+/* The slot that virtio_net_rx_zc_ring_push() fills next */
+static inline unsigned int
+virtio_net_rx_zc_ring_tail(const VirtIONetRxZcRing *r)
+{
+    return (r->head + r->num) % r->size;
+}
+
+static inline void virtio_net_rx_zc_ring_push(VirtIONetRxZcRing *r,
+                                              void *elem)
+{
+    assert(!virtio_net_rx_zc_ring_full(r));
+    r->slots[virtio_net_rx_zc_ring_tail(r)] = elem;
+    r->num++;
+}
+
+/*
+ * Take the buffer in @slot out of the ring.  Returns false if it was
+ * not the oldest one, i.e. if it completed out of order.
+ */
+static inline bool virtio_net_rx_zc_ring_take(VirtIONetRxZcRing *r,
+                                              unsigned int slot)
+{
+    bool in_order = slot == r->head;
+
+    assert(r->slots[slot] &&
+           (slot + r->size - r->head) % r->size < r->num);
+
+    r->slots[slot] = NULL;
+    while (r->num && !r->slots[r->head]) {
+        r->head = (r->head + 1) % r->size;
+        r->num--;
+    }
+    return in_order;
+}
+
+#endif
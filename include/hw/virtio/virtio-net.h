@@ -17,11 +17,14 @@
 #include "qemu/units.h"
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
+#include "hw/virtio/virtio-net-rx-zc.h"
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
 
 #include "ebpf/ebpf_rss.h"
+#include "qapi/qapi-types-virtio.h"
+#include "system/iothread.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIONet, VIRTIO_NET)
@@ -164,7 +167,29 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Recycled elements, only used in the queue pair's AioContext */
+    VirtQueueElementPool rx_pool;
+    VirtQueueElementPool tx_pool;
+    /* Buffers posted to the peer for zero-copy receive */
+    VirtIONetRxZcRing rx_zc;
+    /* The posted buffers are the last ones popped and can be unpopped */
+    bool rx_zc_unpop;
+    /* Coalescing of received TCP segments, see virtio_net_gro_types() */
+    struct NetGRO *gro;
+    /* Parsed headers of the packet being steered by software RSS */
+    struct NetRxPkt *rx_pkt;
+    /*
+     * Packets steered here by software RSS from another AioContext,
+     * delivered by rss_bh in rss_ctx.  Protected by rss_lock.
+     */
+    QemuMutex rss_lock;
+    QSIMPLEQ_HEAD(, VirtioNetRssPacket) rss_backlog;
+    unsigned int rss_backlog_len;
+    QEMUBH *rss_bh;
+    AioContext *rss_ctx;
     struct VirtIONet *n;
+    /* AioContext processing the queue pair, NULL for the main loop */
+    AioContext *ctx;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -186,6 +211,8 @@ struct VirtIONet {
     uint32_t rsc_timeout;
     uint8_t rsc4_enabled;
     uint8_t rsc6_enabled;
+    /* Offer receive GSO with peers that lack vnet headers */
+    bool rx_gro;
     uint8_t has_ufo;
     uint32_t mergeable_rx_bufs;
     uint8_t promisc;
@@ -226,10 +253,17 @@ struct VirtIONet {
     bool primary_opts_from_json;
     NotifierWithReturn migration_state;
     VirtioNetRssData rss_data;
-    struct NetRxPkt *rx_pkt;
+    /* RCU-protected copy of rss_data used by software RSS */
+    struct VirtioNetRssSteering *rss_steering;
     struct EBPFRSSContext ebpf_rss;
     uint32_t nr_ebpf_rss_fds;
     char **ebpf_rss_fds;
+    IOThread *iothread;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    /* AioContext of each queue pair while ioeventfd is started */
+    AioContext **vq_aio_context;
+    bool ioeventfd_started;
+    Error *migration_blocker;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
@@ -72,6 +72,8 @@ typedef struct VirtQueueElement
     unsigned int in_num;
     /* Element has been processed (VIRTIO_F_IN_ORDER) */
     bool in_order_filled;
+    /* Element was allocated from a VirtQueueElementPool */
+    bool pooled;
     hwaddr *in_addr;
     hwaddr *out_addr;
     struct iovec *in_sg;
@@ -208,6 +210,12 @@ struct VirtIODevice
      */
     EventNotifier config_notifier;
     bool device_iotlb_enabled;
+    /**
+     * @defer_notify: in the main loop, raise the used buffer interrupts
+     * of a defer_call_begin()/defer_call_end() section once, at its end.
+     * Set by devices whose backends deliver requests in batches.
+     */
+    bool defer_notify;
     /* Shared memory region for mappings. */
     QSIMPLEQ_HEAD(, VirtioSharedMemory) shmem_list;
 };
@@ -322,6 +330,58 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+
+/*
+ * A pool of elements that are recycled instead of being freed after they
+ * have been pushed.  Elements are @sz bytes (the device's request struct,
+ * which begins with a VirtQueueElement) plus room for @sg_max scatter-gather
+ * entries; longer descriptor chains get an element of their own that is
+ * freed as usual.
+ *
+ * A pool is not thread-safe, devices use one pool per virtqueue and only
+ * access it from the virtqueue's AioContext.
+ */
+typedef struct VirtQueueElementPool {
+    size_t sz;
+    unsigned int sg_max;
+    unsigned int num;
+    unsigned int max;
+    VirtQueueElement **free;
+} VirtQueueElementPool;
+
+void virtqueue_element_pool_init(VirtQueueElementPool *pool, size_t sz,
+                                 unsigned int max, unsigned int sg_max);
+void virtqueue_element_pool_destroy(VirtQueueElementPool *pool);
+
+/*
+ * Release an element popped with virtqueue_pop_batch() or virtqueue_pop().
+ * Pooled elements go back to @pool, others are freed.
+ */
+void virtqueue_element_pool_put(VirtQueueElementPool *pool,
+                                VirtQueueElement *elem);
+
+/*
+ * Pop up to @max descriptor chains into @elems, with elements taken from
+ * @pool.  The avail index is read and ordered against the descriptor reads
+ * once for the whole batch.  Returns the number of elements popped.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, VirtQueueElementPool *pool,
+                                 VirtQueueElement **elems, unsigned int max);
+
+/*
+ * Pretend the last @num elements of a batch were not popped; they are
+ * fetched again by the next pop.  The elements still have to be released.
+ */
+void virtqueue_unpop_batch(VirtQueue *vq, VirtQueueElement **elems,
+                           unsigned int num);
+
+/*
+ * Fill @num elements and make them visible to the guest with a single
+ * flush.  @len may be NULL if no data was written to the elements.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *len, unsigned int num);
+
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -557,6 +617,13 @@ VirtQueue *virtio_get_queue(VirtIODevice *vdev, int n);
 uint16_t virtio_get_queue_index(VirtQueue *vq);
 EventNotifier *virtio_queue_get_guest_notifier(VirtQueue *vq);
 int virtio_device_start_ioeventfd(VirtIODevice *vdev);
+/*
+ * The default VirtioDeviceClass ioeventfd callbacks, which process all
+ * virtqueues in the main loop.  Devices that override the callbacks can
+ * chain up to these.
+ */
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev);
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev);
 int virtio_device_grab_ioeventfd(VirtIODevice *vdev);
 void virtio_device_release_ioeventfd(VirtIODevice *vdev);
 bool virtio_device_ioeventfd_enabled(VirtIODevice *vdev);
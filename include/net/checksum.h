@@ -27,6 +27,13 @@ struct iovec;
 #define CSUM_ALL    (CSUM_IP | CSUM_TCP | CSUM_UDP)
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq);
+
+/*
+ * For testing and benchmarking: select the next slower implementation of
+ * net_checksum_add_cont(), returning false if there is none.
+ */
+bool test_net_checksum_next_accel(void);
+
 uint16_t net_checksum_finish(uint32_t sum);
 uint16_t net_checksum_tcpudp(uint16_t length, uint16_t proto,
                              uint8_t *addrs, uint8_t *buf);
@@ -108,4 +115,39 @@ void net_toeplitz_add(uint32_t *result,
     *result = accumulator;
 }
 
+/* Longest hash input: IPv6 source and destination addresses and ports */
+#define NET_TOEPLITZ_MAX_INPUT  36
+
+/*
+ * Byte-sliced Toeplitz hash.  Entry [i][v] is the contribution of input
+ * byte @i having value @v, so that hashing takes one lookup per input
+ * byte instead of eight shifts and conditional XORs.
+ */
+typedef struct NetToeplitzTable {
+    uint32_t t[NET_TOEPLITZ_MAX_INPUT][256];
+} NetToeplitzTable;
+
+/**
+ * net_toeplitz_table_init: precompute the lookup table for a key
+ *
+ * @table: table to fill
+ * @key_bytes: hash key, NET_TOEPLITZ_MAX_INPUT + 4 bytes long
+ */
+void net_toeplitz_table_init(NetToeplitzTable *table,
+                             const uint8_t *key_bytes);
+
+static inline
+uint32_t net_toeplitz_table_hash(const NetToeplitzTable *table,
+                                 const uint8_t *input, uint32_t len)
+{
+    uint32_t result = 0;
+    uint32_t byte;
+
+    assert(len <= NET_TOEPLITZ_MAX_INPUT);
+    for (byte = 0; byte < len; byte++) {
+        result ^= table->t[byte][input[byte]];
+    }
+    return result;
+}
+
 #endif /* QEMU_NET_CHECKSUM_H */
@@ -0,0 +1,59 @@
+/*
+ * Generic receive offload for backends without vnet headers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_NET_GRO_H
+#define QEMU_NET_GRO_H
+
+#include "standard-headers/linux/virtio_net.h"
+
+/* Flow types that may be coalesced */
+#define NET_GRO_TCPV4   (1 << 0)
+#define NET_GRO_TCPV6   (1 << 1)
+
+typedef struct NetGRO NetGRO;
+
+/*
+ * Called with a coalesced packet and the vnet header that describes it,
+ * in host byte order.  Packets that were not merged with others come
+ * with an all-zero header.
+ *
+ * Returns false if the receiver has no room for the packet right now.
+ * The packet stays held then, and so do all packets after it, until a
+ * later net_gro_flush() delivers them.
+ */
+typedef bool NetGROFlush(void *opaque, const struct virtio_net_hdr *hdr,
+                         const uint8_t *buf, size_t size);
+
+typedef enum NetGROResult {
+    NET_GRO_HELD,   /* the frame was merged or is held */
+    NET_GRO_BYPASS, /* nothing is held, the caller delivers the frame */
+    NET_GRO_BUSY,   /* held packets wait for room, retry the frame later */
+} NetGROResult;
+
+NetGRO *net_gro_new(NetGROFlush *flush, void *opaque);
+void net_gro_free(NetGRO *gro);
+
+/*
+ * Offer an Ethernet frame to @gro.  In-order TCP segments of the flow
+ * types in @types are held and merged with the following segments of
+ * the same flow, up to 64 KiB.  Held packets are flushed when the
+ * current defer_call_begin()/defer_call_end() section ends, that is
+ * after the batch of packets that the backend is delivering.
+ *
+ * With NET_GRO_BUSY the frame was not consumed.  Like a NIC without rx
+ * buffers, the caller should have the net layer queue it and call
+ * net_gro_flush() once the receiver has room again.
+ */
+NetGROResult net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size,
+                             unsigned int types);
+
+/*
+ * Flush all held packets.  Returns false if the receiver ran out of
+ * room; the packets that were not delivered are still held.
+ */
+bool net_gro_flush(NetGRO *gro);
+
+#endif
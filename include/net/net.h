@@ -82,6 +82,10 @@ typedef void (NetAnnounce)(NetClientState *);
 typedef bool (SetSteeringEBPF)(NetClientState *, int);
 typedef bool (NetCheckPeerType)(NetClientState *, ObjectClass *, Error **);
 typedef struct vhost_net *(GetVHostNet)(NetClientState *nc);
+typedef void (SetAioContext)(NetClientState *, AioContext *);
+typedef bool (RxPostBuffer)(NetClientState *, void *, size_t, size_t, void *);
+typedef void (RxReclaimBuffers)(NetClientState *);
+typedef void (RxCompleteBuffer)(NetClientState *, void *, size_t);
 
 typedef struct NetClientInfo {
     NetClientDriver type;
@@ -96,6 +100,7 @@ typedef struct NetClientInfo {
     LinkStatusChanged *link_status_changed;
     QueryRxFilter *query_rx_filter;
     NetPoll *poll;
+    SetAioContext *set_aio_context;
     HasUfo *has_ufo;
     HasUso *has_uso;
     HasTunnel *has_tunnel;
@@ -110,6 +115,10 @@ typedef struct NetClientInfo {
     SetSteeringEBPF *set_steering_ebpf;
     NetCheckPeerType *check_peer_type;
     GetVHostNet *get_vhost_net;
+    /* Zero-copy receive, see qemu_post_rx_buffer() */
+    RxPostBuffer *rx_post_buffer;
+    RxReclaimBuffers *rx_reclaim_buffers;
+    RxCompleteBuffer *rx_complete_buffer;
 } NetClientInfo;
 
 struct NetClientState {
@@ -130,6 +139,8 @@ struct NetClientState {
     bool is_netdev;
     bool do_not_pad; /* do not pad to the minimum ethernet frame length */
     bool is_datapath;
+    /* AioContext that runs the datapath, NULL for the main loop */
+    AioContext *ctx;
     QTAILQ_HEAD(, NetFilterState) filters;
 };
 
@@ -205,6 +216,13 @@ bool qemu_has_tunnel(NetClientState *nc);
 bool qemu_has_vnet_hdr(NetClientState *nc);
 bool qemu_has_vnet_hdr_len(NetClientState *nc, int len);
 void qemu_set_offload(NetClientState *nc, const NetOffloads *ol);
+bool qemu_has_aio_context(NetClientState *nc);
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx);
+bool qemu_can_post_rx_buffers(NetClientState *nc);
+bool qemu_post_rx_buffer(NetClientState *nc, void *buf, size_t size,
+                         size_t headroom, void *opaque);
+void qemu_reclaim_rx_buffers(NetClientState *nc);
+void qemu_complete_rx_buffer(NetClientState *nc, void *opaque, size_t len);
 int qemu_get_vnet_hdr_len(NetClientState *nc);
 void qemu_set_vnet_hdr_len(NetClientState *nc, int len);
 bool qemu_get_vnet_hash_supported_types(NetClientState *nc, uint32_t *types);
@@ -33,6 +33,9 @@ typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
 
+/* Packets that may be queued before packets without sent callback drop */
+#define NET_QUEUE_DEFAULT_LEN  10000
+
 /* Returns:
  *   >0 - success
  *    0 - queue packet for future redelivery
@@ -55,6 +58,16 @@ void qemu_net_queue_append_iov(NetQueue *queue,
 
 void qemu_del_net_queue(NetQueue *queue);
 
+/*
+ * Resize the ring of pending packets.  Fails if packets are pending, the
+ * size can only be changed on an empty queue.
+ */
+bool qemu_net_queue_set_len(NetQueue *queue, uint32_t len);
+uint32_t qemu_net_queue_get_len(NetQueue *queue);
+
+/* Number of packets dropped because the queue was full */
+uint64_t qemu_net_queue_get_dropped(NetQueue *queue);
+
 ssize_t qemu_net_queue_receive(NetQueue *queue,
                                const uint8_t *data,
                                size_t size);
@@ -84,11 +84,15 @@ typedef uint64_t qemu_plugin_id_t;
  * version 7:
  * - add userdata to all plugin callbacks, allowing maintenance of state
  *   externally, and easing interfacing with other languages.
+ *
+ * version 8:
+ * - added memory access buffers, which record accesses from translated
+ *   code and report them to the plugin in batches
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 7
+#define QEMU_PLUGIN_VERSION 8
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -799,6 +803,94 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * typedef qemu_plugin_mem_record - a buffered memory access
+ * @vaddr: the virtual address of the access
+ * @pc: the virtual address of the instruction performing the access
+ * @info: an opaque handle for further queries about the memory
+ *
+ * qemu_plugin_get_hwaddr() cannot be used on @info, as the access has
+ * completed by the time the record is reported.
+ */
+typedef struct {
+    uint64_t vaddr;
+    uint64_t pc;
+    qemu_plugin_meminfo_t info;
+} qemu_plugin_mem_record;
+
+/** struct qemu_plugin_mem_buffer - opaque memory access buffer handle */
+struct qemu_plugin_mem_buffer;
+
+/**
+ * typedef qemu_plugin_vcpu_mem_buffer_cb_t - memory buffer callback type
+ * @vcpu_index: the vCPU that performed the accesses
+ * @records: the accesses, in program order
+ * @n_records: number of entries in @records
+ * @userdata: user data for callback
+ *
+ * @records is only valid for the duration of the callback.
+ */
+typedef void (*qemu_plugin_vcpu_mem_buffer_cb_t)(
+    unsigned int vcpu_index,
+    const qemu_plugin_mem_record *records,
+    size_t n_records,
+    void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_new() - alloc a new memory access buffer
+ * @n_records: number of records buffered per vCPU
+ * @cb: callback of type qemu_plugin_vcpu_mem_buffer_cb_t
+ * @userdata: user data for callback
+ *
+ * A memory access buffer holds up to @n_records accesses for each
+ * vCPU. The records are appended by inline code, without leaving
+ * translated code, and @cb is called with the vCPU's records when its
+ * buffer cannot hold the accesses of the next instruction. Any
+ * remaining records are reported when the vCPU exits and before the
+ * atexit callbacks run.
+ *
+ * An instruction performing more than @n_records accesses only
+ * records the first @n_records of them.
+ *
+ * Returns a pointer to a new buffer. It must be freed using
+ * qemu_plugin_mem_buffer_free.
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t n_records,
+                           qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                           void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_free() - free a memory access buffer
+ * @buffer: buffer to free
+ *
+ * Records still held in @buffer are reported before it is freed. Like
+ * scoreboards, buffers may only be freed once no translated code uses
+ * them anymore, typically in the atexit callback. A plugin that
+ * uninstalls itself must free its buffers first, as they call back
+ * into it.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buffer);
+
+/**
+ * qemu_plugin_register_vcpu_mem_buffer() - buffer memory accesses
+ * @insn: handle for instruction to instrument
+ * @rw: record reads, writes or both
+ * @buffer: buffer to append the records to
+ *
+ * This records every memory access generated by the instruction into
+ * @buffer. Compared to qemu_plugin_register_vcpu_mem_cb() this avoids
+ * a call per access, which makes it suitable for tracing and cache
+ * modelling.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_buffer(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    struct qemu_plugin_mem_buffer *buffer);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
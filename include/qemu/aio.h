@@ -295,6 +295,19 @@ struct AioContext {
 
     /* Pending callback state for cqe handlers */
     CqeHandlerSimpleQ cqe_handler_ready_list;
+
+    /*
+     * Ring with 128-byte sqes for aio_add_cmd_sqe(), created on first use.
+     * NULL if no passthrough commands have been submitted in this AioContext.
+     */
+    struct io_uring *fdmon_io_uring_cmd;
+
+    /*
+     * Fixed buffers registered with fdmon_io_uring, see
+     * aio_register_fixed_buf(). NULL if the kernel does not support them.
+     */
+    struct FdmonFixedBuf *fixed_bufs;
+    unsigned fixed_bufs_gen;
 #endif /* CONFIG_LINUX_IO_URING */
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -830,6 +843,15 @@ static inline bool aio_has_io_uring(void)
     return ctx->fdmon_ops->add_sqe;
 }
 
+/**
+ * aio_has_io_uring_cmd: Return whether IORING_OP_URING_CMD can be submitted.
+ *
+ * Passthrough commands need the 128-byte sqes and 32-byte cqes that only newer
+ * kernels offer. They use a separate ring, which this function creates in the
+ * current AioContext if it does not have one yet.
+ */
+bool aio_has_io_uring_cmd(void);
+
 /**
  * aio_add_sqe: Add an io_uring sqe for submission.
  * @prep_sqe: invoked with an sqe that should be prepared for submission
@@ -850,6 +872,82 @@ static inline bool aio_has_io_uring(void)
  */
 void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
                  void *opaque, CqeHandler *cqe_handler);
+
+/**
+ * aio_add_cmd_sqe: Add a 128-byte io_uring sqe for submission.
+ * @prep_sqe: invoked with an sqe that should be prepared for submission
+ * @opaque: user-defined argument to @prep_sqe()
+ * @cqe_handler: the unique cqe handler associated with this request
+ *
+ * Like aio_add_sqe(), but for IORING_OP_URING_CMD passthrough commands. The
+ * sqe has room for an 80-byte command and @cqe_handler gets the first 16
+ * bytes of the 32-byte cqe.
+ *
+ * The sqe is submitted when the outermost defer_call_begin() section ends, or
+ * immediately outside of one.
+ *
+ * Returns: 0 on success, or -errno if the current AioContext cannot create a
+ * ring for passthrough commands.
+ */
+int aio_add_cmd_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                    void *opaque, CqeHandler *cqe_handler);
+
+/**
+ * aio_register_fixed_buf: Register memory as an io_uring fixed buffer
+ * @host: start of the memory area
+ * @size: size of the memory area in bytes
+ *
+ * Fixed buffers stay pinned, so the kernel does not need to map their pages
+ * for every request. The memory area is registered with the io_uring of each
+ * AioContext before it is looked up there with aio_get_fixed_buf().
+ *
+ * Registration is best effort. If the kernel refuses it, for example because
+ * of RLIMIT_MEMLOCK, then aio_get_fixed_buf() does not find the memory area.
+ *
+ * Calls nest and must be balanced by aio_unregister_fixed_buf() with the same
+ * arguments.
+ */
+void aio_register_fixed_buf(void *host, size_t size);
+
+/**
+ * aio_unregister_fixed_buf: Undo aio_register_fixed_buf()
+ * @host: start of the memory area
+ * @size: size of the memory area in bytes
+ *
+ * When the last reference is dropped, the memory area is unregistered from
+ * the io_uring of every AioContext before this function returns, so it is no
+ * longer pinned and may be freed.
+ *
+ * This function must be called from the main loop thread.
+ */
+void aio_unregister_fixed_buf(void *host, size_t size);
+
+/**
+ * aio_get_fixed_buf: Look up the fixed buffer that contains a memory range
+ * @base: start of the memory range
+ * @len: length of the memory range in bytes
+ *
+ * This function must be called from the @prep_sqe() callback of aio_add_sqe().
+ *
+ * Returns: the buffer index to use in the sqe, or -1 if the memory range is
+ * not part of a fixed buffer in the current AioContext.
+ */
+int aio_get_fixed_buf(const void *base, size_t len);
+
+/**
+ * aio_context_use_sqpoll: Submit io_uring sqes from a kernel thread
+ * @ctx: the AioContext, which must not have been polled yet
+ * @cpu: the host CPU to bind the kernel thread to, or -1
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Recreate the io_uring of @ctx with IORING_SETUP_SQPOLL. A kernel thread then
+ * picks up new sqes without an io_uring_enter(2) call for as long as it keeps
+ * busy. This costs a host CPU, so it only makes sense for AioContexts that
+ * have a dedicated CPU anyway.
+ *
+ * Returns: true on success, false on failure.
+ */
+bool aio_context_use_sqpoll(AioContext *ctx, int cpu, Error **errp);
 #endif /* CONFIG_LINUX_IO_URING */
 
 #endif
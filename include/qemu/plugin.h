@@ -72,6 +72,7 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_MEM_REGULAR,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
+    PLUGIN_CB_MEM_BUFFER,
 };
 
 struct qemu_plugin_regular_cb {
@@ -96,6 +97,12 @@ struct qemu_plugin_conditional_cb {
     uint64_t imm;
 };
 
+struct qemu_plugin_mem_buffer_cb {
+    struct qemu_plugin_mem_buffer *buffer;
+    uint64_t pc;
+    enum qemu_plugin_mem_rw rw;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -107,6 +114,7 @@ struct qemu_plugin_dyn_cb {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
         struct qemu_plugin_inline_cb inline_insn;
+        struct qemu_plugin_mem_buffer_cb mem_buffer;
     };
 };
 
@@ -128,6 +136,25 @@ struct qemu_plugin_scoreboard {
     QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
+/*
+ * A memory access buffer keeps one struct qemu_plugin_mem_buffer_entry
+ * per vcpu in a scoreboard. The entry has room for one record past
+ * @n_records, which absorbs the accesses of instructions performing
+ * more than @n_records of them.
+ */
+struct qemu_plugin_mem_buffer {
+    struct qemu_plugin_scoreboard *score;
+    uint32_t n_records;
+    qemu_plugin_vcpu_mem_buffer_cb_t cb;
+    void *userp;
+    QLIST_ENTRY(qemu_plugin_mem_buffer) entry;
+};
+
+struct qemu_plugin_mem_buffer_entry {
+    uint32_t count;
+    qemu_plugin_mem_record records[];
+};
+
 /* Internal context for this TranslationBlock */
 struct qemu_plugin_tb {
     GPtrArray *insns;
@@ -179,6 +206,9 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_high,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw);
 
+void qemu_plugin_vcpu_mem_buffer_flush(uint32_t cpu_index,
+                                       struct qemu_plugin_mem_buffer *buffer);
+
 void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
@@ -56,6 +56,10 @@ struct IOThread {
     int64_t poll_grow;
     int64_t poll_shrink;
     int64_t poll_weight;
+
+    /* io_uring SQPOLL, see aio_context_use_sqpoll() */
+    bool io_uring_sqpoll;
+    int64_t io_uring_sqpoll_cpu;
 };
 typedef struct IOThread IOThread;
 
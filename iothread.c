@@ -95,6 +95,7 @@ static void iothread_instance_init(Object *obj)
     iothread->poll_grow = IOTHREAD_POLL_GROW_DEFAULT;
     iothread->poll_shrink = IOTHREAD_POLL_SHRINK_DEFAULT;
     iothread->poll_weight = IOTHREAD_POLL_WEIGHT_DEFAULT;
+    iothread->io_uring_sqpoll_cpu = -1;
 
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
@@ -184,6 +185,22 @@ static void iothread_init(EventLoopBase *base, Error **errp)
         return;
     }
 
+    if (iothread->io_uring_sqpoll) {
+#ifdef CONFIG_LINUX_IO_URING
+        if (!aio_context_use_sqpoll(iothread->ctx,
+                                    iothread->io_uring_sqpoll_cpu, errp)) {
+            aio_context_unref(iothread->ctx);
+            iothread->ctx = NULL;
+            return;
+        }
+#else
+        error_setg(errp, "io-uring-sqpoll is not supported in this build");
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+#endif
+    }
+
     thread_name = g_strdup_printf("IO %s",
                         object_get_canonical_path_component(OBJECT(base)));
 
@@ -308,6 +325,58 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value,
+                                         Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    /* The io_uring is set up together with the AioContext */
+    if (iothread->ctx) {
+        error_setg(errp, "io-uring-sqpoll cannot be changed at runtime");
+        return;
+    }
+
+    iothread->io_uring_sqpoll = value;
+}
+
+static void iothread_get_io_uring_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_int64(v, name, &iothread->io_uring_sqpoll_cpu, errp);
+}
+
+static void iothread_set_io_uring_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value;
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    if (iothread->ctx) {
+        error_setg(errp, "%s cannot be changed at runtime", name);
+        return;
+    }
+
+    if (value < -1 || value > INT_MAX) {
+        error_setg(errp, "%s value must be in range [-1, %d]", name, INT_MAX);
+        return;
+    }
+
+    iothread->io_uring_sqpoll_cpu = value;
+}
+
 static void iothread_class_init(ObjectClass *klass, const void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -331,6 +400,13 @@ static void iothread_class_init(ObjectClass *klass, const void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_weight_info);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
+    object_class_property_add(klass, "io-uring-sqpoll-cpu", "int",
+                              iothread_get_io_uring_sqpoll_cpu,
+                              iothread_set_io_uring_sqpoll_cpu,
+                              NULL, NULL);
 }
 
 static const TypeInfo iothread_info = {
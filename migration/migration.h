@@ -36,9 +36,11 @@
 #define  MIGRATION_THREAD_SRC_MULTIFD       "mig/src/send_%d"
 #define  MIGRATION_THREAD_SRC_RETURN        "mig/src/return"
 #define  MIGRATION_THREAD_SRC_TLS           "mig/src/tls"
+#define  MIGRATION_THREAD_SRC_COMPRESS      "mig/src/comp_%d"
 
 #define  MIGRATION_THREAD_DST_COLO          "mig/dst/colo"
 #define  MIGRATION_THREAD_DST_MULTIFD       "mig/dst/recv_%d"
+#define  MIGRATION_THREAD_DST_DECOMPRESS    "mig/dst/decomp_%d"
 #define  MIGRATION_THREAD_DST_FAULT         "mig/dst/fault"
 #define  MIGRATION_THREAD_DST_LISTEN        "mig/dst/listen"
 #define  MIGRATION_THREAD_DST_PREEMPT       "mig/dst/preempt"
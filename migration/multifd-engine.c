@@ -0,0 +1,497 @@
+/*
+ * Multifd batched compression engines
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/lockable.h"
+#include "qemu/module.h"
+#include "qapi/error.h"
+#include "system/ramblock.h"
+#include "migration.h"
+#include "multifd.h"
+#include "multifd-engine.h"
+#include "options.h"
+#include "trace.h"
+
+/* Number of pages a worker takes from a batch at a time */
+#define MULTIFD_ENGINE_CHUNK 8
+
+typedef struct {
+    MultiFDEngine *engine;
+    QemuThread thread;
+    void *ctx;
+} MultiFDEngineWorker;
+
+struct MultiFDEngine {
+    const MultiFDEngineOps *ops;
+    bool compress;
+    /* number of channels using the engine, protected by multifd_engine_lock */
+    unsigned int refcnt;
+    unsigned int nworkers;
+    MultiFDEngineWorker *workers;
+
+    /* this mutex protects the following fields and the batches' next */
+    QemuMutex lock;
+    QemuCond cond;
+    /* batches that still have pages no worker has taken */
+    QSIMPLEQ_HEAD(, MultiFDEngineBatch) queue;
+    bool quit;
+};
+
+/* The engines of both directions, indexed by compress */
+static MultiFDEngine *multifd_engines[2];
+static QemuMutex multifd_engine_lock;
+
+typedef struct {
+    MultiFDEngine *engine;
+    MultiFDEngineBatch batch;
+    /* compressed pages, one page sized slot per page */
+    uint8_t *zbuf;
+    /* page lengths, big endian on the wire */
+    uint32_t *zlen;
+} MultiFDEngineData;
+
+static void multifd_engine_process(MultiFDEngine *engine, void *ctx,
+                                   MultiFDEngineBatch *batch, uint32_t i)
+{
+    const MultiFDEngineOps *ops = engine->ops;
+
+    if (engine->compress) {
+        batch->out_len[i] = ops->compress(ctx, batch->in[i], batch->in_len[i],
+                                          batch->out[i], batch->out_size);
+    } else {
+        batch->out_len[i] = ops->decompress(ctx, batch->in[i],
+                                            batch->in_len[i], batch->out[i],
+                                            batch->out_size);
+    }
+}
+
+static void *multifd_engine_thread(void *opaque)
+{
+    MultiFDEngineWorker *w = opaque;
+    MultiFDEngine *engine = w->engine;
+
+    qemu_mutex_lock(&engine->lock);
+    for (;;) {
+        MultiFDEngineBatch *batch;
+        uint32_t start, end;
+
+        while (!engine->quit && QSIMPLEQ_EMPTY(&engine->queue)) {
+            qemu_cond_wait(&engine->cond, &engine->lock);
+        }
+        if (engine->quit) {
+            break;
+        }
+
+        batch = QSIMPLEQ_FIRST(&engine->queue);
+        start = batch->next;
+        end = MIN(start + MULTIFD_ENGINE_CHUNK, batch->num);
+        batch->next = end;
+        if (end == batch->num) {
+            QSIMPLEQ_REMOVE_HEAD(&engine->queue, entry);
+        }
+        qemu_mutex_unlock(&engine->lock);
+
+        for (uint32_t i = start; i < end; i++) {
+            multifd_engine_process(engine, w->ctx, batch, i);
+        }
+        /* The batch may be reused as soon as the last page is done */
+        if (qatomic_sub_fetch(&batch->pending, end - start) == 0) {
+            qemu_event_set(&batch->done);
+        }
+
+        qemu_mutex_lock(&engine->lock);
+    }
+    qemu_mutex_unlock(&engine->lock);
+
+    return NULL;
+}
+
+static void multifd_engine_free(MultiFDEngine *engine)
+{
+    for (unsigned int i = 0; i < engine->nworkers; i++) {
+        if (engine->workers[i].ctx) {
+            engine->ops->ctx_free(engine->workers[i].ctx);
+        }
+    }
+    g_free(engine->workers);
+    qemu_cond_destroy(&engine->cond);
+    qemu_mutex_destroy(&engine->lock);
+    g_free(engine);
+}
+
+static MultiFDEngine *multifd_engine_new(const MultiFDEngineOps *ops,
+                                         bool compress, Error **errp)
+{
+    MultiFDEngine *engine = g_new0(MultiFDEngine, 1);
+    unsigned int i;
+
+    engine->ops = ops;
+    engine->compress = compress;
+    engine->nworkers = migrate_multifd_compression_threads();
+    if (!engine->nworkers) {
+        engine->nworkers = g_get_num_processors();
+    }
+    engine->workers = g_new0(MultiFDEngineWorker, engine->nworkers);
+    qemu_mutex_init(&engine->lock);
+    qemu_cond_init(&engine->cond);
+    QSIMPLEQ_INIT(&engine->queue);
+
+    for (i = 0; i < engine->nworkers; i++) {
+        engine->workers[i].engine = engine;
+        engine->workers[i].ctx = ops->ctx_new(compress, errp);
+        if (!engine->workers[i].ctx) {
+            multifd_engine_free(engine);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < engine->nworkers; i++) {
+        g_autofree char *name = g_strdup_printf(compress ?
+                                                MIGRATION_THREAD_SRC_COMPRESS :
+                                                MIGRATION_THREAD_DST_DECOMPRESS,
+                                                i);
+
+        qemu_thread_create(&engine->workers[i].thread, name,
+                           multifd_engine_thread, &engine->workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    trace_multifd_engine_new(compress, engine->nworkers);
+    return engine;
+}
+
+/**
+ * multifd_engine_get: get a reference to the engine of a direction
+ *
+ * The first user creates the engine and its worker threads, later
+ * users share them.
+ *
+ * Returns the engine, or NULL on error
+ *
+ * @ops: the engine implementation
+ * @compress: true on the source, false on the destination
+ * @errp: pointer to an error
+ */
+MultiFDEngine *multifd_engine_get(const MultiFDEngineOps *ops, bool compress,
+                                  Error **errp)
+{
+    MultiFDEngine *engine;
+
+    QEMU_LOCK_GUARD(&multifd_engine_lock);
+
+    engine = multifd_engines[compress];
+    if (!engine) {
+        engine = multifd_engine_new(ops, compress, errp);
+        if (!engine) {
+            return NULL;
+        }
+        multifd_engines[compress] = engine;
+    }
+    assert(engine->ops == ops);
+    engine->refcnt++;
+    return engine;
+}
+
+/**
+ * multifd_engine_put: drop a reference to an engine
+ *
+ * The last user stops the worker threads.  No batch may be in flight.
+ *
+ * @engine: the engine returned by multifd_engine_get()
+ */
+void multifd_engine_put(MultiFDEngine *engine)
+{
+    QEMU_LOCK_GUARD(&multifd_engine_lock);
+
+    if (--engine->refcnt) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&engine->lock) {
+        assert(QSIMPLEQ_EMPTY(&engine->queue));
+        engine->quit = true;
+        qemu_cond_broadcast(&engine->cond);
+    }
+    for (unsigned int i = 0; i < engine->nworkers; i++) {
+        qemu_thread_join(&engine->workers[i].thread);
+    }
+
+    multifd_engines[engine->compress] = NULL;
+    multifd_engine_free(engine);
+}
+
+void multifd_engine_batch_init(MultiFDEngineBatch *batch, uint32_t max)
+{
+    batch->num = 0;
+    batch->in = g_new0(uint8_t *, max);
+    batch->in_len = g_new0(uint32_t, max);
+    batch->out = g_new0(uint8_t *, max);
+    batch->out_len = g_new0(uint32_t, max);
+    qemu_event_init(&batch->done, true);
+}
+
+void multifd_engine_batch_destroy(MultiFDEngineBatch *batch)
+{
+    qemu_event_destroy(&batch->done);
+    g_free(batch->in);
+    g_free(batch->in_len);
+    g_free(batch->out);
+    g_free(batch->out_len);
+}
+
+/**
+ * multifd_engine_submit: queue a batch to the worker threads
+ *
+ * Returns immediately; the results are available once
+ * multifd_engine_wait() returns.
+ *
+ * @engine: the engine
+ * @batch: the batch, with its inputs and outputs filled in
+ */
+void multifd_engine_submit(MultiFDEngine *engine, MultiFDEngineBatch *batch)
+{
+    if (!batch->num) {
+        return;
+    }
+
+    qemu_event_reset(&batch->done);
+    qatomic_set(&batch->pending, batch->num);
+
+    WITH_QEMU_LOCK_GUARD(&engine->lock) {
+        batch->next = 0;
+        QSIMPLEQ_INSERT_TAIL(&engine->queue, batch, entry);
+        if (batch->num > MULTIFD_ENGINE_CHUNK) {
+            qemu_cond_broadcast(&engine->cond);
+        } else {
+            qemu_cond_signal(&engine->cond);
+        }
+    }
+}
+
+/**
+ * multifd_engine_wait: wait until all pages of a batch are done
+ *
+ * @batch: the batch passed to multifd_engine_submit()
+ */
+void multifd_engine_wait(MultiFDEngineBatch *batch)
+{
+    qemu_event_wait(&batch->done);
+}
+
+static MultiFDEngineData *multifd_engine_data_new(const MultiFDEngineOps *ops,
+                                                  bool compress, Error **errp)
+{
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t page_count = multifd_ram_page_count();
+    MultiFDEngineData *data;
+    MultiFDEngine *engine;
+
+    engine = multifd_engine_get(ops, compress, errp);
+    if (!engine) {
+        return NULL;
+    }
+
+    data = g_new0(MultiFDEngineData, 1);
+    data->engine = engine;
+    multifd_engine_batch_init(&data->batch, page_count);
+    data->zbuf = g_malloc(page_size * page_count);
+    data->zlen = g_new0(uint32_t, page_count);
+    return data;
+}
+
+static void multifd_engine_data_free(MultiFDEngineData *data)
+{
+    multifd_engine_put(data->engine);
+    multifd_engine_batch_destroy(&data->batch);
+    g_free(data->zbuf);
+    g_free(data->zlen);
+    g_free(data);
+}
+
+int multifd_engine_send_setup(MultiFDSendParams *p,
+                              const MultiFDEngineOps *ops, Error **errp)
+{
+    MultiFDEngineData *data = multifd_engine_data_new(ops, true, errp);
+
+    if (!data) {
+        return -1;
+    }
+    p->compress_data = data;
+
+    /*
+     * Each page is sent with its own IOV.  The additional two IOVs are
+     * used for the packet header and the page lengths.
+     */
+    p->iov = g_new0(struct iovec, multifd_ram_page_count() + 2);
+    return 0;
+}
+
+void multifd_engine_send_cleanup(MultiFDSendParams *p)
+{
+    multifd_engine_data_free(p->compress_data);
+    p->compress_data = NULL;
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+static void multifd_engine_fill_iov(MultiFDSendParams *p, void *buf,
+                                    uint32_t len)
+{
+    p->iov[p->iovs_num].iov_base = buf;
+    p->iov[p->iovs_num].iov_len = len;
+    p->iovs_num++;
+    p->next_packet_size += len;
+}
+
+void multifd_engine_send_prepare(MultiFDSendParams *p, uint32_t flag)
+{
+    MultiFDEngineData *data = p->compress_data;
+    MultiFDEngineBatch *batch = &data->batch;
+    MultiFDPages_t *pages = &p->data->u.ram;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t i;
+
+    if (!multifd_send_prepare_common(p)) {
+        goto out;
+    }
+
+    batch->num = pages->normal_num;
+    /* Pages that do not shrink are sent uncompressed */
+    batch->out_size = page_size - 1;
+    for (i = 0; i < batch->num; i++) {
+        batch->in[i] = pages->block->host + pages->offset[i];
+        batch->in_len[i] = page_size;
+        batch->out[i] = data->zbuf + (size_t)i * page_size;
+    }
+    multifd_engine_submit(data->engine, batch);
+    multifd_engine_wait(batch);
+
+    multifd_engine_fill_iov(p, data->zlen, batch->num * sizeof(uint32_t));
+    for (i = 0; i < batch->num; i++) {
+        if (batch->out_len[i]) {
+            data->zlen[i] = cpu_to_be32(batch->out_len[i]);
+            multifd_engine_fill_iov(p, batch->out[i], batch->out_len[i]);
+        } else {
+            data->zlen[i] = cpu_to_be32(page_size);
+            multifd_engine_fill_iov(p, batch->in[i], page_size);
+        }
+    }
+
+out:
+    p->flags |= flag;
+    multifd_send_fill_packet(p);
+}
+
+int multifd_engine_recv_setup(MultiFDRecvParams *p,
+                              const MultiFDEngineOps *ops, Error **errp)
+{
+    MultiFDEngineData *data = multifd_engine_data_new(ops, false, errp);
+
+    if (!data) {
+        return -1;
+    }
+    p->compress_data = data;
+    return 0;
+}
+
+void multifd_engine_recv_cleanup(MultiFDRecvParams *p)
+{
+    multifd_engine_data_free(p->compress_data);
+    p->compress_data = NULL;
+}
+
+int multifd_engine_recv(MultiFDRecvParams *p, uint32_t flag, Error **errp)
+{
+    MultiFDEngineData *data = p->compress_data;
+    MultiFDEngineBatch *batch = &data->batch;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t len, zbuf_len = 0;
+    uint8_t *zbuf;
+    int ret;
+
+    if (flags != flag) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, flag);
+        return -1;
+    }
+    multifd_recv_zero_page_process(p);
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    /* read the page lengths */
+    len = p->normal_num * sizeof(uint32_t);
+    if (len > in_size) {
+        error_setg(errp, "multifd %u: packet size %u too small for %u pages",
+                   p->id, in_size, p->normal_num);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)data->zlen, len, errp);
+    if (ret != 0) {
+        return ret;
+    }
+    for (uint32_t i = 0; i < p->normal_num; i++) {
+        data->zlen[i] = be32_to_cpu(data->zlen[i]);
+        if (!data->zlen[i] || data->zlen[i] > page_size) {
+            error_setg(errp, "multifd %u: invalid page length %u",
+                       p->id, data->zlen[i]);
+            return -1;
+        }
+        zbuf_len += data->zlen[i];
+    }
+    if (in_size != len + zbuf_len) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, in_size, len + zbuf_len);
+        return -1;
+    }
+
+    /* read the pages */
+    ret = qio_channel_read_all(p->c, (void *)data->zbuf, zbuf_len, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    batch->num = 0;
+    batch->out_size = page_size;
+    zbuf = data->zbuf;
+    for (uint32_t i = 0; i < p->normal_num; i++) {
+        uint8_t *addr = p->host + p->normal[i];
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        if (data->zlen[i] == page_size) {
+            /* the page was sent uncompressed */
+            memcpy(addr, zbuf, page_size);
+        } else {
+            batch->in[batch->num] = zbuf;
+            batch->in_len[batch->num] = data->zlen[i];
+            batch->out[batch->num] = addr;
+            batch->num++;
+        }
+        zbuf += data->zlen[i];
+    }
+    multifd_engine_submit(data->engine, batch);
+    multifd_engine_wait(batch);
+
+    for (uint32_t i = 0; i < batch->num; i++) {
+        if (batch->out_len[i] != page_size) {
+            error_setg(errp, "multifd %u: decompressed length %u, expected %u",
+                       p->id, batch->out_len[i], page_size);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void multifd_engine_init(void)
+{
+    qemu_mutex_init(&multifd_engine_lock);
+}
+
+migration_init(multifd_engine_init);
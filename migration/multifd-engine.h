@@ -0,0 +1,95 @@
+/*
+ * Multifd batched compression engines
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_MIGRATION_MULTIFD_ENGINE_H
+#define QEMU_MIGRATION_MULTIFD_ENGINE_H
+
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "multifd.h"
+
+/*
+ * A compression engine compresses or decompresses batches of pages.
+ * Each page is processed independently, so the pages of one batch can
+ * be spread over the worker threads of the engine, or handed to an
+ * offload device as one request.
+ *
+ * The engine is shared by all multifd channels of one direction, and
+ * its worker count (multifd-compression-threads) is independent of
+ * multifd-channels.
+ */
+typedef struct MultiFDEngineOps {
+    /*
+     * Allocate the per worker context.  @compress tells whether the
+     * engine compresses (source) or decompresses (destination).
+     */
+    void *(*ctx_new)(bool compress, Error **errp);
+
+    /* Free a context returned by ctx_new. */
+    void (*ctx_free)(void *ctx);
+
+    /*
+     * Compress @in_len bytes from @in into at most @out_size bytes at
+     * @out.  Returns the compressed length, or 0 if the data did not
+     * fit or could not be compressed.
+     */
+    uint32_t (*compress)(void *ctx, const uint8_t *in, uint32_t in_len,
+                         uint8_t *out, uint32_t out_size);
+
+    /*
+     * Decompress @in_len bytes from @in into at most @out_size bytes at
+     * @out.  Returns the decompressed length, or 0 on error.
+     */
+    uint32_t (*decompress)(void *ctx, const uint8_t *in, uint32_t in_len,
+                           uint8_t *out, uint32_t out_size);
+} MultiFDEngineOps;
+
+typedef struct MultiFDEngine MultiFDEngine;
+
+typedef struct MultiFDEngineBatch {
+    /* number of pages in the batch */
+    uint32_t num;
+    /* input buffer and length of each page */
+    uint8_t **in;
+    uint32_t *in_len;
+    /* output buffer of each page, each holding @out_size bytes */
+    uint8_t **out;
+    uint32_t out_size;
+    /* result of each page, see MultiFDEngineOps */
+    uint32_t *out_len;
+
+    /* private, only accessed with the engine lock held */
+    uint32_t next;
+    QSIMPLEQ_ENTRY(MultiFDEngineBatch) entry;
+    /* private, pages that are not done yet */
+    uint32_t pending;
+    QemuEvent done;
+} MultiFDEngineBatch;
+
+MultiFDEngine *multifd_engine_get(const MultiFDEngineOps *ops, bool compress,
+                                  Error **errp);
+void multifd_engine_put(MultiFDEngine *engine);
+
+void multifd_engine_batch_init(MultiFDEngineBatch *batch, uint32_t max);
+void multifd_engine_batch_destroy(MultiFDEngineBatch *batch);
+void multifd_engine_submit(MultiFDEngine *engine, MultiFDEngineBatch *batch);
+void multifd_engine_wait(MultiFDEngineBatch *batch);
+
+/*
+ * Generic multifd methods for engines.  Pages are sent as an array of
+ * big endian lengths followed by the page data; a page whose length is
+ * the page size is sent uncompressed.
+ */
+int multifd_engine_send_setup(MultiFDSendParams *p,
+                              const MultiFDEngineOps *ops, Error **errp);
+void multifd_engine_send_cleanup(MultiFDSendParams *p);
+void multifd_engine_send_prepare(MultiFDSendParams *p, uint32_t flag);
+int multifd_engine_recv_setup(MultiFDRecvParams *p,
+                              const MultiFDEngineOps *ops, Error **errp);
+void multifd_engine_recv_cleanup(MultiFDRecvParams *p);
+int multifd_engine_recv(MultiFDRecvParams *p, uint32_t flag, Error **errp);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * Pages are compressed one by one on the worker threads of a
+ * MultiFDEngine, like zstd-mt.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/module.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "multifd.h"
+#include "multifd-engine.h"
+
+typedef struct {
+    /* lz4 compression state, NULL when decompressing */
+    void *state;
+} LZ4Ctx;
+
+static void multifd_lz4_ctx_free(void *opaque)
+{
+    LZ4Ctx *z = opaque;
+
+    g_free(z->state);
+    g_free(z);
+}
+
+static void *multifd_lz4_ctx_new(bool compress, Error **errp)
+{
+    LZ4Ctx *z = g_new0(LZ4Ctx, 1);
+
+    if (compress) {
+        z->state = g_malloc(LZ4_sizeofState());
+    }
+    return z;
+}
+
+static uint32_t multifd_lz4_compress(void *opaque, const uint8_t *in,
+                                     uint32_t in_len, uint8_t *out,
+                                     uint32_t out_size)
+{
+    LZ4Ctx *z = opaque;
+    int ret;
+
+    ret = LZ4_compress_fast_extState(z->state, (const char *)in, (char *)out,
+                                     in_len, out_size, 1);
+    /* 0 if the page does not fit, it is then sent raw */
+    return MAX(ret, 0);
+}
+
+static uint32_t multifd_lz4_decompress(void *opaque, const uint8_t *in,
+                                       uint32_t in_len, uint8_t *out,
+                                       uint32_t out_size)
+{
+    int ret;
+
+    ret = LZ4_decompress_safe((const char *)in, (char *)out, in_len,
+                              out_size);
+    return MAX(ret, 0);
+}
+
+static const MultiFDEngineOps multifd_lz4_engine_ops = {
+    .ctx_new = multifd_lz4_ctx_new,
+    .ctx_free = multifd_lz4_ctx_free,
+    .compress = multifd_lz4_compress,
+    .decompress = multifd_lz4_decompress,
+};
+
+static int multifd_lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    return multifd_engine_send_setup(p, &multifd_lz4_engine_ops, errp);
+}
+
+static void multifd_lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    multifd_engine_send_cleanup(p);
+}
+
+static int multifd_lz4_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    multifd_engine_send_prepare(p, MULTIFD_FLAG_LZ4);
+    return 0;
+}
+
+static int multifd_lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    return multifd_engine_recv_setup(p, &multifd_lz4_engine_ops, errp);
+}
+
+static void multifd_lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    multifd_engine_recv_cleanup(p);
+}
+
+static int multifd_lz4_recv(MultiFDRecvParams *p, Error **errp)
+{
+    return multifd_engine_recv(p, MULTIFD_FLAG_LZ4, errp);
+}
+
+static const MultiFDMethods multifd_lz4_ops = {
+    .send_setup = multifd_lz4_send_setup,
+    .send_cleanup = multifd_lz4_send_cleanup,
+    .send_prepare = multifd_lz4_send_prepare,
+    .recv_setup = multifd_lz4_recv_setup,
+    .recv_cleanup = multifd_lz4_recv_cleanup,
+    .recv = multifd_lz4_recv
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
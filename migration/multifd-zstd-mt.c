@@ -0,0 +1,137 @@
+/*
+ * Multifd multi-threaded zstd compression implementation
+ *
+ * Pages are compressed one by one on the worker threads of a
+ * MultiFDEngine, so that the compression throughput does not depend
+ * on the number of multifd channels.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include <zstd.h>
+#include "qemu/module.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "multifd.h"
+#include "multifd-engine.h"
+#include "options.h"
+
+typedef struct {
+    /* context for compression */
+    ZSTD_CCtx *cctx;
+    /* context for decompression */
+    ZSTD_DCtx *dctx;
+    /* compression level */
+    int level;
+} ZstdMTCtx;
+
+static void multifd_zstd_mt_ctx_free(void *opaque)
+{
+    ZstdMTCtx *z = opaque;
+
+    ZSTD_freeCCtx(z->cctx);
+    ZSTD_freeDCtx(z->dctx);
+    g_free(z);
+}
+
+static void *multifd_zstd_mt_ctx_new(bool compress, Error **errp)
+{
+    ZstdMTCtx *z = g_new0(ZstdMTCtx, 1);
+
+    if (compress) {
+        z->cctx = ZSTD_createCCtx();
+        z->level = migrate_multifd_zstd_level();
+    } else {
+        z->dctx = ZSTD_createDCtx();
+    }
+    if (!z->cctx && !z->dctx) {
+        error_setg(errp, "multifd: zstd context creation failed");
+        g_free(z);
+        return NULL;
+    }
+    return z;
+}
+
+static uint32_t multifd_zstd_mt_compress(void *opaque, const uint8_t *in,
+                                         uint32_t in_len, uint8_t *out,
+                                         uint32_t out_size)
+{
+    ZstdMTCtx *z = opaque;
+    size_t ret;
+
+    ret = ZSTD_compressCCtx(z->cctx, out, out_size, in, in_len, z->level);
+    /* also covers ZSTD_error_dstSize_tooSmall, the page is sent raw */
+    if (ZSTD_isError(ret)) {
+        return 0;
+    }
+    return ret;
+}
+
+static uint32_t multifd_zstd_mt_decompress(void *opaque, const uint8_t *in,
+                                           uint32_t in_len, uint8_t *out,
+                                           uint32_t out_size)
+{
+    ZstdMTCtx *z = opaque;
+    size_t ret;
+
+    ret = ZSTD_decompressDCtx(z->dctx, out, out_size, in, in_len);
+    if (ZSTD_isError(ret)) {
+        return 0;
+    }
+    return ret;
+}
+
+static const MultiFDEngineOps multifd_zstd_mt_engine_ops = {
+    .ctx_new = multifd_zstd_mt_ctx_new,
+    .ctx_free = multifd_zstd_mt_ctx_free,
+    .compress = multifd_zstd_mt_compress,
+    .decompress = multifd_zstd_mt_decompress,
+};
+
+static int multifd_zstd_mt_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    return multifd_engine_send_setup(p, &multifd_zstd_mt_engine_ops, errp);
+}
+
+static void multifd_zstd_mt_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    multifd_engine_send_cleanup(p);
+}
+
+static int multifd_zstd_mt_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    multifd_engine_send_prepare(p, MULTIFD_FLAG_ZSTD_MT);
+    return 0;
+}
+
+static int multifd_zstd_mt_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    return multifd_engine_recv_setup(p, &multifd_zstd_mt_engine_ops, errp);
+}
+
+static void multifd_zstd_mt_recv_cleanup(MultiFDRecvParams *p)
+{
+    multifd_engine_recv_cleanup(p);
+}
+
+static int multifd_zstd_mt_recv(MultiFDRecvParams *p, Error **errp)
+{
+    return multifd_engine_recv(p, MULTIFD_FLAG_ZSTD_MT, errp);
+}
+
+static const MultiFDMethods multifd_zstd_mt_ops = {
+    .send_setup = multifd_zstd_mt_send_setup,
+    .send_cleanup = multifd_zstd_mt_send_cleanup,
+    .send_prepare = multifd_zstd_mt_send_prepare,
+    .recv_setup = multifd_zstd_mt_recv_setup,
+    .recv_cleanup = multifd_zstd_mt_recv_cleanup,
+    .recv = multifd_zstd_mt_recv
+};
+
+static void multifd_zstd_mt_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_ZSTD_MT, &multifd_zstd_mt_ops);
+}
+
+migration_init(multifd_zstd_mt_register);
@@ -57,8 +57,12 @@ MultiFDRecvData *multifd_get_recv_data(void);
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
-/* We reserve 5 bits for compression methods */
-#define MULTIFD_FLAG_COMPRESSION_MASK (0x1f << 1)
+/*
+ * Each compression method has its own bit.  The original 5 bits were
+ * all taken, so later methods use the bits after
+ * MULTIFD_FLAG_DEVICE_STATE.
+ */
+#define MULTIFD_FLAG_COMPRESSION_MASK ((0x1f << 1) | (0xf << 7))
 /* we need to be compatible. Before compression value was 0 */
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
@@ -66,6 +70,8 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_QPL (4 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
 #define MULTIFD_FLAG_QATZIP (16 << 1)
+#define MULTIFD_FLAG_ZSTD_MT (64 << 1)
+#define MULTIFD_FLAG_LZ4 (128 << 1)
 
 /*
  * If set it means that this packet contains device state
@@ -66,6 +66,8 @@
 
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+/* 0: one thread per host CPU */
+#define DEFAULT_MIGRATE_MULTIFD_COMPRESSION_THREADS 0
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -150,6 +152,9 @@ const Property migration_properties[] = {
     DEFINE_PROP_UINT8("multifd-zstd-level", MigrationState,
                       parameters.multifd_zstd_level,
                       DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
+    DEFINE_PROP_UINT8("multifd-compression-threads", MigrationState,
+                      parameters.multifd_compression_threads,
+                      DEFAULT_MIGRATE_MULTIFD_COMPRESSION_THREADS),
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
@@ -943,6 +948,13 @@ int migrate_multifd_zstd_level(void)
     return s->parameters.multifd_zstd_level;
 }
 
+int migrate_multifd_compression_threads(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.multifd_compression_threads;
+}
+
 uint8_t migrate_throttle_trigger_threshold(void)
 {
     MigrationState *s = migrate_get_current();
@@ -1079,7 +1091,8 @@ static void migrate_mark_all_params_present(MigrationParameters *p)
         &p->has_downtime_limit, &p->has_x_checkpoint_delay,
         &p->has_multifd_channels, &p->has_multifd_compression,
         &p->has_multifd_zlib_level, &p->has_multifd_qatzip_level,
-        &p->has_multifd_zstd_level, &p->has_xbzrle_cache_size,
+        &p->has_multifd_zstd_level, &p->has_multifd_compression_threads,
+        &p->has_xbzrle_cache_size,
         &p->has_max_postcopy_bandwidth, &p->has_max_cpu_throttle,
         &p->has_announce_initial, &p->has_announce_max, &p->has_announce_rounds,
         &p->has_announce_step, &p->has_block_bitmap_mapping,
@@ -1377,6 +1390,10 @@ static void migrate_params_test_apply(MigrationParameters *params,
     if (params->has_multifd_zstd_level) {
         dest->multifd_zstd_level = params->multifd_zstd_level;
     }
+    if (params->has_multifd_compression_threads) {
+        dest->multifd_compression_threads =
+            params->multifd_compression_threads;
+    }
     if (params->has_xbzrle_cache_size) {
         dest->xbzrle_cache_size = params->xbzrle_cache_size;
     }
@@ -1504,6 +1521,10 @@ static void migrate_params_apply(MigrationParameters *params)
     if (params->has_multifd_zstd_level) {
         s->parameters.multifd_zstd_level = params->multifd_zstd_level;
     }
+    if (params->has_multifd_compression_threads) {
+        s->parameters.multifd_compression_threads =
+            params->multifd_compression_threads;
+    }
     if (params->has_xbzrle_cache_size) {
         s->parameters.xbzrle_cache_size = params->xbzrle_cache_size;
     }
@@ -22,12 +22,19 @@
 #include "monitor/monitor.h"
 #include "net/net.h"
 #include "net/util.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/error.h"
+#include "qapi/qapi-visit-net.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
+#include "system/hostmem.h"
+#include "system/memory.h"
+#include "system/ramblock.h"
 
 
 typedef struct AFXDPState {
@@ -56,20 +63,69 @@ typedef struct AFXDPState {
     char                 *map_path;
     int                  map_fd;
     uint32_t             map_start_index;
+
+    NetdevAFXDPOptions   *opts;
+    uint32_t             frame_size;
+
+    /* Retries af_xdp_reopen() while the link is down because it failed */
+    QEMUTimer            *reopen_timer;
+
+    /*
+     * Zero-copy receive.  The UMEM maps the guest RAM of zc_block
+     * followed by the frames of the pool, and zc_bufs maps the fill
+     * addresses of posted guest buffers to the peer's opaque values.
+     * All posted buffers use the same headroom.
+     */
+    char                 *zc_memdev;
+    bool                 zc_active;
+    bool                 zc_failed;
+    RAMBlock             *zc_block;
+    size_t               zc_headroom;
+    uint64_t             zc_ram_size;
+    size_t               zc_pagesize;
+    void                 *zc_map;
+    size_t               zc_map_size;
+    GHashTable           *zc_bufs;
 } AFXDPState;
 
 #define AF_XDP_BATCH_SIZE 64
 
+/* Chunk size of the UMEM with zero-copy receive, in unaligned mode */
+#define AF_XDP_ZC_FRAME_SIZE 2048
+
+/* Interval between attempts to re-create a socket that failed */
+#define AF_XDP_REOPEN_INTERVAL_MS 1000
+
 static void af_xdp_send(void *opaque);
 static void af_xdp_writable(void *opaque);
 
 /* Set the event-loop handlers for the af-xdp backend. */
 static void af_xdp_update_fd_handler(AFXDPState *s)
 {
-    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
-                        s->read_poll ? af_xdp_send : NULL,
-                        s->write_poll ? af_xdp_writable : NULL,
-                        s);
+    IOHandler *fd_read = s->read_poll ? af_xdp_send : NULL;
+    IOHandler *fd_write = s->write_poll ? af_xdp_writable : NULL;
+
+    if (!s->xsk) {
+        return;
+    }
+
+    if (s->nc.ctx) {
+        aio_set_fd_handler(s->nc.ctx, xsk_socket__fd(s->xsk),
+                           fd_read, fd_write, NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(xsk_socket__fd(s->xsk), fd_read, fd_write, s);
+    }
+}
+
+/* Remove the event-loop handlers for the af-xdp backend. */
+static void af_xdp_clear_fd_handler(AFXDPState *s)
+{
+    if (s->nc.ctx) {
+        aio_set_fd_handler(s->nc.ctx, xsk_socket__fd(s->xsk),
+                           NULL, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(xsk_socket__fd(s->xsk), NULL, NULL, NULL);
+    }
 }
 
 /* Update the read handler. */
@@ -151,10 +207,15 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     uint32_t idx;
     void *data;
 
+    if (!s->xsk) {
+        /* The link is down until af_xdp_reopen() succeeds */
+        return size;
+    }
+
     /* Try to recover buffers that are already sent. */
     af_xdp_complete_tx(s);
 
-    if (size > XSK_UMEM__DEFAULT_FRAME_SIZE) {
+    if (size > s->frame_size) {
         /* We can't transmit packet this size... */
         return size;
     }
@@ -220,6 +281,29 @@ static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
     }
 }
 
+/* Hand a frame received into a posted guest buffer to the peer. */
+static void af_xdp_zc_complete(AFXDPState *s, const struct xdp_desc *desc)
+{
+    uint64_t addr = xsk_umem__extract_addr(desc->addr);
+    gpointer key = (gpointer)(uintptr_t)addr;
+    void *opaque = g_hash_table_lookup(s->zc_bufs, key);
+    void *frame = xsk_umem__get_data(
+        s->buffer, xsk_umem__add_offset_to_addr(desc->addr));
+    void *dest = s->buffer + addr + MIN(s->zc_headroom, XDP_PACKET_HEADROOM);
+
+    g_hash_table_remove(s->zc_bufs, key);
+
+    /*
+     * The chunk starts inside the guest buffer, so the frame usually is
+     * some bytes after where the peer wants it.  Moving it within the
+     * buffer is still much cheaper than copying from a private frame.
+     */
+    if (frame != dest) {
+        memmove(dest, frame, desc->len);
+    }
+    qemu_complete_rx_buffer(&s->nc, opaque, desc->len);
+}
+
 static void af_xdp_send(void *opaque)
 {
     uint32_t i, n_rx, idx = 0;
@@ -230,16 +314,27 @@ static void af_xdp_send(void *opaque)
         return;
     }
 
+    /* Notify the guest once for the whole batch */
+    defer_call_begin();
+
     for (i = 0; i < n_rx; i++) {
         const struct xdp_desc *desc;
         struct iovec iov;
+        uint64_t addr;
 
         desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+        addr = xsk_umem__extract_addr(desc->addr);
 
-        iov.iov_base = xsk_umem__get_data(s->buffer, desc->addr);
+        if (s->zc_active && addr < s->zc_ram_size) {
+            af_xdp_zc_complete(s, desc);
+            continue;
+        }
+
+        iov.iov_base = xsk_umem__get_data(
+            s->buffer, xsk_umem__add_offset_to_addr(desc->addr));
         iov.iov_len = desc->len;
 
-        s->pool[s->n_pool++] = desc->addr;
+        s->pool[s->n_pool++] = addr;
 
         if (!qemu_sendv_packet_async(&s->nc, &iov, 1,
                                      af_xdp_send_completed)) {
@@ -256,9 +351,52 @@ static void af_xdp_send(void *opaque)
         }
     }
 
-    /* Release actually sent descriptors and try to re-fill. */
+    /*
+     * Release actually sent descriptors and try to re-fill.  While guest
+     * buffers are posted, frames of the pool are only used for Tx, so
+     * that received frames land in guest memory.
+     */
     xsk_ring_cons__release(&s->rx, n_rx);
-    af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
+    if (!s->zc_active || !g_hash_table_size(s->zc_bufs)) {
+        af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
+    }
+
+    defer_call_end();
+}
+
+/* Close the socket and free the UMEM. */
+static void af_xdp_close(AFXDPState *s)
+{
+    if (s->xsk) {
+        af_xdp_clear_fd_handler(s);
+        xsk_socket__delete(s->xsk);
+        s->xsk = NULL;
+    }
+    g_free(s->pool);
+    s->pool = NULL;
+    s->n_pool = 0;
+    s->outstanding_tx = 0;
+    xsk_umem__delete(s->umem);
+    s->umem = NULL;
+    if (s->zc_map) {
+        munmap(s->zc_map, s->zc_map_size);
+        s->zc_map = NULL;
+    } else {
+        qemu_vfree(s->buffer);
+    }
+    s->buffer = NULL;
+}
+
+/* Drop the state of zero-copy receive, the socket is already closed. */
+static void af_xdp_zc_release(AFXDPState *s)
+{
+    g_hash_table_destroy(s->zc_bufs);
+    s->zc_bufs = NULL;
+    s->zc_block = NULL;
+    s->zc_ram_size = 0;
+    s->zc_active = false;
+    s->frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE;
+    ram_block_discard_disable(false);
 }
 
 /* Flush and close. */
@@ -271,14 +409,18 @@ static void af_xdp_cleanup(NetClientState *nc)
 
     af_xdp_poll(nc, false);
 
-    xsk_socket__delete(s->xsk);
-    s->xsk = NULL;
-    g_free(s->pool);
-    s->pool = NULL;
-    xsk_umem__delete(s->umem);
-    s->umem = NULL;
-    qemu_vfree(s->buffer);
-    s->buffer = NULL;
+    af_xdp_close(s);
+    if (s->zc_active) {
+        af_xdp_zc_release(s);
+    }
+    if (s->reopen_timer) {
+        timer_free(s->reopen_timer);
+        s->reopen_timer = NULL;
+    }
+    g_free(s->zc_memdev);
+    s->zc_memdev = NULL;
+    qapi_free_NetdevAFXDPOptions(s->opts);
+    s->opts = NULL;
 
     if (s->map_fd >= 0) {
         idx = nc->queue_index + s->map_start_index;
@@ -293,26 +435,32 @@ static void af_xdp_cleanup(NetClientState *nc)
     s->map_path = NULL;
 }
 
-static int af_xdp_umem_create(AFXDPState *s, int sock_fd, Error **errp)
+/* Number of descriptors if all 4 queues (rx, tx, cq, fq) are full. */
+#define AF_XDP_N_DESCS ((XSK_RING_PROD__DEFAULT_NUM_DESCS + \
+                         XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2)
+
+/*
+ * Create the UMEM.  The frames of the pool start at @pool_offset in
+ * s->buffer; with zero-copy receive the guest RAM comes before them.
+ */
+static int af_xdp_umem_create(AFXDPState *s, int sock_fd, uint64_t pool_offset,
+                              Error **errp)
 {
     struct xsk_umem_config config = {
         .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
         .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
-        .frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE,
+        .frame_size = s->frame_size,
         .frame_headroom = 0,
+        .flags = s->zc_map ? XDP_UMEM_UNALIGNED_CHUNK_FLAG : 0,
     };
-    uint64_t n_descs;
-    uint64_t size;
+    uint64_t size = pool_offset + AF_XDP_N_DESCS * s->frame_size;
     int64_t i;
     int ret;
 
-    /* Number of descriptors if all 4 queues (rx, tx, cq, fq) are full. */
-    n_descs = (XSK_RING_PROD__DEFAULT_NUM_DESCS
-               + XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2;
-    size = n_descs * XSK_UMEM__DEFAULT_FRAME_SIZE;
-
-    s->buffer = qemu_memalign(qemu_real_host_page_size(), size);
-    memset(s->buffer, 0, size);
+    if (!s->buffer) {
+        s->buffer = qemu_memalign(qemu_real_host_page_size(), size);
+        memset(s->buffer, 0, size);
+    }
 
     if (sock_fd < 0) {
         ret = xsk_umem__create(&s->umem, s->buffer, size,
@@ -323,21 +471,23 @@ static int af_xdp_umem_create(AFXDPState *s, int sock_fd, Error **errp)
     }
 
     if (ret) {
-        qemu_vfree(s->buffer);
         error_setg_errno(errp, errno,
                          "failed to create umem for %s queue_index: %d",
                          s->ifname, s->nc.queue_index);
         return -1;
     }
 
-    s->pool = g_new(uint64_t, n_descs);
+    s->pool = g_new(uint64_t, AF_XDP_N_DESCS);
     /* Fill the pool in the opposite order, because it's a LIFO queue. */
-    for (i = n_descs - 1; i >= 0; i--) {
-        s->pool[i] = i * XSK_UMEM__DEFAULT_FRAME_SIZE;
+    for (i = AF_XDP_N_DESCS - 1; i >= 0; i--) {
+        s->pool[i] = pool_offset + i * s->frame_size;
     }
-    s->n_pool = n_descs;
+    s->n_pool = AF_XDP_N_DESCS;
 
-    af_xdp_fq_refill(s, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+    /* Posted guest buffers fill the queue with zero-copy receive. */
+    if (!s->zc_map) {
+        af_xdp_fq_refill(s, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+    }
 
     return 0;
 }
@@ -433,13 +583,270 @@ static int af_xdp_update_xsk_map(AFXDPState *s, Error **errp)
     return 0;
 }
 
+/* Create the socket with a private UMEM, for the copy path. */
+static int af_xdp_open(AFXDPState *s, Error **errp)
+{
+    if (af_xdp_umem_create(s, -1, 0, errp) ||
+        af_xdp_socket_create(s, s->opts, errp)) {
+        af_xdp_close(s);
+        return -1;
+    }
+
+    af_xdp_update_fd_handler(s);
+
+    return 0;
+}
+
+static void af_xdp_reopen(AFXDPState *s);
+
+static void af_xdp_reopen_timer_cb(void *opaque)
+{
+    af_xdp_reopen(opaque);
+}
+
+/* Arm the retry timer in the AioContext that the socket is used in. */
+static void af_xdp_reopen_schedule(AFXDPState *s)
+{
+    if (!s->reopen_timer) {
+        s->reopen_timer = aio_timer_new(s->nc.ctx ?: qemu_get_aio_context(),
+                                        QEMU_CLOCK_REALTIME, SCALE_MS,
+                                        af_xdp_reopen_timer_cb, s);
+    }
+    timer_mod(s->reopen_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                               AF_XDP_REOPEN_INTERVAL_MS);
+}
+
+/*
+ * Go back to the copy path, e.g. after a failure.  If the socket cannot
+ * be created, the link goes down so that the peer and the guest notice,
+ * and creating it is retried until it works.
+ */
+static void af_xdp_reopen(AFXDPState *s)
+{
+    Error *err = NULL;
+
+    if (af_xdp_open(s, &err)) {
+        if (!s->reopen_timer) {
+            error_prepend(&err, "af-xdp: link of %s is down: ", s->ifname);
+            error_report_err(err);
+            net_client_set_link(&(NetClientState *){ &s->nc }, 1, false);
+        } else {
+            error_free(err);
+        }
+        af_xdp_reopen_schedule(s);
+        return;
+    }
+
+    if (s->reopen_timer) {
+        timer_free(s->reopen_timer);
+        s->reopen_timer = NULL;
+        info_report("af-xdp: link of %s is up again", s->ifname);
+        net_client_set_link(&(NetClientState *){ &s->nc }, 1, true);
+    }
+}
+
+/*
+ * Switch to zero-copy receive.  The socket is re-created with a UMEM
+ * that maps the guest RAM of the memory backend followed by the frames
+ * of the pool, which are still used for Tx.  This is done on the first
+ * posted buffer, because memory backends are created after netdevs.
+ */
+static bool af_xdp_zc_activate(AFXDPState *s)
+{
+    size_t priv_size = AF_XDP_N_DESCS * AF_XDP_ZC_FRAME_SIZE;
+    HostMemoryBackend *backend;
+    MemoryRegion *mr = NULL;
+    Error *err = NULL;
+    RAMBlock *rb;
+    size_t pagesize;
+    void *base;
+    Object *obj;
+
+    obj = object_resolve_path_component(object_get_objects_root(),
+                                        s->zc_memdev);
+    backend = (HostMemoryBackend *)object_dynamic_cast(obj,
+                                                       TYPE_MEMORY_BACKEND);
+    if (backend) {
+        mr = host_memory_backend_get_memory(backend);
+    }
+    if (!mr || !mr->ram_block) {
+        error_setg(&err, "memory backend '%s' not found", s->zc_memdev);
+        goto fail;
+    }
+
+    rb = mr->ram_block;
+    if (qemu_ram_get_fd(rb) < 0 || !qemu_ram_is_shared(rb)) {
+        error_setg(&err, "memory backend '%s' must be shared and backed by"
+                   " a file descriptor", s->zc_memdev);
+        goto fail;
+    }
+
+    /* The kernel pins the UMEM, guest RAM must not be discarded. */
+    if (ram_block_discard_disable(true)) {
+        error_setg(&err, "cannot pin memory backend '%s', RAM discard is"
+                   " in use", s->zc_memdev);
+        goto fail;
+    }
+
+    af_xdp_close(s);
+
+    /*
+     * Alias the guest RAM at the start of a reservation that is aligned
+     * to its page size, and put the frames of the pool right after it.
+     */
+    pagesize = qemu_ram_pagesize(rb);
+    s->zc_ram_size = qemu_ram_get_used_length(rb);
+    s->zc_map_size = s->zc_ram_size + ROUND_UP(priv_size, pagesize) + pagesize;
+    s->zc_map = mmap(NULL, s->zc_map_size, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (s->zc_map == MAP_FAILED) {
+        s->zc_map = NULL;
+        error_setg_errno(&err, errno, "failed to reserve the UMEM");
+        goto fail_discard;
+    }
+
+    base = QEMU_ALIGN_PTR_UP(s->zc_map, pagesize);
+    if (mmap(base, s->zc_ram_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, qemu_ram_get_fd(rb),
+             qemu_ram_get_fd_offset(rb)) == MAP_FAILED ||
+        mmap(base + s->zc_ram_size, priv_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        error_setg_errno(&err, errno, "failed to map memory backend '%s'",
+                         s->zc_memdev);
+        goto fail_close;
+    }
+    s->buffer = base;
+    s->frame_size = AF_XDP_ZC_FRAME_SIZE;
+
+    if (af_xdp_umem_create(s, -1, s->zc_ram_size, &err) ||
+        af_xdp_socket_create(s, s->opts, &err)) {
+        goto fail_close;
+    }
+
+    s->zc_bufs = g_hash_table_new(NULL, NULL);
+    s->zc_block = rb;
+    s->zc_pagesize = pagesize;
+    s->zc_active = true;
+    af_xdp_update_fd_handler(s);
+
+    return true;
+
+fail_close:
+    af_xdp_close(s);
+    s->frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE;
+fail_discard:
+    ram_block_discard_disable(false);
+    af_xdp_reopen(s);
+fail:
+    error_prepend(&err, "af-xdp: zero-copy receive disabled for %s: ",
+                  s->ifname);
+    error_report_err(err);
+    s->zc_failed = true;
+    return false;
+}
+
+static bool af_xdp_rx_post_buffer(NetClientState *nc, void *buf, size_t size,
+                                  size_t headroom, void *opaque)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    uint64_t offset, addr;
+    uint32_t idx = 0;
+
+    if (s->reopen_timer) {
+        /* The link is down, see af_xdp_reopen() */
+        return false;
+    }
+
+    if (!s->zc_active && (s->zc_failed || !af_xdp_zc_activate(s))) {
+        return false;
+    }
+
+    if (qemu_ram_block_from_host(buf, false, &offset) != s->zc_block) {
+        return false;
+    }
+
+    if (g_hash_table_size(s->zc_bufs) && headroom != s->zc_headroom) {
+        return false;
+    }
+
+    /*
+     * The kernel may write anywhere in the chunk, starting with the
+     * XDP_PACKET_HEADROOM bytes before the frame, so the whole chunk must
+     * be inside the buffer.  If the buffer has less headroom than that,
+     * af_xdp_zc_complete() moves the frame into place.  The chunk must
+     * not cross a page of the memory backend either.
+     */
+    addr = offset + headroom - MIN(headroom, XDP_PACKET_HEADROOM);
+    if (addr - offset + s->frame_size > size) {
+        return false;
+    }
+    if (QEMU_ALIGN_DOWN(addr, s->zc_pagesize) !=
+        QEMU_ALIGN_DOWN(addr + s->frame_size - 1, s->zc_pagesize)) {
+        return false;
+    }
+
+    if (xsk_ring_prod__reserve(&s->fq, 1, &idx) != 1) {
+        return false;
+    }
+
+    s->zc_headroom = headroom;
+    g_hash_table_insert(s->zc_bufs, (gpointer)(uintptr_t)addr, opaque);
+    *xsk_ring_prod__fill_addr(&s->fq, idx) = addr;
+    xsk_ring_prod__submit(&s->fq, 1);
+
+    if (xsk_ring_prod__needs_wakeup(&s->fq)) {
+        af_xdp_read_poll(s, true);
+    }
+
+    return true;
+}
+
+/*
+ * Fill queue entries can only be taken back by destroying the socket,
+ * so go back to the copy path.  Zero-copy receive is activated again by
+ * the next posted buffer.
+ */
+static void af_xdp_rx_reclaim_buffers(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (!s->zc_active) {
+        return;
+    }
+
+    af_xdp_close(s);
+    af_xdp_zc_release(s);
+    af_xdp_reopen(s);
+}
+
 /* NetClientInfo methods. */
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    /* Move the fd handlers from the old context to the new one */
+    if (s->xsk) {
+        af_xdp_clear_fd_handler(s);
+    }
+    nc->ctx = ctx;
+    af_xdp_update_fd_handler(s);
+
+    if (s->reopen_timer) {
+        timer_free(s->reopen_timer);
+        s->reopen_timer = NULL;
+        af_xdp_reopen_schedule(s);
+    }
+}
+
 static NetClientInfo net_af_xdp_info = {
     .type = NET_CLIENT_DRIVER_AF_XDP,
     .size = sizeof(AFXDPState),
     .receive = af_xdp_receive,
     .poll = af_xdp_poll,
     .cleanup = af_xdp_cleanup,
+    .rx_post_buffer = af_xdp_rx_post_buffer,
+    .rx_reclaim_buffers = af_xdp_rx_reclaim_buffers,
+    .set_aio_context = af_xdp_set_aio_context,
 };
 
 /*
@@ -489,6 +896,11 @@ int net_init_af_xdp(const Netdev *netdev,
         error_setg(errp, "'sock-fds' and 'map-path' are mutually exclusive");
         return -1;
     }
+    if (inhibit && opts->rx_zerocopy_memdev) {
+        error_setg(errp,
+                   "'rx-zerocopy-memdev' is incompatible with 'inhibit=on'");
+        return -1;
+    }
     if (!opts->map_path && opts->has_map_start_index) {
         error_setg(errp, "'map-start-index' requires 'map-path'");
         return -1;
@@ -526,7 +938,11 @@ int net_init_af_xdp(const Netdev *netdev,
         s->map_start_index = map_start_index;
         s->map_fd = -1;
 
-        if (af_xdp_umem_create(s, sock_fds ? sock_fds[i] : -1, &err) ||
+        s->opts = QAPI_CLONE(NetdevAFXDPOptions, opts);
+        s->frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE;
+        s->zc_memdev = g_strdup(opts->rx_zerocopy_memdev);
+
+        if (af_xdp_umem_create(s, sock_fds ? sock_fds[i] : -1, 0, &err) ||
             af_xdp_socket_create(s, opts, &err) ||
             af_xdp_update_xsk_map(s, &err)) {
             goto err;
@@ -10,6 +10,7 @@
 #include "qemu/cutils.h"
 #include "net/announce.h"
 #include "net/net.h"
+#include "qemu/aio-wait.h"
 #include "qapi/clone-visitor.h"
 #include "qapi/qapi-visit-net.h"
 #include "qapi/qapi-commands-net.h"
@@ -133,6 +134,19 @@ static const char *qemu_ether_ntoa(const MACAddr *mac)
     return ret;
 }
 
+typedef struct AnnounceSendData {
+    NetClientState *nc;
+    uint8_t *buf;
+    int len;
+} AnnounceSendData;
+
+static void qemu_announce_send_bh(void *opaque)
+{
+    AnnounceSendData *data = opaque;
+
+    qemu_send_packet_raw(data->nc, data->buf, data->len);
+}
+
 static void qemu_announce_self_iter(NICState *nic, void *opaque)
 {
     AnnounceTimer *timer = opaque;
@@ -162,9 +176,18 @@ static void qemu_announce_self_iter(NICState *nic, void *opaque)
                                   qemu_ether_ntoa(&nic->conf->macaddr), skip);
 
     if (!skip) {
+        NetClientState *nc = qemu_get_queue(nic);
+
         len = announce_self_create(buf, nic->conf->macaddr.a);
 
-        qemu_send_packet_raw(qemu_get_queue(nic), buf, len);
+        if (nc->ctx) {
+            /* the datapath runs in an IOThread, send from there */
+            AnnounceSendData data = { .nc = nc, .buf = buf, .len = len };
+
+            aio_wait_bh_oneshot(nc->ctx, qemu_announce_send_bh, &data);
+        } else {
+            qemu_send_packet_raw(nc, buf, len);
+        }
 
         /* if the NIC provides it's own announcement support, use it as well */
         if (nic->ncs->info->announce) {
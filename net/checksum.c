@@ -16,27 +16,87 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "host/cpuinfo.h"
 #include "net/checksum.h"
 #include "net/eth.h"
 
-uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+typedef uint64_t (*csum_accel_fn)(const uint8_t *, size_t);
+
+/*
+ * Sum the buffer as native-endian 16-bit words, with the carries kept in
+ * the upper bits.  The one's complement sum does not depend on the byte
+ * order (RFC 1071), it only needs a byte swap at the end.
+ */
+static uint64_t net_checksum_int(const uint8_t *buf, size_t len)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    uint64_t sum = 0;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    /* w0 + w1 * 0x10000 is congruent to w0 + w1 modulo 0xffff */
+    for (; len >= 4; buf += 4, len -= 4) {
+        sum += ldl_he_p(buf);
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+    if (len >= 2) {
+        sum += lduw_he_p(buf);
+        buf += 2;
+        len -= 2;
     }
+    if (len) {
+        uint8_t last[2] = { buf[0], 0 };
+
+        sum += lduw_he_p(last);
+    }
+    return sum;
+}
+
+#include "host/checksum.c.inc"
+
+static csum_accel_fn net_checksum_accel;
+static unsigned accel_index;
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
+/* Below this, the call through net_checksum_accel costs more than it saves */
+#define NET_CHECKSUM_ACCEL_MIN  64
+
+uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+{
+    uint64_t sum;
+    uint16_t res;
+
+    if (len <= 0) {
+        return 0;
+    }
+
+    if (len >= NET_CHECKSUM_ACCEL_MIN) {
+        sum = net_checksum_accel(buf, len);
     } else {
-        return sum2 + (sum1 << 8);
+        sum = net_checksum_int(buf, len);
+    }
+
+    /* Fold without ever turning a non-zero sum into zero */
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
     }
+
+    /* Big-endian words, or byte-swapped ones if @buf is at an odd offset */
+    res = be16_to_cpu(sum);
+    return seq & 1 ? bswap16(res) : res;
+}
+
+bool test_net_checksum_next_accel(void)
+{
+    if (accel_index != 0) {
+        net_checksum_accel = accel_table[--accel_index];
+        return true;
+    }
+    return false;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    accel_index = best_accel();
+    net_checksum_accel = accel_table[accel_index];
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -206,3 +266,27 @@ net_checksum_add_iov(const struct iovec *iov, const unsigned int iov_cnt,
     }
     return res;
 }
+
+void net_toeplitz_table_init(NetToeplitzTable *table,
+                             const uint8_t *key_bytes)
+{
+    uint32_t window[8];
+    unsigned int byte, bit, v;
+
+    for (byte = 0; byte < NET_TOEPLITZ_MAX_INPUT; byte++) {
+        /* key bits that line up with each bit of this input byte */
+        uint64_t key = ((uint64_t)ldl_be_p(key_bytes + byte) << 8) |
+                       key_bytes[byte + 4];
+
+        for (bit = 0; bit < 8; bit++) {
+            window[bit] = key >> (8 - bit);
+        }
+
+        /* bit 0 is the most significant bit of the input byte */
+        table->t[byte][0] = 0;
+        for (v = 1; v < 256; v++) {
+            table->t[byte][v] = table->t[byte][v & (v - 1)] ^
+                                window[7 - ctz32(v)];
+        }
+    }
+}
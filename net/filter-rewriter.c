@@ -370,7 +370,7 @@ static void colo_rewriter_cleanup(NetFilterState *nf)
     /* flush packets */
     if (s->incoming_queue) {
         filter_rewriter_flush(nf);
-        g_free(s->incoming_queue);
+        qemu_del_net_queue(s->incoming_queue);
     }
 
     g_clear_pointer(&s->connection_track_table, g_hash_table_destroy);
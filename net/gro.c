@@ -0,0 +1,395 @@
+/*
+ * Generic receive offload for backends without vnet headers
+ *
+ * Consecutive TCP segments of a flow are merged into one packet that is
+ * described by a GSO vnet header, so that a guest processes one packet
+ * per 64 KiB instead of one per MTU.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/defer-call.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gro.h"
+
+#define NET_GRO_MAX_FLOWS   8
+#define NET_GRO_MAX_SIZE    (ETH_HLEN + ETH_MAX_IP_DGRAM_LEN)
+
+/* TCP flags of segments that can be merged */
+#define NET_GRO_TCP_FLAGS   (TH_ACK | TH_PUSH)
+
+typedef struct NetGROPacket {
+    const uint8_t *buf;
+    /* size without Ethernet padding */
+    size_t size;
+    size_t l4_off;
+    size_t hdr_len;
+    size_t payload_len;
+    bool ipv6;
+    uint8_t tcp_flags;
+} NetGROPacket;
+
+typedef struct NetGROFlow {
+    /* headers of the first segment, followed by the merged payload */
+    uint8_t *buf;
+    size_t size;
+    size_t l4_off;
+    size_t hdr_len;
+    bool ipv6;
+    uint32_t next_seq;
+    /* payload length of the first segment */
+    uint16_t mss;
+    unsigned int segs;
+} NetGROFlow;
+
+struct NetGRO {
+    NetGROFlush *flush;
+    void *opaque;
+    /* held flows, oldest first */
+    unsigned int num_flows;
+    NetGROFlow flows[NET_GRO_MAX_FLOWS];
+    /* the receiver refused a flush, see NetGROFlush */
+    bool stalled;
+};
+
+static uint32_t net_gro_pseudo_sum(const uint8_t *l3, bool ipv6, size_t l4_len)
+{
+    uint32_t sum = IP_PROTO_TCP + l4_len;
+
+    if (ipv6) {
+        sum += net_checksum_add(2 * sizeof(struct in6_address),
+                                (uint8_t *)l3 +
+                                offsetof(struct ip6_header, ip6_src));
+    } else {
+        sum += net_checksum_add(2 * sizeof(uint32_t),
+                                (uint8_t *)l3 +
+                                offsetof(struct ip_header, ip_src));
+    }
+    return sum;
+}
+
+static bool net_gro_parse(const uint8_t *buf, size_t size, unsigned int types,
+                          NetGROPacket *pkt)
+{
+    const struct eth_header *eth = (const struct eth_header *)buf;
+    const uint8_t *l3 = buf + ETH_HLEN;
+    const tcp_header *tcp;
+    size_t l3_len, l4_len, tcp_len;
+
+    if (size < ETH_HLEN) {
+        return false;
+    }
+
+    switch (be16_to_cpu(eth->h_proto)) {
+    case ETH_P_IP: {
+        struct ip_header *ip = (struct ip_header *)l3;
+
+        /* No options, no fragments, valid header */
+        if (!(types & NET_GRO_TCPV4) || size < ETH_HLEN + sizeof(*ip) ||
+            ip->ip_ver_len != 0x45 || IP4_IS_FRAGMENT(ip) ||
+            ip->ip_p != IP_PROTO_TCP ||
+            net_raw_checksum((uint8_t *)ip, sizeof(*ip))) {
+            return false;
+        }
+        l3_len = be16_to_cpu(ip->ip_len);
+        pkt->l4_off = ETH_HLEN + sizeof(*ip);
+        pkt->ipv6 = false;
+        break;
+    }
+    case ETH_P_IPV6: {
+        const struct ip6_header *ip6 = (const struct ip6_header *)l3;
+
+        /* No extension headers */
+        if (!(types & NET_GRO_TCPV6) || size < ETH_HLEN + sizeof(*ip6) ||
+            (ip6->ip6_ctlun.ip6_un2_vfc >> 4) != IP_HEADER_VERSION_6 ||
+            ip6->ip6_nxt != IP_PROTO_TCP) {
+            return false;
+        }
+        l3_len = sizeof(*ip6) + be16_to_cpu(ip6->ip6_plen);
+        pkt->l4_off = ETH_HLEN + sizeof(*ip6);
+        pkt->ipv6 = true;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    if (l3_len > size - ETH_HLEN ||
+        pkt->l4_off + sizeof(*tcp) > ETH_HLEN + l3_len) {
+        return false;
+    }
+    pkt->size = ETH_HLEN + l3_len;
+
+    tcp = (const tcp_header *)(buf + pkt->l4_off);
+    tcp_len = TCP_HEADER_DATA_OFFSET(tcp);
+    pkt->hdr_len = pkt->l4_off + tcp_len;
+    pkt->tcp_flags = be16_to_cpu(tcp->th_offset_flags) & 0xff;
+    if (tcp_len < sizeof(*tcp) || pkt->hdr_len >= pkt->size ||
+        (pkt->tcp_flags & ~NET_GRO_TCP_FLAGS) ||
+        !(pkt->tcp_flags & TH_ACK)) {
+        return false;
+    }
+    pkt->payload_len = pkt->size - pkt->hdr_len;
+
+    /* Merged packets are passed on as checksum offloaded, verify them */
+    l4_len = pkt->size - pkt->l4_off;
+    if (net_checksum_finish(net_gro_pseudo_sum(l3, pkt->ipv6, l4_len) +
+                            net_checksum_add(l4_len, (uint8_t *)tcp))) {
+        return false;
+    }
+
+    pkt->buf = buf;
+    return true;
+}
+
+static bool net_gro_same_flow(const NetGROFlow *flow, const NetGROPacket *pkt)
+{
+    const uint8_t *a = flow->buf;
+    const uint8_t *b = pkt->buf;
+
+    if (flow->ipv6 != pkt->ipv6 || flow->hdr_len != pkt->hdr_len ||
+        memcmp(a, b, 2 * ETH_ALEN)) {
+        return false;
+    }
+
+    /* addresses, then ports */
+    if (flow->ipv6) {
+        if (memcmp(a + ETH_HLEN + offsetof(struct ip6_header, ip6_src),
+                   b + ETH_HLEN + offsetof(struct ip6_header, ip6_src),
+                   2 * sizeof(struct in6_address))) {
+            return false;
+        }
+    } else {
+        if (memcmp(a + ETH_HLEN + offsetof(struct ip_header, ip_src),
+                   b + ETH_HLEN + offsetof(struct ip_header, ip_src),
+                   2 * sizeof(uint32_t))) {
+            return false;
+        }
+    }
+
+    return !memcmp(a + flow->l4_off, b + flow->l4_off, 2 * sizeof(uint16_t));
+}
+
+static bool net_gro_can_merge(const NetGROFlow *flow, const NetGROPacket *pkt)
+{
+    const uint8_t *a = flow->buf + ETH_HLEN;
+    const uint8_t *b = pkt->buf + ETH_HLEN;
+    const tcp_header *ta = (const tcp_header *)(flow->buf + flow->l4_off);
+    const tcp_header *tb = (const tcp_header *)(pkt->buf + flow->l4_off);
+
+    if ((ta->th_offset_flags & cpu_to_be16(TH_PUSH)) ||
+        be32_to_cpu(tb->th_seq) != flow->next_seq ||
+        pkt->payload_len > flow->mss ||
+        flow->size + pkt->payload_len > NET_GRO_MAX_SIZE) {
+        return false;
+    }
+
+    /* IP fields that are not rewritten when the packet is segmented */
+    if (flow->ipv6) {
+        /* version, traffic class and flow label; hop limit */
+        if (memcmp(a, b, 4) || a[7] != b[7]) {
+            return false;
+        }
+    } else {
+        const struct ip_header *ia = (const struct ip_header *)a;
+        const struct ip_header *ib = (const struct ip_header *)b;
+
+        if (ia->ip_tos != ib->ip_tos || ia->ip_ttl != ib->ip_ttl ||
+            ia->ip_off != ib->ip_off) {
+            return false;
+        }
+    }
+
+    /* Same acknowledgement, window and options */
+    return ta->th_ack == tb->th_ack && ta->th_win == tb->th_win &&
+           !memcmp(ta + 1, tb + 1,
+                   flow->hdr_len - flow->l4_off - sizeof(tcp_header));
+}
+
+static bool net_gro_flush_flow(NetGRO *gro, NetGROFlow *flow)
+{
+    struct virtio_net_hdr hdr = { 0 };
+    uint8_t *l3 = flow->buf + ETH_HLEN;
+    tcp_header *tcp = (tcp_header *)(flow->buf + flow->l4_off);
+    uint32_t sum;
+
+    if (flow->segs > 1) {
+        if (flow->ipv6) {
+            struct ip6_header *ip6 = (struct ip6_header *)l3;
+
+            ip6->ip6_plen = cpu_to_be16(flow->size - ETH_HLEN - sizeof(*ip6));
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+        } else {
+            struct ip_header *ip = (struct ip_header *)l3;
+
+            ip->ip_len = cpu_to_be16(flow->size - ETH_HLEN);
+            ip->ip_sum = 0;
+            ip->ip_sum = cpu_to_be16(net_raw_checksum(l3, sizeof(*ip)));
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        }
+
+        /* The receiver completes the checksum from the pseudo header */
+        sum = net_gro_pseudo_sum(l3, flow->ipv6, flow->size - flow->l4_off);
+        tcp->th_sum = cpu_to_be16((uint16_t)~net_checksum_finish(sum));
+
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.hdr_len = flow->hdr_len;
+        hdr.gso_size = flow->mss;
+        hdr.csum_start = flow->l4_off;
+        hdr.csum_offset = offsetof(tcp_header, th_sum);
+    }
+
+    /* Rewriting the headers is idempotent, a refused flow can be retried */
+    if (!gro->flush(gro->opaque, &hdr, flow->buf, flow->size)) {
+        gro->stalled = true;
+        return false;
+    }
+    return true;
+}
+
+/* Forget flow @i, keeping its buffer for a later flow */
+static void net_gro_remove_flow(NetGRO *gro, unsigned int i)
+{
+    NetGROFlow flow = gro->flows[i];
+
+    memmove(&gro->flows[i], &gro->flows[i + 1],
+            (gro->num_flows - i - 1) * sizeof(flow));
+    gro->flows[--gro->num_flows] = flow;
+}
+
+static void net_gro_flush_cb(void *opaque)
+{
+    net_gro_flush(opaque);
+}
+
+static NetGROResult net_gro_start_flow(NetGRO *gro, const NetGROPacket *pkt)
+{
+    const tcp_header *tcp = (const tcp_header *)(pkt->buf + pkt->l4_off);
+    NetGROFlow *flow;
+
+    if (gro->num_flows == NET_GRO_MAX_FLOWS) {
+        if (!net_gro_flush_flow(gro, &gro->flows[0])) {
+            return NET_GRO_BUSY;
+        }
+        net_gro_remove_flow(gro, 0);
+    }
+
+    flow = &gro->flows[gro->num_flows++];
+    if (!flow->buf) {
+        flow->buf = g_malloc(NET_GRO_MAX_SIZE);
+    }
+    memcpy(flow->buf, pkt->buf, pkt->size);
+    flow->size = pkt->size;
+    flow->l4_off = pkt->l4_off;
+    flow->hdr_len = pkt->hdr_len;
+    flow->ipv6 = pkt->ipv6;
+    flow->next_seq = be32_to_cpu(tcp->th_seq) + pkt->payload_len;
+    flow->mss = pkt->payload_len;
+    flow->segs = 1;
+
+    /* Runs immediately outside of a defer_call_begin() section */
+    defer_call(net_gro_flush_cb, gro);
+    return NET_GRO_HELD;
+}
+
+NetGROResult net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size,
+                             unsigned int types)
+{
+    NetGROPacket pkt;
+    NetGROFlow *flow;
+    tcp_header *tcp;
+    unsigned int i;
+
+    /* Packets that the receiver refused go first */
+    if (gro->stalled && !net_gro_flush(gro)) {
+        return NET_GRO_BUSY;
+    }
+
+    if (!net_gro_parse(buf, size, types, &pkt)) {
+        /* Keep the order with held packets of the same flow */
+        return net_gro_flush(gro) ? NET_GRO_BYPASS : NET_GRO_BUSY;
+    }
+
+    for (i = 0; i < gro->num_flows; i++) {
+        if (net_gro_same_flow(&gro->flows[i], &pkt)) {
+            break;
+        }
+    }
+
+    if (i == gro->num_flows) {
+        return net_gro_start_flow(gro, &pkt);
+    }
+
+    flow = &gro->flows[i];
+    if (!net_gro_can_merge(flow, &pkt)) {
+        if (!net_gro_flush_flow(gro, flow)) {
+            return NET_GRO_BUSY;
+        }
+        net_gro_remove_flow(gro, i);
+        return net_gro_start_flow(gro, &pkt);
+    }
+
+    memcpy(flow->buf + flow->size, pkt.buf + pkt.hdr_len, pkt.payload_len);
+    flow->size += pkt.payload_len;
+    flow->next_seq += pkt.payload_len;
+    flow->segs++;
+
+    /*
+     * A push or a short segment ends the burst.  If the receiver has no
+     * room, the flow stays held with the segment merged into it.
+     */
+    if ((pkt.tcp_flags & TH_PUSH) || pkt.payload_len < flow->mss) {
+        tcp = (tcp_header *)(flow->buf + flow->l4_off);
+        tcp->th_offset_flags |= cpu_to_be16(pkt.tcp_flags & TH_PUSH);
+        if (net_gro_flush_flow(gro, flow)) {
+            net_gro_remove_flow(gro, i);
+        }
+    }
+
+    return NET_GRO_HELD;
+}
+
+bool net_gro_flush(NetGRO *gro)
+{
+    unsigned int i;
+
+    for (i = 0; i < gro->num_flows; i++) {
+        if (!net_gro_flush_flow(gro, &gro->flows[i])) {
+            break;
+        }
+    }
+
+    /* Keep the buffers of the flushed flows for later flows */
+    while (i--) {
+        net_gro_remove_flow(gro, 0);
+    }
+
+    gro->stalled = gro->num_flows > 0;
+    return !gro->stalled;
+}
+
+NetGRO *net_gro_new(NetGROFlush *flush, void *opaque)
+{
+    NetGRO *gro = g_new0(NetGRO, 1);
+
+    gro->flush = flush;
+    gro->opaque = opaque;
+    return gro;
+}
+
+/* Held packets are dropped */
+void net_gro_free(NetGRO *gro)
+{
+    unsigned int i;
+
+    if (!gro) {
+        return;
+    }
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        g_free(gro->flows[i].buf);
+    }
+    g_free(gro);
+}
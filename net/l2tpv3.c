@@ -30,6 +30,7 @@
 #include "clients.h"
 #include "qapi/error.h"
 #include "qemu/bswap.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
 #include "qemu/sockets.h"
@@ -443,7 +444,11 @@ static void net_l2tpv3_send(void *opaque)
         s->queue_head = (s->queue_head + count) % MAX_L2TPV3_MSGCNT;
         s->queue_depth += count;
     }
+
+    /* Let the peer coalesce the received packets, see net_gro_receive() */
+    defer_call_begin();
     net_l2tpv3_process_queue(s);
+    defer_call_end();
 }
 
 static void destroy_vector(struct mmsghdr *msgvec, int count, int iovcount)
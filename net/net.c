@@ -285,6 +285,11 @@ static void qemu_net_client_setup(NetClientState *nc,
     QTAILQ_INSERT_TAIL(&net_clients, nc, next);
 
     nc->incoming_queue = qemu_new_net_queue(qemu_deliver_packet_iov, nc);
+    if (peer) {
+        /* queue-len of a netdev applies to both directions */
+        qemu_net_queue_set_len(nc->incoming_queue,
+                               qemu_net_queue_get_len(peer->incoming_queue));
+    }
     nc->destructor = destructor;
     nc->is_datapath = is_datapath;
     QTAILQ_INIT(&nc->filters);
@@ -559,6 +564,84 @@ void qemu_set_offload(NetClientState *nc, const NetOffloads *ol)
     nc->info->set_offload(nc, ol);
 }
 
+bool qemu_has_aio_context(NetClientState *nc)
+{
+    if (!nc || !nc->info->set_aio_context) {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Run the datapath of @nc and of its peer in @ctx, or in the main loop
+ * if @ctx is NULL.  The caller must make sure that no packets are in
+ * flight, i.e. that the peer is not polled while the context changes.
+ */
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    nc->ctx = ctx;
+    if (!nc->peer) {
+        return;
+    }
+
+    assert(qemu_has_aio_context(nc->peer));
+    nc->peer->info->set_aio_context(nc->peer, ctx);
+}
+
+/*
+ * Zero-copy receive: a NIC hands receive buffers in guest memory to its
+ * peer, which stores incoming frames there directly instead of passing
+ * them to qemu_send_packet().  Packets that bypass the net layer cannot
+ * be seen by filters, so this is only possible without them.
+ */
+bool qemu_can_post_rx_buffers(NetClientState *nc)
+{
+    if (!nc->peer || !nc->peer->info->rx_post_buffer) {
+        return false;
+    }
+
+    return QTAILQ_EMPTY(&nc->filters) && QTAILQ_EMPTY(&nc->peer->filters);
+}
+
+/*
+ * Offer the buffer @buf of @size bytes to the peer of @nc.  The peer
+ * stores a frame at @buf + @headroom and then calls the NIC's
+ * rx_complete_buffer() with @opaque and the length of the frame.
+ * Returns false if the peer cannot use the buffer, in which case it
+ * still belongs to the caller.
+ */
+bool qemu_post_rx_buffer(NetClientState *nc, void *buf, size_t size,
+                         size_t headroom, void *opaque)
+{
+    if (!qemu_can_post_rx_buffers(nc)) {
+        return false;
+    }
+
+    return nc->peer->info->rx_post_buffer(nc->peer, buf, size, headroom,
+                                          opaque);
+}
+
+/*
+ * Take back all buffers posted by @nc that were not completed.  Once
+ * this returns, the peer does not access them anymore.
+ */
+void qemu_reclaim_rx_buffers(NetClientState *nc)
+{
+    if (!nc->peer || !nc->peer->info->rx_reclaim_buffers) {
+        return;
+    }
+
+    nc->peer->info->rx_reclaim_buffers(nc->peer);
+}
+
+/* Called by a backend when it stored a frame of @len bytes in a buffer */
+void qemu_complete_rx_buffer(NetClientState *nc, void *opaque, size_t len)
+{
+    assert(nc->peer && nc->peer->info->rx_complete_buffer);
+    nc->peer->info->rx_complete_buffer(nc->peer, opaque, len);
+}
+
 int qemu_get_vnet_hdr_len(NetClientState *nc)
 {
     if (!nc) {
@@ -1358,6 +1441,11 @@ static int net_client_init1(const Netdev *netdev, bool is_netdev, Error **errp)
         return -1;
     }
 
+    if (netdev->has_queue_len && !netdev->queue_len) {
+        error_setg(errp, "queue-len must be greater than 0");
+        return -1;
+    }
+
     if (net_client_init_fun[netdev->type](netdev, netdev->id, peer, errp) < 0) {
         /* FIXME drop when all init functions store an Error */
         if (errp && !*errp) {
@@ -1367,6 +1455,19 @@ static int net_client_init1(const Netdev *netdev, bool is_netdev, Error **errp)
         return -1;
     }
 
+    if (netdev->has_queue_len) {
+        QTAILQ_FOREACH(nc, &net_clients, next) {
+            if (g_strcmp0(nc->name, netdev->id)) {
+                continue;
+            }
+            qemu_net_queue_set_len(nc->incoming_queue, netdev->queue_len);
+            if (nc->peer) {
+                qemu_net_queue_set_len(nc->peer->incoming_queue,
+                                       netdev->queue_len);
+            }
+        }
+    }
+
     if (is_netdev) {
         nc = qemu_find_netdev(netdev->id);
         assert(nc);
@@ -1512,6 +1613,11 @@ void qmp_netdev_del(const char *id, Error **errp)
         return;
     }
 
+    if (nc->ctx) {
+        error_setg(errp, "Device '%s' is in use by an IOThread", id);
+        return;
+    }
+
     qemu_del_net_client(nc);
 
     /*
@@ -1556,6 +1662,11 @@ void print_net_client(Monitor *mon, NetClientState *nc)
                    nc->queue_index,
                    NetClientDriver_str(nc->info->type),
                    nc->info_str);
+    if (qemu_net_queue_get_dropped(nc->incoming_queue)) {
+        monitor_printf(mon, "  queue: len=%u dropped=%" PRIu64 "\n",
+                       qemu_net_queue_get_len(nc->incoming_queue),
+                       qemu_net_queue_get_dropped(nc->incoming_queue));
+    }
     if (!QTAILQ_EMPTY(&nc->filters)) {
         monitor_printf(mon, "filters:\n");
     }
@@ -1696,6 +1807,10 @@ static void net_vm_change_state_handler(void *opaque, bool running,
     NetClientState *tmp;
 
     QTAILQ_FOREACH_SAFE(nc, &net_clients, next, tmp) {
+        if (nc->ctx) {
+            /* The owner of the AioContext flushes its own queues */
+            continue;
+        }
         if (running) {
             /* Flush queued packets and wake up backends. */
             if (nc->peer && qemu_can_send_packet(nc)) {
@@ -23,7 +23,9 @@
 
 #include "qemu/osdep.h"
 #include "net/queue.h"
+#include "qemu/iov.h"
 #include "qemu/queue.h"
+#include "qemu/units.h"
 #include "net/net.h"
 
 /* The delivery handler may only return zero if it will call
@@ -46,20 +48,55 @@ struct NetPacket {
     unsigned flags;
     int size;
     NetPacketSent *sent_cb;
-    uint8_t data[];
+    /*
+     * The data buffer of a ring slot is kept when the packet is
+     * delivered.  Overflow packets are allocated with their data.
+     */
+    uint8_t *buf;
+    size_t buf_size;
 };
 
+/*
+ * Pending packets live in a ring of slots, which grows up to nq_maxlen
+ * slots.  The data buffers of the slots are kept across packets, so that
+ * a peer that is slow to receive does not cause an allocation and a free
+ * per packet.
+ *
+ * Packets with a sent callback are never dropped.  If the ring is full,
+ * they are allocated individually and queued in the overflow list, which
+ * is delivered after the ring.
+ */
 struct NetQueue {
     void *opaque;
     uint32_t nq_maxlen;
     uint32_t nq_count;
     NetQueueDeliverFunc *deliver;
 
-    QTAILQ_HEAD(, NetPacket) packets;
+    NetPacket *slots;
+    uint32_t nslots;
+    /* Total size of the data buffers of the slots */
+    size_t slots_buf_size;
+    uint32_t head;
+    uint32_t ring_count;
+    /* The packet at head - 1 is being delivered by qemu_net_queue_flush() */
+    bool ring_inflight;
+
+    QTAILQ_HEAD(, NetPacket) overflow;
+    /* The first overflow packet is being delivered */
+    bool overflow_inflight;
+
+    uint64_t dropped;
 
     unsigned delivering : 1;
 };
 
+/* Larger buffers are freed after delivery instead of kept in their slot */
+#define NET_QUEUE_SLOT_BUF_MAX  (16 * KiB)
+/* Buffers are freed after delivery once the slots hold this much memory */
+#define NET_QUEUE_SLOTS_BUF_MAX (4 * MiB)
+/* Initial number of slots */
+#define NET_QUEUE_MIN_SLOTS     64
+
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
 {
     NetQueue *queue;
@@ -67,50 +104,171 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue = g_new0(NetQueue, 1);
 
     queue->opaque = opaque;
-    queue->nq_maxlen = 10000;
+    queue->nq_maxlen = NET_QUEUE_DEFAULT_LEN;
     queue->nq_count = 0;
     queue->deliver = deliver;
 
-    QTAILQ_INIT(&queue->packets);
+    QTAILQ_INIT(&queue->overflow);
 
     queue->delivering = 0;
 
     return queue;
 }
 
+static void qemu_net_queue_free_slots(NetQueue *queue)
+{
+    uint32_t i;
+
+    if (!queue->slots) {
+        return;
+    }
+    for (i = 0; i < queue->nslots; i++) {
+        g_free(queue->slots[i].buf);
+    }
+    g_free(queue->slots);
+    queue->slots = NULL;
+    queue->nslots = 0;
+    queue->slots_buf_size = 0;
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
     NetPacket *packet, *next;
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
+    QTAILQ_FOREACH_SAFE(packet, &queue->overflow, entry, next) {
+        QTAILQ_REMOVE(&queue->overflow, packet, entry);
         g_free(packet);
     }
+    qemu_net_queue_free_slots(queue);
 
     g_free(queue);
 }
 
-static void qemu_net_queue_append(NetQueue *queue,
-                                  NetClientState *sender,
-                                  unsigned flags,
-                                  const uint8_t *buf,
-                                  size_t size,
-                                  NetPacketSent *sent_cb)
+bool qemu_net_queue_set_len(NetQueue *queue, uint32_t len)
+{
+    assert(len);
+
+    if (queue->nq_count || queue->ring_inflight || queue->overflow_inflight) {
+        return false;
+    }
+
+    qemu_net_queue_free_slots(queue);
+    queue->nq_maxlen = len;
+    queue->head = 0;
+    return true;
+}
+
+uint32_t qemu_net_queue_get_len(NetQueue *queue)
+{
+    return queue->nq_maxlen;
+}
+
+uint64_t qemu_net_queue_get_dropped(NetQueue *queue)
+{
+    return queue->dropped;
+}
+
+static NetPacket *qemu_net_queue_slot(NetQueue *queue, uint32_t i)
+{
+    return &queue->slots[(queue->head + i) % queue->nslots];
+}
+
+/* Double the number of slots, moving the pending packets to the start */
+static void qemu_net_queue_grow(NetQueue *queue)
+{
+    uint32_t nslots = MIN(MAX(queue->nslots * 2, NET_QUEUE_MIN_SLOTS),
+                          queue->nq_maxlen);
+    NetPacket *slots = g_new0(NetPacket, nslots);
+    uint32_t i;
+
+    /* The packet being delivered must stay at head - 1 */
+    assert(!queue->ring_inflight);
+
+    for (i = 0; i < queue->nslots; i++) {
+        slots[i] = *qemu_net_queue_slot(queue, i);
+    }
+    g_free(queue->slots);
+    queue->slots = slots;
+    queue->nslots = nslots;
+    queue->head = 0;
+}
+
+/*
+ * Return a packet with room for @size bytes of data, at the tail of the
+ * queue, or NULL if the packet must be dropped.
+ */
+static NetPacket *qemu_net_queue_alloc(NetQueue *queue,
+                                       NetClientState *sender,
+                                       unsigned flags,
+                                       size_t size,
+                                       NetPacketSent *sent_cb)
 {
     NetPacket *packet;
+    bool use_ring;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
+        queue->dropped++;
+        return NULL; /* drop if queue full and no callback */
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
+
+    /* Packets go to the ring only while nothing is in the overflow list */
+    use_ring = QTAILQ_EMPTY(&queue->overflow) && !queue->overflow_inflight;
+    if (use_ring && queue->ring_count == queue->nslots &&
+        queue->nslots < queue->nq_maxlen && !queue->ring_inflight) {
+        qemu_net_queue_grow(queue);
+    }
+
+    if (use_ring &&
+        queue->ring_count + queue->ring_inflight < queue->nslots) {
+        packet = qemu_net_queue_slot(queue, queue->ring_count++);
+        if (packet->buf_size < size) {
+            queue->slots_buf_size -= packet->buf_size;
+            g_free(packet->buf);
+            packet->buf = g_malloc(size);
+            packet->buf_size = size;
+            queue->slots_buf_size += size;
+        }
+    } else {
+        packet = g_malloc(sizeof(NetPacket) + size);
+        packet->buf = (uint8_t *)(packet + 1);
+        packet->buf_size = size;
+        QTAILQ_INSERT_TAIL(&queue->overflow, packet, entry);
+    }
+
     packet->sender = sender;
     packet->flags = flags;
     packet->size = size;
     packet->sent_cb = sent_cb;
-    memcpy(packet->data, buf, size);
 
     queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    return packet;
+}
+
+/* Called when a ring packet leaves the queue */
+static void qemu_net_queue_slot_done(NetQueue *queue, NetPacket *packet)
+{
+    if (packet->buf_size > NET_QUEUE_SLOT_BUF_MAX ||
+        queue->slots_buf_size > NET_QUEUE_SLOTS_BUF_MAX) {
+        queue->slots_buf_size -= packet->buf_size;
+        g_free(packet->buf);
+        packet->buf = NULL;
+        packet->buf_size = 0;
+    }
+}
+
+static void qemu_net_queue_append(NetQueue *queue,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  const uint8_t *buf,
+                                  size_t size,
+                                  NetPacketSent *sent_cb)
+{
+    NetPacket *packet;
+
+    packet = qemu_net_queue_alloc(queue, sender, flags, size, sent_cb);
+    if (packet) {
+        memcpy(packet->buf, buf, size);
+    }
 }
 
 void qemu_net_queue_append_iov(NetQueue *queue,
@@ -121,31 +279,12 @@ void qemu_net_queue_append_iov(NetQueue *queue,
                                NetPacketSent *sent_cb)
 {
     NetPacket *packet;
-    size_t max_len = 0;
-    int i;
-
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
-    }
-    for (i = 0; i < iovcnt; i++) {
-        max_len += iov[i].iov_len;
-    }
-
-    packet = g_malloc(sizeof(NetPacket) + max_len);
-    packet->sender = sender;
-    packet->sent_cb = sent_cb;
-    packet->flags = flags;
-    packet->size = 0;
 
-    for (i = 0; i < iovcnt; i++) {
-        size_t len = iov[i].iov_len;
-
-        memcpy(packet->data + packet->size, iov[i].iov_base, len);
-        packet->size += len;
+    packet = qemu_net_queue_alloc(queue, sender, flags,
+                                  iov_size(iov, iovcnt), sent_cb);
+    if (packet) {
+        iov_to_buf(iov, iovcnt, 0, packet->buf, packet->size);
     }
-
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
 }
 
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
@@ -246,10 +385,41 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
+    g_autoptr(GArray) sent = NULL;
+    uint32_t i, j;
+
+    /* Compact the ring, the slots of purged packets move after the tail */
+    for (i = j = 0; i < queue->ring_count; i++) {
+        packet = qemu_net_queue_slot(queue, i);
+        if (packet->sender == from) {
+            if (packet->sent_cb) {
+                if (!sent) {
+                    sent = g_array_new(false, false, sizeof(NetPacketSent *));
+                }
+                g_array_append_val(sent, packet->sent_cb);
+            }
+            qemu_net_queue_slot_done(queue, packet);
+            continue;
+        }
+        if (i != j) {
+            NetPacket tmp = *qemu_net_queue_slot(queue, j);
+
+            *qemu_net_queue_slot(queue, j) = *packet;
+            *packet = tmp;
+        }
+        j++;
+    }
+    queue->nq_count -= queue->ring_count - j;
+    queue->ring_count = j;
+
+    /* The callbacks may queue packets again */
+    for (i = 0; sent && i < sent->len; i++) {
+        g_array_index(sent, NetPacketSent *, i)(from, 0);
+    }
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
+    QTAILQ_FOREACH_SAFE(packet, &queue->overflow, entry, next) {
         if (packet->sender == from) {
-            QTAILQ_REMOVE(&queue->packets, packet, entry);
+            QTAILQ_REMOVE(&queue->overflow, packet, entry);
             queue->nq_count--;
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
@@ -264,22 +434,54 @@ bool qemu_net_queue_flush(NetQueue *queue)
     if (queue->delivering)
         return false;
 
-    while (!QTAILQ_EMPTY(&queue->packets)) {
+    while (queue->ring_count) {
+        NetPacket *packet;
+        int ret;
+
+        packet = qemu_net_queue_slot(queue, 0);
+        queue->head = (queue->head + 1) % queue->nslots;
+        queue->ring_count--;
+        queue->nq_count--;
+        queue->ring_inflight = true;
+
+        ret = qemu_net_queue_deliver(queue,
+                                     packet->sender,
+                                     packet->flags,
+                                     packet->buf,
+                                     packet->size);
+        queue->ring_inflight = false;
+        if (ret == 0) {
+            queue->head = (queue->head + queue->nslots - 1) %
+                          queue->nslots;
+            queue->ring_count++;
+            queue->nq_count++;
+            return false;
+        }
+
+        qemu_net_queue_slot_done(queue, packet);
+        if (packet->sent_cb) {
+            packet->sent_cb(packet->sender, ret);
+        }
+    }
+
+    while (!QTAILQ_EMPTY(&queue->overflow)) {
         NetPacket *packet;
         int ret;
 
-        packet = QTAILQ_FIRST(&queue->packets);
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
+        packet = QTAILQ_FIRST(&queue->overflow);
+        QTAILQ_REMOVE(&queue->overflow, packet, entry);
         queue->nq_count--;
+        queue->overflow_inflight = true;
 
         ret = qemu_net_queue_deliver(queue,
                                      packet->sender,
                                      packet->flags,
-                                     packet->data,
+                                     packet->buf,
                                      packet->size);
+        queue->overflow_inflight = false;
         if (ret == 0) {
             queue->nq_count++;
-            QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
+            QTAILQ_INSERT_HEAD(&queue->overflow, packet, entry);
             return false;
         }
 
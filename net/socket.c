@@ -27,6 +27,7 @@
 #include "clients.h"
 #include "monitor/monitor.h"
 #include "qapi/error.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
 #include "qemu/sockets.h"
@@ -50,10 +51,15 @@ static void net_socket_writable(void *opaque);
 
 static void net_socket_update_fd_handler(NetSocketState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll ? s->send_fn : NULL,
-                        s->write_poll ? net_socket_writable : NULL,
-                        s);
+    IOHandler *fd_read = s->read_poll ? s->send_fn : NULL;
+    IOHandler *fd_write = s->write_poll ? net_socket_writable : NULL;
+
+    if (s->nc.ctx) {
+        aio_set_fd_handler(s->nc.ctx, s->fd, fd_read, fd_write,
+                           NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd, fd_read, fd_write, s);
+    }
 }
 
 static void net_socket_read_poll(NetSocketState *s, bool enable)
@@ -183,7 +189,10 @@ static void net_socket_send(void *opaque)
     }
     buf = buf1;
 
+    /* Let the peer coalesce the packets of one read, see net_gro_receive() */
+    defer_call_begin();
     ret = net_fill_rstate(&s->rs, buf, size);
+    defer_call_end();
 
     if (ret == -1) {
         goto eoc;
@@ -322,10 +331,30 @@ static void net_socket_cleanup(NetClientState *nc)
     }
 }
 
+static void net_socket_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    if (s->fd < 0) {
+        nc->ctx = ctx;
+        return;
+    }
+
+    /* Move the fd handlers from the old context to the new one */
+    if (nc->ctx) {
+        aio_set_fd_handler(nc->ctx, s->fd, NULL, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    nc->ctx = ctx;
+    net_socket_update_fd_handler(s);
+}
+
 static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_DRIVER_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive_dgram,
+    .set_aio_context = net_socket_set_aio_context,
     .cleanup = net_socket_cleanup,
 };
 
@@ -417,6 +446,7 @@ static NetClientInfo net_socket_info = {
     .type = NET_CLIENT_DRIVER_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive,
+    .set_aio_context = net_socket_set_aio_context,
     .cleanup = net_socket_cleanup,
 };
 
@@ -7,6 +7,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/defer-call.h"
 #include "qemu/iov.h"
 #include "qapi/error.h"
 #include "net/net.h"
@@ -124,7 +125,10 @@ gboolean net_stream_data_send(QIOChannel *ioc, GIOCondition condition,
     }
     buf = buf1;
 
+    /* Let the peer coalesce the packets of one read, see net_gro_receive() */
+    defer_call_begin();
     ret = net_fill_rstate(&d->rs, (const uint8_t *)buf, size);
+    defer_call_end();
 
     if (ret == -1) {
         goto eoc;
@@ -39,6 +39,7 @@
 #include "system/system.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
@@ -49,6 +50,14 @@
 
 #include "net/vhost_net.h"
 
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+#endif
+
+/* Maximum and default number of packets received per tap_send() call */
+#define TAP_RX_BATCH_MAX 64
+#define TAP_RX_BATCH_DEFAULT 50
+
 static const int kernel_feature_bits[] = {
     VIRTIO_F_NOTIFY_ON_EMPTY,
     VIRTIO_RING_F_INDIRECT_DESC,
@@ -68,7 +77,21 @@ static const int kernel_feature_bits[] = {
     VHOST_INVALID_FEATURE_BIT
 };
 
-typedef struct TAPState {
+typedef struct TAPState TAPState;
+
+#ifdef CONFIG_LINUX_IO_URING
+/* A receive buffer whose read is submitted through the AioContext's ring */
+typedef struct TAPRxBuf {
+    TAPState *s;
+    CqeHandler cqe_handler;
+    /* the next buffer's read is linked to this one */
+    bool link;
+    bool done;
+    uint8_t buf[NET_BUFSIZE];
+} TAPRxBuf;
+#endif
+
+struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
@@ -84,7 +107,19 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
-} TAPState;
+    unsigned rx_batch;
+#ifdef CONFIG_LINUX_IO_URING
+    /* use io_uring reads when running in an IOThread, see tap_send() */
+    bool rx_uring;
+    TAPRxBuf *rx_bufs;
+    /* number of reads in the current or next chain */
+    unsigned rx_chain;
+    /* reads of the current chain that have not been delivered yet */
+    unsigned rx_inflight;
+    /* reads of the current chain that returned a packet */
+    unsigned rx_packets;
+#endif
+};
 
 static void launch_script(const char *setup_script, const char *ifname,
                           int fd, Error **errp);
@@ -107,12 +142,27 @@ static char *tap_parse_script(const char *script_arg, const char *default_path)
     return g_steal_pointer(&res);
 }
 
+static bool tap_rx_inflight(TAPState *s)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    return s->rx_inflight;
+#else
+    return false;
+#endif
+}
+
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    IOHandler *fd_read = s->read_poll && s->enabled && !tap_rx_inflight(s) ?
+                         tap_send : NULL;
+    IOHandler *fd_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    if (s->nc.ctx) {
+        aio_set_fd_handler(s->nc.ctx, s->fd, fd_read, fd_write,
+                           NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd, fd_read, fd_write, s);
+    }
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -193,44 +243,181 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
-static void tap_send(void *opaque)
+/*
+ * Hand one packet read from the tap to the peer.  Returns false if no
+ * more packets should be read for now.
+ */
+static bool tap_send_packet(TAPState *s, uint8_t *buf, int size)
 {
-    TAPState *s = opaque;
-    int size;
-    int packets = 0;
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
 
-    while (true) {
-        uint8_t *buf = s->buf;
-        uint8_t min_pkt[ETH_ZLEN];
-        size_t min_pktsz = sizeof(min_pkt);
+    if (s->host_vnet_hdr_len && size <= s->host_vnet_hdr_len) {
+        /* Invalid packet */
+        return false;
+    }
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
-        if (size <= 0) {
-            break;
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        buf  += s->host_vnet_hdr_len;
+        size -= s->host_vnet_hdr_len;
+    }
+
+    if (net_peer_needs_padding(&s->nc)) {
+        if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+            buf = min_pkt;
+            size = min_pktsz;
         }
+    }
 
-        if (s->host_vnet_hdr_len && size <= s->host_vnet_hdr_len) {
-            /* Invalid packet */
-            break;
+    size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+    if (size == 0) {
+        tap_read_poll(s, false);
+        return false;
+    }
+    return size > 0;
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static void tap_rx_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
+{
+    TAPRxBuf *rxb = opaque;
+
+    io_uring_prep_read(sqe, rxb->s->fd, rxb->buf, sizeof(rxb->buf), 0);
+
+    /*
+     * Fail with -EAGAIN once the tap is empty instead of waiting for the
+     * next packet.  The link must be a hard one because every read that
+     * returns a packet is a short read, which would break a normal link.
+     */
+    sqe->rw_flags = RWF_NOWAIT;
+    if (rxb->link) {
+        sqe->flags |= IOSQE_IO_HARDLINK;
+    }
+}
+
+/* Called when all reads of the chain have been delivered */
+static void tap_rx_chain_done(TAPState *s)
+{
+    /*
+     * Double the chain while it fills up, otherwise make it one read
+     * longer than the number of packets it returned.  A chain that ends
+     * early costs one empty read per wakeup, like the read() loop does.
+     */
+    if (s->rx_packets == s->rx_chain) {
+        s->rx_chain = MIN(s->rx_chain * 2, s->rx_batch);
+    } else {
+        s->rx_chain = s->rx_packets + 1;
+    }
+    tap_update_fd_handler(s);
+}
+
+static void tap_rx_cqe_handler(CqeHandler *cqe_handler)
+{
+    TAPRxBuf *rxb = container_of(cqe_handler, TAPRxBuf, cqe_handler);
+    TAPState *s = rxb->s;
+
+    rxb->done = true;
+
+    /*
+     * The linked reads run one after the other, so their completions
+     * arrive in chain order.  Deliver in that order regardless, so that
+     * packets can never overtake each other.
+     */
+    while (s->rx_inflight) {
+        TAPRxBuf *next = &s->rx_bufs[s->rx_chain - s->rx_inflight];
+        int size = next->cqe_handler.cqe.res;
+
+        if (!next->done) {
+            return;
         }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
+        /*
+         * The packet was already consumed from the tap, so deliver it
+         * even if the peer stopped receiving in the meantime; the net
+         * queue keeps it until the peer is ready.
+         */
+        if (size > 0 && s->fd >= 0) {
+            tap_send_packet(s, next->buf, size);
+            s->rx_packets++;
+        } else if (size == -EOPNOTSUPP) {
+            /* The tap does not support RWF_NOWAIT, go back to read() */
+            s->rx_uring = false;
         }
+        s->rx_inflight--;
+    }
 
-        if (net_peer_needs_padding(&s->nc)) {
-            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
-                buf = min_pkt;
-                size = min_pktsz;
-            }
+    tap_rx_chain_done(s);
+}
+
+/*
+ * Submit a chain of linked reads into the first buffers of the pool; the
+ * ring submits them with a single system call.  The fd handler stays
+ * disabled until all of them have been delivered, so only buffers whose
+ * packet has been passed on are submitted again.  Completions are
+ * processed inside a defer_call_begin()/defer_call_end() section, so the
+ * peer notifies the guest once per chain.
+ */
+static void tap_rx_uring_submit(TAPState *s)
+{
+    unsigned i;
+
+    if (!s->rx_bufs) {
+        s->rx_bufs = g_new0(TAPRxBuf, s->rx_batch);
+        for (i = 0; i < s->rx_batch; i++) {
+            s->rx_bufs[i].s = s;
+            s->rx_bufs[i].cqe_handler.cb = tap_rx_cqe_handler;
         }
+        s->rx_chain = 1;
+    }
+
+    s->rx_inflight = s->rx_chain;
+    s->rx_packets = 0;
+    tap_update_fd_handler(s);
+
+    for (i = 0; i < s->rx_chain; i++) {
+        s->rx_bufs[i].link = i + 1 < s->rx_chain;
+        s->rx_bufs[i].done = false;
+        aio_add_sqe(tap_rx_prep_sqe, &s->rx_bufs[i],
+                    &s->rx_bufs[i].cqe_handler);
+    }
+}
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
+/*
+ * Wait for the submitted reads, which belong to the current AioContext.
+ * They do not wait for packets, so this only takes one ring round trip.
+ */
+static void tap_rx_uring_drain(TAPState *s)
+{
+    while (s->rx_inflight) {
+        assert(s->nc.ctx && in_aio_context_home_thread(s->nc.ctx));
+        aio_poll(s->nc.ctx, true);
+    }
+}
+#endif
+
+static void tap_send(void *opaque)
+{
+    TAPState *s = opaque;
+    int size;
+    int packets = 0;
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->rx_uring && s->nc.ctx && aio_has_io_uring()) {
+        tap_rx_uring_submit(s);
+        return;
+    }
+#endif
+
+    /* Notify the guest once for the whole batch */
+    defer_call_begin();
+
+    while (true) {
+        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+        if (size <= 0) {
             break;
-        } else if (size < 0) {
+        }
+
+        if (!tap_send_packet(s, s->buf, size)) {
             break;
         }
 
@@ -241,10 +428,12 @@ static void tap_send(void *opaque)
          * stalling the guest.
          */
         packets++;
-        if (packets >= 50) {
+        if (packets >= s->rx_batch) {
             break;
         }
     }
+
+    defer_call_end();
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -353,6 +542,11 @@ static void tap_cleanup(NetClientState *nc)
 
     tap_read_poll(s, false);
     tap_write_poll(s, false);
+#ifdef CONFIG_LINUX_IO_URING
+    tap_rx_uring_drain(s);
+    g_free(s->rx_bufs);
+    s->rx_bufs = NULL;
+#endif
     close(s->fd);
     s->fd = -1;
 }
@@ -364,6 +558,29 @@ static void tap_poll(NetClientState *nc, bool enable)
     tap_write_poll(s, enable);
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (s->fd < 0) {
+        nc->ctx = ctx;
+        return;
+    }
+
+#ifdef CONFIG_LINUX_IO_URING
+    tap_rx_uring_drain(s);
+#endif
+
+    /* Move the fd handlers from the old context to the new one */
+    if (nc->ctx) {
+        aio_set_fd_handler(nc->ctx, s->fd, NULL, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    nc->ctx = ctx;
+    tap_update_fd_handler(s);
+}
+
 static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -399,6 +616,7 @@ static NetClientInfo net_tap_info = {
     .receive = tap_receive,
     .receive_iov = tap_receive_iov,
     .poll = tap_poll,
+    .set_aio_context = tap_set_aio_context,
     .cleanup = tap_cleanup,
     .has_ufo = tap_has_ufo,
     .has_uso = tap_has_uso,
@@ -434,6 +652,7 @@ static TAPState *net_tap_fd_init(NetClientState *peer,
     s->has_uso = tap_probe_has_uso(s->fd);
     s->has_tunnel = tap_probe_has_tunnel(s->fd);
     s->enabled = true;
+    s->rx_batch = TAP_RX_BATCH_DEFAULT;
     tap_set_offload(&s->nc, &ol);
     /*
      * Make sure host header length is set correctly in tap:
@@ -719,6 +938,13 @@ static bool net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         goto failed;
     }
 
+    if (tap->has_rx_batch) {
+        s->rx_batch = tap->rx_batch;
+    }
+#ifdef CONFIG_LINUX_IO_URING
+    s->rx_uring = tap->rx_uring;
+#endif
+
     if (tap->fd || tap->fds) {
         qemu_set_info_str(&s->nc, "fd=%d", fd);
     } else if (tap->helper) {
@@ -891,6 +1117,13 @@ int net_init_tap(const Netdev *netdev, const char *name,
         return -1;
     }
 
+    if (tap->has_rx_batch &&
+        (tap->rx_batch == 0 || tap->rx_batch > TAP_RX_BATCH_MAX)) {
+        error_setg(errp, "rx-batch must be between 1 and %d",
+                   TAP_RX_BATCH_MAX);
+        return -1;
+    }
+
     queues = tap_parse_fds_and_queues(tap, &fds, errp);
     if (queues < 0) {
         return -1;
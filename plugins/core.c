@@ -279,10 +279,50 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
     async_run_on_cpu(cpu, qemu_plugin_vcpu_init__async, RUN_ON_CPU_NULL);
 }
 
+static struct qemu_plugin_mem_buffer_entry *
+plugin_mem_buffer_entry(struct qemu_plugin_mem_buffer *buffer,
+                        uint32_t cpu_index)
+{
+    GArray *arr = buffer->score->data;
+
+    return (void *)(arr->data + cpu_index * g_array_get_element_size(arr));
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void qemu_plugin_vcpu_mem_buffer_flush(uint32_t cpu_index,
+                                       struct qemu_plugin_mem_buffer *buffer)
+{
+    struct qemu_plugin_mem_buffer_entry *e =
+        plugin_mem_buffer_entry(buffer, cpu_index);
+    size_t n = MIN(e->count, buffer->n_records);
+
+    if (n) {
+        buffer->cb(cpu_index, e->records, n, buffer->userp);
+    }
+    e->count = 0;
+}
+
+static void plugin_mem_buffers_flush(uint32_t cpu_index)
+{
+    struct qemu_plugin_mem_buffer *buffer;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    QLIST_FOREACH(buffer, &plugin.mem_buffers, entry) {
+        qemu_plugin_vcpu_mem_buffer_flush(cpu_index, buffer);
+    }
+}
+
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_mem_buffers_flush(cpu->cpu_index);
+
     qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_RW_REGS);
     plugin_vcpu_cb__udata(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
     qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_NO_REGS);
@@ -367,6 +407,21 @@ void plugin_register_inline_op_on_entry(GArray **arr,
     dyn_cb->inline_insn = inline_cb;
 }
 
+void plugin_register_mem_buffer_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        struct qemu_plugin_mem_buffer *buffer,
+                                        uint64_t pc)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    struct qemu_plugin_mem_buffer_cb buffer_cb = { .rw = rw,
+                                                   .buffer = buffer,
+                                                   .pc = pc };
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->type = PLUGIN_CB_MEM_BUFFER;
+    dyn_cb->mem_buffer = buffer_cb;
+}
+
 void plugin_register_dyn_cb__udata(GArray **arr,
                                    qemu_plugin_vcpu_udata_cb_t cb,
                                    enum qemu_plugin_cb_flags flags,
@@ -690,6 +745,24 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__udata(QEMU_PLUGIN_EV_FLUSH);
 }
 
+/* Record an access made from a helper, see also gen_mem_buffer_cb() */
+static void exec_mem_buffer_cb(struct qemu_plugin_mem_buffer_cb *cb,
+                               uint32_t cpu_index, uint64_t vaddr,
+                               qemu_plugin_meminfo_t info)
+{
+    struct qemu_plugin_mem_buffer_entry *e =
+        plugin_mem_buffer_entry(cb->buffer, cpu_index);
+
+    if (e->count >= cb->buffer->n_records) {
+        qemu_plugin_vcpu_mem_buffer_flush(cpu_index, cb->buffer);
+    }
+    e->records[e->count++] = (qemu_plugin_mem_record) {
+        .vaddr = vaddr,
+        .pc = cb->pc,
+        .info = info,
+    };
+}
+
 void exec_inline_op(enum plugin_dyn_cb_type type,
                     struct qemu_plugin_inline_cb *cb,
                     int cpu_index)
@@ -750,6 +823,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                 exec_inline_op(cb->type, &cb->inline_insn, cpu->cpu_index);
             }
             break;
+        case PLUGIN_CB_MEM_BUFFER:
+            if (rw & cb->mem_buffer.rw) {
+                exec_mem_buffer_cb(&cb->mem_buffer, cpu->cpu_index, vaddr,
+                                   make_plugin_meminfo(oi, rw));
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -758,6 +837,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
 
 void qemu_plugin_atexit_cb(void)
 {
+    int i;
+
+    /* report what is left in the buffers while the plugins can use it */
+    for (i = 0; i < plugin.num_vcpus; i++) {
+        plugin_mem_buffers_flush(i);
+    }
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -847,6 +932,7 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QLIST_INIT(&plugin.scoreboards);
+    QLIST_INIT(&plugin.mem_buffers);
     plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
@@ -883,6 +969,44 @@ void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
     g_free(score);
 }
 
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t n_records,
+                      qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                      void *userdata)
+{
+    struct qemu_plugin_mem_buffer *buffer;
+
+    g_assert(n_records > 0 && n_records < UINT32_MAX);
+    buffer = g_new0(struct qemu_plugin_mem_buffer, 1);
+    buffer->n_records = n_records;
+    buffer->cb = cb;
+    buffer->userp = userdata;
+    buffer->score = plugin_scoreboard_new(
+        sizeof(struct qemu_plugin_mem_buffer_entry) +
+        (n_records + 1) * sizeof(qemu_plugin_mem_record));
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.mem_buffers, buffer, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return buffer;
+}
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buffer)
+{
+    int i;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    for (i = 0; i < plugin.num_vcpus; i++) {
+        qemu_plugin_vcpu_mem_buffer_flush(i, buffer);
+    }
+    QLIST_REMOVE(buffer, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    plugin_scoreboard_free(buffer->score);
+    g_free(buffer);
+}
+
 enum qemu_plugin_cb_flags tcg_call_to_qemu_plugin_cb_flags(int flags)
 {
     if (flags & TCG_CALL_NO_RWG) {
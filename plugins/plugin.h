@@ -34,6 +34,7 @@ struct qemu_plugin_state {
     GHashTable *cpu_ht;
     QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
     size_t scoreboard_alloc_size;
+    QLIST_HEAD(, qemu_plugin_mem_buffer) mem_buffers;
     DECLARE_BITMAP(mask, QEMU_PLUGIN_EV_MAX);
     /*
      * @lock protects the struct as well as ctx->uninstalling.
@@ -75,6 +76,11 @@ void plugin_register_inline_op_on_entry(GArray **arr,
                                         qemu_plugin_u64 entry,
                                         uint64_t imm);
 
+void plugin_register_mem_buffer_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        struct qemu_plugin_mem_buffer *buffer,
+                                        uint64_t pc);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_udata_cb_t cb,
                             void *userdata,
@@ -120,6 +126,13 @@ struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
 
 void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
 
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t n_records,
+                      qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                      void *userdata);
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buffer);
+
 /**
  * qemu_plugin_fillin_mode_info() - populate mode specific info
  * info: pointer to qemu_info_t structure
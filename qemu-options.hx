@@ -240,6 +240,8 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-eviction=on|off (recycle old TCG translations instead of flushing them all, default=off)\n"
+    "                superblock-threshold=n (retranslate TCG blocks run n times as superblocks, default=0)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
@@ -283,6 +285,22 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-eviction=on|off``
+        When the TCG translation block cache is full, only discard the
+        translations in the oldest parts of the cache instead of all of
+        them. This avoids retranslating the whole working set of long
+        running guests at once. ``info jit`` shows how often the whole
+        cache still had to be flushed. Only supported in system mode
+        (default=off).
+
+    ``superblock-threshold=n``
+        After a TCG translation block has run n times, translate it again
+        together with the blocks that follow it on the same page, as one
+        superblock.  The code of hot loops is then optimized across block
+        boundaries.  ``info jit`` shows how many superblocks were built.
+        Superblocks are not built when plugins or icount are in use
+        (default=0, never).
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -3008,7 +3026,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev tap,id=str[,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile]\n"
     "         [,br=bridge][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off]\n"
     "         [,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
-    "         [,poll-us=n]\n"
+    "         [,poll-us=n][,rx-batch=n][,rx-uring=on|off]\n"
     "                configure a host TAP network backend with ID 'str'\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
@@ -3031,6 +3049,9 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
     "                use 'poll-us=n' to specify the maximum number of microseconds that could be\n"
     "                spent on busy polling for vhost net\n"
+    "                use 'rx-batch=n' to receive up to n packets per wakeup\n"
+    "                use 'rx-uring=on' to receive with linked io_uring reads when\n"
+    "                the TAP is serviced by an IOThread\n"
     "-netdev bridge,id=str[,br=bridge][,helper=helper]\n"
     "                configure a host TAP network backend with ID 'str' that is\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
@@ -3103,6 +3124,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
     "         [,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]\n"
     "         [,map-path=/path/to/socket/map][,map-start-index=i]\n"
+    "         [,rx-zerocopy-memdev=id]\n"
     "                attach to the existing network interface 'name' with AF_XDP socket\n"
     "                use 'mode=MODE' to specify an XDP program attach mode\n"
     "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
@@ -3114,6 +3136,8 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                  and use 'map-start-index' to specify the starting index for the map (default: 0) (Since 10.1)\n"
     "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
     "                use 'start-queue=m' to specify the first queue that should be used\n"
+    "                use 'rx-zerocopy-memdev=id' to receive directly into guest buffers\n"
+    "                that are in the memory backend 'id'\n"
 #endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
@@ -3229,6 +3253,13 @@ SRST
     network backend) which is activated if no other networking options
     are provided.
 
+``-netdev type,id=id[,queue-len=n][,...]``
+    All network backends accept ``queue-len``, the number of packets
+    that are queued between the backend and its peer while the
+    receiving side cannot take them. Further packets are dropped,
+    unless their sender waits for them to be delivered. The default is
+    10000.
+
 ``-netdev passt,id=str[,option][,...]``
     Configure a passt network backend which requires no administrator
     privilege to run. Valid options are:
@@ -3544,7 +3575,7 @@ SRST
             # and connect the TCP stream to its stdin/stdout
             |qemu_system| -nic  'user,id=n1,guestfwd=tcp:10.0.2.100:1234-cmd:netcat 10.10.1.1 4321'
 
-``-netdev tap,id=id[,fd=h][,ifname=name][,script=file][,downscript=dfile][,br=bridge][,helper=helper]``
+``-netdev tap,id=id[,fd=h][,ifname=name][,script=file][,downscript=dfile][,br=bridge][,helper=helper][,rx-batch=n][,rx-uring=on|off]``
     Configure a host TAP network backend with ID id.
 
     Use the network script file to configure it and the network script
@@ -3563,6 +3594,16 @@ SRST
     ``fd``\ =h can be used to specify the handle of an already opened
     host TAP interface.
 
+    ``rx-batch``\ =n sets the maximum number of packets that are
+    received each time the TAP becomes readable (1 to 64, default 50).
+
+    ``rx-uring=on`` receives packets with a chain of linked io_uring
+    reads, submitted with a single system call, instead of one
+    ``read()`` per packet.  The chain grows up to ``rx-batch`` reads
+    while the TAP keeps it busy.  It only takes effect while the TAP is
+    serviced by an IOThread (for example with the ``iothread`` property
+    of virtio-net) whose event loop uses io_uring.
+
     Examples:
 
     .. parsed-literal::
@@ -3951,7 +3992,7 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
-``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z][,map-path=/path/to/socket/map][,map-start-index=i]``
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z][,map-path=/path/to/socket/map][,map-start-index=i][,rx-zerocopy-memdev=id]``
     Configure AF_XDP backend to connect to a network interface 'name'
     using AF_XDP socket.  A specific program attach mode for a default
     XDP program can be forced with 'mode', defaults to best-effort,
@@ -4016,6 +4057,25 @@ SRST
     for insertion into the socket map.  The combination of 'map-path' and
     'sock-fds' together is not supported.
 
+    With 'rx-zerocopy-memdev', the UMEM of each socket maps the memory
+    backend that holds guest RAM, and the receive buffers posted by a
+    virtio-net device are given to the kernel as fill queue entries.
+    Frames are then received without a copy.  The memory backend must be
+    shareable and backed by a file descriptor, and using huge pages lets
+    more buffers qualify because a buffer must not cross a page boundary.
+    Buffers that are too small for a frame, and all buffers while the
+    device uses RSS, hash reporting, receive segment coalescing or
+    network filters, go through the regular copying path.  The memory
+    backend is locked in host memory while zero-copy receive is active.
+
+    .. parsed-literal::
+
+        |qemu_system| linux.img \\
+            -object memory-backend-memfd,id=mem,size=4G,hugetlb=on,share=on \\
+            -machine memory-backend=mem \\
+            -device virtio-net-pci,netdev=n1 \\
+            -netdev af-xdp,id=n1,ifname=eth0,rx-zerocopy-memdev=mem
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -29,6 +29,7 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
 #include "exec/translation-block.h"
@@ -72,8 +73,14 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t alloc_seq; /* number of region allocations since reset */
+    uint64_t *region_seq; /* alloc_seq at the time each region was assigned */
+    unsigned long *evicted; /* regions freed by tcg_region_evict() */
 };
 
+/* Fraction of the regions that tcg_region_evict() recycles at once */
+#define TCG_REGION_EVICT_DIV 8
+
 static struct tcg_region_state region;
 
 /*
@@ -359,11 +366,20 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else {
+        /* All regions have been used once; fall back to evicted ones */
+        curr_region = find_first_bit(region.evicted, region.n);
+        if (curr_region == region.n) {
+            return true;
+        }
+        clear_bit(curr_region, region.evicted);
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
+    region.region_seq[curr_region] = region.alloc_seq++;
     return false;
 }
 
@@ -412,6 +428,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.alloc_seq = 0;
+    bitmap_zero(region.evicted, region.n);
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,13 +440,95 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
-static size_t tcg_n_regions(size_t tb_size, unsigned max_threads)
+/* Returns the index of the region that @s is generating code into */
+static size_t tcg_region_of_ctx(const TCGContext *s)
+{
+    size_t offset = s->code_gen_buffer - region.start_aligned;
+
+    /* The final region may have a few extra pages, see tcg_region_bounds() */
+    return MIN(offset / region.stride, region.n - 1);
+}
+
+/*
+ * Free the least recently assigned regions so that tcg_region_alloc() can
+ * hand them out again, instead of resetting the whole code_gen_buffer.
+ * @evict_tb is called for each TB in those regions and must make sure that
+ * nothing references the TB any more.  Regions that a TCG context is still
+ * generating code into are never evicted.
+ *
+ * Call from a safe-work context.
+ * Returns the number of evicted regions; 0 means a full flush is needed.
+ */
+size_t tcg_region_evict(GTraverseFunc evict_tb, gpointer user_data)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    size_t nr = DIV_ROUND_UP(region.n, TCG_REGION_EVICT_DIV);
+    g_autofree unsigned long *busy = bitmap_new(region.n);
+    size_t evicted = 0;
+    unsigned int i;
+
+    qemu_mutex_lock(&region.lock);
+
+    /* Unassigned and already evicted regions have nothing to evict */
+    bitmap_set(busy, region.current, region.n - region.current);
+    bitmap_or(busy, busy, region.evicted, region.n);
+    for (i = 0; i < n_ctxs; i++) {
+        set_bit(tcg_region_of_ctx(qatomic_read(&tcg_ctxs[i])), busy);
+    }
+
+    while (evicted < nr) {
+        struct tcg_region_tree *rt;
+        size_t oldest = region.n;
+        void *start, *end;
+        size_t j;
+
+        for (j = find_first_zero_bit(busy, region.n); j < region.n;
+             j = find_next_zero_bit(busy, region.n, j + 1)) {
+            if (oldest == region.n ||
+                region.region_seq[j] < region.region_seq[oldest]) {
+                oldest = j;
+            }
+        }
+        if (oldest == region.n) {
+            break;
+        }
+
+        rt = region_trees + oldest * tree_size;
+        qemu_mutex_lock(&rt->lock);
+        q_tree_foreach(rt->tree, evict_tb, user_data);
+        /* Increment the refcount first so that destroy acts as a reset */
+        q_tree_ref(rt->tree);
+        q_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        /* Undo what tcg_region_alloc() added when the region filled up */
+        tcg_region_bounds(oldest, &start, &end);
+        region.agg_size_full -= end - start - TCG_HIGHWATER;
+
+        set_bit(oldest, busy);
+        set_bit(oldest, region.evicted);
+        evicted++;
+    }
+
+    qemu_mutex_unlock(&region.lock);
+    return evicted;
+}
+
+static size_t tcg_n_regions(size_t tb_size, unsigned max_threads, bool evict)
 {
 #ifdef CONFIG_USER_ONLY
     return 1;
 #else
     size_t n_regions;
 
+    /*
+     * Eviction recycles whole regions, so even a single vCPU thread needs
+     * several of them.
+     */
+    if (evict && max_threads == 1) {
+        return MAX(MIN(tb_size / (2 * MiB), TCG_REGION_EVICT_DIV), 1);
+    }
+
     /*
      * It is likely that some vCPUs will translate more code than others,
      * so we first try to set more regions than threads, with those regions
@@ -734,7 +834,8 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in system-mode
  */
-void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
+void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads,
+                     bool evict)
 {
     const size_t page_size = qemu_real_host_page_size();
     size_t region_size;
@@ -772,7 +873,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
      * As a result of this we might end up with a few extra pages at the end of
      * the buffer; we will assign those to the last region.
      */
-    region.n = tcg_n_regions(tb_size, max_threads);
+    region.n = tcg_n_regions(tb_size, max_threads, evict);
     region_size = tb_size / region.n;
     region_size = QEMU_ALIGN_DOWN(region_size, page_size);
 
@@ -793,6 +894,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.region_seq = g_new0(uint64_t, region.n);
+    region.evicted = bitmap_new(region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -1814,10 +1814,11 @@ static void tcg_context_init(unsigned max_threads)
     tcg_env = temp_tcgv_ptr(ts);
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_threads)
+void tcg_init(size_t tb_size, int splitwx, unsigned max_threads,
+              bool evict)
 {
     tcg_context_init(max_threads);
-    tcg_region_init(tb_size, splitwx, max_threads);
+    tcg_region_init(tb_size, splitwx, max_threads, evict);
 }
 
 /*
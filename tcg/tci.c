@@ -23,6 +23,11 @@
 #include "tcg/tcg-ldst.h"
 #include "disas/dis-asm.h"
 #include "tcg-has.h"
+#include "tcg-internal.h"
+#include "exec/target_page.h"
+#include "exec/tlb-common.h"
+#include "exec/cpu-common.h"
+#include "exec/mmu-access-type.h"
 #include <ffi.h>
 
 
@@ -122,6 +127,17 @@ static void tci_args_rrbb(uint32_t insn, TCGReg *r0, TCGReg *r1,
     *i3 = extract32(insn, 22, 6);
 }
 
+static void tci_args_rrcl(uint32_t insn, const uint32_t **tb_ptr,
+                          TCGReg *r0, TCGReg *r1, TCGCond *c2, void **l3)
+{
+    uint32_t label = *(*tb_ptr)++;
+
+    *r0 = extract32(insn, 8, 4);
+    *r1 = extract32(insn, 12, 4);
+    *c2 = extract32(insn, 16, 4);
+    *l3 = sextract32(label, 12, 20) + (void *)*tb_ptr;
+}
+
 static void tci_args_rrrc(uint32_t insn,
                           TCGReg *r0, TCGReg *r1, TCGReg *r2, TCGCond *c3)
 {
@@ -257,11 +273,75 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
     return result;
 }
 
+/*
+ * The TLB lookup that the native backends emit inline before a guest
+ * memory access.  Return the host address if the access hits in the
+ * fast TLB, or NULL to go through the out of line helpers.  Only
+ * naturally aligned accesses are handled here: they cannot cross a
+ * page, and a single host access of that size is atomic.
+ */
+static void *tci_tlb_lookup(CPUArchState *env, uint64_t taddr, MemOpIdx oi,
+                            MMUAccessType access_type)
+{
+    MemOp mop = get_memop(oi);
+    CPUTLBDescFast *fast;
+    CPUTLBEntry *entry;
+    uint64_t mask;
+
+    if (!tcg_use_softmmu) {
+        return NULL;
+    }
+
+    fast = cpu_tlb_fast(env_cpu(env), get_mmuidx(oi));
+    entry = (void *)fast->table +
+            ((taddr >> (TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS)) & fast->mask);
+
+    /* Misaligned addresses miss too, as does any alignment fault. */
+    mask = (int64_t)TARGET_PAGE_MASK;
+    mask |= (1 << (mop & MO_SIZE)) - 1;
+    mask |= (1 << memop_alignment_bits(mop)) - 1;
+
+    /* Any flag in the comparator, such as TLB_MMIO, forces a miss. */
+    if (qatomic_read(&entry->addr_idx[access_type]) != (taddr & mask)) {
+        return NULL;
+    }
+    return (void *)(uintptr_t)(taddr + entry->addend);
+}
+
 static uint64_t tci_qemu_ld(CPUArchState *env, uint64_t taddr,
                             MemOpIdx oi, const void *tb_ptr)
 {
     MemOp mop = get_memop(oi);
     uintptr_t ra = (uintptr_t)tb_ptr;
+    void *haddr = tci_tlb_lookup(env, taddr, oi, MMU_DATA_LOAD);
+
+    if (haddr) {
+        uint64_t val;
+
+        switch (mop & MO_SIZE) {
+        case MO_8:
+            val = ldub_p(haddr);
+            break;
+        case MO_16:
+            val = lduw_he_p(haddr);
+            val = mop & MO_BSWAP ? bswap16(val) : val;
+            break;
+        case MO_32:
+            val = ldl_he_p(haddr);
+            val = mop & MO_BSWAP ? bswap32(val) : val;
+            break;
+        case MO_64:
+            val = ldq_he_p(haddr);
+            val = mop & MO_BSWAP ? bswap64(val) : val;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        if (mop & MO_SIGN) {
+            val = sextract64(val, 0, 8 << (mop & MO_SIZE));
+        }
+        return val;
+    }
 
     switch (mop & MO_SSIZE) {
     case MO_UB:
@@ -288,6 +368,27 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
 {
     MemOp mop = get_memop(oi);
     uintptr_t ra = (uintptr_t)tb_ptr;
+    void *haddr = tci_tlb_lookup(env, taddr, oi, MMU_DATA_STORE);
+
+    if (haddr) {
+        switch (mop & MO_SIZE) {
+        case MO_8:
+            stb_p(haddr, val);
+            break;
+        case MO_16:
+            stw_he_p(haddr, mop & MO_BSWAP ? bswap16(val) : val);
+            break;
+        case MO_32:
+            stl_he_p(haddr, mop & MO_BSWAP ? bswap32(val) : val);
+            break;
+        case MO_64:
+            stq_he_p(haddr, mop & MO_BSWAP ? bswap64(val) : val);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        return;
+    }
 
     switch (mop & MO_SIZE) {
     case MO_UB:
@@ -307,6 +408,19 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
     }
 }
 
+/*
+ * With CONFIG_TCI_THREADED, each opcode is dispatched with a computed
+ * goto through a table of handler labels instead of the switch.  The
+ * compiler copies the short fetch and indirect jump into the tail of
+ * every handler, so the host branch predictor sees one indirect branch
+ * per opcode rather than a single one shared by all of them.
+ */
+#ifdef CONFIG_TCI_THREADED
+#define TCI_CASE(op)    case INDEX_op_##op: tci_do_##op:
+#else
+#define TCI_CASE(op)    case INDEX_op_##op:
+#endif
+
 /* Interpret pseudo code in tb. */
 /*
  * Disable CFI checks.
@@ -321,6 +435,95 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
     uint64_t stack[(TCG_STATIC_CALL_ARGS_SIZE + TCG_STATIC_FRAME_SIZE)
                    / sizeof(uint64_t)];
     bool carry = false;
+#ifdef CONFIG_TCI_THREADED
+    static const void * const dispatch[256] = {
+        [0 ... 255] = &&tci_do_default,
+        [INDEX_op_call] = &&tci_do_call,
+        [INDEX_op_br] = &&tci_do_br,
+        [INDEX_op_setcond] = &&tci_do_setcond,
+        [INDEX_op_movcond] = &&tci_do_movcond,
+        [INDEX_op_mov] = &&tci_do_mov,
+        [INDEX_op_tci_movi] = &&tci_do_tci_movi,
+        [INDEX_op_tci_movl] = &&tci_do_tci_movl,
+        [INDEX_op_tci_setcarry] = &&tci_do_tci_setcarry,
+        [INDEX_op_ld8u] = &&tci_do_ld8u,
+        [INDEX_op_ld8s] = &&tci_do_ld8s,
+        [INDEX_op_ld16u] = &&tci_do_ld16u,
+        [INDEX_op_ld16s] = &&tci_do_ld16s,
+        [INDEX_op_ld] = &&tci_do_ld,
+        [INDEX_op_st8] = &&tci_do_st8,
+        [INDEX_op_st16] = &&tci_do_st16,
+        [INDEX_op_st] = &&tci_do_st,
+        [INDEX_op_tci_ld_add_st] = &&tci_do_tci_ld_add_st,
+        [INDEX_op_tci_ld_addi_st] = &&tci_do_tci_ld_addi_st,
+        [INDEX_op_add] = &&tci_do_add,
+        [INDEX_op_sub] = &&tci_do_sub,
+        [INDEX_op_mul] = &&tci_do_mul,
+        [INDEX_op_and] = &&tci_do_and,
+        [INDEX_op_or] = &&tci_do_or,
+        [INDEX_op_xor] = &&tci_do_xor,
+        [INDEX_op_andc] = &&tci_do_andc,
+        [INDEX_op_orc] = &&tci_do_orc,
+        [INDEX_op_eqv] = &&tci_do_eqv,
+        [INDEX_op_nand] = &&tci_do_nand,
+        [INDEX_op_nor] = &&tci_do_nor,
+        [INDEX_op_neg] = &&tci_do_neg,
+        [INDEX_op_not] = &&tci_do_not,
+        [INDEX_op_ctpop] = &&tci_do_ctpop,
+        [INDEX_op_addco] = &&tci_do_addco,
+        [INDEX_op_addci] = &&tci_do_addci,
+        [INDEX_op_addcio] = &&tci_do_addcio,
+        [INDEX_op_subbo] = &&tci_do_subbo,
+        [INDEX_op_subbi] = &&tci_do_subbi,
+        [INDEX_op_subbio] = &&tci_do_subbio,
+        [INDEX_op_muls2] = &&tci_do_muls2,
+        [INDEX_op_mulu2] = &&tci_do_mulu2,
+        [INDEX_op_tci_divs32] = &&tci_do_tci_divs32,
+        [INDEX_op_tci_divu32] = &&tci_do_tci_divu32,
+        [INDEX_op_tci_rems32] = &&tci_do_tci_rems32,
+        [INDEX_op_tci_remu32] = &&tci_do_tci_remu32,
+        [INDEX_op_tci_clz32] = &&tci_do_tci_clz32,
+        [INDEX_op_tci_ctz32] = &&tci_do_tci_ctz32,
+        [INDEX_op_tci_setcond32] = &&tci_do_tci_setcond32,
+        [INDEX_op_tci_movcond32] = &&tci_do_tci_movcond32,
+        [INDEX_op_tci_brcond32] = &&tci_do_tci_brcond32,
+        [INDEX_op_shl] = &&tci_do_shl,
+        [INDEX_op_shr] = &&tci_do_shr,
+        [INDEX_op_sar] = &&tci_do_sar,
+        [INDEX_op_tci_rotl32] = &&tci_do_tci_rotl32,
+        [INDEX_op_tci_rotr32] = &&tci_do_tci_rotr32,
+        [INDEX_op_deposit] = &&tci_do_deposit,
+        [INDEX_op_extract] = &&tci_do_extract,
+        [INDEX_op_sextract] = &&tci_do_sextract,
+        [INDEX_op_tci_brcond] = &&tci_do_tci_brcond,
+        [INDEX_op_bswap16] = &&tci_do_bswap16,
+        [INDEX_op_bswap32] = &&tci_do_bswap32,
+        [INDEX_op_ld32u] = &&tci_do_ld32u,
+        [INDEX_op_ld32s] = &&tci_do_ld32s,
+        [INDEX_op_st32] = &&tci_do_st32,
+        [INDEX_op_tci_ld32_add_st32] = &&tci_do_tci_ld32_add_st32,
+        [INDEX_op_tci_ld32_addi_st32] = &&tci_do_tci_ld32_addi_st32,
+        [INDEX_op_divs] = &&tci_do_divs,
+        [INDEX_op_divu] = &&tci_do_divu,
+        [INDEX_op_rems] = &&tci_do_rems,
+        [INDEX_op_remu] = &&tci_do_remu,
+        [INDEX_op_clz] = &&tci_do_clz,
+        [INDEX_op_ctz] = &&tci_do_ctz,
+        [INDEX_op_rotl] = &&tci_do_rotl,
+        [INDEX_op_rotr] = &&tci_do_rotr,
+        [INDEX_op_ext_i32_i64] = &&tci_do_ext_i32_i64,
+        [INDEX_op_extu_i32_i64] = &&tci_do_extu_i32_i64,
+        [INDEX_op_bswap64] = &&tci_do_bswap64,
+        [INDEX_op_exit_tb] = &&tci_do_exit_tb,
+        [INDEX_op_goto_tb] = &&tci_do_goto_tb,
+        [INDEX_op_goto_ptr] = &&tci_do_goto_ptr,
+        [INDEX_op_qemu_ld] = &&tci_do_qemu_ld,
+        [INDEX_op_tci_qemu_ld_rrr] = &&tci_do_tci_qemu_ld_rrr,
+        [INDEX_op_qemu_st] = &&tci_do_qemu_st,
+        [INDEX_op_tci_qemu_st_rrr] = &&tci_do_tci_qemu_st_rrr,
+        [INDEX_op_mb] = &&tci_do_mb,
+    };
+#endif
 
     regs[TCG_AREG0] = (tcg_target_ulong)env;
     regs[TCG_REG_CALL_STACK] = (uintptr_t)stack;
@@ -342,8 +545,11 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
         insn = *tb_ptr++;
         opc = extract32(insn, 0, 8);
 
+#ifdef CONFIG_TCI_THREADED
+        goto *dispatch[opc];
+#endif
         switch (opc) {
-        case INDEX_op_call:
+        TCI_CASE(call)
             {
                 void *call_slots[MAX_CALL_IARGS];
                 ffi_cif *cif;
@@ -392,73 +598,106 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
             break;
 
-        case INDEX_op_br:
+        TCI_CASE(br)
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = ptr;
             continue;
-        case INDEX_op_setcond:
+        TCI_CASE(setcond)
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare64(regs[r1], regs[r2], condition);
             break;
-        case INDEX_op_movcond:
+        TCI_CASE(movcond)
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare64(regs[r1], regs[r2], condition);
             regs[r0] = regs[tmp32 ? r3 : r4];
             break;
-        case INDEX_op_mov:
+        TCI_CASE(mov)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = regs[r1];
             break;
-        case INDEX_op_tci_movi:
+        TCI_CASE(tci_movi)
             tci_args_ri(insn, &r0, &t1);
             regs[r0] = t1;
             break;
-        case INDEX_op_tci_movl:
+        TCI_CASE(tci_movl)
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             regs[r0] = *(tcg_target_ulong *)ptr;
             break;
-        case INDEX_op_tci_setcarry:
+        TCI_CASE(tci_setcarry)
             carry = true;
             break;
 
             /* Load/store operations (32 bit). */
 
-        case INDEX_op_ld8u:
+        TCI_CASE(ld8u)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint8_t *)ptr;
             break;
-        case INDEX_op_ld8s:
+        TCI_CASE(ld8s)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int8_t *)ptr;
             break;
-        case INDEX_op_ld16u:
+        TCI_CASE(ld16u)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint16_t *)ptr;
             break;
-        case INDEX_op_ld16s:
+        TCI_CASE(ld16s)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int16_t *)ptr;
             break;
-        case INDEX_op_ld:
+        TCI_CASE(ld)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(tcg_target_ulong *)ptr;
             break;
-        case INDEX_op_st8:
+        TCI_CASE(st8)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint8_t *)ptr = regs[r0];
             break;
-        case INDEX_op_st16:
+        TCI_CASE(st16)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint16_t *)ptr = regs[r0];
             break;
-        case INDEX_op_st:
+        TCI_CASE(st)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            *(tcg_target_ulong *)ptr = regs[r0];
+            break;
+
+            /*
+             * Fused update of an env field, from tcg_out_fuse_ld_add_st.
+             * The insns that make up the sequence follow the opcode.
+             */
+
+        TCI_CASE(tci_ld_add_st)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(tcg_target_ulong *)ptr;
+            insn = *tb_ptr++;
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            regs[r0] = regs[r1] + regs[r2];
+            insn = *tb_ptr++;
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            *(tcg_target_ulong *)ptr = regs[r0];
+            break;
+        TCI_CASE(tci_ld_addi_st)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(tcg_target_ulong *)ptr;
+            insn = *tb_ptr++;
+            tci_args_ri(insn, &r0, &t1);
+            regs[r0] = t1;
+            insn = *tb_ptr++;
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            regs[r0] = regs[r1] + regs[r2];
+            insn = *tb_ptr++;
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(tcg_target_ulong *)ptr = regs[r0];
@@ -466,73 +705,73 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
 
             /* Arithmetic operations (mixed 32/64 bit). */
 
-        case INDEX_op_add:
+        TCI_CASE(add)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] + regs[r2];
             break;
-        case INDEX_op_sub:
+        TCI_CASE(sub)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] - regs[r2];
             break;
-        case INDEX_op_mul:
+        TCI_CASE(mul)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] * regs[r2];
             break;
-        case INDEX_op_and:
+        TCI_CASE(and)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] & regs[r2];
             break;
-        case INDEX_op_or:
+        TCI_CASE(or)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] | regs[r2];
             break;
-        case INDEX_op_xor:
+        TCI_CASE(xor)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ^ regs[r2];
             break;
-        case INDEX_op_andc:
+        TCI_CASE(andc)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] & ~regs[r2];
             break;
-        case INDEX_op_orc:
+        TCI_CASE(orc)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] | ~regs[r2];
             break;
-        case INDEX_op_eqv:
+        TCI_CASE(eqv)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ~(regs[r1] ^ regs[r2]);
             break;
-        case INDEX_op_nand:
+        TCI_CASE(nand)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ~(regs[r1] & regs[r2]);
             break;
-        case INDEX_op_nor:
+        TCI_CASE(nor)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ~(regs[r1] | regs[r2]);
             break;
-        case INDEX_op_neg:
+        TCI_CASE(neg)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = -regs[r1];
             break;
-        case INDEX_op_not:
+        TCI_CASE(not)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = ~regs[r1];
             break;
-        case INDEX_op_ctpop:
+        TCI_CASE(ctpop)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = ctpop64(regs[r1]);
             break;
-        case INDEX_op_addco:
+        TCI_CASE(addco)
             tci_args_rrr(insn, &r0, &r1, &r2);
             t1 = regs[r1] + regs[r2];
             carry = t1 < regs[r1];
             regs[r0] = t1;
             break;
-        case INDEX_op_addci:
+        TCI_CASE(addci)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] + regs[r2] + carry;
             break;
-        case INDEX_op_addcio:
+        TCI_CASE(addcio)
             tci_args_rrr(insn, &r0, &r1, &r2);
             if (carry) {
                 t1 = regs[r1] + regs[r2] + 1;
@@ -543,16 +782,16 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
             regs[r0] = t1;
             break;
-        case INDEX_op_subbo:
+        TCI_CASE(subbo)
             tci_args_rrr(insn, &r0, &r1, &r2);
             carry = regs[r1] < regs[r2];
             regs[r0] = regs[r1] - regs[r2];
             break;
-        case INDEX_op_subbi:
+        TCI_CASE(subbi)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] - regs[r2] - carry;
             break;
-        case INDEX_op_subbio:
+        TCI_CASE(subbio)
             tci_args_rrr(insn, &r0, &r1, &r2);
             if (carry) {
                 carry = regs[r1] <= regs[r2];
@@ -562,116 +801,149 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
                 regs[r0] = regs[r1] - regs[r2];
             }
             break;
-        case INDEX_op_muls2:
+        TCI_CASE(muls2)
             tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
             muls64(&regs[r0], &regs[r1], regs[r2], regs[r3]);
             break;
-        case INDEX_op_mulu2:
+        TCI_CASE(mulu2)
             tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
             mulu64(&regs[r0], &regs[r1], regs[r2], regs[r3]);
             break;
 
             /* Arithmetic operations (32 bit). */
 
-        case INDEX_op_tci_divs32:
+        TCI_CASE(tci_divs32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int32_t)regs[r1] / (int32_t)regs[r2];
             break;
-        case INDEX_op_tci_divu32:
+        TCI_CASE(tci_divu32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint32_t)regs[r1] / (uint32_t)regs[r2];
             break;
-        case INDEX_op_tci_rems32:
+        TCI_CASE(tci_rems32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int32_t)regs[r1] % (int32_t)regs[r2];
             break;
-        case INDEX_op_tci_remu32:
+        TCI_CASE(tci_remu32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint32_t)regs[r1] % (uint32_t)regs[r2];
             break;
-        case INDEX_op_tci_clz32:
+        TCI_CASE(tci_clz32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             tmp32 = regs[r1];
             regs[r0] = tmp32 ? clz32(tmp32) : regs[r2];
             break;
-        case INDEX_op_tci_ctz32:
+        TCI_CASE(tci_ctz32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             tmp32 = regs[r1];
             regs[r0] = tmp32 ? ctz32(tmp32) : regs[r2];
             break;
-        case INDEX_op_tci_setcond32:
+        TCI_CASE(tci_setcond32)
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
             break;
-        case INDEX_op_tci_movcond32:
+        TCI_CASE(tci_movcond32)
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare32(regs[r1], regs[r2], condition);
             regs[r0] = regs[tmp32 ? r3 : r4];
             break;
+        TCI_CASE(tci_brcond32)
+            tci_args_rrcl(insn, &tb_ptr, &r0, &r1, &condition, &ptr);
+            if (tci_compare32(regs[r0], regs[r1], condition)) {
+                tb_ptr = ptr;
+            }
+            break;
 
             /* Shift/rotate operations. */
 
-        case INDEX_op_shl:
+        TCI_CASE(shl)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] << (regs[r2] % TCG_TARGET_REG_BITS);
             break;
-        case INDEX_op_shr:
+        TCI_CASE(shr)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] >> (regs[r2] % TCG_TARGET_REG_BITS);
             break;
-        case INDEX_op_sar:
+        TCI_CASE(sar)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ((tcg_target_long)regs[r1]
                         >> (regs[r2] % TCG_TARGET_REG_BITS));
             break;
-        case INDEX_op_tci_rotl32:
+        TCI_CASE(tci_rotl32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = rol32(regs[r1], regs[r2] & 31);
             break;
-        case INDEX_op_tci_rotr32:
+        TCI_CASE(tci_rotr32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ror32(regs[r1], regs[r2] & 31);
             break;
-        case INDEX_op_deposit:
+        TCI_CASE(deposit)
             tci_args_rrrbb(insn, &r0, &r1, &r2, &pos, &len);
             regs[r0] = deposit64(regs[r1], pos, len, regs[r2]);
             break;
-        case INDEX_op_extract:
+        TCI_CASE(extract)
             tci_args_rrbb(insn, &r0, &r1, &pos, &len);
             regs[r0] = extract64(regs[r1], pos, len);
             break;
-        case INDEX_op_sextract:
+        TCI_CASE(sextract)
             tci_args_rrbb(insn, &r0, &r1, &pos, &len);
             regs[r0] = sextract64(regs[r1], pos, len);
             break;
-        case INDEX_op_brcond:
-            tci_args_rl(insn, tb_ptr, &r0, &ptr);
-            if (regs[r0]) {
+        TCI_CASE(tci_brcond)
+            tci_args_rrcl(insn, &tb_ptr, &r0, &r1, &condition, &ptr);
+            if (tci_compare64(regs[r0], regs[r1], condition)) {
                 tb_ptr = ptr;
             }
             break;
-        case INDEX_op_bswap16:
+        TCI_CASE(bswap16)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = bswap16(regs[r1]);
             break;
-        case INDEX_op_bswap32:
+        TCI_CASE(bswap32)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = bswap32(regs[r1]);
             break;
 
             /* Load/store operations (64 bit). */
 
-        case INDEX_op_ld32u:
+        TCI_CASE(ld32u)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint32_t *)ptr;
             break;
-        case INDEX_op_ld32s:
+        TCI_CASE(ld32s)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int32_t *)ptr;
             break;
-        case INDEX_op_st32:
+        TCI_CASE(st32)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            *(uint32_t *)ptr = regs[r0];
+            break;
+        TCI_CASE(tci_ld32_add_st32)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(uint32_t *)ptr;
+            insn = *tb_ptr++;
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            regs[r0] = regs[r1] + regs[r2];
+            insn = *tb_ptr++;
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            *(uint32_t *)ptr = regs[r0];
+            break;
+        TCI_CASE(tci_ld32_addi_st32)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(uint32_t *)ptr;
+            insn = *tb_ptr++;
+            tci_args_ri(insn, &r0, &t1);
+            regs[r0] = t1;
+            insn = *tb_ptr++;
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            regs[r0] = regs[r1] + regs[r2];
+            insn = *tb_ptr++;
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint32_t *)ptr = regs[r0];
@@ -679,66 +951,66 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
 
             /* Arithmetic operations (64 bit). */
 
-        case INDEX_op_divs:
+        TCI_CASE(divs)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int64_t)regs[r1] / (int64_t)regs[r2];
             break;
-        case INDEX_op_divu:
+        TCI_CASE(divu)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint64_t)regs[r1] / (uint64_t)regs[r2];
             break;
-        case INDEX_op_rems:
+        TCI_CASE(rems)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int64_t)regs[r1] % (int64_t)regs[r2];
             break;
-        case INDEX_op_remu:
+        TCI_CASE(remu)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint64_t)regs[r1] % (uint64_t)regs[r2];
             break;
-        case INDEX_op_clz:
+        TCI_CASE(clz)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ? clz64(regs[r1]) : regs[r2];
             break;
-        case INDEX_op_ctz:
+        TCI_CASE(ctz)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ? ctz64(regs[r1]) : regs[r2];
             break;
 
             /* Shift/rotate operations (64 bit). */
 
-        case INDEX_op_rotl:
+        TCI_CASE(rotl)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = rol64(regs[r1], regs[r2] & 63);
             break;
-        case INDEX_op_rotr:
+        TCI_CASE(rotr)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ror64(regs[r1], regs[r2] & 63);
             break;
-        case INDEX_op_ext_i32_i64:
+        TCI_CASE(ext_i32_i64)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (int32_t)regs[r1];
             break;
-        case INDEX_op_extu_i32_i64:
+        TCI_CASE(extu_i32_i64)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (uint32_t)regs[r1];
             break;
-        case INDEX_op_bswap64:
+        TCI_CASE(bswap64)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = bswap64(regs[r1]);
             break;
 
             /* QEMU specific operations. */
 
-        case INDEX_op_exit_tb:
+        TCI_CASE(exit_tb)
             tci_args_l(insn, tb_ptr, &ptr);
             return (uintptr_t)ptr;
 
-        case INDEX_op_goto_tb:
+        TCI_CASE(goto_tb)
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = *(void **)ptr;
             break;
 
-        case INDEX_op_goto_ptr:
+        TCI_CASE(goto_ptr)
             tci_args_r(insn, &r0);
             ptr = (void *)regs[r0];
             if (!ptr) {
@@ -747,35 +1019,38 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             tb_ptr = ptr;
             break;
 
-        case INDEX_op_qemu_ld:
+        TCI_CASE(qemu_ld)
             tci_args_rrm(insn, &r0, &r1, &oi);
             taddr = regs[r1];
             regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
             break;
-        case INDEX_op_tci_qemu_ld_rrr:
+        TCI_CASE(tci_qemu_ld_rrr)
             tci_args_rrr(insn, &r0, &r1, &r2);
             taddr = regs[r1];
             oi = regs[r2];
             regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
             break;
 
-        case INDEX_op_qemu_st:
+        TCI_CASE(qemu_st)
             tci_args_rrm(insn, &r0, &r1, &oi);
             taddr = regs[r1];
             tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
             break;
-        case INDEX_op_tci_qemu_st_rrr:
+        TCI_CASE(tci_qemu_st_rrr)
             tci_args_rrr(insn, &r0, &r1, &r2);
             taddr = regs[r1];
             oi = regs[r2];
             tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
             break;
 
-        case INDEX_op_mb:
+        TCI_CASE(mb)
             /* Ensure ordering for all kinds */
             smp_mb();
             break;
         default:
+#ifdef CONFIG_TCI_THREADED
+        tci_do_default:
+#endif
             g_assert_not_reached();
         }
     }
@@ -866,10 +1141,11 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
         info->fprintf_func(info->stream, "%-12s  %d, %p", op_name, len, ptr);
         break;
 
-    case INDEX_op_brcond:
-        tci_args_rl(insn, tb_ptr, &r0, &ptr);
-        info->fprintf_func(info->stream, "%-12s  %s, 0, ne, %p",
-                           op_name, str_r(r0), ptr);
+    case INDEX_op_tci_brcond:
+    case INDEX_op_tci_brcond32:
+        tci_args_rrcl(insn, &tb_ptr, &r0, &r1, &c, &ptr);
+        info->fprintf_func(info->stream, "%-12s  %s, %s, %s, %p",
+                           op_name, str_r(r0), str_r(r1), str_c(c), ptr);
         break;
 
     case INDEX_op_setcond:
@@ -905,6 +1181,10 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
     case INDEX_op_st16:
     case INDEX_op_st32:
     case INDEX_op_st:
+    case INDEX_op_tci_ld_add_st:
+    case INDEX_op_tci_ld32_add_st32:
+    case INDEX_op_tci_ld_addi_st:
+    case INDEX_op_tci_ld32_addi_st32:
         tci_args_rrs(insn, &r0, &r1, &s2);
         info->fprintf_func(info->stream, "%-12s  %s, %s, %d",
                            op_name, str_r(r0), str_r(r1), s2);
@@ -1029,5 +1309,5 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
         break;
     }
 
-    return sizeof(insn);
+    return (void *)tb_ptr - (void *)(uintptr_t)addr;
 }
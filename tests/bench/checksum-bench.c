@@ -0,0 +1,50 @@
+/*
+ * Internet checksum speed benchmark
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "net/checksum.h"
+
+static void test(const void *opaque)
+{
+    size_t max = 64 * KiB;
+    uint8_t *buf = g_malloc(max);
+    int accel_index = 0;
+
+    for (size_t i = 0; i < max; i++) {
+        buf[i] = i * 31;
+    }
+
+    do {
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+        for (size_t len = 64; len <= max; len *= 4) {
+            double total = 0.0;
+            uint32_t sum = 0;
+
+            g_test_timer_start();
+            do {
+                sum += net_checksum_add(len, buf);
+                total += len;
+            } while (g_test_timer_elapsed() < 0.5);
+
+            total /= MiB;
+            g_test_message("net_checksum_add #%d: %6zuB %8.0f MB/sec (%04x)",
+                           accel_index, len, total / g_test_timer_last(),
+                           net_checksum_finish(sum));
+        }
+        accel_index++;
+    } while (test_net_checksum_next_accel());
+
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/net/checksum/speed", NULL, test);
+    return g_test_run();
+}
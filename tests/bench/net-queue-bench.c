@@ -0,0 +1,73 @@
+/*
+ * NetQueue enqueue/flush benchmark
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "qemu/units.h"
+#include "net/net.h"
+#include "net/queue.h"
+
+#define BATCH 256
+
+static bool blocked;
+static uint64_t delivered;
+
+/* net/queue.c is linked without net/net.c */
+int qemu_can_send_packet(NetClientState *sender)
+{
+    return 1;
+}
+
+static ssize_t deliver(NetClientState *sender, unsigned flags,
+                       const struct iovec *iov, int iovcnt, void *opaque)
+{
+    if (blocked) {
+        return 0;
+    }
+    delivered++;
+    return iov_size(iov, iovcnt);
+}
+
+static void test(const void *opaque)
+{
+    size_t size = (uintptr_t)opaque;
+    NetQueue *queue = qemu_new_net_queue(deliver, NULL);
+    uint8_t *buf = g_malloc0(size);
+    double mpps, mbps;
+
+    delivered = 0;
+    g_test_timer_start();
+    do {
+        blocked = true;
+        for (int i = 0; i < BATCH; i++) {
+            qemu_net_queue_send(queue, NULL, 0, buf, size, NULL);
+        }
+        blocked = false;
+        g_assert(qemu_net_queue_flush(queue));
+    } while (g_test_timer_elapsed() < 0.5);
+
+    g_assert_cmpuint(qemu_net_queue_get_dropped(queue), ==, 0);
+    mpps = delivered / g_test_timer_last() / 1e6;
+    mbps = delivered * size / g_test_timer_last() / MiB;
+    g_test_message("enqueue+flush %6zu bytes: %6.2f Mpps %8.0f MB/sec",
+                   size, mpps, mbps);
+
+    qemu_del_net_queue(queue);
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = { 64, 1514, 9014, 65550 };
+
+    g_test_init(&argc, &argv, NULL);
+    for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+        g_autofree char *path =
+            g_strdup_printf("/net/queue/enqueue-flush/%zu", sizes[i]);
+
+        g_test_add_data_func(path, (void *)(uintptr_t)sizes[i], test);
+    }
+    return g_test_run();
+}
@@ -127,6 +127,7 @@ static enum op operation;
 static enum tester tester;
 static uint64_t n_completed_ops;
 static unsigned int duration = DEFAULT_DURATION_SECS;
+static bool clear_flags;
 static int64_t ns_elapsed;
 /* disable optimizations with volatile */
 static volatile union fp res;
@@ -318,6 +319,10 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float32 b = ops[1].f32;
                 float32 c = ops[2].f32;
 
+                if (clear_flags) {
+                    set_float_exception_flags(0, &soft_status);
+                }
+
                 switch (op) {
                 case OP_ADD:
                     res.f32 = float32_add(a, b, &soft_status);
@@ -353,6 +358,10 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float64 b = ops[1].f64;
                 float64 c = ops[2].f64;
 
+                if (clear_flags) {
+                    set_float_exception_flags(0, &soft_status);
+                }
+
                 switch (op) {
                 case OP_ADD:
                     res.f64 = float64_add(a, b, &soft_status);
@@ -388,6 +397,10 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float128 b = ops[1].f128;
                 float128 c = ops[2].f128;
 
+                if (clear_flags) {
+                    set_float_exception_flags(0, &soft_status);
+                }
+
                 switch (op) {
                 case OP_ADD:
                     res.f128 = float128_add(a, b, &soft_status);
@@ -523,6 +536,8 @@ static void usage_complete(int argc, char *argv[])
 
     fprintf(stderr, "Usage: %s [options]\n", argv[0]);
     fprintf(stderr, "options:\n");
+    fprintf(stderr, " -c = clear the exception flags before each operation "
+            "(soft tester only). Default: disabled\n");
     fprintf(stderr, " -d = duration, in seconds. Default: %d\n",
             DEFAULT_DURATION_SECS);
     fprintf(stderr, " -h = show this help message.\n");
@@ -625,11 +640,14 @@ static void parse_args(int argc, char *argv[])
     int rounding = ROUND_EVEN;
 
     for (;;) {
-        c = getopt(argc, argv, "d:ho:p:r:t:zZ");
+        c = getopt(argc, argv, "cd:ho:p:r:t:zZ");
         if (c < 0) {
             break;
         }
         switch (c) {
+        case 'c':
+            clear_flags = true;
+            break;
         case 'd':
             duration = atoi(optarg);
             break;
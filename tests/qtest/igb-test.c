@@ -51,6 +51,7 @@ static void igb_send_verify(QE1000E *d, int *test_sockets, QGuestAllocator *allo
     char buffer[64];
     int ret;
     uint32_t recv_len;
+    uint32_t slot;
 
     /* Prepare test data buffer */
     uint64_t data = guest_alloc(alloc, sizeof(buffer));
@@ -65,10 +66,11 @@ static void igb_send_verify(QE1000E *d, int *test_sockets, QGuestAllocator *allo
                                           sizeof(buffer));
 
     /* Put descriptor to the ring */
-    e1000e_tx_ring_push(d, &descr);
+    slot = e1000e_tx_ring_push(d, &descr);
 
     /* Wait for TX WB interrupt */
     e1000e_wait_isr(d, E1000E_TX0_MSG_ID);
+    memread(d->tx_ring + slot * E1000_RING_DESC_LEN, &descr, sizeof(descr));
 
     /* Check DD bit */
     g_assert_cmphex(le32_to_cpu(descr.wb.status) & E1000_TXD_STAT_DD, ==,
@@ -85,10 +87,9 @@ static void igb_send_verify(QE1000E *d, int *test_sockets, QGuestAllocator *allo
     guest_free(alloc, data);
 }
 
-static void igb_receive_verify(QE1000E *d, int *test_sockets, QGuestAllocator *alloc)
+/* Send a dummy packet to device's socket */
+static void igb_send_to_device(int *test_sockets)
 {
-    union e1000_adv_rx_desc descr;
-
     struct eth_header test_iov = packet;
     int len = htonl(sizeof(packet));
     struct iovec iov[] = {
@@ -100,26 +101,21 @@ static void igb_receive_verify(QE1000E *d, int *test_sockets, QGuestAllocator *a
             .iov_len = sizeof(packet),
         },
     };
-
-    char buffer[64];
     int ret;
 
-    /* Send a dummy packet to device's socket*/
     ret = iov_send(test_sockets[0], iov, 2, 0, sizeof(len) + sizeof(packet));
     g_assert_cmpint(ret, == , sizeof(packet) + sizeof(len));
+}
 
-    /* Prepare test data buffer */
-    uint64_t data = guest_alloc(alloc, sizeof(buffer));
-
-    /* Prepare RX descriptor */
-    memset(&descr, 0, sizeof(descr));
-    descr.read.pkt_addr = cpu_to_le64(data);
-
-    /* Put descriptor to the ring */
-    e1000e_rx_ring_push(d, &descr);
+/* Wait for the packet sent by igb_send_to_device() in @data */
+static void igb_receive_wait(QE1000E *d, uint32_t slot, uint64_t data)
+{
+    union e1000_adv_rx_desc descr;
+    char buffer[64];
 
-    /* Wait for TX WB interrupt */
+    /* Wait for RX WB interrupt */
     e1000e_wait_isr(d, E1000E_RX0_MSG_ID);
+    memread(d->rx_ring + slot * E1000_RING_DESC_LEN, &descr, sizeof(descr));
 
     /* Check DD bit */
     g_assert_cmphex(le32_to_cpu(descr.wb.upper.status_error) &
@@ -128,11 +124,64 @@ static void igb_receive_verify(QE1000E *d, int *test_sockets, QGuestAllocator *a
     /* Check data sent to the backend */
     memread(data, buffer, sizeof(buffer));
     g_assert_false(memcmp(buffer, &packet, sizeof(packet)));
+}
+
+static void igb_receive_verify(QE1000E *d, int *test_sockets,
+                               QGuestAllocator *alloc)
+{
+    union e1000_adv_rx_desc descr;
+    uint64_t data;
+    uint32_t slot;
+
+    igb_send_to_device(test_sockets);
+
+    /* Prepare test data buffer */
+    data = guest_alloc(alloc, 64);
+
+    /* Prepare RX descriptor */
+    memset(&descr, 0, sizeof(descr));
+    descr.read.pkt_addr = cpu_to_le64(data);
+
+    /* Put descriptor to the ring */
+    slot = e1000e_rx_ring_push(d, &descr);
+    igb_receive_wait(d, slot, data);
 
     /* Free test data buffer */
     guest_free(alloc, data);
 }
 
+/*
+ * A packet that arrives while the VM is stopped is not received until
+ * it is resumed, and the rings keep working after that.
+ */
+static void igb_stop_cont_verify(QE1000E *d, int *test_sockets,
+                                 QGuestAllocator *alloc)
+{
+    union e1000_adv_rx_desc descr;
+    uint64_t data = guest_alloc(alloc, 64);
+    uint32_t slot;
+
+    memset(&descr, 0, sizeof(descr));
+    descr.read.pkt_addr = cpu_to_le64(data);
+    slot = e1000e_rx_ring_push(d, &descr);
+
+    qobject_unref(qmp("{ 'execute' : 'stop'}"));
+    igb_send_to_device(test_sockets);
+
+    /* Let QEMU see the packet before 'cont' */
+    qobject_unref(qmp("{ 'execute' : 'query-status'}"));
+    memread(d->rx_ring + slot * E1000_RING_DESC_LEN, &descr, sizeof(descr));
+    g_assert_cmphex(le32_to_cpu(descr.wb.upper.status_error) &
+        E1000_RXD_STAT_DD, ==, 0);
+    qobject_unref(qmp("{ 'execute' : 'cont'}"));
+
+    igb_receive_wait(d, slot, data);
+    guest_free(alloc, data);
+
+    igb_send_verify(d, test_sockets, alloc);
+    igb_receive_verify(d, test_sockets, alloc);
+}
+
 static void test_e1000e_init(void *obj, void *data, QGuestAllocator * alloc)
 {
     /* init does nothing */
@@ -191,6 +240,21 @@ static void test_igb_multiple_transfers(void *obj, void *data,
 
 }
 
+static void test_igb_stop_cont(void *obj, void *data, QGuestAllocator *alloc)
+{
+    QE1000E_PCI *e1000e = obj;
+    QE1000E *d = &e1000e->e1000e;
+    QOSGraphObject *e_object = obj;
+    QPCIDevice *dev = e_object->get_driver(e_object, "pci-device");
+
+    /* FIXME: add spapr support */
+    if (qpci_check_buggy_msi(dev)) {
+        return;
+    }
+
+    igb_stop_cont_verify(d, data, alloc);
+}
+
 static void data_test_clear(void *sockets)
 {
     int *test_sockets = sockets;
@@ -214,6 +278,12 @@ static void *data_test_init(GString *cmd_line, void *arg)
     return test_sockets;
 }
 
+static void *data_test_init_iothread(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=thread0 ");
+    return data_test_init(cmd_line, arg);
+}
+
 #endif
 
 static void *data_test_init_no_socket(GString *cmd_line, void *arg)
@@ -247,6 +317,16 @@ static void register_igb_test(void)
     qos_add_test("rx", "igb", test_igb_rx, &opts);
     qos_add_test("multiple_transfers", "igb",
                  test_igb_multiple_transfers, &opts);
+    qos_add_test("stop_cont", "igb", test_igb_stop_cont, &opts);
+
+    opts.before = data_test_init_iothread;
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "iothread=thread0",
+    };
+    qos_add_test("iothread/tx", "igb", test_igb_tx, &opts);
+    qos_add_test("iothread/rx", "igb", test_igb_rx, &opts);
+    qos_add_test("iothread/stop_cont", "igb", test_igb_stop_cont, &opts);
+    opts.edge = (QOSGraphEdgeOptions) { };
 #endif
 
     opts.before = data_test_init_no_socket;
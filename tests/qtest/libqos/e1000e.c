@@ -36,7 +36,7 @@
 
 #define E1000E_RING_LEN (0x1000)
 
-void e1000e_tx_ring_push(QE1000E *d, void *descr)
+uint32_t e1000e_tx_ring_push(QE1000E *d, void *descr)
 {
     QE1000E_PCI *d_pci = container_of(d, QE1000E_PCI, e1000e);
     uint32_t tail = e1000e_macreg_read(d, E1000_TDT);
@@ -51,9 +51,10 @@ void e1000e_tx_ring_push(QE1000E *d, void *descr)
     qtest_memread(d_pci->pci_dev.bus->qts,
                   d->tx_ring + tail * E1000_RING_DESC_LEN,
                   descr, E1000_RING_DESC_LEN);
+    return tail;
 }
 
-void e1000e_rx_ring_push(QE1000E *d, void *descr)
+uint32_t e1000e_rx_ring_push(QE1000E *d, void *descr)
 {
     QE1000E_PCI *d_pci = container_of(d, QE1000E_PCI, e1000e);
     uint32_t tail = e1000e_macreg_read(d, E1000_RDT);
@@ -68,6 +69,7 @@ void e1000e_rx_ring_push(QE1000E *d, void *descr)
     qtest_memread(d_pci->pci_dev.bus->qts,
                   d->rx_ring + tail * E1000_RING_DESC_LEN,
                   descr, E1000_RING_DESC_LEN);
+    return tail;
 }
 
 static void e1000e_foreach_callback(QPCIDevice *dev, int devfn, void *data)
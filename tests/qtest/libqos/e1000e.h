@@ -55,7 +55,13 @@ static inline uint32_t e1000e_macreg_read(QE1000E *d, uint32_t reg)
 }
 
 void e1000e_wait_isr(QE1000E *d, uint16_t msg_id);
-void e1000e_tx_ring_push(QE1000E *d, void *descr);
-void e1000e_rx_ring_push(QE1000E *d, void *descr);
+
+/*
+ * Write @descr to the tail of the ring and advance the tail.  @descr is then
+ * updated from the ring, but with an IOThread the device may write back the
+ * descriptor later.  Returns the index of the descriptor in the ring.
+ */
+uint32_t e1000e_tx_ring_push(QE1000E *d, void *descr);
+uint32_t e1000e_rx_ring_push(QE1000E *d, void *descr);
 
 #endif
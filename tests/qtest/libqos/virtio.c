@@ -23,7 +23,7 @@
  * The following qvirtio_readX/writeX() functions handle Legacy and VIRTIO 1.0
  * accesses seamlessly.
  */
-static uint16_t qvirtio_readw(QVirtioDevice *d, QTestState *qts, uint64_t addr)
+uint16_t qvirtio_readw(QVirtioDevice *d, QTestState *qts, uint64_t addr)
 {
     uint16_t val;
 
@@ -37,7 +37,7 @@ static uint16_t qvirtio_readw(QVirtioDevice *d, QTestState *qts, uint64_t addr)
     return val;
 }
 
-static uint32_t qvirtio_readl(QVirtioDevice *d, QTestState *qts, uint64_t addr)
+uint32_t qvirtio_readl(QVirtioDevice *d, QTestState *qts, uint64_t addr)
 {
     uint32_t val;
 
@@ -51,8 +51,8 @@ static uint32_t qvirtio_readl(QVirtioDevice *d, QTestState *qts, uint64_t addr)
     return val;
 }
 
-static void qvirtio_writew(QVirtioDevice *d, QTestState *qts,
-                           uint64_t addr, uint16_t val)
+void qvirtio_writew(QVirtioDevice *d, QTestState *qts,
+                    uint64_t addr, uint16_t val)
 {
     if (d->features & (1ull << VIRTIO_F_VERSION_1)) {
         val = cpu_to_le16(val);
@@ -62,8 +62,8 @@ static void qvirtio_writew(QVirtioDevice *d, QTestState *qts,
     }
 }
 
-static void qvirtio_writel(QVirtioDevice *d, QTestState *qts,
-                           uint64_t addr, uint32_t val)
+void qvirtio_writel(QVirtioDevice *d, QTestState *qts,
+                    uint64_t addr, uint32_t val)
 {
     if (d->features & (1ull << VIRTIO_F_VERSION_1)) {
         val = cpu_to_le32(val);
@@ -73,8 +73,8 @@ static void qvirtio_writel(QVirtioDevice *d, QTestState *qts,
     }
 }
 
-static void qvirtio_writeq(QVirtioDevice *d, QTestState *qts,
-                           uint64_t addr, uint64_t val)
+void qvirtio_writeq(QVirtioDevice *d, QTestState *qts,
+                    uint64_t addr, uint64_t val)
 {
     if (d->features & (1ull << VIRTIO_F_VERSION_1)) {
         val = cpu_to_le64(val);
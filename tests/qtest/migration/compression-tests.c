@@ -57,8 +57,60 @@ static void test_multifd_postcopy_tcp_zstd(char *name, MigrateCommon *args)
 
     test_precopy_common(args);
 }
+
+static void *
+migrate_hook_start_precopy_tcp_multifd_zstd_mt(QTestState *from,
+                                               QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-compression-threads", 3);
+    migrate_set_parameter_int(to, "multifd-compression-threads", 3);
+    set_multifd_compression(from, to, "zstd-mt");
+
+    return NULL;
+}
+
+static void test_multifd_tcp_zstd_mt(char *name, MigrateCommon *args)
+{
+    args->start_hook = migrate_hook_start_precopy_tcp_multifd_zstd_mt;
+
+    args->start.caps[MIGRATION_CAPABILITY_MULTIFD] = true;
+
+    test_precopy_common(args);
+}
 #endif /* CONFIG_ZSTD */
 
+#ifdef CONFIG_LZ4
+static void *
+migrate_hook_start_precopy_tcp_multifd_lz4(QTestState *from,
+                                           QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-compression-threads", 3);
+    migrate_set_parameter_int(to, "multifd-compression-threads", 3);
+    set_multifd_compression(from, to, "lz4");
+
+    return NULL;
+}
+
+static void test_multifd_tcp_lz4(char *name, MigrateCommon *args)
+{
+    args->start_hook = migrate_hook_start_precopy_tcp_multifd_lz4;
+
+    args->start.caps[MIGRATION_CAPABILITY_MULTIFD] = true;
+
+    test_precopy_common(args);
+}
+
+static void test_multifd_postcopy_tcp_lz4(char *name, MigrateCommon *args)
+{
+    args->start_hook = migrate_hook_start_precopy_tcp_multifd_lz4;
+
+    args->start.caps[MIGRATION_CAPABILITY_MULTIFD] = true;
+    args->start.caps[MIGRATION_CAPABILITY_POSTCOPY_RAM] = true;
+
+    test_precopy_common(args);
+}
+#endif /* CONFIG_LZ4 */
+
 #ifdef CONFIG_QATZIP
 static void *
 migrate_hook_start_precopy_tcp_multifd_qatzip(QTestState *from,
@@ -189,6 +241,17 @@ void migration_test_add_compression(MigrationTestEnv *env)
         migration_test_add("/migration/multifd+postcopy/tcp/plain/zstd",
                            test_multifd_postcopy_tcp_zstd);
     }
+    migration_test_add("/migration/multifd/tcp/plain/zstd-mt",
+                       test_multifd_tcp_zstd_mt);
+#endif
+
+#ifdef CONFIG_LZ4
+    migration_test_add("/migration/multifd/tcp/plain/lz4",
+                       test_multifd_tcp_lz4);
+    if (env->has_uffd) {
+        migration_test_add("/migration/multifd+postcopy/tcp/plain/lz4",
+                           test_multifd_postcopy_tcp_lz4);
+    }
 #endif
 
 #ifdef CONFIG_QATZIP
@@ -16,6 +16,7 @@
 #include "libqtest-single.h"
 #include "libqos/qgraph.h"
 #include "libqos/pci.h"
+#include "hw/pci/pci_regs.h"
 #include "block/nvme.h"
 
 typedef struct QNvme QNvme;
@@ -559,6 +560,253 @@ static void test_migrate(void *obj, void *data, QGuestAllocator *alloc)
     g_string_free(dest_cmdline, true);
 }
 
+static void nvme_admin_cmd(nvme_ctrl *ctrl, uint8_t opcode, uint16_t cid,
+                           uint64_t prp1, uint32_t cdw10, uint32_t cdw11)
+{
+    uint64_t phys_cmd; /* NvmeCmd* */
+    NvmeCqe cqe;
+
+    phys_cmd = nvme_get_next_sqe(&ctrl->admin_sq, opcode, cid, prp1);
+    g_assert(phys_cmd);
+
+    qtest_writel(ctrl->pdev->bus->qts,
+                 PHYS_ADDR_OF_FIELD(NvmeCmd, phys_cmd, cdw10), cdw10);
+    qtest_writel(ctrl->pdev->bus->qts,
+                 PHYS_ADDR_OF_FIELD(NvmeCmd, phys_cmd, cdw11), cdw11);
+
+    nvme_commit_sqe(&ctrl->admin_sq);
+
+    cqe = nvme_wait(&ctrl->admin_sq);
+    g_assert(nvme_is_cqe_success(&cqe));
+    g_assert_cmpint(le16_to_cpu(cqe.cid), ==, cid);
+}
+
+static void *nvme_setup_iothread(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=thread0");
+    return arg;
+}
+
+/* Submit I/O on a queue pair that is processed in an IOThread */
+static void test_iothread(void *obj, void *data, QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    g_autofree nvme_ctrl *ctrl = NULL;
+    nvme_cq io_cq;
+    nvme_sq io_sq;
+    uint64_t phys_cmd; /* NvmeCmd* */
+    NvmeCqe cqe;
+    int i;
+
+    qpci_device_enable(pdev);
+
+    ctrl = g_malloc0(sizeof(*ctrl));
+    ctrl->alloc = alloc;
+    ctrl->pdev = pdev;
+    ctrl->bar = qpci_iomap(ctrl->pdev, 0, NULL);
+
+    test_migrate_setup_nvme_ctrl(ctrl);
+
+    nvme_init_cq(ctrl, &io_cq, 3, 4 /* CQEs num */);
+    nvme_init_sq(ctrl, &io_sq, 2, 4 /* SQEs num */, &io_cq);
+
+    /* qid 1, physically contiguous, no interrupts */
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_CREATE_CQ, 1, io_cq.phys_cqe,
+                   1 | ((io_cq.common.size - 1) << 16), 0x1);
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_CREATE_SQ, 2, io_sq.phys_sqe,
+                   1 | ((io_sq.common.size - 1) << 16), 0x1 | (1 << 16));
+
+    for (i = 0; i < 8; i++) {
+        phys_cmd = nvme_get_next_sqe(&io_sq, NVME_CMD_FLUSH, i, 0);
+        g_assert(phys_cmd);
+        qtest_writel(pdev->bus->qts,
+                     PHYS_ADDR_OF_FIELD(NvmeCmd, phys_cmd, nsid), 1);
+        nvme_commit_sqe(&io_sq);
+
+        cqe = nvme_wait(&io_sq);
+        g_assert(nvme_is_cqe_success(&cqe));
+        g_assert_cmpint(le16_to_cpu(cqe.cid), ==, i);
+    }
+
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_DELETE_SQ, 3, 0, 1, 0);
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_DELETE_CQ, 4, 0, 1, 0);
+
+    /* reset with a live I/O queue pair to exercise the quiesce path */
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_CREATE_CQ, 5, io_cq.phys_cqe,
+                   1 | ((io_cq.common.size - 1) << 16), 0x1);
+    qpci_io_writel(ctrl->pdev, ctrl->bar, NVME_REG_CC, 0);
+    nvme_wait_ready(ctrl, 0);
+
+    guest_free(alloc, io_sq.phys_sqe);
+    guest_free(alloc, io_cq.phys_cqe);
+    qpci_iounmap(ctrl->pdev, ctrl->bar);
+}
+
+#define NVME_TEST_MSIX_DATA 0x12345678
+
+static uint64_t nvme_msix_setup(QPCIDevice *pdev, QGuestAllocator *alloc,
+                                uint16_t entry)
+{
+    uint64_t off = pdev->msix_table_off + entry * PCI_MSIX_ENTRY_SIZE;
+    uint64_t addr = guest_alloc(alloc, 4);
+    uint32_t control;
+
+    qtest_writel(pdev->bus->qts, addr, 0);
+
+    qpci_io_writel(pdev, pdev->msix_table_bar,
+                   off + PCI_MSIX_ENTRY_LOWER_ADDR, addr & ~0UL);
+    qpci_io_writel(pdev, pdev->msix_table_bar,
+                   off + PCI_MSIX_ENTRY_UPPER_ADDR, (addr >> 32) & ~0UL);
+    qpci_io_writel(pdev, pdev->msix_table_bar,
+                   off + PCI_MSIX_ENTRY_DATA, NVME_TEST_MSIX_DATA);
+
+    control = qpci_io_readl(pdev, pdev->msix_table_bar,
+                            off + PCI_MSIX_ENTRY_VECTOR_CTRL);
+    qpci_io_writel(pdev, pdev->msix_table_bar,
+                   off + PCI_MSIX_ENTRY_VECTOR_CTRL,
+                   control & ~PCI_MSIX_ENTRY_CTRL_MASKBIT);
+
+    return addr;
+}
+
+static bool nvme_msix_raised(QPCIDevice *pdev, uint64_t addr)
+{
+    if (qtest_readl(pdev->bus->qts, addr) != NVME_TEST_MSIX_DATA) {
+        return false;
+    }
+
+    qtest_writel(pdev->bus->qts, addr, 0);
+    return true;
+}
+
+static void nvme_wait_cqe_posted(nvme_cq *cq)
+{
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        if (nvme_cqe_pending(cq)) {
+            return;
+        }
+
+        g_usleep(1000);
+    }
+
+    g_assert_not_reached();
+}
+
+static void nvme_wait_msix(QPCIDevice *pdev, uint64_t addr)
+{
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        if (nvme_msix_raised(pdev, addr)) {
+            return;
+        }
+
+        g_usleep(1000);
+    }
+
+    g_assert_not_reached();
+}
+
+static void nvme_submit_flush(nvme_sq *sq, uint16_t cid)
+{
+    uint64_t phys_cmd; /* NvmeCmd* */
+
+    phys_cmd = nvme_get_next_sqe(sq, NVME_CMD_FLUSH, cid, 0);
+    g_assert(phys_cmd);
+    qtest_writel(sq->common.ctrl->pdev->bus->qts,
+                 PHYS_ADDR_OF_FIELD(NvmeCmd, phys_cmd, nsid), 1);
+    nvme_commit_sqe(sq);
+}
+
+/* Interrupt Coalescing (FID 08h) and Interrupt Vector Configuration (09h) */
+static void test_int_coalescing(void *obj, void *data, QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    g_autofree nvme_ctrl *ctrl = NULL;
+    nvme_cq io_cq;
+    nvme_sq io_sq;
+    uint64_t msix_addr;
+    NvmeCqe cqe;
+    uint16_t cid = 0;
+    int i;
+
+    if (qpci_check_buggy_msi(pdev)) {
+        return;
+    }
+
+    qpci_device_enable(pdev);
+    qpci_msix_enable(pdev);
+
+    ctrl = g_malloc0(sizeof(*ctrl));
+    ctrl->alloc = alloc;
+    ctrl->pdev = pdev;
+    /* the MSI-X table shares BAR0 with the controller registers */
+    ctrl->bar = pdev->msix_table_bar;
+
+    test_migrate_setup_nvme_ctrl(ctrl);
+    msix_addr = nvme_msix_setup(pdev, alloc, 1);
+
+    /* aggregate 4 entries (0's based) for at most 1 ms */
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_SET_FEATURES, cid++, 0,
+                   NVME_INTERRUPT_COALESCING, 3 | (10 << 8));
+
+    nvme_init_cq(ctrl, &io_cq, 3, 8 /* CQEs num */);
+    nvme_init_sq(ctrl, &io_sq, 2, 8 /* SQEs num */, &io_cq);
+
+    /* qid 1, physically contiguous, interrupts enabled on vector 1 */
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_CREATE_CQ, cid++, io_cq.phys_cqe,
+                   1 | ((io_cq.common.size - 1) << 16), 0x3 | (1 << 16));
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_CREATE_SQ, cid++, io_sq.phys_sqe,
+                   1 | ((io_sq.common.size - 1) << 16), 0x1 | (1 << 16));
+
+    /* below the aggregation threshold no interrupt is raised... */
+    for (i = 0; i < 3; i++) {
+        nvme_submit_flush(&io_sq, cid++);
+        cqe = nvme_wait(&io_sq);
+        g_assert(nvme_is_cqe_success(&cqe));
+        g_assert(!nvme_msix_raised(pdev, msix_addr));
+    }
+
+    /* ...until it is reached */
+    nvme_submit_flush(&io_sq, cid++);
+    nvme_wait_msix(pdev, msix_addr);
+    cqe = nvme_wait(&io_sq);
+    g_assert(nvme_is_cqe_success(&cqe));
+
+    /*
+     * The aggregation time bounds the delay.  With an IOThread, the main
+     * loop may only start the timer after the clock has been stepped, so
+     * keep stepping until the interrupt is raised.
+     */
+    nvme_submit_flush(&io_sq, cid++);
+    nvme_wait_cqe_posted(&io_cq);
+    g_assert(!nvme_msix_raised(pdev, msix_addr));
+    for (i = 0; i < 10 && !nvme_msix_raised(pdev, msix_addr); i++) {
+        qtest_clock_step(pdev->bus->qts, 2 * 1000 * 1000);
+        g_usleep(1000);
+    }
+    g_assert_cmpint(i, <, 10);
+    cqe = nvme_wait(&io_sq);
+    g_assert(nvme_is_cqe_success(&cqe));
+
+    /* coalescing can be disabled for the vector */
+    nvme_admin_cmd(ctrl, NVME_ADM_CMD_SET_FEATURES, cid++, 0,
+                   NVME_INTERRUPT_VECTOR_CONF, 1 | NVME_INTVC_NOCOALESCING);
+    nvme_submit_flush(&io_sq, cid++);
+    nvme_wait_msix(pdev, msix_addr);
+    cqe = nvme_wait(&io_sq);
+    g_assert(nvme_is_cqe_success(&cqe));
+
+    guest_free(alloc, msix_addr);
+    guest_free(alloc, io_sq.phys_sqe);
+    guest_free(alloc, io_cq.phys_cqe);
+    qpci_msix_disable(pdev);
+}
+
 static void nvme_register_nodes(void)
 {
     QOSGraphEdgeOptions opts = {
@@ -587,6 +835,19 @@ static void nvme_register_nodes(void)
     qos_add_test("reg-read", "nvme", nvmetest_reg_read_test, NULL);
 
     qos_add_test("migrate", "nvme", test_migrate, NULL);
+
+    qos_add_test("int-coalescing", "nvme", test_int_coalescing, NULL);
+
+    qos_add_test("iothread", "nvme", test_iothread, &(QOSGraphTestOptions) {
+        .before = nvme_setup_iothread,
+        .edge.extra_device_opts = "iothread=thread0",
+    });
+
+    qos_add_test("int-coalescing-iothread", "nvme", test_int_coalescing,
+                 &(QOSGraphTestOptions) {
+        .before = nvme_setup_iothread,
+        .edge.extra_device_opts = "iothread=thread0",
+    });
 }
 
 libqos_init(nvme_register_nodes);
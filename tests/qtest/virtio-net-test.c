@@ -9,6 +9,7 @@
 
 #include "qemu/osdep.h"
 #include "libqtest-single.h"
+#include "qemu/bswap.h"
 #include "qemu/iov.h"
 #include "qemu/module.h"
 #include "qobject/qdict.h"
@@ -16,6 +17,13 @@
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#endif
+
 #ifndef ETH_P_RARP
 #define ETH_P_RARP 0x8035
 #endif
@@ -166,6 +174,258 @@ static void stop_cont_test(void *obj, void *data, QGuestAllocator *t_alloc)
     rx_stop_cont_test(dev, t_alloc, rx, sv[0]);
 }
 
+/*
+ * The batch tests drive the rings themselves instead of going through
+ * qvirtqueue_add(), so that descriptors are reused once the device has
+ * used them and so that the same code covers both ring layouts.  Every
+ * buffer is a single descriptor, made available in slot order, and
+ * virtio-net uses them in the order they were made available.
+ */
+#define BATCH_BUFFERS 96
+#define BATCH_ROUNDS 4
+/* Large enough for the TX batch to fill the socket and go async */
+#define BATCH_TX_LEN (16 * 1024)
+#define BATCH_RX_LEN 64
+
+typedef struct TestRing {
+    QVirtQueue *vq;
+    bool packed;
+    /* Buffers made available and used so far */
+    uint32_t avail;
+    uint32_t used;
+} TestRing;
+
+static void test_ring_init(TestRing *r, QVirtioDevice *dev, QVirtQueue *vq)
+{
+    *r = (TestRing) {
+        .vq = vq,
+        .packed = dev->features & (1ull << VIRTIO_F_RING_PACKED),
+    };
+
+    if (r->packed) {
+        /*
+         * qvring_init() linked the descriptors of a split ring, which
+         * in the packed layout puts garbage into the flags.  A zeroed
+         * driver area leaves notifications enabled.
+         */
+        qtest_memset(global_qtest, vq->desc, 0,
+                     vq->size * sizeof(struct vring_packed_desc));
+        qtest_memset(global_qtest, vq->avail, 0,
+                     sizeof(struct vring_packed_desc_event));
+    }
+}
+
+static uint16_t test_ring_slot(TestRing *r, uint32_t n)
+{
+    return n % r->vq->size;
+}
+
+/* The wrap counter of the ring pass that buffer @n falls in */
+static bool test_ring_wrap(TestRing *r, uint32_t n)
+{
+    return !(n / r->vq->size % 2);
+}
+
+/* Make a buffer available without notifying the device */
+static void test_ring_add(TestRing *r, uint64_t addr, uint32_t len,
+                          bool write)
+{
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq = r->vq;
+    uint16_t slot = test_ring_slot(r, r->avail);
+    uint64_t desc = vq->desc + 16 * slot;
+    uint16_t flags = write ? VRING_DESC_F_WRITE : 0;
+
+    g_assert_cmpuint(r->avail - r->used, <, vq->size);
+
+    qvirtio_writeq(vq->vdev, qts, desc, addr);
+    qvirtio_writel(vq->vdev, qts, desc + 8, len);
+    if (r->packed) {
+        if (test_ring_wrap(r, r->avail)) {
+            flags |= 1 << VRING_PACKED_DESC_F_AVAIL;
+        } else {
+            flags |= 1 << VRING_PACKED_DESC_F_USED;
+        }
+        /* The buffer id, then the flags that hand it to the device */
+        qvirtio_writew(vq->vdev, qts, desc + 12, slot);
+        qvirtio_writew(vq->vdev, qts, desc + 14, flags);
+    } else {
+        qvirtio_writew(vq->vdev, qts, desc + 12, flags);
+        qvirtio_writew(vq->vdev, qts, vq->avail + 4 + 2 * slot, slot);
+        qvirtqueue_set_avail_idx(qts, vq->vdev, vq, r->avail + 1);
+    }
+    r->avail++;
+}
+
+static void test_ring_kick(TestRing *r)
+{
+    r->vq->vdev->bus->virtqueue_kick(r->vq->vdev, r->vq);
+}
+
+/* Wait for the next used buffer, which must be the oldest one */
+static uint32_t test_ring_wait_used(TestRing *r)
+{
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq = r->vq;
+    uint16_t slot = test_ring_slot(r, r->used);
+    gint64 start_time = g_get_monotonic_time();
+    uint32_t id, len;
+
+    g_assert_cmpuint(r->used, <, r->avail);
+
+    for (;;) {
+        if (r->packed) {
+            uint64_t desc = vq->desc + 16 * slot;
+            uint16_t flags = qvirtio_readw(vq->vdev, qts, desc + 14);
+            bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+            bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+
+            if (avail == used && used == test_ring_wrap(r, r->used)) {
+                id = qvirtio_readw(vq->vdev, qts, desc + 12);
+                len = qvirtio_readl(vq->vdev, qts, desc + 8);
+                break;
+            }
+        } else if (qvirtqueue_get_buf(qts, vq, &id, &len)) {
+            break;
+        }
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_NET_TIMEOUT_US);
+    }
+
+    g_assert_cmpuint(id, ==, slot);
+    r->used++;
+    return len;
+}
+
+/*
+ * Each round makes a batch of buffers available with one notification.
+ * The device pops them in batches, and once the socket is full the rest
+ * of a batch is unpopped and popped again when the peer catches up.
+ */
+static void tx_batch_test(QGuestAllocator *alloc, TestRing *tx, int socket)
+{
+    uint64_t addr[BATCH_BUFFERS];
+    g_autofree char *buffer = g_malloc(BATCH_TX_LEN);
+    uint32_t seq = 0;
+    int i, round;
+
+    for (i = 0; i < BATCH_BUFFERS; i++) {
+        addr[i] = guest_alloc(alloc, VNET_HDR_SIZE + BATCH_TX_LEN);
+        qtest_memset(global_qtest, addr[i], 0, VNET_HDR_SIZE);
+    }
+
+    for (round = 0; round < BATCH_ROUNDS; round++) {
+        for (i = 0; i < BATCH_BUFFERS; i++) {
+            uint32_t data = seq + i;
+
+            memwrite(addr[i] + VNET_HDR_SIZE, &data, sizeof(data));
+            test_ring_add(tx, addr[i], VNET_HDR_SIZE + BATCH_TX_LEN, false);
+        }
+        test_ring_kick(tx);
+
+        for (i = 0; i < BATCH_BUFFERS; i++, seq++) {
+            uint32_t len, data;
+            int ret;
+
+            ret = recv(socket, &len, sizeof(len), MSG_WAITALL);
+            g_assert_cmpint(ret, ==, sizeof(len));
+            g_assert_cmpuint(ntohl(len), ==, BATCH_TX_LEN);
+
+            ret = recv(socket, buffer, BATCH_TX_LEN, MSG_WAITALL);
+            g_assert_cmpint(ret, ==, BATCH_TX_LEN);
+            memcpy(&data, buffer, sizeof(data));
+            g_assert_cmpuint(data, ==, seq);
+        }
+
+        for (i = 0; i < BATCH_BUFFERS; i++) {
+            test_ring_wait_used(tx);
+        }
+    }
+
+    for (i = 0; i < BATCH_BUFFERS; i++) {
+        guest_free(alloc, addr[i]);
+    }
+}
+
+/*
+ * Each round makes a batch of buffers available and then receives one
+ * packet into each of them.  Over the rounds the ring wraps and the
+ * popped elements are recycled many times.
+ */
+static void rx_batch_test(QGuestAllocator *alloc, TestRing *rx, int socket)
+{
+    uint64_t addr[BATCH_BUFFERS];
+    uint32_t seq = 0;
+    int i, round;
+
+    for (i = 0; i < BATCH_BUFFERS; i++) {
+        addr[i] = guest_alloc(alloc, VNET_HDR_SIZE + BATCH_RX_LEN);
+    }
+
+    for (round = 0; round < BATCH_ROUNDS; round++) {
+        for (i = 0; i < BATCH_BUFFERS; i++) {
+            test_ring_add(rx, addr[i], VNET_HDR_SIZE + BATCH_RX_LEN, true);
+        }
+        test_ring_kick(rx);
+
+        for (i = 0; i < BATCH_BUFFERS; i++) {
+            uint32_t packet[BATCH_RX_LEN / sizeof(uint32_t)] = { seq + i };
+            uint32_t len = htonl(sizeof(packet));
+            struct iovec iov[] = {
+                {
+                    .iov_base = &len,
+                    .iov_len = sizeof(len),
+                }, {
+                    .iov_base = packet,
+                    .iov_len = sizeof(packet),
+                },
+            };
+            int ret;
+
+            ret = iov_send(socket, iov, 2, 0, sizeof(len) + sizeof(packet));
+            g_assert_cmpint(ret, ==, sizeof(len) + sizeof(packet));
+        }
+
+        for (i = 0; i < BATCH_BUFFERS; i++, seq++) {
+            uint32_t data;
+
+            g_assert_cmpuint(test_ring_wait_used(rx), ==,
+                             VNET_HDR_SIZE + BATCH_RX_LEN);
+            memread(addr[i] + VNET_HDR_SIZE, &data, sizeof(data));
+            g_assert_cmpuint(data, ==, seq);
+        }
+    }
+
+    for (i = 0; i < BATCH_BUFFERS; i++) {
+        guest_free(alloc, addr[i]);
+    }
+}
+
+static void batch_test(void *obj, void *data, QGuestAllocator *t_alloc,
+                       bool packed)
+{
+    QVirtioNet *net_if = obj;
+    TestRing rx, tx;
+    int *sv = data;
+
+    test_ring_init(&rx, net_if->vdev, net_if->queues[0]);
+    test_ring_init(&tx, net_if->vdev, net_if->queues[1]);
+    g_assert(rx.packed == packed);
+
+    rx_batch_test(t_alloc, &rx, sv[0]);
+    tx_batch_test(t_alloc, &tx, sv[0]);
+}
+
+static void batch_split_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    batch_test(obj, data, t_alloc, false);
+}
+
+static void batch_packed_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    batch_test(obj, data, t_alloc, true);
+}
+
 static void hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioPCIDevice *dev = obj;
@@ -285,6 +545,160 @@ static void *virtio_net_test_setup(GString *cmd_line, void *arg)
     return sv;
 }
 
+static void *virtio_net_test_setup_iothread(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=thread0 ");
+    return virtio_net_test_setup(cmd_line, arg);
+}
+
+#ifdef CONFIG_LINUX
+#define TAP_RX_PACKETS 32
+/* IEEE 802 local experimental ethertype */
+#define TAP_RX_ETH_P 0x88b5
+
+typedef struct TapRxTest {
+    int tap_fd;
+    /* QEMU's end of the socket used without a tap, or -1 */
+    int peer_fd;
+    /* AF_PACKET socket that transmits on the tap, -1 if unavailable */
+    int packet_fd;
+    int ifindex;
+} TapRxTest;
+
+/* Frames sent on the tap must reach the guest in order */
+static void tap_rx_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *vq = net_if->queues[0];
+    QTestState *qts = global_qtest;
+    TapRxTest *t = data;
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_ifindex = t->ifindex,
+        .sll_halen = ETH_ALEN,
+    };
+    /* Leave room for frames the host stack sends on its own */
+    uint64_t req_addr[2 * TAP_RX_PACKETS];
+    uint32_t free_head[2 * TAP_RX_PACKETS];
+    uint32_t seq = 0;
+    int i;
+
+    if (t->packet_fd < 0) {
+        g_test_skip("needs CAP_NET_ADMIN and CAP_NET_RAW for a tap");
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(req_addr); i++) {
+        req_addr[i] = guest_alloc(t_alloc, 128);
+        free_head[i] = qvirtqueue_add(qts, vq, req_addr[i], 128, true, false);
+        qvirtqueue_kick(qts, dev, vq, free_head[i]);
+    }
+
+    /* Send the whole burst before QEMU reads, to fill up the chains */
+    for (i = 0; i < TAP_RX_PACKETS; i++) {
+        uint8_t frame[64] = {
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+            0x02, 0x00, 0x00, 0x00, 0x00, 0x01,
+            TAP_RX_ETH_P >> 8, TAP_RX_ETH_P & 0xff,
+        };
+
+        stl_be_p(&frame[ETH_HLEN], i);
+        g_assert_cmpint(sendto(t->packet_fd, frame, sizeof(frame), 0,
+                               (struct sockaddr *)&sll, sizeof(sll)),
+                        ==, sizeof(frame));
+    }
+
+    for (i = 0; i < ARRAY_SIZE(req_addr) && seq < TAP_RX_PACKETS; i++) {
+        uint8_t frame[ETH_HLEN + 4];
+
+        qvirtio_wait_used_elem(qts, dev, vq, free_head[i], NULL,
+                               QVIRTIO_NET_TIMEOUT_US);
+        memread(req_addr[i] + VNET_HDR_SIZE, frame, sizeof(frame));
+        if (lduw_be_p(&frame[12]) == TAP_RX_ETH_P) {
+            g_assert_cmpuint(ldl_be_p(&frame[ETH_HLEN]), ==, seq);
+            seq++;
+        }
+    }
+    g_assert_cmpuint(seq, ==, TAP_RX_PACKETS);
+}
+
+static void virtio_net_test_cleanup_tap(void *data)
+{
+    TapRxTest *t = data;
+
+    qos_invalidate_command_line();
+    if (t->packet_fd >= 0) {
+        close(t->packet_fd);
+    }
+    if (t->peer_fd >= 0) {
+        close(t->peer_fd);
+    }
+    close(t->tap_fd);
+    g_free(t);
+}
+
+/*
+ * Bring up a tap interface and pass it to QEMU.  Without the privileges
+ * to do so, pass a socket instead so that QEMU starts and the test can
+ * skip itself.
+ */
+static void *virtio_net_test_setup_tap(GString *cmd_line, void *arg)
+{
+    TapRxTest *t = g_new(TapRxTest, 1);
+    struct ifreq ifr = {
+        .ifr_flags = IFF_TAP | IFF_NO_PI,
+    };
+    g_autofree char *sysctl = NULL;
+    int sv[2];
+    int fd;
+
+    t->peer_fd = -1;
+    t->packet_fd = -1;
+    g_test_queue_destroy(virtio_net_test_cleanup_tap, t);
+    g_string_append(cmd_line, " -object iothread,id=thread0 ");
+
+    t->tap_fd = open("/dev/net/tun", O_RDWR);
+    if (t->tap_fd < 0 || ioctl(t->tap_fd, TUNSETIFF, &ifr) < 0) {
+        if (t->tap_fd >= 0) {
+            close(t->tap_fd);
+        }
+        g_assert_cmpint(socketpair(PF_UNIX, SOCK_STREAM, 0, sv), !=, -1);
+        t->tap_fd = sv[0];
+        t->peer_fd = sv[1];
+        g_string_append_printf(cmd_line, " -netdev socket,fd=%d,id=hs0 ",
+                               sv[1]);
+        return t;
+    }
+
+    /* Keep IPv6 autoconfiguration from sending frames of its own */
+    sysctl = g_strdup_printf("/proc/sys/net/ipv6/conf/%s/disable_ipv6",
+                             ifr.ifr_name);
+    fd = open(sysctl, O_WRONLY);
+    if (fd >= 0) {
+        g_assert_cmpint(write(fd, "1", 1), ==, 1);
+        close(fd);
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    g_assert_cmpint(fd, >=, 0);
+    ifr.ifr_flags = IFF_UP;
+    if (ioctl(fd, SIOCSIFFLAGS, &ifr) == 0 &&
+        ioctl(fd, SIOCGIFINDEX, &ifr) == 0) {
+        t->ifindex = ifr.ifr_ifindex;
+        t->packet_fd = socket(AF_PACKET, SOCK_RAW, 0);
+    }
+    close(fd);
+
+    g_string_append_printf(cmd_line, " -netdev tap,id=hs0,fd=%d", t->tap_fd);
+#ifdef CONFIG_LINUX_IO_URING
+    g_string_append(cmd_line, ",rx-uring=on");
+#endif
+    g_string_append_c(cmd_line, ' ');
+    return t;
+}
+#endif /* CONFIG_LINUX */
+
 #endif /* _WIN32 */
 
 static void large_tx(void *obj, void *data, QGuestAllocator *t_alloc)
@@ -328,6 +742,26 @@ static void register_virtio_net_test(void)
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
+    qos_add_test("batch/split", "virtio-net", batch_split_test, &opts);
+
+    /* libqos only drives packed rings through the modern PCI transport */
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "disable-legacy=on,packed=on",
+    };
+    qos_add_test("batch/packed", "virtio-net-pci", batch_packed_test, &opts);
+
+    opts.before = virtio_net_test_setup_iothread;
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "iothread=thread0",
+    };
+    qos_add_test("iothread/basic", "virtio-net-pci", send_recv_test, &opts);
+    qos_add_test("iothread/rx_stop_cont", "virtio-net-pci", stop_cont_test,
+                 &opts);
+#ifdef CONFIG_LINUX
+    opts.before = virtio_net_test_setup_tap;
+    qos_add_test("iothread/tap_rx", "virtio-net-pci", tap_rx_test, &opts);
+#endif
+    opts.edge = (QOSGraphEdgeOptions) { };
 #endif
 
     /* These tests do not need a loopback backend.  */
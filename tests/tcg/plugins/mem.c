@@ -20,6 +20,7 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 typedef struct {
     uint64_t mem_count;
     uint64_t io_count;
+    uint64_t buffer_count;
 } CPUCount;
 
 typedef struct {
@@ -51,8 +52,10 @@ typedef struct {
 static struct qemu_plugin_scoreboard *counts;
 static qemu_plugin_u64 mem_count;
 static qemu_plugin_u64 io_count;
+static qemu_plugin_u64 buffer_count;
+static struct qemu_plugin_mem_buffer *mem_buffer;
 static bool do_inline, do_callback, do_print_accesses, do_region_summary;
-static bool do_haddr;
+static bool do_haddr, do_buffer;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
 
@@ -80,8 +83,18 @@ static void plugin_exit(void *p)
         g_string_append_printf(out, "io accesses: %" PRIu64 "\n",
                                qemu_plugin_u64_sum(io_count));
     }
+    if (do_buffer) {
+        g_string_append_printf(out, "buffered mem accesses: %" PRIu64 "\n",
+                               qemu_plugin_u64_sum(buffer_count));
+    }
     qemu_plugin_outs(out->str);
 
+    /* all buffered records have been delivered by now */
+    if (do_inline && do_buffer) {
+        g_assert(qemu_plugin_u64_sum(mem_count) ==
+                 qemu_plugin_u64_sum(buffer_count));
+    }
+
 
     if (do_region_summary) {
         g_autoptr(GList) regionlist = g_hash_table_get_values(regions);
@@ -104,6 +117,9 @@ static void plugin_exit(void *p)
         qemu_plugin_outs(out->str);
     }
 
+    if (mem_buffer) {
+        qemu_plugin_mem_buffer_free(mem_buffer);
+    }
     qemu_plugin_scoreboard_free(counts);
 }
 
@@ -228,6 +244,13 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
     }
 }
 
+static void vcpu_mem_buffer(unsigned int cpu_index,
+                            const qemu_plugin_mem_record *records,
+                            size_t n_records, void *udata)
+{
+    qemu_plugin_u64_add(buffer_count, cpu_index, n_records);
+}
+
 static void print_access(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
                          uint64_t vaddr, void *udata)
 {
@@ -280,6 +303,9 @@ static void vcpu_tb_trans(struct qemu_plugin_tb *tb, void *userdata)
                 QEMU_PLUGIN_INLINE_ADD_U64,
                 mem_count, 1);
         }
+        if (do_buffer) {
+            qemu_plugin_register_vcpu_mem_buffer(insn, rw, mem_buffer);
+        }
         if (do_callback || do_region_summary) {
             qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
                                              QEMU_PLUGIN_CB_NO_REGS,
@@ -333,6 +359,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "buffer") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_buffer)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "print-accesses") == 0) {
             if (!qemu_plugin_bool_parse(tokens[0], tokens[1],
                                         &do_print_accesses)) {
@@ -374,6 +405,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
     mem_count = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, mem_count);
     io_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, io_count);
+    buffer_count = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, buffer_count);
+    if (do_buffer) {
+        mem_buffer = qemu_plugin_mem_buffer_new(256, vcpu_mem_buffer, NULL);
+    }
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans, NULL);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
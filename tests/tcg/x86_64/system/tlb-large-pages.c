@@ -0,0 +1,134 @@
+/*
+ * Large page TLB flush test
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * The softmmu TLB has no large pages.  It installs 4k entries for them
+ * and has to flush all of those entries when a single address within
+ * the large page is invalidated.  It tracks a few large pages per
+ * mmu_idx exactly and lumps the others together.
+ *
+ * Map more 2M pages than are tracked exactly and touch every 4k page of
+ * them.  Then remap them one at a time and invalidate one address of
+ * the remapped page with invlpg.  Every 4k page of it must see the new
+ * frame, while the other large pages keep theirs.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <minilib.h>
+
+#define PAGE_SIZE 4096
+#define LPAGE_SIZE (2 * 1024 * 1024)
+#define PAGES_PER_LPAGE (LPAGE_SIZE / PAGE_SIZE)
+
+#define PTE_ADDR_MASK 0x000ffffffffff000UL
+#define PDE_LPAGE 0x83 /* present, writable, 2M page */
+
+/* More than the 8 large pages the TLB tracks exactly per mmu_idx */
+#define NR_LPAGES 12
+#define NR_ROUNDS 4
+
+/* Not backed by RAM, so only ever reached through the new mappings */
+#define VIRT_BASE 0x40000000UL
+/* One frame more than there are large pages, all within 128M of RAM */
+#define PHYS_BASE 0x2000000UL
+#define NR_FRAMES (NR_LPAGES + 1)
+
+static uint64_t *pd;
+static unsigned int frame_of[NR_LPAGES];
+
+static uint64_t read_cr3(void)
+{
+    uint64_t cr3;
+
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+static void write_cr3(uint64_t cr3)
+{
+    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+static void invlpg(uintptr_t addr)
+{
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static uint32_t tag(unsigned int frame, unsigned int page)
+{
+    return frame << 16 | page;
+}
+
+static uintptr_t lpage_addr(unsigned int lpage, unsigned int page)
+{
+    return VIRT_BASE + lpage * LPAGE_SIZE + page * PAGE_SIZE;
+}
+
+static void map(unsigned int lpage, unsigned int frame)
+{
+    pd[lpage] = (PHYS_BASE + frame * LPAGE_SIZE) | PDE_LPAGE;
+    frame_of[lpage] = frame;
+}
+
+/* Read every 4k page of every large page, which refills the TLB */
+static bool check(void)
+{
+    bool ok = true;
+
+    for (unsigned int i = 0; i < NR_LPAGES; i++) {
+        for (unsigned int page = 0; page < PAGES_PER_LPAGE; page++) {
+            /* volatile: the same address reads differently after map() */
+            uint32_t got = *(volatile uint32_t *)lpage_addr(i, page);
+            uint32_t expect = tag(frame_of[i], page);
+
+            if (got != expect) {
+                ml_printf("large page %d page %d: got %x, expected %x\n",
+                          i, page, got, expect);
+                ok = false;
+                break;
+            }
+        }
+    }
+    return ok;
+}
+
+int main(void)
+{
+    uint64_t *pml4 = (uint64_t *)(read_cr3() & PTE_ADDR_MASK);
+    uint64_t *pdpt = (uint64_t *)(pml4[0] & PTE_ADDR_MASK);
+    unsigned int spare = NR_LPAGES;
+    bool ok;
+
+    /* boot.S identity maps the low 4G with 2M pages */
+    pd = (uint64_t *)(pdpt[VIRT_BASE >> 30] & PTE_ADDR_MASK);
+
+    for (unsigned int frame = 0; frame < NR_FRAMES; frame++) {
+        for (unsigned int page = 0; page < PAGES_PER_LPAGE; page++) {
+            *(uint32_t *)(PHYS_BASE + frame * LPAGE_SIZE + page * PAGE_SIZE) =
+                tag(frame, page);
+        }
+    }
+
+    for (unsigned int i = 0; i < NR_LPAGES; i++) {
+        map(i, i);
+    }
+    write_cr3(read_cr3());
+    ok = check();
+
+    for (unsigned int round = 0; ok && round < NR_ROUNDS; round++) {
+        for (unsigned int i = 0; ok && i < NR_LPAGES; i++) {
+            unsigned int old = frame_of[i];
+            unsigned int page = (i * 37 + round * 101) % PAGES_PER_LPAGE;
+
+            map(i, spare);
+            spare = old;
+            invlpg(lpage_addr(i, page));
+            ok = check();
+        }
+    }
+
+    ml_printf("Test complete: %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : -1;
+}
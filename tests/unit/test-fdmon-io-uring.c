@@ -0,0 +1,344 @@
+/*
+ * fdmon-io_uring tests
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/aio.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+
+static AioContext *ctx;
+static size_t page_size;
+
+typedef struct {
+    CqeHandler cqe_handler;
+    int fd;
+    void *base;
+    size_t len;
+    int index; /* aio_get_fixed_buf() result */
+    bool done;
+} FixedRead;
+
+static void fixed_read_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
+{
+    FixedRead *r = opaque;
+
+    r->index = aio_get_fixed_buf(r->base, r->len);
+    if (r->index < 0) {
+        io_uring_prep_nop(sqe);
+    } else {
+        io_uring_prep_read_fixed(sqe, r->fd, r->base, r->len, 0, r->index);
+    }
+}
+
+static void fixed_read_cqe_handler(CqeHandler *cqe_handler)
+{
+    FixedRead *r = container_of(cqe_handler, FixedRead, cqe_handler);
+
+    r->done = true;
+}
+
+/*
+ * Look up @base and @len with aio_get_fixed_buf() and, if that finds a
+ * fixed buffer, read from a pipe into it with IORING_OP_READ_FIXED so
+ * that the kernel confirms the buffer index. Returns the buffer index.
+ */
+static int fixed_read(void *base, size_t len)
+{
+    g_autofree uint8_t *data = g_malloc(len);
+    FixedRead r = {
+        .cqe_handler.cb = fixed_read_cqe_handler,
+        .base = base,
+        .len = len,
+    };
+    int fds[2];
+
+    for (size_t i = 0; i < len; i++) {
+        data[i] = g_test_rand_int_range(0, 256);
+    }
+    g_assert(g_unix_open_pipe(fds, FD_CLOEXEC, NULL));
+    g_assert_cmpint(write(fds[1], data, len), ==, len);
+    r.fd = fds[0];
+
+    aio_add_sqe(fixed_read_prep_sqe, &r, &r.cqe_handler);
+    while (!r.done) {
+        aio_poll(ctx, true);
+    }
+
+    if (r.index >= 0) {
+        g_assert_cmpint(r.cqe_handler.cqe.res, ==, len);
+        g_assert(!memcmp(base, data, len));
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return r.index;
+}
+
+/*
+ * Two adjacent memory areas take up one slot each. A range is found in
+ * the slot of the area it lies in, but not if it crosses into the other
+ * area or past the end of the registered memory.
+ */
+static void test_fixed_buf_adjacent(void)
+{
+    size_t area = 2 * page_size;
+    uint8_t *mem;
+    int a, b;
+
+    if (!aio_has_io_uring()) {
+        g_test_skip("io_uring is not available");
+        return;
+    }
+
+    mem = mmap(NULL, 3 * area, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    g_assert(mem != MAP_FAILED);
+    aio_register_fixed_buf(mem, area);
+    aio_register_fixed_buf(mem + area, area);
+
+    a = fixed_read(mem, 64);
+    if (a < 0) {
+        g_test_skip("io_uring fixed buffers are not available");
+        aio_unregister_fixed_buf(mem, area);
+        aio_unregister_fixed_buf(mem + area, area);
+        munmap(mem, 3 * area);
+        return;
+    }
+    b = fixed_read(mem + area, 64);
+    g_assert_cmpint(b, >=, 0);
+    g_assert_cmpint(b, !=, a);
+
+    /* Both sides of the boundary between the areas */
+    g_assert_cmpint(fixed_read(mem + area - 16, 16), ==, a);
+    g_assert_cmpint(fixed_read(mem + area, 16), ==, b);
+    g_assert_cmpint(fixed_read(mem + area - 16, 32), ==, -1);
+    g_assert_cmpint(fixed_read(mem, area), ==, a);
+    g_assert_cmpint(fixed_read(mem, area + 1), ==, -1);
+
+    /* The end of the registered memory */
+    g_assert_cmpint(fixed_read(mem + 2 * area - 16, 16), ==, b);
+    g_assert_cmpint(fixed_read(mem + 2 * area - 16, 32), ==, -1);
+    g_assert_cmpint(fixed_read(mem + 2 * area, 16), ==, -1);
+
+    /* Registrations nest, the slot goes away with the last reference */
+    aio_register_fixed_buf(mem, area);
+    aio_unregister_fixed_buf(mem, area);
+    g_assert_cmpint(fixed_read(mem, 64), ==, a);
+    aio_unregister_fixed_buf(mem, area);
+    g_assert_cmpint(fixed_read(mem, 64), ==, -1);
+    g_assert_cmpint(fixed_read(mem + area, 64), ==, b);
+
+    /* The free slot is reused */
+    aio_register_fixed_buf(mem + 2 * area, area);
+    g_assert_cmpint(fixed_read(mem + 2 * area, 64), ==, a);
+    g_assert_cmpint(fixed_read(mem + 2 * area - 16, 32), ==, -1);
+    aio_unregister_fixed_buf(mem + 2 * area, area);
+
+    aio_unregister_fixed_buf(mem + area, area);
+    g_assert_cmpint(fixed_read(mem + area, 64), ==, -1);
+    munmap(mem, 3 * area);
+}
+
+/*
+ * A memory area larger than the kernel's limit for one buffer is split
+ * into slots of 1 GiB. This pins more than 1 GiB of memory, so it only
+ * runs in slow mode.
+ */
+static void test_fixed_buf_split(void)
+{
+    size_t size = 1 * GiB + 2 * page_size;
+    uint8_t *mem;
+    int first;
+
+    if (!aio_has_io_uring()) {
+        g_test_skip("io_uring is not available");
+        return;
+    }
+    if (!g_test_slow()) {
+        g_test_skip("pins 1 GiB of memory, only runs in slow mode");
+        return;
+    }
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    g_assert(mem != MAP_FAILED);
+    aio_register_fixed_buf(mem, size);
+
+    first = fixed_read(mem, 64);
+    if (first < 0) {
+        g_test_skip("1 GiB of memory could not be registered");
+    } else {
+        g_assert_cmpint(fixed_read(mem + 1 * GiB - 16, 16), ==, first);
+        g_assert_cmpint(fixed_read(mem + 1 * GiB, 16), ==, first + 1);
+        g_assert_cmpint(fixed_read(mem + 1 * GiB - 16, 32), ==, -1);
+        g_assert_cmpint(fixed_read(mem + size - 16, 16), ==, first + 1);
+        g_assert_cmpint(fixed_read(mem + size - 16, 32), ==, -1);
+    }
+
+    aio_unregister_fixed_buf(mem, size);
+    munmap(mem, size);
+}
+
+typedef struct {
+    CqeHandler cqe_handler;
+    unsigned *completed;
+} Nop;
+
+static void nop_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
+{
+    io_uring_prep_nop(sqe);
+}
+
+static void nop_cqe_handler(CqeHandler *cqe_handler)
+{
+    Nop *nop = container_of(cqe_handler, Nop, cqe_handler);
+
+    g_assert_cmpint(cqe_handler->cqe.res, ==, 0);
+    (*nop->completed)++;
+}
+
+static void count_bh(void *opaque)
+{
+    (*(unsigned *)opaque)++;
+}
+
+static unsigned events;
+
+static void event_read(EventNotifier *e)
+{
+    event_notifier_test_and_clear(e);
+    events++;
+}
+
+/*
+ * Check that @ctx, the current AioContext, runs bottom halves and fd
+ * handlers and completes sqes, more of them than fit in the sq ring.
+ */
+static void check_aio_context(AioContext *ctx)
+{
+    Nop nops[192];
+    EventNotifier e;
+    unsigned bhs = 0, completed = 0;
+
+    aio_bh_schedule_oneshot(ctx, count_bh, &bhs);
+    while (!bhs) {
+        aio_poll(ctx, true);
+    }
+
+    events = 0;
+    event_notifier_init(&e, false);
+    aio_set_event_notifier(ctx, &e, event_read, NULL, NULL);
+    event_notifier_set(&e);
+    while (!events) {
+        aio_poll(ctx, true);
+    }
+    aio_set_event_notifier(ctx, &e, NULL, NULL, NULL);
+    event_notifier_cleanup(&e);
+
+    for (int i = 0; i < ARRAY_SIZE(nops); i++) {
+        nops[i] = (Nop) {
+            .cqe_handler.cb = nop_cqe_handler,
+            .completed = &completed,
+        };
+        aio_add_sqe(nop_prep_sqe, NULL, &nops[i].cqe_handler);
+    }
+    while (completed < ARRAY_SIZE(nops)) {
+        aio_poll(ctx, true);
+    }
+}
+
+typedef struct {
+    int cpu;
+    bool has_io_uring;
+    bool sqpoll;
+    char *error;
+} SqpollThread;
+
+/* SQPOLL is set up before an AioContext is used, so do it in a new thread */
+static void *sqpoll_thread(void *opaque)
+{
+    SqpollThread *t = opaque;
+    AioContext *thread_ctx;
+    Error *local_err = NULL;
+
+    rcu_register_thread();
+    thread_ctx = aio_context_new(&error_abort);
+    qemu_set_current_aio_context(thread_ctx);
+
+    t->has_io_uring = aio_has_io_uring();
+    if (t->has_io_uring) {
+        t->sqpoll = aio_context_use_sqpoll(thread_ctx, t->cpu, &local_err);
+        if (local_err) {
+            t->error = g_strdup(error_get_pretty(local_err));
+            error_free(local_err);
+        }
+
+        /* Whether SQPOLL was set up or not, the AioContext keeps working */
+        check_aio_context(thread_ctx);
+    }
+
+    aio_context_unref(thread_ctx);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void run_sqpoll_thread(SqpollThread *t)
+{
+    QemuThread thread;
+
+    qemu_thread_create(&thread, "sqpoll", sqpoll_thread, t,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_join(&thread);
+}
+
+static void test_sqpoll(void)
+{
+    SqpollThread t = { .cpu = -1 };
+
+    run_sqpoll_thread(&t);
+    if (!t.has_io_uring) {
+        g_test_skip("io_uring is not available");
+    } else if (!t.sqpoll) {
+        /* Older kernels only allow SQPOLL with CAP_SYS_ADMIN */
+        g_assert(t.error);
+        g_test_skip(t.error);
+    } else {
+        g_assert_null(t.error);
+    }
+    g_free(t.error);
+}
+
+/* A refused SQPOLL ring leaves the AioContext with its original ring */
+static void test_sqpoll_refused(void)
+{
+    SqpollThread t = { .cpu = INT_MAX };
+
+    run_sqpoll_thread(&t);
+    if (!t.has_io_uring) {
+        g_test_skip("io_uring is not available");
+    } else {
+        g_assert_false(t.sqpoll);
+        g_assert(t.error && strstr(t.error, "SQPOLL"));
+    }
+    g_free(t.error);
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop(&error_fatal);
+    ctx = qemu_get_aio_context();
+    page_size = qemu_real_host_page_size();
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/fdmon-io-uring/fixed-buf/adjacent",
+                    test_fixed_buf_adjacent);
+    g_test_add_func("/fdmon-io-uring/fixed-buf/split", test_fixed_buf_split);
+    g_test_add_func("/fdmon-io-uring/sqpoll", test_sqpoll);
+    g_test_add_func("/fdmon-io-uring/sqpoll/refused", test_sqpoll_refused);
+    return g_test_run();
+}
@@ -0,0 +1,118 @@
+/*
+ * Internet checksum tests
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "net/checksum.h"
+
+#define MAX_OFFSET  64
+
+static uint8_t buffer[64 * 1024 + MAX_OFFSET];
+
+/* The original byte at a time net_checksum_add_cont() */
+static uint32_t checksum_ref(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum1 = 0, sum2 = 0;
+    int i;
+
+    for (i = 0; i < len - 1; i += 2) {
+        sum1 += (uint32_t)buf[i];
+        sum2 += (uint32_t)buf[i + 1];
+    }
+    if (i < len) {
+        sum1 += (uint32_t)buf[i];
+    }
+
+    if (seq & 1) {
+        return sum1 + (sum2 << 8);
+    } else {
+        return sum2 + (sum1 << 8);
+    }
+}
+
+static void check(int len, size_t off, int seq)
+{
+    uint16_t expect = net_checksum_finish(checksum_ref(len, buffer + off, seq));
+    uint16_t got = net_checksum_finish(net_checksum_add_cont(len, buffer + off,
+                                                             seq));
+
+    if (expect != got) {
+        g_test_message("len %d offset %zu seq %d", len, off, seq);
+    }
+    g_assert_cmphex(got, ==, expect);
+}
+
+static void test_lengths(void)
+{
+    size_t off;
+    int len;
+
+    /* Odd and even lengths, at every alignment */
+    for (off = 0; off < MAX_OFFSET; off++) {
+        for (len = 0; len <= 520; len++) {
+            check(len, off, 0);
+            check(len, off, 1);
+        }
+    }
+
+    /* Packet sized buffers, up to the largest IP datagram */
+    for (off = 0; off < 8; off++) {
+        check(1500, off, 0);
+        check(9001, off, 1);
+        check(65535, off, 0);
+        check(65535, off, 1);
+        check(sizeof(buffer) - MAX_OFFSET, off, 0);
+    }
+}
+
+/* A buffer checksummed in two parts gives the same result as in one */
+static void test_split(void)
+{
+    const int len = 1500;
+    uint16_t expect = net_checksum_finish(checksum_ref(len, buffer + 1, 0));
+
+    for (int i = 0; i <= len; i++) {
+        uint32_t sum = net_checksum_add_cont(i, buffer + 1, 0) +
+                       net_checksum_add_cont(len - i, buffer + 1 + i, i);
+
+        g_assert_cmphex(net_checksum_finish(sum), ==, expect);
+    }
+}
+
+/* Buffers of all ones and of pseudo-random bytes */
+static void test_patterns(void)
+{
+    uint32_t x = 1;
+
+    /* Carries out of every lane */
+    memset(buffer, 0xff, sizeof(buffer));
+    test_lengths();
+    test_split();
+
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buffer[i] = x;
+    }
+    test_lengths();
+    test_split();
+}
+
+/* Every implementation the host supports, from the fastest down */
+static void test_accels(void)
+{
+    do {
+        test_patterns();
+    } while (test_net_checksum_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/checksum/accel", test_accels);
+
+    return g_test_run();
+}
@@ -0,0 +1,470 @@
+/*
+ * Generic receive offload tests
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/defer-call.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gro.h"
+
+#define MSS         1000
+#define TYPES       (NET_GRO_TCPV4 | NET_GRO_TCPV6)
+
+typedef struct TestPacket {
+    struct virtio_net_hdr hdr;
+    uint8_t *buf;
+    size_t size;
+} TestPacket;
+
+typedef struct TestGRO {
+    NetGRO *gro;
+    GArray *out;
+    /* the receiver has no room */
+    bool refuse;
+} TestGRO;
+
+static const uint8_t dst_mac[ETH_ALEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+static const uint8_t src_mac[ETH_ALEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x57 };
+
+static bool test_flush(void *opaque, const struct virtio_net_hdr *hdr,
+                       const uint8_t *buf, size_t size)
+{
+    TestGRO *t = opaque;
+    TestPacket pkt = {
+        .hdr = *hdr,
+        .buf = g_memdup2(buf, size),
+        .size = size,
+    };
+
+    if (t->refuse) {
+        g_free(pkt.buf);
+        return false;
+    }
+
+    g_array_append_val(t->out, pkt);
+    return true;
+}
+
+static void test_gro_init(TestGRO *t)
+{
+    t->gro = net_gro_new(test_flush, t);
+    t->out = g_array_new(false, false, sizeof(TestPacket));
+    t->refuse = false;
+}
+
+static void test_gro_cleanup(TestGRO *t)
+{
+    for (unsigned i = 0; i < t->out->len; i++) {
+        g_free(g_array_index(t->out, TestPacket, i).buf);
+    }
+    g_array_free(t->out, true);
+    net_gro_free(t->gro);
+}
+
+static size_t l4_offset(bool ipv6, size_t ip_opt_len)
+{
+    return ETH_HLEN + (ipv6 ? sizeof(struct ip6_header) :
+                              sizeof(struct ip_header) + ip_opt_len);
+}
+
+/* The TCP checksum including the pseudo header, 0 if it is correct */
+static uint16_t tcp_csum(const uint8_t *buf, size_t size, bool ipv6,
+                         size_t l4_off)
+{
+    uint8_t *l3 = (uint8_t *)buf + ETH_HLEN;
+    size_t l4_len = size - l4_off;
+    uint32_t sum = IP_PROTO_TCP + l4_len;
+
+    if (ipv6) {
+        sum += net_checksum_add(2 * sizeof(struct in6_address),
+                                l3 + offsetof(struct ip6_header, ip6_src));
+    } else {
+        sum += net_checksum_add(2 * sizeof(uint32_t),
+                                l3 + offsetof(struct ip_header, ip_src));
+    }
+    return net_checksum_finish(sum +
+                               net_checksum_add(l4_len,
+                                                (uint8_t *)buf + l4_off));
+}
+
+/*
+ * Build a TCP segment from port 1000 to port 2000 whose payload bytes are
+ * the low bytes of their sequence numbers.
+ */
+static size_t build_segment(uint8_t *buf, bool ipv6, size_t ip_opt_len,
+                            uint32_t seq, uint8_t flags, size_t payload_len)
+{
+    struct eth_header *eth = (struct eth_header *)buf;
+    uint8_t *l3 = buf + ETH_HLEN;
+    size_t l4_off = l4_offset(ipv6, ip_opt_len);
+    tcp_header *tcp = (tcp_header *)(buf + l4_off);
+    uint8_t *payload = (uint8_t *)(tcp + 1);
+    size_t l4_len = sizeof(*tcp) + payload_len;
+
+    memset(buf, 0, l4_off + l4_len);
+    memcpy(eth->h_dest, dst_mac, ETH_ALEN);
+    memcpy(eth->h_source, src_mac, ETH_ALEN);
+
+    if (ipv6) {
+        struct ip6_header *ip6 = (struct ip6_header *)l3;
+
+        eth->h_proto = cpu_to_be16(ETH_P_IPV6);
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_flow = cpu_to_be32(0x60000000);
+        ip6->ip6_plen = cpu_to_be16(l4_len);
+        ip6->ip6_nxt = IP_PROTO_TCP;
+        ip6->ip6_ctlun.ip6_un1.ip6_un1_hlim = 64;
+        ip6->ip6_src.s6_addr[0] = 0xfd;
+        ip6->ip6_src.s6_addr[15] = 1;
+        ip6->ip6_dst.s6_addr[0] = 0xfd;
+        ip6->ip6_dst.s6_addr[15] = 2;
+    } else {
+        struct ip_header *ip = (struct ip_header *)l3;
+        size_t ip_hdr_len = l4_off - ETH_HLEN;
+
+        eth->h_proto = cpu_to_be16(ETH_P_IP);
+        ip->ip_ver_len = 0x40 | (ip_hdr_len / 4);
+        ip->ip_len = cpu_to_be16(ip_hdr_len + l4_len);
+        ip->ip_off = cpu_to_be16(IP_DF);
+        ip->ip_ttl = 64;
+        ip->ip_p = IP_PROTO_TCP;
+        ip->ip_src = cpu_to_be32(0x0a000001);
+        ip->ip_dst = cpu_to_be32(0x0a000002);
+        /* No-operation options */
+        memset(ip + 1, 1, ip_opt_len);
+        ip->ip_sum = cpu_to_be16(net_raw_checksum(l3, ip_hdr_len));
+    }
+
+    tcp->th_sport = cpu_to_be16(1000);
+    tcp->th_dport = cpu_to_be16(2000);
+    tcp->th_seq = cpu_to_be32(seq);
+    tcp->th_ack = cpu_to_be32(1);
+    tcp->th_offset_flags = cpu_to_be16((sizeof(*tcp) / 4) << 12 | flags);
+    tcp->th_win = cpu_to_be16(0xffff);
+    for (size_t i = 0; i < payload_len; i++) {
+        payload[i] = seq + i;
+    }
+    tcp->th_sum = cpu_to_be16(tcp_csum(buf, l4_off + l4_len, ipv6, l4_off));
+
+    return l4_off + l4_len;
+}
+
+static NetGROResult receive_segment(TestGRO *t, bool ipv6, uint32_t seq,
+                                    uint8_t flags, size_t payload_len)
+{
+    uint8_t buf[ETH_HLEN + sizeof(struct ip6_header) + sizeof(tcp_header) +
+                MSS];
+    size_t size = build_segment(buf, ipv6, 0, seq, flags, payload_len);
+
+    return net_gro_receive(t->gro, buf, size, TYPES);
+}
+
+static uint32_t packet_seq(const TestPacket *pkt, bool ipv6)
+{
+    const tcp_header *tcp =
+        (const tcp_header *)(pkt->buf + l4_offset(ipv6, 0));
+
+    return be32_to_cpu(tcp->th_seq);
+}
+
+/* Check a packet that was passed on as it was received */
+static void check_unmerged(const TestPacket *pkt, bool ipv6, uint32_t seq)
+{
+    size_t l4_off = l4_offset(ipv6, 0);
+
+    g_assert_cmpint(pkt->hdr.gso_type, ==, VIRTIO_NET_HDR_GSO_NONE);
+    g_assert_cmpint(pkt->hdr.flags, ==, 0);
+    g_assert_cmpint(packet_seq(pkt, ipv6), ==, seq);
+    g_assert_cmpint(tcp_csum(pkt->buf, pkt->size, ipv6, l4_off), ==, 0);
+}
+
+/* Check a coalesced packet that starts at @seq */
+static void check_merged(TestPacket *pkt, bool ipv6, uint32_t seq,
+                         size_t payload_len, uint16_t gso_size)
+{
+    size_t l4_off = l4_offset(ipv6, 0);
+    size_t hdr_len = l4_off + sizeof(tcp_header);
+    uint8_t *l3 = pkt->buf + ETH_HLEN;
+    uint8_t *csum;
+
+    g_assert_cmpint(pkt->size, ==, hdr_len + payload_len);
+    g_assert_cmpint(pkt->hdr.flags, ==, VIRTIO_NET_HDR_F_NEEDS_CSUM);
+    g_assert_cmpint(pkt->hdr.gso_type, ==,
+                    ipv6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4);
+    g_assert_cmpint(pkt->hdr.gso_size, ==, gso_size);
+    g_assert_cmpint(pkt->hdr.hdr_len, ==, hdr_len);
+    g_assert_cmpint(pkt->hdr.csum_start, ==, l4_off);
+    g_assert_cmpint(pkt->hdr.csum_offset, ==, offsetof(tcp_header, th_sum));
+    g_assert_cmpint(packet_seq(pkt, ipv6), ==, seq);
+
+    if (ipv6) {
+        struct ip6_header *ip6 = (struct ip6_header *)l3;
+
+        g_assert_cmpint(be16_to_cpu(ip6->ip6_plen), ==,
+                        pkt->size - l4_off);
+    } else {
+        struct ip_header *ip = (struct ip_header *)l3;
+
+        g_assert_cmpint(be16_to_cpu(ip->ip_len), ==, pkt->size - ETH_HLEN);
+        g_assert_cmpint(net_raw_checksum(l3, sizeof(*ip)), ==, 0);
+    }
+
+    for (size_t i = 0; i < payload_len; i++) {
+        g_assert_cmpint(pkt->buf[hdr_len + i], ==, (uint8_t)(seq + i));
+    }
+
+    /* Complete the checksum like the guest does */
+    csum = pkt->buf + pkt->hdr.csum_start + pkt->hdr.csum_offset;
+    stw_be_p(csum, net_checksum_finish(
+                 net_checksum_add(pkt->size - pkt->hdr.csum_start,
+                                  pkt->buf + pkt->hdr.csum_start)));
+    g_assert_cmpint(tcp_csum(pkt->buf, pkt->size, ipv6, l4_off), ==, 0);
+}
+
+static uint8_t packet_tcp_flags(const TestPacket *pkt, bool ipv6)
+{
+    const tcp_header *tcp =
+        (const tcp_header *)(pkt->buf + l4_offset(ipv6, 0));
+
+    return be16_to_cpu(tcp->th_offset_flags) & 0xff;
+}
+
+static void test_merge(const void *opaque)
+{
+    bool ipv6 = GPOINTER_TO_INT(opaque);
+    TestGRO t;
+
+    test_gro_init(&t);
+
+    defer_call_begin();
+    for (int i = 0; i < 3; i++) {
+        g_assert_cmpint(receive_segment(&t, ipv6, i * MSS, TH_ACK, MSS), ==,
+                        NET_GRO_HELD);
+    }
+    g_assert_cmpint(t.out->len, ==, 0);
+    defer_call_end();
+
+    g_assert_cmpint(t.out->len, ==, 1);
+    check_merged(&g_array_index(t.out, TestPacket, 0), ipv6, 0, 3 * MSS, MSS);
+
+    test_gro_cleanup(&t);
+}
+
+/* A lone segment is passed on unchanged at the end of the batch */
+static void test_single(void)
+{
+    TestGRO t;
+
+    test_gro_init(&t);
+
+    defer_call_begin();
+    g_assert_cmpint(receive_segment(&t, false, 0, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    defer_call_end();
+
+    g_assert_cmpint(t.out->len, ==, 1);
+    check_unmerged(&g_array_index(t.out, TestPacket, 0), false, 0);
+
+    test_gro_cleanup(&t);
+}
+
+/* Flow types that were not requested, and IPv4 options, are not merged */
+static void test_bypass(void)
+{
+    uint8_t buf[ETH_HLEN + sizeof(struct ip6_header) + sizeof(tcp_header) +
+                MSS];
+    TestGRO t;
+    size_t size;
+
+    test_gro_init(&t);
+
+    defer_call_begin();
+
+    size = build_segment(buf, true, 0, 0, TH_ACK, MSS);
+    g_assert_cmpint(net_gro_receive(t.gro, buf, size, NET_GRO_TCPV4), ==,
+                    NET_GRO_BYPASS);
+
+    /* Held packets of the flow are flushed before the caller delivers */
+    g_assert_cmpint(receive_segment(&t, false, 0, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    size = build_segment(buf, false, 4, MSS, TH_ACK, MSS);
+    g_assert_cmpint(net_gro_receive(t.gro, buf, size, TYPES), ==,
+                    NET_GRO_BYPASS);
+    g_assert_cmpint(t.out->len, ==, 1);
+
+    defer_call_end();
+
+    g_assert_cmpint(t.out->len, ==, 1);
+    check_unmerged(&g_array_index(t.out, TestPacket, 0), false, 0);
+
+    test_gro_cleanup(&t);
+}
+
+static void test_bad_csum(void)
+{
+    uint8_t buf[ETH_HLEN + sizeof(struct ip_header) + sizeof(tcp_header) +
+                MSS];
+    TestGRO t;
+    size_t size;
+
+    test_gro_init(&t);
+
+    size = build_segment(buf, false, 0, 0, TH_ACK, MSS);
+    buf[size - 1] ^= 1;
+    g_assert_cmpint(net_gro_receive(t.gro, buf, size, TYPES), ==,
+                    NET_GRO_BYPASS);
+    g_assert_cmpint(t.out->len, ==, 0);
+
+    test_gro_cleanup(&t);
+}
+
+/* Segments that do not follow the held ones are passed on unmerged */
+static void test_out_of_order(void)
+{
+    static const uint32_t seqs[] = { 0, 2 * MSS, MSS };
+    TestGRO t;
+
+    test_gro_init(&t);
+
+    defer_call_begin();
+    for (int i = 0; i < ARRAY_SIZE(seqs); i++) {
+        g_assert_cmpint(receive_segment(&t, false, seqs[i], TH_ACK, MSS), ==,
+                        NET_GRO_HELD);
+        /* Each one flushes the previous one */
+        g_assert_cmpint(t.out->len, ==, i);
+    }
+    defer_call_end();
+
+    g_assert_cmpint(t.out->len, ==, ARRAY_SIZE(seqs));
+    for (int i = 0; i < ARRAY_SIZE(seqs); i++) {
+        check_unmerged(&g_array_index(t.out, TestPacket, i), false, seqs[i]);
+    }
+
+    test_gro_cleanup(&t);
+}
+
+/* PSH ends the burst right away and is kept in the merged packet */
+static void test_psh(void)
+{
+    TestGRO t;
+    TestPacket *pkt;
+
+    test_gro_init(&t);
+
+    defer_call_begin();
+    g_assert_cmpint(receive_segment(&t, true, 0, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    g_assert_cmpint(receive_segment(&t, true, MSS, TH_ACK | TH_PUSH, MSS), ==,
+                    NET_GRO_HELD);
+    g_assert_cmpint(t.out->len, ==, 1);
+    defer_call_end();
+
+    g_assert_cmpint(t.out->len, ==, 1);
+    pkt = &g_array_index(t.out, TestPacket, 0);
+    g_assert_cmpint(packet_tcp_flags(pkt, true), ==, TH_ACK | TH_PUSH);
+    check_merged(pkt, true, 0, 2 * MSS, MSS);
+
+    test_gro_cleanup(&t);
+}
+
+/* FIN cannot be merged; the held segments go first */
+static void test_fin(void)
+{
+    TestGRO t;
+
+    test_gro_init(&t);
+
+    defer_call_begin();
+    g_assert_cmpint(receive_segment(&t, false, 0, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    g_assert_cmpint(receive_segment(&t, false, MSS, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    g_assert_cmpint(receive_segment(&t, false, 2 * MSS, TH_ACK | TH_FIN, MSS),
+                    ==, NET_GRO_BYPASS);
+    g_assert_cmpint(t.out->len, ==, 1);
+    defer_call_end();
+
+    check_merged(&g_array_index(t.out, TestPacket, 0), false, 0, 2 * MSS, MSS);
+
+    test_gro_cleanup(&t);
+}
+
+/* A segment shorter than the first one ends the burst */
+static void test_short_segment(void)
+{
+    TestGRO t;
+
+    test_gro_init(&t);
+
+    defer_call_begin();
+    g_assert_cmpint(receive_segment(&t, false, 0, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    g_assert_cmpint(receive_segment(&t, false, MSS, TH_ACK, MSS / 2), ==,
+                    NET_GRO_HELD);
+    g_assert_cmpint(t.out->len, ==, 1);
+    defer_call_end();
+
+    check_merged(&g_array_index(t.out, TestPacket, 0), false, 0,
+                 MSS + MSS / 2, MSS);
+
+    test_gro_cleanup(&t);
+}
+
+/* Packets that the receiver refuses are held until it has room */
+static void test_stall(void)
+{
+    TestGRO t;
+
+    test_gro_init(&t);
+    t.refuse = true;
+
+    defer_call_begin();
+    g_assert_cmpint(receive_segment(&t, false, 0, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    g_assert_cmpint(receive_segment(&t, false, MSS, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    defer_call_end();
+
+    g_assert_cmpint(t.out->len, ==, 0);
+    g_assert_cmpint(receive_segment(&t, false, 2 * MSS, TH_ACK, MSS), ==,
+                    NET_GRO_BUSY);
+    g_assert_false(net_gro_flush(t.gro));
+
+    t.refuse = false;
+    g_assert_true(net_gro_flush(t.gro));
+    g_assert_cmpint(t.out->len, ==, 1);
+    check_merged(&g_array_index(t.out, TestPacket, 0), false, 0, 2 * MSS, MSS);
+
+    /* The refused segment is offered again */
+    defer_call_begin();
+    g_assert_cmpint(receive_segment(&t, false, 2 * MSS, TH_ACK, MSS), ==,
+                    NET_GRO_HELD);
+    defer_call_end();
+
+    g_assert_cmpint(t.out->len, ==, 2);
+    check_unmerged(&g_array_index(t.out, TestPacket, 1), false, 2 * MSS);
+
+    test_gro_cleanup(&t);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/net/gro/merge/ipv4", GINT_TO_POINTER(false),
+                         test_merge);
+    g_test_add_data_func("/net/gro/merge/ipv6", GINT_TO_POINTER(true),
+                         test_merge);
+    g_test_add_func("/net/gro/single", test_single);
+    g_test_add_func("/net/gro/bypass", test_bypass);
+    g_test_add_func("/net/gro/bad-csum", test_bad_csum);
+    g_test_add_func("/net/gro/out-of-order", test_out_of_order);
+    g_test_add_func("/net/gro/psh", test_psh);
+    g_test_add_func("/net/gro/fin", test_fin);
+    g_test_add_func("/net/gro/short-segment", test_short_segment);
+    g_test_add_func("/net/gro/stall", test_stall);
+
+    return g_test_run();
+}
@@ -0,0 +1,286 @@
+/*
+ * NetQueue tests
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "net/net.h"
+#include "net/queue.h"
+
+/* Each packet carries its sequence number */
+typedef struct TestQueue {
+    NetQueue *queue;
+    /* packets the receiver takes before it is full, -1 for no limit */
+    int budget;
+    GArray *delivered;
+    GArray *sent;
+} TestQueue;
+
+static TestQueue tq;
+static NetClientState sender_a, sender_b;
+
+/* net/queue.c is linked without net/net.c */
+int qemu_can_send_packet(NetClientState *sender)
+{
+    return 1;
+}
+
+static ssize_t test_deliver(NetClientState *sender, unsigned flags,
+                            const struct iovec *iov, int iovcnt,
+                            void *opaque)
+{
+    size_t size = iov_size(iov, iovcnt);
+    uint32_t seq;
+
+    if (!tq.budget) {
+        return 0;
+    }
+    if (tq.budget > 0) {
+        tq.budget--;
+    }
+
+    g_assert_cmpuint(size, >=, sizeof(seq));
+    iov_to_buf(iov, iovcnt, 0, &seq, sizeof(seq));
+    g_array_append_val(tq.delivered, seq);
+    return size;
+}
+
+static void test_sent(NetClientState *sender, ssize_t ret)
+{
+    g_array_append_val(tq.sent, sender);
+}
+
+static void test_queue_init(uint32_t len)
+{
+    tq.queue = qemu_new_net_queue(test_deliver, NULL);
+    if (len) {
+        g_assert(qemu_net_queue_set_len(tq.queue, len));
+    }
+    tq.budget = -1;
+    tq.delivered = g_array_new(false, false, sizeof(uint32_t));
+    tq.sent = g_array_new(false, false, sizeof(NetClientState *));
+}
+
+static void test_queue_cleanup(void)
+{
+    qemu_del_net_queue(tq.queue);
+    g_array_free(tq.delivered, true);
+    g_array_free(tq.sent, true);
+}
+
+static ssize_t test_send(NetClientState *sender, uint32_t seq, size_t size,
+                         NetPacketSent *sent_cb)
+{
+    g_autofree uint8_t *buf = g_malloc0(size);
+
+    memcpy(buf, &seq, sizeof(seq));
+    return qemu_net_queue_send(tq.queue, sender, 0, buf, size, sent_cb);
+}
+
+static void check_delivered(const uint32_t *seq, unsigned n)
+{
+    g_assert_cmpuint(tq.delivered->len, ==, n);
+    for (unsigned i = 0; i < n; i++) {
+        g_assert_cmpuint(g_array_index(tq.delivered, uint32_t, i), ==, seq[i]);
+    }
+    g_array_set_size(tq.delivered, 0);
+}
+
+static void check_delivered_range(uint32_t first, uint32_t n)
+{
+    g_assert_cmpuint(tq.delivered->len, ==, n);
+    for (uint32_t i = 0; i < n; i++) {
+        g_assert_cmpuint(g_array_index(tq.delivered, uint32_t, i), ==,
+                         first + i);
+    }
+    g_array_set_size(tq.delivered, 0);
+}
+
+static void test_default_len(void)
+{
+    test_queue_init(0);
+    g_assert_cmpuint(qemu_net_queue_get_len(tq.queue), ==,
+                     NET_QUEUE_DEFAULT_LEN);
+    test_queue_cleanup();
+}
+
+/* The ring grows from its initial size while keeping the order */
+static void test_grow(void)
+{
+    uint32_t seq;
+
+    test_queue_init(0);
+    tq.budget = 0;
+    for (seq = 0; seq < 1000; seq++) {
+        g_assert_cmpint(test_send(&sender_a, seq, 64, NULL), ==, 0);
+    }
+    tq.budget = -1;
+    g_assert(qemu_net_queue_flush(tq.queue));
+    check_delivered_range(0, 1000);
+    g_assert_cmpuint(qemu_net_queue_get_dropped(tq.queue), ==, 0);
+    test_queue_cleanup();
+}
+
+/* Packets keep their order when the ring wraps around */
+static void test_wraparound(void)
+{
+    uint32_t seq = 0, next = 0;
+
+    test_queue_init(8);
+    tq.budget = 0;
+    test_send(&sender_a, seq++, 100, NULL);
+    test_send(&sender_a, seq++, 100, NULL);
+    for (int round = 0; round < 10; round++) {
+        /* Queue 5 packets, the receiver then takes 5 and leaves 2 */
+        tq.budget = 0;
+        for (int i = 0; i < 5; i++) {
+            g_assert_cmpint(test_send(&sender_a, seq++, 100 + round, NULL),
+                            ==, 0);
+        }
+        tq.budget = 5;
+        g_assert(!qemu_net_queue_flush(tq.queue));
+        check_delivered_range(next, 5);
+        next += 5;
+    }
+    tq.budget = -1;
+    g_assert(qemu_net_queue_flush(tq.queue));
+    check_delivered_range(next, seq - next);
+    g_assert_cmpuint(qemu_net_queue_get_dropped(tq.queue), ==, 0);
+    test_queue_cleanup();
+}
+
+/* Purging compacts the ring and keeps the order of the other packets */
+static void test_purge(void)
+{
+    static const uint32_t expect[] = { 1, 3, 5, 10, 11, 12 };
+
+    test_queue_init(8);
+    tq.budget = 0;
+
+    /* Move head away from slot 0 */
+    test_send(&sender_b, 100, 64, NULL);
+    test_send(&sender_b, 101, 64, NULL);
+    tq.budget = 2;
+    g_assert(qemu_net_queue_flush(tq.queue));
+    g_array_set_size(tq.delivered, 0);
+
+    for (uint32_t seq = 0; seq < 6; seq++) {
+        test_send(seq & 1 ? &sender_b : &sender_a, seq, 64, test_sent);
+    }
+    qemu_net_queue_purge(tq.queue, &sender_a);
+    g_assert_cmpuint(tq.sent->len, ==, 3);
+    for (unsigned i = 0; i < tq.sent->len; i++) {
+        g_assert(g_array_index(tq.sent, NetClientState *, i) == &sender_a);
+    }
+    g_array_set_size(tq.sent, 0);
+
+    /* The freed slots are reused behind the remaining packets */
+    for (uint32_t seq = 10; seq < 13; seq++) {
+        test_send(&sender_b, seq, 64, NULL);
+    }
+    tq.budget = -1;
+    g_assert(qemu_net_queue_flush(tq.queue));
+    check_delivered(expect, ARRAY_SIZE(expect));
+    g_assert_cmpuint(tq.sent->len, ==, 3);
+    test_queue_cleanup();
+}
+
+/*
+ * Packets with a sent callback overflow the ring instead of being
+ * dropped, and are delivered after it in order.
+ */
+static void test_overflow(void)
+{
+    uint32_t seq;
+
+    test_queue_init(4);
+    tq.budget = 0;
+    for (seq = 0; seq < 8; seq++) {
+        g_assert_cmpint(test_send(&sender_a, seq, 64, test_sent), ==, 0);
+    }
+    g_assert_cmpuint(qemu_net_queue_get_dropped(tq.queue), ==, 0);
+
+    /* The ring has room again, but the overflow list goes first */
+    tq.budget = 2;
+    g_assert(!qemu_net_queue_flush(tq.queue));
+    check_delivered_range(0, 2);
+    test_send(&sender_a, seq++, 64, test_sent);
+
+    /* Stop while delivering from the overflow list */
+    tq.budget = 4;
+    g_assert(!qemu_net_queue_flush(tq.queue));
+    check_delivered_range(2, 4);
+    test_send(&sender_a, seq++, 64, test_sent);
+
+    tq.budget = -1;
+    g_assert(qemu_net_queue_flush(tq.queue));
+    check_delivered_range(6, seq - 6);
+    g_assert_cmpuint(tq.sent->len, ==, seq);
+    test_queue_cleanup();
+}
+
+/* Packets without a sent callback are dropped and counted */
+static void test_drop(void)
+{
+    uint32_t seq;
+
+    test_queue_init(4);
+    tq.budget = 0;
+    for (seq = 0; seq < 7; seq++) {
+        test_send(&sender_a, seq, 64, NULL);
+    }
+    g_assert_cmpuint(qemu_net_queue_get_dropped(tq.queue), ==, 3);
+
+    /* The queue is full, but packets with a callback are still kept */
+    test_send(&sender_a, seq++, 64, test_sent);
+    g_assert_cmpuint(qemu_net_queue_get_dropped(tq.queue), ==, 3);
+
+    tq.budget = -1;
+    g_assert(qemu_net_queue_flush(tq.queue));
+    check_delivered((const uint32_t[]) { 0, 1, 2, 3, 7 }, 5);
+    g_assert_cmpuint(tq.sent->len, ==, 1);
+
+    /* The length can only change on an empty queue */
+    tq.budget = 0;
+    test_send(&sender_a, seq++, 64, NULL);
+    g_assert(!qemu_net_queue_set_len(tq.queue, 16));
+    qemu_net_queue_purge(tq.queue, &sender_a);
+    g_assert(qemu_net_queue_set_len(tq.queue, 16));
+    g_assert_cmpuint(qemu_net_queue_get_dropped(tq.queue), ==, 3);
+    test_queue_cleanup();
+}
+
+/* Slots keep working when packet sizes change */
+static void test_sizes(void)
+{
+    static const size_t sizes[] = { 64, 65550, 1514, 9014, 64, 65550 };
+    uint32_t seq = 0;
+
+    test_queue_init(4);
+    for (int round = 0; round < 4; round++) {
+        tq.budget = 0;
+        for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+            test_send(&sender_a, seq++, sizes[(i + round) % ARRAY_SIZE(sizes)],
+                      test_sent);
+        }
+        tq.budget = -1;
+        g_assert(qemu_net_queue_flush(tq.queue));
+        check_delivered_range(seq - ARRAY_SIZE(sizes), ARRAY_SIZE(sizes));
+    }
+    test_queue_cleanup();
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/queue/default-len", test_default_len);
+    g_test_add_func("/net/queue/grow", test_grow);
+    g_test_add_func("/net/queue/wraparound", test_wraparound);
+    g_test_add_func("/net/queue/purge", test_purge);
+    g_test_add_func("/net/queue/overflow", test_overflow);
+    g_test_add_func("/net/queue/drop", test_drop);
+    g_test_add_func("/net/queue/sizes", test_sizes);
+    return g_test_run();
+}
@@ -0,0 +1,163 @@
+/*
+ * Toeplitz hash tests
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "net/checksum.h"
+
+#define KEY_LEN (NET_TOEPLITZ_MAX_INPUT + 4)
+
+/* Key of the Microsoft RSS hash verification suite */
+static const uint8_t ms_key[KEY_LEN] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+typedef struct {
+    uint8_t src[4];
+    uint8_t dst[4];
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t hash_ip;
+    uint32_t hash_tcp;
+} TestIPv4;
+
+static const TestIPv4 ms_ipv4[] = {
+    { { 66, 9, 149, 187 }, { 161, 142, 100, 80 }, 2794, 1766,
+      0x323e8fc2, 0x51ccc178 },
+    { { 199, 92, 111, 2 }, { 65, 69, 140, 83 }, 14230, 4739,
+      0xd718262a, 0xc626b0ea },
+    { { 24, 19, 198, 95 }, { 12, 22, 207, 184 }, 12898, 38024,
+      0xd2d0a5de, 0x5c2b394a },
+    { { 38, 27, 205, 30 }, { 209, 142, 163, 6 }, 48228, 2217,
+      0x82989176, 0xafc7327f },
+    { { 153, 39, 163, 191 }, { 202, 188, 127, 2 }, 44251, 1303,
+      0x5d1809c5, 0x10e828a2 },
+};
+
+typedef struct {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t hash_ip;
+    uint32_t hash_tcp;
+} TestIPv6;
+
+static const TestIPv6 ms_ipv6[] = {
+    /* 3ffe:2501:200:1fff::7 -> 3ffe:2501:200:3::1 */
+    { { 0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x1f, 0xff,
+        0, 0, 0, 0, 0, 0, 0, 0x07 },
+      { 0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x00, 0x03,
+        0, 0, 0, 0, 0, 0, 0, 0x01 },
+      2794, 1766, 0x2cc18cd5, 0x40207d3d },
+    /* 3ffe:501:8::260:97ff:fe40:efab -> ff02::1 */
+    { { 0x3f, 0xfe, 0x05, 0x01, 0x00, 0x08, 0, 0,
+        0x02, 0x60, 0x97, 0xff, 0xfe, 0x40, 0xef, 0xab },
+      { 0xff, 0x02, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0x01 },
+      14230, 4739, 0x0f0c461c, 0xdde51bbf },
+    /* 3ffe:1900:4545:3:200:f8ff:fe21:67cf -> fe80::200:f8ff:fe21:67cf */
+    { { 0x3f, 0xfe, 0x19, 0x00, 0x45, 0x45, 0x00, 0x03,
+        0x02, 0x00, 0xf8, 0xff, 0xfe, 0x21, 0x67, 0xcf },
+      { 0xfe, 0x80, 0, 0, 0, 0, 0, 0,
+        0x02, 0x00, 0xf8, 0xff, 0xfe, 0x21, 0x67, 0xcf },
+      44251, 38024, 0x4b61e985, 0x02d1feef },
+};
+
+/* The bit at a time hash used by e1000e and igb */
+static uint32_t toeplitz_ref(const uint8_t *key_bytes, const uint8_t *input,
+                             uint32_t len)
+{
+    uint8_t key_copy[KEY_LEN];
+    uint8_t input_copy[NET_TOEPLITZ_MAX_INPUT];
+    net_toeplitz_key key;
+    uint32_t result = 0;
+
+    memcpy(key_copy, key_bytes, sizeof(key_copy));
+    memcpy(input_copy, input, len);
+    net_toeplitz_key_init(&key, key_copy);
+    net_toeplitz_add(&result, input_copy, len, &key);
+    return result;
+}
+
+/* Check the table and the bitwise hash of @input against @expect */
+static void check(const NetToeplitzTable *table, const uint8_t *input,
+                  uint32_t len, uint32_t expect)
+{
+    g_assert_cmphex(net_toeplitz_table_hash(table, input, len), ==, expect);
+    g_assert_cmphex(toeplitz_ref(ms_key, input, len), ==, expect);
+}
+
+static void test_ms_vectors(void)
+{
+    g_autofree NetToeplitzTable *table = g_new(NetToeplitzTable, 1);
+    uint8_t input[NET_TOEPLITZ_MAX_INPUT];
+    int i;
+
+    net_toeplitz_table_init(table, ms_key);
+
+    for (i = 0; i < ARRAY_SIZE(ms_ipv4); i++) {
+        const TestIPv4 *t = &ms_ipv4[i];
+
+        memcpy(input, t->src, 4);
+        memcpy(input + 4, t->dst, 4);
+        stw_be_p(input + 8, t->sport);
+        stw_be_p(input + 10, t->dport);
+        check(table, input, 8, t->hash_ip);
+        check(table, input, 12, t->hash_tcp);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(ms_ipv6); i++) {
+        const TestIPv6 *t = &ms_ipv6[i];
+
+        memcpy(input, t->src, 16);
+        memcpy(input + 16, t->dst, 16);
+        stw_be_p(input + 32, t->sport);
+        stw_be_p(input + 34, t->dport);
+        check(table, input, 32, t->hash_ip);
+        check(table, input, 36, t->hash_tcp);
+    }
+}
+
+static void fill_random(uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = g_test_rand_int_range(0, 256);
+    }
+}
+
+/* Random keys and inputs of every length up to the longest one */
+static void test_random(void)
+{
+    g_autofree NetToeplitzTable *table = g_new(NetToeplitzTable, 1);
+    uint8_t key[KEY_LEN];
+    uint8_t input[NET_TOEPLITZ_MAX_INPUT];
+
+    for (int k = 0; k < 64; k++) {
+        fill_random(key, sizeof(key));
+        net_toeplitz_table_init(table, key);
+
+        for (uint32_t len = 0; len <= NET_TOEPLITZ_MAX_INPUT; len++) {
+            for (int i = 0; i < 16; i++) {
+                fill_random(input, len);
+                g_assert_cmphex(net_toeplitz_table_hash(table, input, len),
+                                ==, toeplitz_ref(key, input, len));
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/toeplitz/ms-vectors", test_ms_vectors);
+    g_test_add_func("/net/toeplitz/random", test_random);
+    return g_test_run();
+}
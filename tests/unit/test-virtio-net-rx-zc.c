@@ -0,0 +1,147 @@
+/*
+ * virtio-net zero-copy receive buffer ring tests
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "hw/virtio/virtio-net-rx-zc.h"
+
+#define RING_SIZE 8
+
+static void *slots[RING_SIZE];
+static char elems[4 * RING_SIZE];
+
+static VirtIONetRxZcRing ring_new(unsigned int head)
+{
+    memset(slots, 0, sizeof(slots));
+    return (VirtIONetRxZcRing) {
+        .slots = slots,
+        .size = RING_SIZE,
+        .head = head,
+    };
+}
+
+/* Posts buffers like virtio_net_rx_zc_add(), returns the slot used */
+static unsigned int post(VirtIONetRxZcRing *r, void *elem)
+{
+    unsigned int slot = virtio_net_rx_zc_ring_tail(r);
+
+    g_assert_false(virtio_net_rx_zc_ring_full(r));
+    virtio_net_rx_zc_ring_push(r, elem);
+    g_assert(r->slots[slot] == elem);
+    return slot;
+}
+
+static void test_in_order(void)
+{
+    VirtIONetRxZcRing r = ring_new(RING_SIZE - 3);
+    unsigned int slot[RING_SIZE];
+
+    for (int i = 0; i < RING_SIZE; i++) {
+        slot[i] = post(&r, &elems[i]);
+    }
+    g_assert(virtio_net_rx_zc_ring_full(&r));
+    g_assert_cmpuint(slot[3], ==, 0);
+
+    for (int i = 0; i < RING_SIZE; i++) {
+        g_assert(virtio_net_rx_zc_ring_take(&r, slot[i]));
+        g_assert_cmpuint(r.num, ==, RING_SIZE - i - 1);
+        g_assert_cmpuint(r.head, ==, (slot[i] + 1) % RING_SIZE);
+    }
+}
+
+/*
+ * A buffer completed out of order leaves a hole.  The ring stays full,
+ * and the tail slot still holds a posted buffer, until the buffers
+ * before the hole complete too.
+ */
+static void test_out_of_order(void)
+{
+    VirtIONetRxZcRing r = ring_new(5);
+    unsigned int slot[RING_SIZE];
+
+    for (int i = 0; i < RING_SIZE; i++) {
+        slot[i] = post(&r, &elems[i]);
+    }
+
+    g_assert_false(virtio_net_rx_zc_ring_take(&r, slot[2]));
+    g_assert_false(virtio_net_rx_zc_ring_take(&r, slot[7]));
+    g_assert(virtio_net_rx_zc_ring_full(&r));
+    g_assert(r.slots[virtio_net_rx_zc_ring_tail(&r)] == &elems[0]);
+    g_assert(r.slots[slot[1]] == &elems[1]);
+
+    /* Completing the oldest buffer skips the hole behind the next one */
+    g_assert(virtio_net_rx_zc_ring_take(&r, slot[0]));
+    g_assert_cmpuint(r.num, ==, RING_SIZE - 1);
+    g_assert(virtio_net_rx_zc_ring_take(&r, slot[1]));
+    g_assert_cmpuint(r.num, ==, RING_SIZE - 3);
+    g_assert_cmpuint(r.head, ==, slot[3]);
+
+    /* The freed slots are reused without touching the posted buffers */
+    for (int i = 0; i < 3; i++) {
+        post(&r, &elems[RING_SIZE + i]);
+    }
+    g_assert(virtio_net_rx_zc_ring_full(&r));
+    for (int i = 3; i < 7; i++) {
+        g_assert(r.slots[slot[i]] == &elems[i]);
+    }
+
+    /* The hole at the end of the ring is skipped once reached */
+    for (int i = 3; i < 7; i++) {
+        g_assert(virtio_net_rx_zc_ring_take(&r, slot[i]));
+    }
+    g_assert_cmpuint(r.num, ==, 3);
+    g_assert(r.slots[r.head] == &elems[RING_SIZE]);
+}
+
+/* Random completion order against a model of the posted buffers */
+static void test_random(void)
+{
+    VirtIONetRxZcRing r = ring_new(0);
+    bool posted[ARRAY_SIZE(elems)] = { false };
+    unsigned int next = 0, completed = 0;
+
+    while (completed < 4096) {
+        if (!virtio_net_rx_zc_ring_full(&r) && g_test_rand_int_range(0, 2)) {
+            unsigned int e = next;
+
+            while (posted[e]) {
+                e = (e + 1) % ARRAY_SIZE(elems);
+            }
+            next = (e + 1) % ARRAY_SIZE(elems);
+            posted[e] = true;
+            post(&r, &elems[e]);
+        } else if (r.num) {
+            unsigned int slot;
+
+            do {
+                slot = (r.head + g_test_rand_int_range(0, r.num)) % r.size;
+            } while (!r.slots[slot]);
+
+            posted[(char *)r.slots[slot] - elems] = false;
+            virtio_net_rx_zc_ring_take(&r, slot);
+            completed++;
+        }
+
+        /* Every posted buffer is in the ring exactly once */
+        for (unsigned int e = 0; e < ARRAY_SIZE(elems); e++) {
+            unsigned int found = 0;
+
+            for (unsigned int i = 0; i < r.num; i++) {
+                found += r.slots[(r.head + i) % r.size] == &elems[e];
+            }
+            g_assert_cmpuint(found, ==, posted[e]);
+        }
+        g_assert(!r.num || r.slots[r.head]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/virtio-net/rx-zc/in-order", test_in_order);
+    g_test_add_func("/virtio-net/rx-zc/out-of-order", test_out_of_order);
+    g_test_add_func("/virtio-net/rx-zc/random", test_random);
+    return g_test_run();
+}
@@ -46,20 +46,68 @@
 #include "qemu/osdep.h"
 #include <poll.h>
 #include "qapi/error.h"
+#include "qemu/bitmap.h"
 #include "qemu/defer-call.h"
+#include "qemu/lockable.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/units.h"
+#include "block/aio-wait.h"
 #include "aio-posix.h"
 #include "trace.h"
 
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
 
+    /* Milliseconds before an idle SQPOLL kernel thread goes to sleep */
+    FDMON_IO_URING_SQPOLL_IDLE_MS = 1000,
+
     /* AioHandler::flags */
     FDMON_IO_URING_PENDING            = (1 << 0),
     FDMON_IO_URING_ADD                = (1 << 1),
     FDMON_IO_URING_REMOVE             = (1 << 2),
     FDMON_IO_URING_DELETE_AIO_HANDLER = (1 << 3),
+
+    /* Registered buffer table size and number of aio_register_fixed_buf() */
+    FDMON_IO_URING_FIXED_BUF_SLOTS   = 1024,
+    FDMON_IO_URING_FIXED_BUF_REGIONS = 32,
+};
+
+/* The kernel refuses to register buffers larger than this */
+#define FDMON_IO_URING_FIXED_BUF_SLOT_SIZE (1 * GiB)
+
+/*
+ * A memory area passed to aio_register_fixed_buf(). It takes up consecutive
+ * slots of the registered buffer table, starting at @first_slot. @id is unique
+ * per registration so that an area registered again at the same address is
+ * not mistaken for the stale one.
+ */
+struct FdmonFixedBuf {
+    uint64_t id;
+    void *host;
+    size_t size;
+    unsigned first_slot;
+    unsigned refcnt; /* only used in fixed_bufs[] */
 };
+typedef struct FdmonFixedBuf FdmonFixedBuf;
+
+/*
+ * Memory areas that every AioContext should register. Each AioContext keeps a
+ * copy of what its ring actually has in ctx->fixed_bufs and catches up with
+ * fixed_bufs[] in its own thread when fixed_bufs_gen changes.
+ */
+static QemuMutex fixed_bufs_lock;
+static FdmonFixedBuf fixed_bufs[FDMON_IO_URING_FIXED_BUF_REGIONS];
+static DECLARE_BITMAP(fixed_buf_slots, FDMON_IO_URING_FIXED_BUF_SLOTS);
+static unsigned fixed_bufs_gen;
+static uint64_t fixed_buf_next_id = 1;
+
+/* AioContexts with a registered buffer table, protected by fixed_bufs_lock */
+static GSList *fixed_bufs_ctxs;
+
+static void __attribute__((__constructor__)) fixed_bufs_init(void)
+{
+    qemu_mutex_init(&fixed_bufs_lock);
+}
 
 static inline int poll_events_from_pfd(int pfd_events)
 {
@@ -98,6 +146,11 @@ static struct io_uring_sqe *get_sqe(AioContext *ctx)
 
     assert(ret > 1);
     sqe = io_uring_get_sqe(ring);
+    while (!sqe && (ring->flags & IORING_SETUP_SQPOLL)) {
+        /* The kernel thread has not consumed the sqes yet */
+        io_uring_sqring_wait(ring);
+        sqe = io_uring_get_sqe(ring);
+    }
     assert(sqe);
     return sqe;
 }
@@ -453,6 +506,362 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
     return false;
 }
 
+static unsigned fixed_buf_nr_slots(const FdmonFixedBuf *buf)
+{
+    return DIV_ROUND_UP(buf->size, FDMON_IO_URING_FIXED_BUF_SLOT_SIZE);
+}
+
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+/* Fill in (@add is true) or clear the slots of @buf in @ctx's ring */
+static bool fixed_buf_update(AioContext *ctx, const FdmonFixedBuf *buf,
+                             bool add)
+{
+    unsigned nr_slots = fixed_buf_nr_slots(buf);
+    g_autofree struct iovec *iov = g_new0(struct iovec, nr_slots);
+    int ret;
+
+    if (add) {
+        for (unsigned i = 0; i < nr_slots; i++) {
+            size_t offset = (size_t)i * FDMON_IO_URING_FIXED_BUF_SLOT_SIZE;
+
+            iov[i].iov_base = (uint8_t *)buf->host + offset;
+            iov[i].iov_len = MIN(buf->size - offset,
+                                 FDMON_IO_URING_FIXED_BUF_SLOT_SIZE);
+        }
+    }
+
+    ret = io_uring_register_buffers_update_tag(&ctx->fdmon_io_uring,
+                                               buf->first_slot, iov, NULL,
+                                               nr_slots);
+    trace_fdmon_io_uring_fixed_buf_update(ctx, buf->host, buf->size,
+                                          buf->first_slot, add, ret);
+    if (ret == nr_slots) {
+        return true;
+    }
+
+    if (add && ret != 0) {
+        /* Don't leave the slots that were filled in behind */
+        memset(iov, 0, nr_slots * sizeof(iov[0]));
+        io_uring_register_buffers_update_tag(&ctx->fdmon_io_uring,
+                                             buf->first_slot, iov, NULL,
+                                             nr_slots);
+    }
+    return false;
+}
+
+/* Bring ctx->fixed_bufs in line with fixed_bufs[] */
+static void fixed_bufs_sync(AioContext *ctx)
+{
+    QEMU_LOCK_GUARD(&fixed_bufs_lock);
+
+    for (int i = 0; i < ARRAY_SIZE(fixed_bufs); i++) {
+        FdmonFixedBuf *want = &fixed_bufs[i];
+        FdmonFixedBuf *have = &ctx->fixed_bufs[i];
+
+        if (have->id == want->id) {
+            continue;
+        }
+
+        if (have->host) {
+            fixed_buf_update(ctx, have, false);
+            *have = (FdmonFixedBuf){};
+        }
+
+        if (want->host && fixed_buf_update(ctx, want, true)) {
+            have->id = want->id;
+            have->host = want->host;
+            have->size = want->size;
+            have->first_slot = want->first_slot;
+        }
+    }
+
+    ctx->fixed_bufs_gen = fixed_bufs_gen;
+}
+#else
+static void fixed_bufs_sync(AioContext *ctx)
+{
+    g_assert_not_reached(); /* ctx->fixed_bufs is always NULL */
+}
+#endif /* HAVE_IO_URING_REGISTER_BUFFERS_SPARSE */
+
+void aio_register_fixed_buf(void *host, size_t size)
+{
+    FdmonFixedBuf *free_buf = NULL;
+    FdmonFixedBuf new_buf = {
+        .host = host,
+        .size = size,
+        .refcnt = 1,
+    };
+    unsigned nr_slots = fixed_buf_nr_slots(&new_buf);
+
+    QEMU_LOCK_GUARD(&fixed_bufs_lock);
+
+    for (int i = 0; i < ARRAY_SIZE(fixed_bufs); i++) {
+        FdmonFixedBuf *buf = &fixed_bufs[i];
+
+        if (buf->host == host && buf->size == size) {
+            buf->refcnt++;
+            return;
+        }
+
+        if (!buf->host && !free_buf) {
+            free_buf = buf;
+        }
+    }
+
+    new_buf.first_slot =
+        bitmap_find_next_zero_area(fixed_buf_slots,
+                                   FDMON_IO_URING_FIXED_BUF_SLOTS,
+                                   0, nr_slots, 0);
+    if (!free_buf || new_buf.first_slot >= FDMON_IO_URING_FIXED_BUF_SLOTS) {
+        trace_fdmon_io_uring_fixed_buf_table_full(host, size);
+        return;
+    }
+
+    bitmap_set(fixed_buf_slots, new_buf.first_slot, nr_slots);
+    new_buf.id = fixed_buf_next_id++;
+    *free_buf = new_buf;
+    qatomic_inc(&fixed_bufs_gen);
+}
+
+static void fixed_bufs_sync_bh(void *opaque)
+{
+    AioContext *ctx = opaque;
+
+    if (ctx->fixed_bufs) {
+        fixed_bufs_sync(ctx);
+    }
+}
+
+void aio_unregister_fixed_buf(void *host, size_t size)
+{
+    GSList *ctxs = NULL;
+
+    WITH_QEMU_LOCK_GUARD(&fixed_bufs_lock) {
+        for (int i = 0; i < ARRAY_SIZE(fixed_bufs); i++) {
+            FdmonFixedBuf *buf = &fixed_bufs[i];
+
+            if (buf->host != host || buf->size != size) {
+                continue;
+            }
+
+            if (--buf->refcnt == 0) {
+                bitmap_clear(fixed_buf_slots, buf->first_slot,
+                             fixed_buf_nr_slots(buf));
+                *buf = (FdmonFixedBuf){};
+                qatomic_inc(&fixed_bufs_gen);
+
+                ctxs = g_slist_copy(fixed_bufs_ctxs);
+                g_slist_foreach(ctxs, (GFunc)aio_context_ref, NULL);
+            }
+            break;
+        }
+    }
+
+    /*
+     * The memory may be freed as soon as we return, so don't wait for idle
+     * AioContexts to call aio_get_fixed_buf() before they drop their pin on
+     * it. fixed_bufs_sync() must run in the thread that owns the ring.
+     */
+    for (GSList *l = ctxs; l; l = l->next) {
+        AioContext *ctx = l->data;
+
+        if (ctx == qemu_get_current_aio_context()) {
+            fixed_bufs_sync_bh(ctx);
+        } else {
+            aio_wait_bh_oneshot(ctx, fixed_bufs_sync_bh, ctx);
+        }
+        aio_context_unref(ctx);
+    }
+    g_slist_free(ctxs);
+}
+
+int aio_get_fixed_buf(const void *base, size_t len)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    uintptr_t addr = (uintptr_t)base;
+
+    if (!ctx->fixed_bufs || len == 0) {
+        return -1;
+    }
+
+    if (unlikely(ctx->fixed_bufs_gen != qatomic_read(&fixed_bufs_gen))) {
+        fixed_bufs_sync(ctx);
+    }
+
+    for (int i = 0; i < FDMON_IO_URING_FIXED_BUF_REGIONS; i++) {
+        FdmonFixedBuf *buf = &ctx->fixed_bufs[i];
+        uintptr_t start = (uintptr_t)buf->host;
+        size_t offset, slot;
+
+        if (!buf->host || addr < start || addr - start >= buf->size) {
+            continue;
+        }
+
+        offset = addr - start;
+        slot = offset / FDMON_IO_URING_FIXED_BUF_SLOT_SIZE;
+        if (len > buf->size - offset ||
+            (offset + len - 1) / FDMON_IO_URING_FIXED_BUF_SLOT_SIZE != slot) {
+            return -1;
+        }
+        return buf->first_slot + slot;
+    }
+    return -1;
+}
+
+/*
+ * Fixed buffers are optional. The slots of the sparse table are filled in by
+ * fixed_bufs_sync() once aio_get_fixed_buf() is used.
+ */
+static void fixed_bufs_setup(AioContext *ctx)
+{
+    QEMU_LOCK_GUARD(&fixed_bufs_lock);
+
+    fixed_bufs_ctxs = g_slist_remove(fixed_bufs_ctxs, ctx);
+    g_free(ctx->fixed_bufs);
+    ctx->fixed_bufs = NULL;
+    ctx->fixed_bufs_gen = 0;
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+    if (io_uring_register_buffers_sparse(&ctx->fdmon_io_uring,
+                                         FDMON_IO_URING_FIXED_BUF_SLOTS) == 0) {
+        ctx->fixed_bufs = g_new0(FdmonFixedBuf,
+                                 FDMON_IO_URING_FIXED_BUF_REGIONS);
+        fixed_bufs_ctxs = g_slist_prepend(fixed_bufs_ctxs, ctx);
+    }
+#endif
+}
+
+#ifdef HAVE_IO_URING_SETUP_SQE128
+/*
+ * IORING_OP_URING_CMD passthrough commands (e.g. NVMe) need 128-byte sqes and
+ * 32-byte cqes, which double the size of a ring. They go to a second ring that
+ * an AioContext only creates once passthrough is used in it, so that ordinary
+ * I/O and fd monitoring keep the small layout. The main ring watches the fd of
+ * the passthrough ring and cmd_ring_read() dispatches its cqes.
+ */
+static void cmd_ring_submit(void *opaque)
+{
+    AioContext *ctx = opaque;
+
+    while (io_uring_submit(ctx->fdmon_io_uring_cmd) == -EINTR) {
+        /* Keep trying if syscall was interrupted */
+    }
+}
+
+static void cmd_ring_read(void *opaque)
+{
+    AioContext *ctx = opaque;
+    struct io_uring *ring = ctx->fdmon_io_uring_cmd;
+    CqeHandlerSimpleQ ready_list = QSIMPLEQ_HEAD_INITIALIZER(ready_list);
+    struct io_uring_cqe *cqe;
+    unsigned num_cqes = 0;
+    unsigned head;
+
+#ifdef HAVE_IO_URING_CQ_HAS_OVERFLOW
+    if (io_uring_cq_has_overflow(ring)) {
+        io_uring_get_events(ring);
+    }
+#endif
+
+    /* Handlers may submit new commands, so empty the cq ring first */
+    io_uring_for_each_cqe(ring, head, cqe) {
+        CqeHandler *cqe_handler = io_uring_cqe_get_data(cqe);
+
+        cqe_handler->cqe = *cqe;
+        QSIMPLEQ_INSERT_TAIL(&ready_list, cqe_handler, next);
+        num_cqes++;
+    }
+    io_uring_cq_advance(ring, num_cqes);
+
+    defer_call_begin();
+
+    while (!QSIMPLEQ_EMPTY(&ready_list)) {
+        CqeHandler *cqe_handler = QSIMPLEQ_FIRST(&ready_list);
+
+        QSIMPLEQ_REMOVE_HEAD(&ready_list, next);
+
+        trace_fdmon_io_uring_cqe_handler(ctx, cqe_handler,
+                                         cqe_handler->cqe.res);
+        cqe_handler->cb(cqe_handler);
+    }
+
+    defer_call_end();
+}
+
+/* Create the passthrough ring of the current AioContext if necessary */
+static int cmd_ring_get(AioContext *ctx)
+{
+    struct io_uring *ring;
+    int ret;
+
+    if (ctx->fdmon_io_uring_cmd) {
+        return 0;
+    }
+
+    ring = g_new0(struct io_uring, 1);
+    ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, ring,
+                              IORING_SETUP_SQE128 | IORING_SETUP_CQE32);
+    trace_fdmon_io_uring_cmd_ring_setup(ctx, ret);
+    if (ret != 0) {
+        g_free(ring);
+        return ret;
+    }
+
+    ctx->fdmon_io_uring_cmd = ring;
+    aio_set_fd_handler(ctx, ring->ring_fd, cmd_ring_read,
+                       NULL, NULL, NULL, ctx);
+    return 0;
+}
+
+bool aio_has_io_uring_cmd(void)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    return aio_has_io_uring() && cmd_ring_get(ctx) == 0;
+}
+
+int aio_add_cmd_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                    void *opaque, CqeHandler *cqe_handler)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    struct io_uring_sqe *sqe;
+    int ret;
+
+    ret = cmd_ring_get(ctx);
+    if (ret != 0) {
+        return ret;
+    }
+
+    sqe = io_uring_get_sqe(ctx->fdmon_io_uring_cmd);
+    if (!sqe) {
+        cmd_ring_submit(ctx);
+        sqe = io_uring_get_sqe(ctx->fdmon_io_uring_cmd);
+        assert(sqe);
+    }
+
+    prep_sqe(sqe, opaque);
+    io_uring_sqe_set_data(sqe, cqe_handler);
+
+    trace_fdmon_io_uring_add_sqe(ctx, opaque, sqe->opcode, sqe->fd, sqe->off,
+                                 cqe_handler);
+
+    /* Commands queued in a defer_call_begin() section go in one syscall */
+    defer_call(cmd_ring_submit, ctx);
+    return 0;
+}
+#else
+bool aio_has_io_uring_cmd(void)
+{
+    return false;
+}
+
+int aio_add_cmd_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                    void *opaque, CqeHandler *cqe_handler)
+{
+    return -ENOTSUP;
+}
+#endif /* HAVE_IO_URING_SETUP_SQE128 */
+
 static const FDMonOps fdmon_io_uring_ops = {
     .update = fdmon_io_uring_update,
     .wait = fdmon_io_uring_wait,
@@ -469,6 +878,9 @@ bool fdmon_io_uring_setup(AioContext *ctx, Error **errp)
     int ret;
 
     ctx->io_uring_fd_tag = NULL;
+    ctx->fixed_bufs = NULL;
+
+    ctx->fdmon_io_uring_cmd = NULL;
 
     ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
     if (ret != 0) {
@@ -476,6 +888,8 @@ bool fdmon_io_uring_setup(AioContext *ctx, Error **errp)
         return false;
     }
 
+    fixed_bufs_setup(ctx);
+
     QSLIST_INIT(&ctx->submit_list);
     QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
@@ -484,6 +898,50 @@ bool fdmon_io_uring_setup(AioContext *ctx, Error **errp)
     return true;
 }
 
+bool aio_context_use_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+    struct io_uring_params params = {
+        .flags = IORING_SETUP_SQPOLL,
+        .sq_thread_idle = FDMON_IO_URING_SQPOLL_IDLE_MS,
+    };
+    struct io_uring ring;
+    int ret;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops) {
+        error_setg(errp, "SQPOLL requires io_uring, which is not available");
+        return false;
+    }
+
+    if (cpu >= 0) {
+        params.flags |= IORING_SETUP_SQ_AFF;
+        params.sq_thread_cpu = cpu;
+    }
+
+    ret = io_uring_queue_init_params(FDMON_IO_URING_ENTRIES, &ring, &params);
+    if (ret != 0) {
+        error_setg_errno(errp, -ret, "Failed to initialize io_uring with "
+                         "SQPOLL");
+        return false;
+    }
+
+    /*
+     * AioHandlers only reach the ring in fill_sq_ring(), so nothing has been
+     * submitted yet and the old ring can simply be swapped out.
+     */
+    assert(!io_uring_sq_ready(&ctx->fdmon_io_uring));
+
+    g_source_remove_unix_fd(&ctx->source, ctx->io_uring_fd_tag);
+    io_uring_queue_exit(&ctx->fdmon_io_uring);
+
+    ctx->fdmon_io_uring = ring;
+    fixed_bufs_setup(ctx);
+    ctx->io_uring_fd_tag = g_source_add_unix_fd(&ctx->source,
+            ctx->fdmon_io_uring.ring_fd, G_IO_IN);
+
+    trace_fdmon_io_uring_sqpoll(ctx, cpu);
+    return true;
+}
+
 void fdmon_io_uring_destroy(AioContext *ctx)
 {
     AioHandler *node;
@@ -492,6 +950,23 @@ void fdmon_io_uring_destroy(AioContext *ctx)
         return;
     }
 
+    WITH_QEMU_LOCK_GUARD(&fixed_bufs_lock) {
+        fixed_bufs_ctxs = g_slist_remove(fixed_bufs_ctxs, ctx);
+        g_free(ctx->fixed_bufs);
+        ctx->fixed_bufs = NULL;
+    }
+
+#ifdef HAVE_IO_URING_SETUP_SQE128
+    if (ctx->fdmon_io_uring_cmd) {
+        /* The AioHandler is freed together with the others below */
+        aio_set_fd_handler(ctx, ctx->fdmon_io_uring_cmd->ring_fd,
+                           NULL, NULL, NULL, NULL, NULL);
+        io_uring_queue_exit(ctx->fdmon_io_uring_cmd);
+        g_free(ctx->fdmon_io_uring_cmd);
+        ctx->fdmon_io_uring_cmd = NULL;
+    }
+#endif
+
     io_uring_queue_exit(&ctx->fdmon_io_uring);
 
     /* Move handlers due to be removed onto the deleted list */